@@ -9,6 +9,7 @@
 
 #include "xenia/base/arena.h"
 
+#include <algorithm>
 #include <cstring>
 #include <memory>
 
@@ -17,7 +18,9 @@
 namespace xe {
 
 Arena::Arena(size_t chunk_size)
-    : chunk_size_(chunk_size), head_chunk_(nullptr), active_chunk_(nullptr) {}
+    : chunk_size_(chunk_size), head_chunk_(nullptr), active_chunk_(nullptr) {
+  std::memset(free_lists_, 0, sizeof(free_lists_));
+}
 
 Arena::~Arena() {
   Reset();
@@ -31,6 +34,9 @@ Arena::~Arena() {
 }
 
 void Arena::Reset() {
+  // Everything on the free lists lives in the chunks being rewound.
+  std::memset(free_lists_, 0, sizeof(free_lists_));
+  retired_.clear();
   active_chunk_ = head_chunk_;
   if (active_chunk_) {
     active_chunk_->offset = 0;
@@ -46,6 +52,15 @@ void Arena::DebugFill() {
 }
 
 void* Arena::Alloc(size_t size) {
+  if (IsPooledSize(size)) {
+    auto& free_list = free_lists_[size / 8 - 1];
+    if (free_list) {
+      auto node = free_list;
+      free_list = node->next;
+      return node;
+    }
+  }
+
   if (active_chunk_) {
     if (active_chunk_->capacity - active_chunk_->offset < size + 4096) {
       Chunk* next = active_chunk_->next;
@@ -68,6 +83,27 @@ void* Arena::Alloc(size_t size) {
 
 void Arena::Rewind(size_t size) { active_chunk_->offset -= size; }
 
+void Arena::Retire(void* p, size_t size) {
+  if (p && IsPooledSize(size)) {
+    retired_.emplace_back(p, size);
+  }
+}
+
+void Arena::ReclaimRetired() {
+  // Unlinking the same node twice is harmless to callers, so tolerate
+  // duplicates rather than corrupting the free lists.
+  std::sort(retired_.begin(), retired_.end());
+  retired_.erase(std::unique(retired_.begin(), retired_.end()),
+                 retired_.end());
+  for (auto& it : retired_) {
+    auto node = reinterpret_cast<FreeNode*>(it.first);
+    auto& free_list = free_lists_[it.second / 8 - 1];
+    node->next = free_list;
+    free_list = node;
+  }
+  retired_.clear();
+}
+
 size_t Arena::CalculateSize() {
   size_t total_length = 0;
   Chunk* chunk = head_chunk_;
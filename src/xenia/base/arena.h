@@ -12,6 +12,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <utility>
 #include <vector>
 
 namespace xe {
@@ -31,6 +32,19 @@ class Arena {
   }
   void Rewind(size_t size);
 
+  // Hands back an allocation of the given size for reuse by a later Alloc of
+  // the same size once ReclaimRetired is called. The memory is left untouched
+  // until then, so callers may keep walking nodes they have just unlinked.
+  // Sizes that aren't a multiple of 8 or are over kMaxPooledSize are ignored
+  // and stay allocated until Reset.
+  void Retire(void* p, size_t size);
+  template <typename T>
+  void Retire(T* p) {
+    Retire(p, sizeof(T));
+  }
+  // Moves retired allocations onto the free lists used by Alloc.
+  void ReclaimRetired();
+
   void* CloneContents();
   template <typename T>
   void CloneContents(std::vector<T>* buffer) {
@@ -51,12 +65,26 @@ class Arena {
     size_t offset;
   };
 
+  // Free list entry stored in the reclaimed allocation itself.
+  struct FreeNode {
+    FreeNode* next;
+  };
+  static const size_t kMaxPooledSize = 256;
+  static const size_t kSizeClassCount = kMaxPooledSize / 8;
+  static bool IsPooledSize(size_t size) {
+    return size && size <= kMaxPooledSize && !(size & 7);
+  }
+
   size_t CalculateSize();
   void CloneContents(void* buffer, size_t buffer_length);
 
   size_t chunk_size_;
   Chunk* head_chunk_;
   Chunk* active_chunk_;
+
+  // Exact size classes, indexed by size / 8 - 1.
+  FreeNode* free_lists_[kSizeClassCount];
+  std::vector<std::pair<void*, size_t>> retired_;
 };
 
 }  // namespace xe
@@ -0,0 +1,272 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/free_run_index.h"
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/math.h"
+
+namespace xe {
+
+const uint32_t FreeRunIndex::kNotFound;
+
+FreeRunIndex::FreeRunIndex() { Reset(0); }
+
+FreeRunIndex::FreeRunIndex(uint32_t count) { Reset(count); }
+
+void FreeRunIndex::Reset(uint32_t count) {
+  count_ = count;
+  free_count_ = count;
+  leaf_count_ = xe::next_pow2(std::max(1u, (count + 63) / 64));
+  bits_.assign(leaf_count_, 0);
+  for (uint32_t i = 0; i < count / 64; ++i) {
+    bits_[i] = ~uint64_t(0);
+  }
+  if (count % 64) {
+    bits_[count / 64] = (uint64_t(1) << (count % 64)) - 1;
+  }
+  nodes_.resize(leaf_count_ * 2);
+  UpdateNodes(0, leaf_count_ - 1);
+}
+
+void FreeRunIndex::MarkUsed(uint32_t first, uint32_t count) {
+  SetRange(first, count, false);
+}
+
+void FreeRunIndex::MarkFree(uint32_t first, uint32_t count) {
+  SetRange(first, count, true);
+}
+
+void FreeRunIndex::SetRange(uint32_t first, uint32_t count, bool free) {
+  if (!count) {
+    return;
+  }
+  assert_true(first + count <= count_);
+  uint32_t end = first + count;
+  uint32_t first_word = first / 64;
+  uint32_t last_word = (end - 1) / 64;
+  for (uint32_t word = first_word; word <= last_word; ++word) {
+    uint32_t low_bit = word == first_word ? first % 64 : 0;
+    uint32_t high_bit = word == last_word ? (end - 1) % 64 + 1 : 64;
+    uint64_t mask = high_bit - low_bit == 64
+                        ? ~uint64_t(0)
+                        : ((uint64_t(1) << (high_bit - low_bit)) - 1) << low_bit;
+    uint64_t old_bits = bits_[word];
+    bits_[word] = free ? old_bits | mask : old_bits & ~mask;
+    free_count_ += xe::bit_count(bits_[word]) - xe::bit_count(old_bits);
+  }
+  UpdateNodes(first_word, last_word);
+}
+
+FreeRunIndex::Node FreeRunIndex::LeafNode(uint64_t bits) {
+  Node node;
+  node.prefix = xe::tzcnt(~bits);
+  node.suffix = xe::lzcnt(~bits);
+  // Each step shortens every run of set bits by one.
+  node.max = 0;
+  for (uint64_t runs = bits; runs; runs &= runs << 1) {
+    ++node.max;
+  }
+  return node;
+}
+
+void FreeRunIndex::UpdateNodes(uint32_t first_word, uint32_t last_word) {
+  for (uint32_t word = first_word; word <= last_word; ++word) {
+    nodes_[leaf_count_ + word] = LeafNode(bits_[word]);
+  }
+  uint32_t child_length = 64;
+  for (uint32_t low = (leaf_count_ + first_word) / 2,
+                high = (leaf_count_ + last_word) / 2;
+       low; low /= 2, high /= 2, child_length *= 2) {
+    for (uint32_t i = low; i <= high; ++i) {
+      const Node& left = nodes_[i * 2];
+      const Node& right = nodes_[i * 2 + 1];
+      Node& node = nodes_[i];
+      node.prefix = left.prefix == child_length ? child_length + right.prefix
+                                                : left.prefix;
+      node.suffix = right.suffix == child_length ? child_length + left.suffix
+                                                 : right.suffix;
+      node.max = std::max(std::max(left.max, right.max),
+                          left.suffix + right.prefix);
+    }
+  }
+}
+
+uint32_t FreeRunIndex::FreeRunLength(uint32_t index) const {
+  if (index >= count_) {
+    return 0;
+  }
+  uint32_t word = index / 64;
+  uint32_t shift = index % 64;
+  // Bits shifted in at the top read as used, stopping the count there.
+  uint32_t length = xe::tzcnt(~(bits_[word] >> shift));
+  if (length < 64 - shift) {
+    return length;
+  }
+  // Padding past the last entry is used, so this stops at count_.
+  while (++word < leaf_count_) {
+    if (bits_[word] != ~uint64_t(0)) {
+      return length + xe::tzcnt(~bits_[word]);
+    }
+    length += 64;
+  }
+  return length;
+}
+
+uint32_t FreeRunIndex::FindRun(uint32_t low, uint32_t high, uint32_t count,
+                               uint32_t alignment, bool top_down) const {
+  high = std::min(high, count_);
+  if (!count || low >= high || high - low < count) {
+    return kNotFound;
+  }
+  Search search;
+  search.low = low;
+  search.high = high;
+  search.count = count;
+  search.alignment = std::max(1u, alignment);
+  search.top_down = top_down;
+  search.run_edge = kNotFound;
+  search.result = kNotFound;
+  uint32_t root_length = leaf_count_ * 64;
+  bool found = top_down ? FindDescending(search, 1, 0, root_length)
+                        : FindAscending(search, 1, 0, root_length);
+  if (!found && search.run_edge != kNotFound) {
+    // The last run followed reaches the edge of the searched range.
+    if (top_down) {
+      OfferRun(search, search.low, search.run_edge);
+    } else {
+      OfferRun(search, search.run_edge, search.high);
+    }
+  }
+  return search.result;
+}
+
+bool FreeRunIndex::OfferRun(Search& search, uint32_t first, uint32_t end) {
+  if (end - first < search.count) {
+    return false;
+  }
+  uint32_t base;
+  if (search.top_down) {
+    base = end - search.count;
+    base -= base % search.alignment;
+    if (base < first) {
+      return false;
+    }
+  } else {
+    base = (first + search.alignment - 1) / search.alignment * search.alignment;
+    if (base > end - search.count) {
+      return false;
+    }
+  }
+  search.result = base;
+  return true;
+}
+
+bool FreeRunIndex::FindAscending(Search& search, uint32_t node,
+                                 uint32_t node_first,
+                                 uint32_t node_length) const {
+  uint32_t node_end = node_first + node_length;
+  if (node_end <= search.low || node_first >= search.high) {
+    return false;
+  }
+  const Node& info = nodes_[node];
+  if (search.low <= node_first && node_end <= search.high) {
+    if (info.prefix == node_length) {
+      // Entirely free; the run continues through it.
+      if (search.run_edge == kNotFound) {
+        search.run_edge = node_first;
+      }
+      return false;
+    }
+    if (info.max < search.count) {
+      // Nothing long enough inside, only the edges can join other runs.
+      if (search.run_edge != kNotFound || info.prefix) {
+        uint32_t first =
+            search.run_edge != kNotFound ? search.run_edge : node_first;
+        if (OfferRun(search, first, node_first + info.prefix)) {
+          return true;
+        }
+      }
+      search.run_edge = info.suffix ? node_end - info.suffix : kNotFound;
+      return false;
+    }
+  }
+  if (node >= leaf_count_) {
+    uint64_t bits = bits_[node - leaf_count_];
+    uint32_t end = std::min(node_end, search.high);
+    for (uint32_t i = std::max(node_first, search.low); i < end; ++i) {
+      if ((bits >> (i - node_first)) & 1) {
+        if (search.run_edge == kNotFound) {
+          search.run_edge = i;
+        }
+      } else if (search.run_edge != kNotFound) {
+        if (OfferRun(search, search.run_edge, i)) {
+          return true;
+        }
+        search.run_edge = kNotFound;
+      }
+    }
+    return false;
+  }
+  uint32_t half = node_length / 2;
+  return FindAscending(search, node * 2, node_first, half) ||
+         FindAscending(search, node * 2 + 1, node_first + half, half);
+}
+
+bool FreeRunIndex::FindDescending(Search& search, uint32_t node,
+                                  uint32_t node_first,
+                                  uint32_t node_length) const {
+  uint32_t node_end = node_first + node_length;
+  if (node_end <= search.low || node_first >= search.high) {
+    return false;
+  }
+  const Node& info = nodes_[node];
+  if (search.low <= node_first && node_end <= search.high) {
+    if (info.prefix == node_length) {
+      if (search.run_edge == kNotFound) {
+        search.run_edge = node_end;
+      }
+      return false;
+    }
+    if (info.max < search.count) {
+      if (search.run_edge != kNotFound || info.suffix) {
+        uint32_t end = search.run_edge != kNotFound ? search.run_edge : node_end;
+        if (OfferRun(search, node_end - info.suffix, end)) {
+          return true;
+        }
+      }
+      search.run_edge = info.prefix ? node_first + info.prefix : kNotFound;
+      return false;
+    }
+  }
+  if (node >= leaf_count_) {
+    uint64_t bits = bits_[node - leaf_count_];
+    uint32_t first = std::max(node_first, search.low);
+    for (uint32_t i = std::min(node_end, search.high); i-- > first;) {
+      if ((bits >> (i - node_first)) & 1) {
+        if (search.run_edge == kNotFound) {
+          search.run_edge = i + 1;
+        }
+      } else if (search.run_edge != kNotFound) {
+        if (OfferRun(search, i + 1, search.run_edge)) {
+          return true;
+        }
+        search.run_edge = kNotFound;
+      }
+    }
+    return false;
+  }
+  uint32_t half = node_length / 2;
+  return FindDescending(search, node * 2 + 1, node_first + half, half) ||
+         FindDescending(search, node * 2, node_first, half);
+}
+
+}  // namespace xe
@@ -0,0 +1,93 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_FREE_RUN_INDEX_H_
+#define XENIA_BASE_FREE_RUN_INDEX_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace xe {
+
+// Free Run Index: tracks which of a fixed number of entries (such as heap
+// pages) are free and finds aligned runs of free entries.
+// Entries are kept in a bitmap with a tree over its 64-entry words recording
+// the longest free run in each subtree, so searches skip used space in
+// O(log n) instead of walking every entry.
+// Not threadsafe; callers are expected to hold their own lock.
+class FreeRunIndex {
+ public:
+  static const uint32_t kNotFound = UINT32_MAX;
+
+  FreeRunIndex();
+  explicit FreeRunIndex(uint32_t count);
+
+  // Resizes the index to count entries, all free.
+  void Reset(uint32_t count);
+
+  uint32_t size() const { return count_; }
+  uint32_t free_count() const { return free_count_; }
+  bool is_free(uint32_t index) const {
+    return (bits_[index / 64] >> (index % 64)) & 1;
+  }
+
+  void MarkUsed(uint32_t first, uint32_t count);
+  void MarkFree(uint32_t first, uint32_t count);
+
+  // Number of consecutive free entries starting at index (0 if it's used).
+  uint32_t FreeRunLength(uint32_t index) const;
+
+  // Finds count free entries within [low, high) whose first entry is a
+  // multiple of alignment. Returns the lowest such run, or the highest one if
+  // top_down is set, or kNotFound.
+  uint32_t FindRun(uint32_t low, uint32_t high, uint32_t count,
+                   uint32_t alignment, bool top_down) const;
+
+ private:
+  struct Node {
+    // Free entries at the start, at the end and the longest free run anywhere
+    // within the entries covered by the node.
+    uint32_t prefix;
+    uint32_t suffix;
+    uint32_t max;
+  };
+
+  struct Search {
+    uint32_t low;
+    uint32_t high;
+    uint32_t count;
+    uint32_t alignment;
+    bool top_down;
+    // Start (bottom-up) or end (top-down) of the free run being followed.
+    uint32_t run_edge;
+    uint32_t result;
+  };
+
+  void SetRange(uint32_t first, uint32_t count, bool free);
+  void UpdateNodes(uint32_t first_word, uint32_t last_word);
+  static Node LeafNode(uint64_t bits);
+  static bool OfferRun(Search& search, uint32_t first, uint32_t end);
+  bool FindAscending(Search& search, uint32_t node, uint32_t node_first,
+                     uint32_t node_length) const;
+  bool FindDescending(Search& search, uint32_t node, uint32_t node_first,
+                      uint32_t node_length) const;
+
+  uint32_t count_;
+  uint32_t free_count_;
+  // Power of two; words past the end of the entries are kept fully used.
+  uint32_t leaf_count_;
+  // One bit per entry, set when free.
+  std::vector<uint64_t> bits_;
+  // Implicit binary tree: 1 is the root, leaves start at leaf_count_.
+  std::vector<Node> nodes_;
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_FREE_RUN_INDEX_H_
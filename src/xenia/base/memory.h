@@ -54,8 +54,8 @@ void* AllocFixed(void* base_address, size_t length,
                  AllocationType allocation_type, PageAccess access);
 
 // Deallocates and/or releases the given block of memory.
-// When releasing memory length must be zero, as all pages in the region are
-// released.
+// When releasing memory all pages in the region are released; length must be
+// the size of the whole allocation, as POSIX hosts can't look it up.
 bool DeallocFixed(void* base_address, size_t length,
                   DeallocationType deallocation_type);
 
@@ -70,6 +70,24 @@ bool Protect(void* base_address, size_t length, PageAccess access,
 // the region.
 bool QueryProtect(void* base_address, size_t& length, PageAccess& access_out);
 
+// Whether the host can report which pages were written without protecting them
+// (userfaultfd asynchronous write protection on Linux).
+bool IsDirtyPageTrackingSupported();
+
+// Allows dirty page tracking in the region, which must be mapped. Only writes
+// to pages since they were last reset are tracked.
+bool EnableDirtyPageTracking(void* base_address, size_t length);
+
+// Marks the pages of the region clean.
+bool ResetDirtyPages(void* base_address, size_t length);
+
+// Sets bit n of dirty_bitmap if page n of the page-aligned region was written
+// since it was last reset, and marks it clean again in the same step, so a
+// racing write is reported either now or by the next call. Bits are only ever
+// set, so the results for several views of the same memory can be combined.
+bool QueryAndResetDirtyPages(void* base_address, size_t length,
+                             uint64_t* dirty_bitmap);
+
 // Allocates a block of memory for a type with the given alignment.
 // The memory must be freed with AlignedFree.
 template <typename T>
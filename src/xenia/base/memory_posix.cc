@@ -8,10 +8,16 @@
  */
 
 #include "xenia/base/memory.h"
+#include "xenia/base/math.h"
 #include "xenia/base/string.h"
 
+#include <algorithm>
 #include <fcntl.h>
+#include <linux/fs.h>
+#include <linux/userfaultfd.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 namespace xe {
@@ -38,9 +44,19 @@ uint32_t ToPosixProtectFlags(PageAccess access) {
 
 void* AllocFixed(void* base_address, size_t length,
                  AllocationType allocation_type, PageAccess access) {
-  // mmap does not support reserve / commit, so ignore allocation_type.
   uint32_t prot = ToPosixProtectFlags(access);
-  return mmap(base_address, length, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (allocation_type == AllocationType::kCommit && base_address) {
+    // mmap has no reserve / commit, so committing part of an existing mapping
+    // only makes it accessible. Mapping over it would drop its contents (or
+    // without MAP_FIXED, create an unrelated mapping elsewhere).
+    if (mprotect(base_address, length, prot) != 0) {
+      return nullptr;
+    }
+    return base_address;
+  }
+  void* result =
+      mmap(base_address, length, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return result != MAP_FAILED ? result : nullptr;
 }
 
 bool DeallocFixed(void* base_address, size_t length,
@@ -61,6 +77,169 @@ bool QueryProtect(void* base_address, size_t& length, PageAccess& access_out) {
   return false;
 }
 
+// Dirty pages come from userfaultfd asynchronous write protection: a write to
+// a protected page is resolved by the kernel by unprotecting it, and
+// PAGEMAP_SCAN finds unprotected pages and protects them again atomically.
+// Older headers lack the (stable) definitions, Linux 6.7 is needed to use them.
+#ifndef PAGEMAP_SCAN
+#define PAGE_IS_WRITTEN (1 << 1)
+#define PM_SCAN_WP_MATCHING (1 << 0)
+#define PM_SCAN_CHECK_WPASYNC (1 << 1)
+struct page_region {
+  uint64_t start;
+  uint64_t end;
+  uint64_t categories;
+};
+struct pm_scan_arg {
+  uint64_t size;
+  uint64_t flags;
+  uint64_t start;
+  uint64_t end;
+  uint64_t walk_end;
+  uint64_t vec;
+  uint64_t vec_len;
+  uint64_t max_pages;
+  uint64_t category_inverted;
+  uint64_t category_mask;
+  uint64_t category_anyof_mask;
+  uint64_t return_mask;
+};
+#define PAGEMAP_SCAN _IOWR('f', 16, struct pm_scan_arg)
+#endif  // PAGEMAP_SCAN
+#ifndef UFFD_FEATURE_WP_ASYNC
+#define UFFD_FEATURE_WP_UNPOPULATED (1 << 13)
+#define UFFD_FEATURE_WP_ASYNC (1 << 15)
+#endif  // UFFD_FEATURE_WP_ASYNC
+#ifndef UFFD_USER_MODE_ONLY
+#define UFFD_USER_MODE_ONLY 1
+#endif  // UFFD_USER_MODE_ONLY
+
+int pagemap_fd() {
+  static int fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+  return fd;
+}
+
+// Registrations last as long as the descriptor, so it is never closed.
+int userfault_fd() {
+  static int fd = []() {
+    int fd = int(syscall(SYS_userfaultfd,
+                         O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY));
+    if (fd < 0) {
+      return -1;
+    }
+    uffdio_api api = {0};
+    api.api = UFFD_API;
+    api.features = UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_WP_UNPOPULATED;
+    if (ioctl(fd, UFFDIO_API, &api) != 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }();
+  return fd;
+}
+
+bool ProbeDirtyPageTracking() {
+  if (pagemap_fd() < 0 || userfault_fd() < 0) {
+    return false;
+  }
+  // Guest memory is made of file mapping views, so check one of those. Older
+  // kernels only support some kinds of memory.
+  std::wstring name = L"xenia_dirty_page_probe_" + std::to_wstring(getpid());
+  size_t length = page_size();
+  auto handle =
+      CreateFileMappingHandle(name, length, PageAccess::kReadWrite, true);
+  if (!handle) {
+    return false;
+  }
+  auto page = reinterpret_cast<volatile uint8_t*>(
+      MapFileView(handle, nullptr, length, PageAccess::kReadWrite, 0));
+  bool supported = false;
+  if (page != MAP_FAILED) {
+    uint64_t clean = 0;
+    uint64_t dirty = 0;
+    uint64_t reset = 0;
+    supported = EnableDirtyPageTracking((void*)page, length) &&
+                ResetDirtyPages((void*)page, length) &&
+                QueryAndResetDirtyPages((void*)page, length, &clean);
+    page[0] = 1;
+    supported = supported &&
+                QueryAndResetDirtyPages((void*)page, length, &dirty) &&
+                QueryAndResetDirtyPages((void*)page, length, &reset) &&
+                !clean && dirty == 1 && !reset;
+    UnmapFileView(handle, (void*)page, length);
+  }
+  CloseFileMappingHandle(handle);
+  shm_unlink(xe::to_string(name).c_str());
+  return supported;
+}
+
+bool IsDirtyPageTrackingSupported() {
+  static bool supported = ProbeDirtyPageTracking();
+  return supported;
+}
+
+bool EnableDirtyPageTracking(void* base_address, size_t length) {
+  int fd = userfault_fd();
+  if (fd < 0) {
+    return false;
+  }
+  uffdio_register reg = {{0}};
+  reg.range.start = reinterpret_cast<uintptr_t>(base_address);
+  reg.range.len = length;
+  reg.mode = UFFDIO_REGISTER_MODE_WP;
+  return ioctl(fd, UFFDIO_REGISTER, &reg) == 0;
+}
+
+bool ResetDirtyPages(void* base_address, size_t length) {
+  int fd = userfault_fd();
+  if (fd < 0) {
+    return false;
+  }
+  uffdio_writeprotect wp = {{0}};
+  wp.range.start = reinterpret_cast<uintptr_t>(base_address);
+  wp.range.len = xe::round_up(length, page_size());
+  wp.mode = UFFDIO_WRITEPROTECT_MODE_WP;
+  return ioctl(fd, UFFDIO_WRITEPROTECT, &wp) == 0;
+}
+
+bool QueryAndResetDirtyPages(void* base_address, size_t length,
+                             uint64_t* dirty_bitmap) {
+  int fd = pagemap_fd();
+  if (fd < 0) {
+    return false;
+  }
+  uintptr_t start = reinterpret_cast<uintptr_t>(base_address);
+  uintptr_t end = start + xe::round_up(length, page_size());
+  page_region regions[64];
+  while (start < end) {
+    pm_scan_arg arg = {0};
+    arg.size = sizeof(arg);
+    arg.flags = PM_SCAN_WP_MATCHING | PM_SCAN_CHECK_WPASYNC;
+    arg.start = start;
+    arg.end = end;
+    arg.vec = reinterpret_cast<uintptr_t>(regions);
+    arg.vec_len = xe::countof(regions);
+    arg.category_mask = PAGE_IS_WRITTEN;
+    arg.return_mask = PAGE_IS_WRITTEN;
+    int count = ioctl(fd, PAGEMAP_SCAN, &arg);
+    if (count < 0) {
+      return false;
+    }
+    for (int i = 0; i < count; ++i) {
+      for (uintptr_t page = regions[i].start; page < regions[i].end;
+           page += page_size()) {
+        size_t index = (page - reinterpret_cast<uintptr_t>(base_address)) /
+                       page_size();
+        dirty_bitmap[index / 64] |= 1ull << (index % 64);
+      }
+    }
+    // The walk stops early once the region vector is full.
+    start = uintptr_t(arg.walk_end);
+  }
+  return true;
+}
+
 FileMappingHandle CreateFileMappingHandle(std::wstring path, size_t length,
                                           PageAccess access, bool commit) {
   int oflag;
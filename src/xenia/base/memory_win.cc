@@ -142,6 +142,21 @@ bool QueryProtect(void* base_address, size_t& length, PageAccess& access_out) {
   return true;
 }
 
+// Write watches (MEM_WRITE_WATCH) only apply to VirtualAlloc memory, not to
+// the file mapping views guest memory is made of.
+bool IsDirtyPageTrackingSupported() { return false; }
+
+bool EnableDirtyPageTracking(void* base_address, size_t length) {
+  return false;
+}
+
+bool ResetDirtyPages(void* base_address, size_t length) { return false; }
+
+bool QueryAndResetDirtyPages(void* base_address, size_t length,
+                             uint64_t* dirty_bitmap) {
+  return false;
+}
+
 FileMappingHandle CreateFileMappingHandle(std::wstring path, size_t length,
                                           PageAccess access, bool commit) {
   DWORD protect =
@@ -0,0 +1,71 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/arena.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace base {
+namespace test {
+
+TEST_CASE("arena_retire_reclaim", "Arena") {
+  Arena arena(64 * 1024);
+  void* a = arena.Alloc(24);
+  void* b = arena.Alloc(24);
+  arena.Retire(a, 24);
+  arena.Retire(b, 24);
+  // Retired memory isn't reused until reclaimed.
+  void* c = arena.Alloc(24);
+  REQUIRE(c != a);
+  REQUIRE(c != b);
+
+  arena.ReclaimRetired();
+  void* d = arena.Alloc(24);
+  void* e = arena.Alloc(24);
+  REQUIRE((d == a || d == b));
+  REQUIRE((e == a || e == b));
+  REQUIRE(d != e);
+  // Only the same size class is reused.
+  arena.Retire(d, 24);
+  arena.ReclaimRetired();
+  REQUIRE(arena.Alloc(32) != d);
+  REQUIRE(arena.Alloc(24) == d);
+}
+
+TEST_CASE("arena_retire_twice", "Arena") {
+  Arena arena(64 * 1024);
+  void* a = arena.Alloc(16);
+  arena.Retire(a, 16);
+  arena.Retire(a, 16);
+  arena.ReclaimRetired();
+  REQUIRE(arena.Alloc(16) == a);
+  REQUIRE(arena.Alloc(16) != a);
+}
+
+TEST_CASE("arena_retire_unpooled", "Arena") {
+  Arena arena(64 * 1024);
+  void* a = arena.Alloc(13);
+  arena.Retire(a, 13);
+  arena.ReclaimRetired();
+  REQUIRE(arena.Alloc(13) != a);
+
+  // Reset drops anything reclaimed along with the chunks.
+  void* b = arena.Alloc(24);
+  arena.Retire(b, 24);
+  arena.ReclaimRetired();
+  arena.Reset();
+  void* c = arena.Alloc(24);
+  void* d = arena.Alloc(24);
+  REQUIRE(c != d);
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
@@ -0,0 +1,115 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/free_run_index.h"
+
+#include <random>
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace base {
+namespace test {
+
+// Entry by entry search the index is expected to match.
+uint32_t FindRunLinear(const std::vector<bool>& used, uint32_t low,
+                       uint32_t high, uint32_t count, uint32_t alignment,
+                       bool top_down) {
+  auto fits = [&](uint32_t base) {
+    for (uint32_t i = base; i < base + count; ++i) {
+      if (used[i]) {
+        return false;
+      }
+    }
+    return true;
+  };
+  uint32_t first = (low + alignment - 1) / alignment * alignment;
+  if (high < count || first > high - count) {
+    return FreeRunIndex::kNotFound;
+  }
+  uint32_t last = (high - count) / alignment * alignment;
+  if (top_down) {
+    for (uint32_t base = last; base >= first && base <= last;
+         base -= alignment) {
+      if (fits(base)) {
+        return base;
+      }
+    }
+  } else {
+    for (uint32_t base = first; base <= last; base += alignment) {
+      if (fits(base)) {
+        return base;
+      }
+    }
+  }
+  return FreeRunIndex::kNotFound;
+}
+
+TEST_CASE("free_run_index_find", "FreeRunIndex") {
+  FreeRunIndex index(1000);
+  REQUIRE(index.free_count() == 1000);
+  REQUIRE(index.FindRun(0, 1000, 16, 1, false) == 0);
+  REQUIRE(index.FindRun(0, 1000, 16, 1, true) == 984);
+  REQUIRE(index.FindRun(0, 1000, 16, 16, true) == 976);
+  REQUIRE(index.FindRun(0, 1000, 1001, 1, false) == FreeRunIndex::kNotFound);
+
+  index.MarkUsed(0, 100);
+  index.MarkUsed(130, 870);
+  REQUIRE(index.free_count() == 30);
+  REQUIRE(index.FreeRunLength(100) == 30);
+  REQUIRE(index.FreeRunLength(120) == 10);
+  REQUIRE(index.FreeRunLength(130) == 0);
+  REQUIRE(index.FindRun(0, 1000, 30, 1, false) == 100);
+  REQUIRE(index.FindRun(0, 1000, 31, 1, false) == FreeRunIndex::kNotFound);
+  REQUIRE(index.FindRun(0, 1000, 16, 16, false) == 112);
+  REQUIRE(index.FindRun(0, 1000, 16, 32, false) == FreeRunIndex::kNotFound);
+  REQUIRE(index.FindRun(0, 120, 16, 1, true) == 104);
+
+  index.MarkFree(0, 1000);
+  REQUIRE(index.free_count() == 1000);
+  REQUIRE(index.FreeRunLength(0) == 1000);
+}
+
+TEST_CASE("free_run_index_random", "FreeRunIndex") {
+  const uint32_t kCount = 3000;
+  std::mt19937 rng(1234);
+  FreeRunIndex index(kCount);
+  std::vector<bool> used(kCount);
+  for (int n = 0; n < 2000; ++n) {
+    uint32_t first = rng() % kCount;
+    uint32_t count = 1 + rng() % std::min(200u, kCount - first);
+    bool mark_used = (rng() % 3) != 0;
+    if (mark_used) {
+      index.MarkUsed(first, count);
+    } else {
+      index.MarkFree(first, count);
+    }
+    for (uint32_t i = first; i < first + count; ++i) {
+      used[i] = mark_used;
+    }
+
+    uint32_t low = rng() % kCount;
+    uint32_t high = low + rng() % (kCount - low + 1);
+    uint32_t find_count = 1 + rng() % 64;
+    uint32_t alignment = 1u << (rng() % 5);
+    bool top_down = (rng() & 1) != 0;
+    REQUIRE(index.FindRun(low, high, find_count, alignment, top_down) ==
+            FindRunLinear(used, low, high, find_count, alignment, top_down));
+
+    uint32_t run = 0;
+    while (first + run < kCount && !used[first + run]) {
+      ++run;
+    }
+    REQUIRE(index.FreeRunLength(first) == run);
+  }
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
@@ -0,0 +1,44 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/math.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace base {
+namespace test {
+
+TEST_CASE("tzcnt", "Math") {
+  REQUIRE(xe::tzcnt(uint8_t(0)) == 8);
+  REQUIRE(xe::tzcnt(uint8_t(1)) == 0);
+  REQUIRE(xe::tzcnt(uint8_t(0x80)) == 7);
+  REQUIRE(xe::tzcnt(uint16_t(0)) == 16);
+  REQUIRE(xe::tzcnt(uint16_t(1)) == 0);
+  REQUIRE(xe::tzcnt(uint16_t(0x80)) == 7);
+  REQUIRE(xe::tzcnt(uint32_t(0)) == 32);
+  REQUIRE(xe::tzcnt(uint32_t(1)) == 0);
+  REQUIRE(xe::tzcnt(uint32_t(0x80)) == 7);
+  REQUIRE(xe::tzcnt(uint64_t(0)) == 64);
+  REQUIRE(xe::tzcnt(uint64_t(1)) == 0);
+  REQUIRE(xe::tzcnt(uint64_t(0x80)) == 7);
+  REQUIRE(xe::tzcnt(uint64_t(1) << 63) == 63);
+}
+
+TEST_CASE("lzcnt", "Math") {
+  REQUIRE(xe::lzcnt(uint32_t(0)) == 32);
+  REQUIRE(xe::lzcnt(uint32_t(1)) == 31);
+  REQUIRE(xe::lzcnt(uint64_t(0)) == 64);
+  REQUIRE(xe::lzcnt(uint64_t(1)) == 63);
+  REQUIRE(xe::lzcnt(uint64_t(1) << 63) == 0);
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
@@ -9,6 +9,14 @@
 
 #include "xenia/base/memory.h"
 
+#include "xenia/base/platform.h"
+#include "xenia/base/string.h"
+
+#if XE_PLATFORM_LINUX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif  // XE_PLATFORM_LINUX
+
 #include "third_party/catch/include/catch.hpp"
 
 namespace xe {
@@ -414,6 +422,43 @@ TEST_CASE("copy_and_swap_16_in_32_unaligned", "Copy and Swap") {
   REQUIRE(true == true);
 }
 
+#if XE_PLATFORM_LINUX
+TEST_CASE("query_and_reset_dirty_pages", "Dirty Pages") {
+  if (!memory::IsDirtyPageTrackingSupported()) {
+    return;
+  }
+  std::wstring name = L"xenia_dirty_page_test_" + std::to_wstring(getpid());
+  size_t page_size = memory::page_size();
+  size_t length = 8 * page_size;
+  auto handle = memory::CreateFileMappingHandle(
+      name, length, memory::PageAccess::kReadWrite, true);
+  REQUIRE(handle != nullptr);
+  // The mapping is named, so remove it even if an assertion below fails.
+  struct MappingCleanup {
+    ~MappingCleanup() { shm_unlink(xe::to_string(name).c_str()); }
+    const std::wstring& name;
+  } cleanup = {name};
+  auto base = reinterpret_cast<uint8_t*>(memory::MapFileView(
+      handle, nullptr, length, memory::PageAccess::kReadWrite, 0));
+  REQUIRE(base != MAP_FAILED);
+  REQUIRE(memory::EnableDirtyPageTracking(base, length));
+  REQUIRE(memory::ResetDirtyPages(base, length));
+
+  base[1 * page_size] = 1;
+  base[6 * page_size + 7] = 1;
+  uint64_t dirty = 0;
+  REQUIRE(memory::QueryAndResetDirtyPages(base, length, &dirty));
+  REQUIRE(dirty == 0b01000010);
+  // The query marked them clean.
+  dirty = 0;
+  REQUIRE(memory::QueryAndResetDirtyPages(base, length, &dirty));
+  REQUIRE(dirty == 0);
+
+  memory::UnmapFileView(handle, base, length);
+  memory::CloseFileMappingHandle(handle);
+}
+#endif  // XE_PLATFORM_LINUX
+
 }  // namespace test
 }  // namespace base
 }  // namespace xe
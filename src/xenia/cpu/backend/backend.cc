@@ -23,7 +23,7 @@ bool Backend::Initialize(Processor* processor) {
   return true;
 }
 
-void* Backend::AllocThreadData() { return nullptr; }
+void* Backend::AllocThreadData(ThreadState* thread_state) { return nullptr; }
 
 void Backend::FreeThreadData(void* thread_data) {}
 
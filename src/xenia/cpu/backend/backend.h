@@ -22,6 +22,7 @@ class Function;
 class GuestFunction;
 class Module;
 class Processor;
+class ThreadState;
 }  // namespace cpu
 }  // namespace xe
 
@@ -43,7 +44,8 @@ class Backend {
 
   virtual bool Initialize(Processor* processor);
 
-  virtual void* AllocThreadData();
+  // Called once the thread state and its context have been set up.
+  virtual void* AllocThreadData(ThreadState* thread_state);
   virtual void FreeThreadData(void* thread_data);
 
   virtual void CommitExecutableRange(uint32_t guest_low,
@@ -54,6 +56,18 @@ class Backend {
   virtual std::unique_ptr<GuestFunction> CreateGuestFunction(
       Module* module, uint32_t address) = 0;
 
+  // Loads previously generated code for the module from the persistent JIT
+  // cache, if the backend supports one.
+  virtual bool LoadCachedCode(Module* module) { return false; }
+  // Writes all code generated for the module to the persistent JIT cache.
+  virtual bool SaveCachedCode(Module* module) { return false; }
+  // Defines the function from code in the persistent JIT cache, skipping
+  // translation. Returns false if there is no usable cached code for it.
+  virtual bool DefineCachedFunction(GuestFunction* function) { return false; }
+  // Frees all code generated for the module, which is being unloaded. Threads
+  // may still be finishing up in it, so the space may be reused later.
+  virtual void ReleaseModuleCode(Module* module) {}
+
   // Calculates the next host instruction based on the current thread state and
   // current PC. This will look for branches and other control flow
   // instructions.
@@ -78,14 +78,16 @@ bool X64Assembler::Assemble(GuestFunction* function, HIRBuilder* builder,
   void* machine_code = nullptr;
   size_t code_size = 0;
   if (!emitter_->Emit(function, builder, debug_info_flags, debug_info.get(),
-                      &machine_code, &code_size, &function->source_map())) {
+                      &machine_code, &code_size, &source_map_)) {
     return false;
   }
+  function->source_map().Assign(source_map_);
+  function->SetInlinedCode(emitter_->inlined_ranges(),
+                           emitter_->inlined_source_map());
 
   // Stash generated machine code.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmMachineCode) {
-    DumpMachineCode(machine_code, code_size, function->source_map(),
-                    &string_buffer_);
+    DumpMachineCode(machine_code, code_size, source_map_, &string_buffer_);
     debug_info->set_machine_code_disasm(string_buffer_.ToString());
     string_buffer_.Reset();
   }
@@ -97,9 +99,17 @@ bool X64Assembler::Assemble(GuestFunction* function, HIRBuilder* builder,
   // Install into indirection table.
   uint64_t host_address = reinterpret_cast<uint64_t>(machine_code);
   assert_true((host_address >> 32) == 0);
-  reinterpret_cast<X64CodeCache*>(backend_->code_cache())
-      ->AddIndirection(function->address(),
-                       static_cast<uint32_t>(host_address));
+  auto code_cache = reinterpret_cast<X64CodeCache*>(backend_->code_cache());
+  code_cache->AddIndirection(function->address(),
+                             static_cast<uint32_t>(host_address));
+
+  // Track the code for the persistent cache if it can be reused by future
+  // runs. Anything built with debug info embeds per-run data.
+  if (code_cache->has_persistent_cache() && !debug_info_flags &&
+      emitter_->is_relocatable()) {
+    code_cache->AddPersistentFunction(function, emitter_->stack_size(),
+                                      emitter_->relocations());
+  }
 
   return true;
 }
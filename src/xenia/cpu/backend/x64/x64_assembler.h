@@ -51,6 +51,9 @@ class X64Assembler : public Assembler {
   uintptr_t capstone_handle_;
 
   StringBuffer string_buffer_;
+  // Scratch source map for the function being assembled before it's encoded
+  // into the function.
+  std::vector<SourceMapEntry> source_map_;
 };
 
 }  // namespace x64
@@ -13,7 +13,9 @@
 
 #include "third_party/capstone/include/capstone.h"
 #include "third_party/capstone/include/x86.h"
+#include "third_party/xxhash/xxhash.h"
 
+#include "build/version.h"
 #include "xenia/base/exception_handler.h"
 #include "xenia/base/logging.h"
 #include "xenia/cpu/backend/x64/x64_assembler.h"
@@ -25,6 +27,7 @@
 #include "xenia/cpu/breakpoint.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/cpu/stack_walker.h"
+#include "xenia/cpu/thread_state.h"
 
 DEFINE_bool(
     enable_haswell_instructions, true,
@@ -42,6 +45,7 @@ class X64ThunkEmitter : public X64Emitter {
   HostToGuestThunk EmitHostToGuestThunk();
   GuestToHostThunk EmitGuestToHostThunk();
   ResolveFunctionThunk EmitResolveFunctionThunk();
+  IndirectCallThunk EmitIndirectCallThunk();
 
  private:
   // The following four functions provide save/load functionality for registers.
@@ -115,12 +119,16 @@ bool X64Backend::Initialize(Processor* processor) {
   host_to_guest_thunk_ = thunk_emitter.EmitHostToGuestThunk();
   guest_to_host_thunk_ = thunk_emitter.EmitGuestToHostThunk();
   resolve_function_thunk_ = thunk_emitter.EmitResolveFunctionThunk();
+  indirect_call_thunk_ = thunk_emitter.EmitIndirectCallThunk();
 
   // Set the code cache to use the ResolveFunction thunk for default
   // indirections.
   assert_zero(uint64_t(resolve_function_thunk_) & 0xFFFFFFFF00000000ull);
   code_cache_->set_indirection_default(
       uint32_t(uint64_t(resolve_function_thunk_)));
+  assert_zero(uint64_t(indirect_call_thunk_) & 0xFFFFFFFF00000000ull);
+  code_cache_->set_indirect_call_thunk(
+      uint32_t(uint64_t(indirect_call_thunk_)));
 
   // Allocate some special indirections.
   code_cache_->CommitExecutableRange(0x9FFF0000, 0x9FFFFFFF);
@@ -128,12 +136,38 @@ bool X64Backend::Initialize(Processor* processor) {
   // Allocate emitter constant data.
   emitter_data_ = X64Emitter::PlaceConstData();
 
+  // Persisted code embeds the thunk and constant data addresses and is only
+  // valid for the build and host features it was generated with.
+  XXH64_state_t hash_state;
+  XXH64_reset(&hash_state, 0);
+  XXH64_update(&hash_state, XE_BUILD_COMMIT, std::strlen(XE_BUILD_COMMIT));
+  uint64_t environment[] = {
+      uint64_t(host_to_guest_thunk_),
+      uint64_t(guest_to_host_thunk_),
+      uint64_t(resolve_function_thunk_),
+      uint64_t(emitter_data_),
+      uint64_t(thunk_emitter.feature_flags()),
+      uint64_t(machine_info_.supports_extended_load_store),
+  };
+  XXH64_update(&hash_state, environment, sizeof(environment));
+  code_cache_->set_host_environment_hash(XXH64_digest(&hash_state));
+
   // Setup exception callback
   ExceptionHandler::Install(&ExceptionCallbackThunk, this);
 
   return true;
 }
 
+void* X64Backend::AllocThreadData(ThreadState* thread_state) {
+  auto epoch_slot = &thread_state->context()->code_epoch;
+  code_cache_->RegisterThread(epoch_slot);
+  return epoch_slot;
+}
+
+void X64Backend::FreeThreadData(void* thread_data) {
+  code_cache_->UnregisterThread(reinterpret_cast<uint64_t*>(thread_data));
+}
+
 void X64Backend::CommitExecutableRange(uint32_t guest_low,
                                        uint32_t guest_high) {
   code_cache_->CommitExecutableRange(guest_low, guest_high);
@@ -148,6 +182,26 @@ std::unique_ptr<GuestFunction> X64Backend::CreateGuestFunction(
   return std::make_unique<X64Function>(module, address);
 }
 
+bool X64Backend::LoadCachedCode(Module* module) {
+  return code_cache_->LoadPersistentCache(module);
+}
+
+bool X64Backend::SaveCachedCode(Module* module) {
+  return code_cache_->SavePersistentCache(module);
+}
+
+bool X64Backend::DefineCachedFunction(GuestFunction* function) {
+  return code_cache_->PlaceCachedFunction(function);
+}
+
+void X64Backend::ReleaseModuleCode(Module* module) {
+  // Keep what was generated for the next time the module is loaded.
+  code_cache_->SavePersistentCache(module);
+  size_t count = code_cache_->ReleaseModuleCode(module);
+  XELOGI("Released code for %zu functions in module %s", count,
+         module->name().c_str());
+}
+
 uint64_t ReadCapstoneReg(X64Context* context, x86_reg reg) {
   switch (reg) {
     case X86_REG_RAX:
@@ -433,6 +487,22 @@ HostToGuestThunk X64ThunkEmitter::EmitHostToGuestThunk() {
   return (HostToGuestThunk)fn;
 }
 
+// Scans the calling thread's stack for code retired since its code epoch was
+// published, and republishes it as far as allowed.
+extern "C" uint64_t RepublishCodeEpoch(void* raw_context) {
+  auto thread_state = *reinterpret_cast<ThreadState**>(raw_context);
+  auto backend =
+      reinterpret_cast<X64Backend*>(thread_state->processor()->backend());
+  auto context = thread_state->context();
+  // Everything between here and the outermost entry into generated code,
+  // including the volatile registers saved by the thunk.
+  volatile uint8_t stack_low = 0;
+  backend->code_cache()->RepublishEpoch(
+      &context->code_epoch, const_cast<const uint8_t*>(&stack_low),
+      reinterpret_cast<const void*>(context->code_stack_top));
+  return 0;
+}
+
 GuestToHostThunk X64ThunkEmitter::EmitGuestToHostThunk() {
   // rcx = target function
   // rdx = arg0
@@ -446,6 +516,21 @@ GuestToHostThunk X64ThunkEmitter::EmitGuestToHostThunk() {
   // Save off volatile registers.
   EmitSaveVolatileRegs();
 
+  // The host returns into the guest frames on the stack, so the thread is
+  // still in generated code. Long-running threads never leave it, though, so
+  // if code was retired since the epoch was published, publish the oldest
+  // one the stack still needs.
+  Xbyak::Label epoch_current;
+  mov(rax, uint64_t(backend()->code_cache()->retired_code_epoch_ptr()));
+  mov(rax, qword[rax]);
+  cmp(qword[GetContextReg() + offsetof(ppc::PPCContext, code_epoch)], rax);
+  ja(epoch_current);
+  mov(rcx, GetContextReg());
+  mov(rax, uint64_t(&RepublishCodeEpoch));
+  call(rax);
+  EmitLoadVolatileRegs();
+  L(epoch_current);
+
   mov(rax, rcx);              // function
   mov(rcx, GetContextReg());  // context
   call(rax);
@@ -487,6 +572,17 @@ ResolveFunctionThunk X64ThunkEmitter::EmitResolveFunctionThunk() {
   return (ResolveFunctionThunk)fn;
 }
 
+IndirectCallThunk X64ThunkEmitter::EmitIndirectCallThunk() {
+  // ebx = target PPC address
+  // rcx = guest return address, left for the target
+  // rsp + 0 = return address into the calling site (if not a tail call)
+  mov(eax, dword[ebx]);
+  jmp(rax);
+
+  void* fn = Emplace(0);
+  return (IndirectCallThunk)fn;
+}
+
 void X64ThunkEmitter::EmitSaveVolatileRegs() {
   // Save off volatile registers.
   // mov(qword[rsp + offsetof(StackLayout::Thunk, r[0])], rax);
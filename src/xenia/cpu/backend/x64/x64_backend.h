@@ -33,6 +33,7 @@ class X64CodeCache;
 typedef void* (*HostToGuestThunk)(void* target, void* arg0, void* arg1);
 typedef void* (*GuestToHostThunk)(void* target, void* arg0, void* arg1);
 typedef void (*ResolveFunctionThunk)();
+typedef void (*IndirectCallThunk)();
 
 class X64Backend : public Backend {
  public:
@@ -52,9 +53,17 @@ class X64Backend : public Backend {
   ResolveFunctionThunk resolve_function_thunk() const {
     return resolve_function_thunk_;
   }
+  // Calls the function at the guest address in ebx through the indirection
+  // table. Target of chained call sites that aren't linked.
+  IndirectCallThunk indirect_call_thunk() const { return indirect_call_thunk_; }
 
   bool Initialize(Processor* processor) override;
 
+  // Thread data is the thread's code epoch slot, registered with the code
+  // cache.
+  void* AllocThreadData(ThreadState* thread_state) override;
+  void FreeThreadData(void* thread_data) override;
+
   void CommitExecutableRange(uint32_t guest_low, uint32_t guest_high) override;
 
   std::unique_ptr<Assembler> CreateAssembler() override;
@@ -62,6 +71,11 @@ class X64Backend : public Backend {
   std::unique_ptr<GuestFunction> CreateGuestFunction(Module* module,
                                                      uint32_t address) override;
 
+  bool LoadCachedCode(Module* module) override;
+  bool SaveCachedCode(Module* module) override;
+  bool DefineCachedFunction(GuestFunction* function) override;
+  void ReleaseModuleCode(Module* module) override;
+
   uint64_t CalculateNextHostInstruction(ThreadDebugInfo* thread_info,
                                         uint64_t current_pc) override;
 
@@ -81,6 +95,7 @@ class X64Backend : public Backend {
   HostToGuestThunk host_to_guest_thunk_;
   GuestToHostThunk guest_to_host_thunk_;
   ResolveFunctionThunk resolve_function_thunk_;
+  IndirectCallThunk indirect_call_thunk_;
 };
 
 }  // namespace x64
@@ -9,6 +9,8 @@
 
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 
+#include <algorithm>
+#include <cinttypes>
 #include <cstdlib>
 #include <cstring>
 
@@ -17,24 +19,79 @@
 #pragma comment(lib, "../third_party/vtune/lib64/jitprofiling.lib")
 #endif
 
+#include "third_party/xxhash/xxhash.h"
 #include "xenia/base/assert.h"
+#include "xenia/base/atomic.h"
 #include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
+#include "xenia/base/string.h"
+#include "xenia/base/threading.h"
+#include "xenia/cpu/backend/x64/x64_function.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/function.h"
+#include "xenia/cpu/mmio_handler.h"
 #include "xenia/cpu/module.h"
 
+DEFINE_bool(perf_map, false,
+            "Write /tmp/perf-<pid>.map naming generated functions for Linux "
+            "perf.");
+DEFINE_bool(perf_jitdump, false,
+            "Write /tmp/jit-<pid>.dump with generated code and guest "
+            "addresses for `perf inject --jit`. Record with -k mono.");
+
 namespace xe {
 namespace cpu {
 namespace backend {
 namespace x64 {
 
+// Bumped whenever the file layout or the conventions of generated code change.
+// 'XJC0' as it appears in the file.
+static const uint32_t kPersistentCacheMagic = 0x30434A58;
+static const uint32_t kPersistentCacheVersion = 2;
+
+struct PersistentCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t image_hash;
+  uint64_t host_environment_hash;
+  uint64_t host_image_anchor;
+  uint32_t function_count;
+  uint32_t reserved;
+};
+
+// Followed by the name, code, relocations and source map.
+struct PersistentFunctionHeader {
+  uint32_t guest_address;
+  uint32_t guest_end_address;
+  uint64_t guest_hash;
+  uint32_t stack_size;
+  uint32_t code_size;
+  uint32_t relocation_count;
+  uint32_t source_map_count;
+  uint32_t name_length;
+  uint32_t reserved;
+};
+
+// Some object within the host executable image. The image is relocated as a
+// unit, so the distance this moves between the run that wrote a cache and the
+// current one is how far all kHostImage relocations need to move.
+static const uint8_t host_image_anchor_ = 0;
+static uint64_t host_image_anchor() {
+  return reinterpret_cast<uint64_t>(&host_image_anchor_);
+}
+
 X64CodeCache::X64CodeCache() = default;
 
 X64CodeCache::~X64CodeCache() {
+  if (!call_site_stats_.empty()) {
+    DumpCallSiteStats();
+  }
+
   if (indirection_table_base_) {
-    xe::memory::DeallocFixed(indirection_table_base_, 0,
+    xe::memory::DeallocFixed(indirection_table_base_, kIndirectionTableSize,
                              xe::memory::DeallocationType::kRelease);
   }
 
@@ -84,8 +141,25 @@ bool X64CodeCache::Initialize() {
     return false;
   }
 
-  // Preallocate the function map to a large, reasonable size.
-  generated_code_map_.reserve(kMaximumFunctionCount);
+  // Preallocate the function map to a reasonable size. It grows as needed.
+  generated_code_map_->reserve(kInitialFunctionMapCapacity);
+
+  if (FLAGS_perf_map || FLAGS_perf_jitdump) {
+    perf_jit_writer_ =
+        X64PerfJitWriter::Create(FLAGS_perf_map, FLAGS_perf_jitdump);
+  }
+
+  // Tracing and disassembly are never persisted, so bypass the cache entirely
+  // when they are requested.
+  if (!FLAGS_jit_cache_path.empty()) {
+    if (FLAGS_trace_functions || FLAGS_trace_function_coverage ||
+        FLAGS_trace_function_references || FLAGS_trace_function_data ||
+        FLAGS_disassemble_functions) {
+      XELOGW("Function tracing enabled; ignoring --jit_cache_path");
+    } else {
+      persistent_cache_path_ = xe::to_wstring(FLAGS_jit_cache_path);
+    }
+  }
 
   return true;
 }
@@ -94,15 +168,171 @@ void X64CodeCache::set_indirection_default(uint32_t default_value) {
   indirection_default_value_ = default_value;
 }
 
+void X64CodeCache::RegisterThread(volatile uint64_t* epoch_slot) {
+  *epoch_slot = kThreadOutsideCode;
+  std::lock_guard<std::mutex> lock(thread_epochs_mutex_);
+  thread_epoch_slots_.push_back(epoch_slot);
+}
+
+void X64CodeCache::UnregisterThread(volatile uint64_t* epoch_slot) {
+  std::lock_guard<std::mutex> lock(thread_epochs_mutex_);
+  auto it = std::find(thread_epoch_slots_.begin(), thread_epoch_slots_.end(),
+                      epoch_slot);
+  if (it != thread_epoch_slots_.end()) {
+    thread_epoch_slots_.erase(it);
+  }
+}
+
+uint64_t X64CodeCache::EnterCode(volatile uint64_t* epoch_slot) {
+  // Only this thread writes its slot.
+  uint64_t previous_epoch = *epoch_slot;
+  if (previous_epoch != kThreadOutsideCode) {
+    return previous_epoch;
+  }
+  // The exchange is a full barrier, so the slot is visible before anything the
+  // thread then reads from the indirection table or call sites. Either the
+  // reclaiming thread sees the slot, or this thread sees the unlinked code.
+  return xe::atomic_exchange(uint64_t(code_epoch_), epoch_slot);
+}
+
+void X64CodeCache::RepublishEpoch(volatile uint64_t* epoch_slot,
+                                  const void* stack_low,
+                                  const void* stack_high) {
+  // Only this thread writes its slot. Code is retired under the lock after it
+  // has been unlinked, so anything retired later than what we see here gets
+  // an epoch at or above the one published.
+  uint64_t thread_epoch = *epoch_slot;
+  auto global_lock = global_critical_region_.Acquire();
+  uint64_t epoch = code_epoch_;
+
+  // Only code retired since the thread entered can be on its stack.
+  std::vector<const RetiredCode*> pending;
+  for (auto& retired : retired_code_) {
+    if (retired.epoch >= thread_epoch) {
+      pending.push_back(&retired);
+    }
+  }
+  std::sort(pending.begin(), pending.end(),
+            [](const RetiredCode* a, const RetiredCode* b) {
+              return a->offset < b->offset;
+            });
+
+  // Any value on the stack that points into retired code may be a return
+  // address into it, and keeps the thread at that code's epoch.
+  uint64_t code_base = reinterpret_cast<uint64_t>(generated_code_base_);
+  auto p = reinterpret_cast<const uint64_t*>(
+      xe::round_up(reinterpret_cast<uintptr_t>(stack_low), sizeof(uint64_t)));
+  auto end = reinterpret_cast<const uint64_t*>(stack_high);
+  for (; p < end && !pending.empty(); ++p) {
+    uint64_t value = *p;
+    if (value < code_base || value >= code_base + kGeneratedCodeSize) {
+      continue;
+    }
+    size_t offset = size_t(value - code_base);
+    auto it = std::upper_bound(pending.begin(), pending.end(), offset,
+                               [](size_t offset, const RetiredCode* retired) {
+                                 return offset < retired->offset;
+                               });
+    if (it != pending.begin() &&
+        offset < (*std::prev(it))->offset + (*std::prev(it))->length) {
+      epoch = std::min(epoch, (*std::prev(it))->epoch);
+    }
+  }
+
+  if (epoch > thread_epoch) {
+    *epoch_slot = epoch;
+  }
+}
+
 void X64CodeCache::AddIndirection(uint32_t guest_address,
                                   uint32_t host_address) {
   if (!indirection_table_base_) {
     return;
   }
 
+  std::lock_guard<std::mutex> lock(call_sites_mutex_);
   uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
       indirection_table_base_ + (guest_address - kIndirectionTableBase));
   *indirection_slot = host_address;
+  LinkCallTarget(guest_address, host_address);
+}
+
+void X64CodeCache::RemoveIndirection(uint32_t guest_address) {
+  if (!indirection_table_base_) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(call_sites_mutex_);
+  uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
+      indirection_table_base_ + (guest_address - kIndirectionTableBase));
+  *indirection_slot = indirection_default_value_;
+  LinkCallTarget(guest_address, 0);
+}
+
+void X64CodeCache::LinkCallTarget(uint32_t guest_address,
+                                  uint32_t host_address) {
+  auto& target = call_targets_[guest_address];
+  if (target.host_address == host_address) {
+    return;
+  }
+  target.host_address = host_address;
+  for (auto& site : target.sites) {
+    PatchCallSite(site, host_address ? host_address : indirect_call_thunk_);
+  }
+}
+
+void X64CodeCache::PatchCallSite(const CallSite& site, uint32_t host_address) {
+  // Relative to the end of the call/jmp. Both the site and the target are
+  // within the low 4GB, so this always fits.
+  int32_t displacement = int32_t(
+      host_address - uint32_t(reinterpret_cast<uint64_t>(site.displacement)) -
+      4);
+  // Aligned 4b stores are atomic, so a thread executing the site concurrently
+  // jumps to either the old or the new target.
+  assert_zero(reinterpret_cast<uintptr_t>(site.displacement) & 3);
+  *reinterpret_cast<volatile int32_t*>(site.displacement) = displacement;
+  if (site.stats) {
+    site.stats->linked = host_address != indirect_call_thunk_;
+  }
+}
+
+CallSiteStats* X64CodeCache::AllocateCallSiteStats(uint32_t caller_address,
+                                                   uint32_t target_address) {
+  std::lock_guard<std::mutex> lock(call_sites_mutex_);
+  CallSiteStats stats = {0};
+  stats.caller_address = caller_address;
+  stats.target_address = target_address;
+  call_site_stats_.push_back(stats);
+  return &call_site_stats_.back();
+}
+
+void X64CodeCache::DumpCallSiteStats() {
+  std::lock_guard<std::mutex> lock(call_sites_mutex_);
+  uint64_t direct_calls = 0;
+  uint64_t table_calls = 0;
+  std::vector<const CallSiteStats*> sites;
+  for (auto& stats : call_site_stats_) {
+    direct_calls += stats.direct_calls;
+    table_calls += stats.table_calls;
+    if (stats.direct_calls || stats.table_calls) {
+      sites.push_back(&stats);
+    }
+  }
+  XELOGI("Call sites: %zu emitted, %zu called, %" PRIu64
+         " direct calls, %" PRIu64 " table calls",
+         call_site_stats_.size(), sites.size(), direct_calls, table_calls);
+
+  // Busiest sites are the most interesting.
+  std::sort(sites.begin(), sites.end(),
+            [](const CallSiteStats* a, const CallSiteStats* b) {
+              return a->direct_calls + a->table_calls >
+                     b->direct_calls + b->table_calls;
+            });
+  for (size_t i = 0; i < sites.size() && i < 32; ++i) {
+    XELOGI("  %.8X -> %.8X: %" PRIu64 " direct, %" PRIu64 " table",
+           sites[i]->caller_address, sites[i]->target_address,
+           sites[i]->direct_calls, sites[i]->table_calls);
+  }
 }
 
 void X64CodeCache::CommitExecutableRange(uint32_t guest_low,
@@ -132,40 +362,92 @@ void* X64CodeCache::PlaceHostCode(uint32_t guest_address, void* machine_code,
                         nullptr);
 }
 
-void* X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
-                                   size_t code_size, size_t stack_size,
-                                   GuestFunction* function_info) {
+void* X64CodeCache::PlaceGuestCode(
+    uint32_t guest_address, void* machine_code, size_t code_size,
+    size_t stack_size, GuestFunction* function_info,
+    const std::vector<ChainedCallSite>* call_sites,
+    const std::vector<SourceMapEntry>* source_map) {
   // Hold a lock while we bump the pointers up. This is important as the
   // unwind table requires entries AND code to be sorted in order.
   size_t low_mark;
   size_t high_mark;
   uint8_t* code_address = nullptr;
   UnwindReservation unwind_reservation;
+  bool released = false;
   {
     auto global_lock = global_critical_region_.Acquire();
 
-    low_mark = generated_code_offset_;
+    if (!retired_code_.empty()) {
+      ReclaimRetiredCode();
+    }
+
+    // Functions of a module released while they were being compiled are dead
+    // on arrival.
+    released = function_info &&
+               std::find(released_modules_.begin(), released_modules_.end(),
+                         function_info->module()) != released_modules_.end();
 
     // Reserve code.
     // Always move the code to land on 16b alignment.
-    code_address = generated_code_base_ + generated_code_offset_;
-    generated_code_offset_ += xe::round_up(code_size, 16);
+    size_t code_length = xe::round_up(code_size, 16);
+    if (!free_ranges_.empty()) {
+      code_address = AllocateFreeRange(code_length);
+    }
+    if (code_address) {
+      // Only platforms without unwind tables reuse space, so there's never
+      // anything to reserve past the code.
+      low_mark = code_address - generated_code_base_;
+      high_mark = low_mark + code_length;
+      unwind_reservation =
+          RequestUnwindReservation(generated_code_base_ + high_mark);
+      assert_zero(unwind_reservation.data_size);
+
+      // Keep the map sorted by inserting in place.
+      ReserveCodeMapEntry();
+      auto& code_map = *generated_code_map_;
+      uint64_t key = (uint64_t(low_mark) << 32) | high_mark;
+      auto it = std::lower_bound(
+          code_map.begin(), code_map.end(), key,
+          [](const std::pair<uint64_t, GuestFunction*>& entry, uint64_t key) {
+            return entry.first < key;
+          });
+      ++generated_code_map_sequence_;
+      code_map.emplace(it, key, released ? nullptr : function_info);
+      ++generated_code_map_sequence_;
+    } else {
+      low_mark = generated_code_offset_;
 
-    // Reserve unwind info.
-    // We go on the high size of the unwind info as we don't know how big we
-    // need it, and a few extra bytes of padding isn't the worst thing.
-    unwind_reservation =
-        RequestUnwindReservation(generated_code_base_ + generated_code_offset_);
-    generated_code_offset_ += unwind_reservation.data_size;
+      code_address = generated_code_base_ + generated_code_offset_;
+      generated_code_offset_ += code_length;
 
-    high_mark = generated_code_offset_;
+      // Reserve unwind info.
+      // We go on the high size of the unwind info as we don't know how big we
+      // need it, and a few extra bytes of padding isn't the worst thing.
+      unwind_reservation = RequestUnwindReservation(generated_code_base_ +
+                                                    generated_code_offset_);
+      generated_code_offset_ += unwind_reservation.data_size;
 
-    // Store in map. It is maintained in sorted order of host PC dependent on
-    // us also being append-only.
-    generated_code_map_.emplace_back(
-        (uint64_t(code_address - generated_code_base_) << 32) |
-            generated_code_offset_,
-        function_info);
+      high_mark = generated_code_offset_;
+
+      // Store in map. It is maintained in sorted order of host PC dependent on
+      // us also being append-only.
+      ReserveCodeMapEntry();
+      ++generated_code_map_sequence_;
+      generated_code_map_->emplace_back(
+          (uint64_t(code_address - generated_code_base_) << 32) |
+              generated_code_offset_,
+          released ? nullptr : function_info);
+      ++generated_code_map_sequence_;
+    }
+
+    if (released) {
+      RetiredCode retired;
+      retired.offset = low_mark;
+      retired.length = high_mark - low_mark;
+      retired.epoch = code_epoch_++;
+      retired_code_.push_back(retired);
+      retired_code_epoch_ = retired.epoch;
+    }
 
     // TODO(DrChat): The following code doesn't really need to be under the
     // global lock except for PlaceCode (but it depends on the previous code
@@ -199,6 +481,11 @@ void* X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
               unwind_reservation);
   }
 
+  if (released) {
+    // Never linked anywhere, so nothing can reach it.
+    return code_address;
+  }
+
 #if ENABLE_VTUNE
   if (iJIT_IsProfilingActive() == iJIT_SAMPLING_ON) {
     std::string method_name;
@@ -220,13 +507,44 @@ void* X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
   }
 #endif
 
+  // Link the calls out of the code to whatever their targets currently are.
+  if (call_sites && !call_sites->empty()) {
+    std::lock_guard<std::mutex> lock(call_sites_mutex_);
+    for (auto& call_site : *call_sites) {
+      auto& target = call_targets_[call_site.target_address];
+      CallSite site;
+      site.displacement = code_address + call_site.code_offset;
+      site.stats = call_site.stats;
+      PatchCallSite(site, target.host_address ? target.host_address
+                                              : indirect_call_thunk_);
+      target.sites.push_back(site);
+    }
+  }
+
+  if (perf_jit_writer_) {
+    // Absolute label addresses in emitted code are only fixed up by Xbyak
+    // after this returns, so those may be stale in the jitdump copy.
+    std::string name;
+    std::string source_name;
+    if (function_info) {
+      name = function_info->name().empty()
+                 ? xe::format_string("sub_%.8X", guest_address)
+                 : function_info->name();
+      source_name = function_info->module()->name();
+    } else {
+      name = xe::format_string("xe_host_%.8X",
+                               uint32_t(uintptr_t(code_address)));
+    }
+    perf_jit_writer_->WriteCode(name, code_address, code_size, source_name,
+                                source_map);
+  }
+
   // Now that everything is ready, fix up the indirection table.
   // Note that we do support code that doesn't have an indirection fixup, so
   // ignore those when we see them.
   if (guest_address && indirection_table_base_) {
-    uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
-        indirection_table_base_ + (guest_address - kIndirectionTableBase));
-    *indirection_slot = uint32_t(reinterpret_cast<uint64_t>(code_address));
+    AddIndirection(guest_address,
+                   uint32_t(reinterpret_cast<uint64_t>(code_address)));
   }
 
   return code_address;
@@ -270,29 +588,586 @@ uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
 
 GuestFunction* X64CodeCache::LookupFunction(uint64_t host_pc) {
   uint32_t key = uint32_t(host_pc - kGeneratedCodeBase);
-  void* fn_entry = std::bsearch(
-      &key, generated_code_map_.data(), generated_code_map_.size() + 1,
-      sizeof(std::pair<uint32_t, Function*>),
-      [](const void* key_ptr, const void* element_ptr) {
-        auto key = *reinterpret_cast<const uint32_t*>(key_ptr);
-        auto element =
-            reinterpret_cast<const std::pair<uint64_t, GuestFunction*>*>(
-                element_ptr);
-        if (key < (element->first >> 32)) {
-          return -1;
-        } else if (key > uint32_t(element->first)) {
-          return 1;
-        } else {
-          return 0;
+  // The map is modified whenever code is placed or released. Retry if that
+  // happened during the search, but give up after a few attempts as the
+  // modifying thread may have been suspended by the caller. The storage
+  // searched stays valid either way.
+  for (int attempt = 0; attempt < 8; ++attempt) {
+    uint32_t sequence = generated_code_map_sequence_.load();
+    if (sequence & 1) {
+      xe::threading::MaybeYield();
+      continue;
+    }
+    auto code_map = std::atomic_load(&generated_code_map_);
+    GuestFunction* function = nullptr;
+    auto it = std::upper_bound(
+        code_map->begin(), code_map->end(), key,
+        [](uint32_t key, const std::pair<uint64_t, GuestFunction*>& entry) {
+          return key < (entry.first >> 32);
+        });
+    if (it != code_map->begin()) {
+      --it;
+      if (key <= uint32_t(it->first)) {
+        function = it->second;
+      }
+    }
+    if (generated_code_map_sequence_.load() == sequence) {
+      return function;
+    }
+  }
+  return nullptr;
+}
+
+size_t X64CodeCache::ReleaseModuleCode(Module* module) {
+  {
+    auto global_lock = global_critical_region_.Acquire();
+    released_modules_.push_back(module);
+  }
+  {
+    // Anything worth keeping must have been saved already.
+    std::lock_guard<std::mutex> lock(persistent_mutex_);
+    persistent_modules_.erase(module);
+  }
+  return RetireCode([module](GuestFunction* function) {
+    return function->module() == module;
+  });
+}
+
+size_t X64CodeCache::RetireCode(
+    std::function<bool(GuestFunction*)> predicate) {
+  // Pull the functions out of the map first so that nothing finds them while
+  // they're being unlinked. Keys are [start offset | end offset].
+  std::vector<std::pair<GuestFunction*, uint64_t>> functions;
+  {
+    auto global_lock = global_critical_region_.Acquire();
+    ++generated_code_map_sequence_;
+    for (auto& entry : *generated_code_map_) {
+      if (entry.second && predicate(entry.second)) {
+        functions.emplace_back(entry.second, entry.first);
+        entry.second = nullptr;
+      }
+    }
+    ++generated_code_map_sequence_;
+  }
+  if (functions.empty()) {
+    return 0;
+  }
+
+  std::vector<std::pair<uint8_t*, uint8_t*>> ranges;
+  for (auto& it : functions) {
+    ranges.emplace_back(generated_code_base_ + (it.second >> 32),
+                        generated_code_base_ + uint32_t(it.second));
+  }
+  std::sort(ranges.begin(), ranges.end());
+  auto in_ranges = [&ranges](const uint8_t* p) {
+    auto it = std::upper_bound(
+        ranges.begin(), ranges.end(), p,
+        [](const uint8_t* p, const std::pair<uint8_t*, uint8_t*>& range) {
+          return p < range.first;
+        });
+    return it != ranges.begin() && p < (--it)->second;
+  };
+
+  {
+    std::lock_guard<std::mutex> lock(call_sites_mutex_);
+    // Send callers of the functions back through the resolver, unless they
+    // have since been given other code (such as an optimized version).
+    for (auto& it : functions) {
+      uint32_t guest_address = it.first->address();
+      uint32_t host_address = uint32_t(reinterpret_cast<uint64_t>(
+          generated_code_base_ + (it.second >> 32)));
+      auto target_it = call_targets_.find(guest_address);
+      if (target_it == call_targets_.end() ||
+          target_it->second.host_address != host_address) {
+        continue;
+      }
+      if (indirection_table_base_) {
+        uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
+            indirection_table_base_ + (guest_address - kIndirectionTableBase));
+        *indirection_slot = indirection_default_value_;
+      }
+      LinkCallTarget(guest_address, 0);
+    }
+    // Call sites within the code must never be patched again.
+    for (auto& it : call_targets_) {
+      auto& sites = it.second.sites;
+      sites.erase(std::remove_if(sites.begin(), sites.end(),
+                                 [&in_ranges](const CallSite& site) {
+                                   return in_ranges(site.displacement);
+                                 }),
+                  sites.end());
+    }
+  }
+
+  if (has_persistent_cache()) {
+    std::lock_guard<std::mutex> lock(persistent_mutex_);
+    for (auto& it : functions) {
+      auto module_it = persistent_modules_.find(it.first->module());
+      if (module_it == persistent_modules_.end()) {
+        continue;
+      }
+      auto& records = module_it->second->functions;
+      auto record_it = records.find(it.first->address());
+      if (record_it != records.end() && record_it->second.function == it.first) {
+        records.erase(record_it);
+      }
+    }
+  }
+
+  {
+    auto global_lock = global_critical_region_.Acquire();
+    // Threads entering generated code from here on can't reach any of it.
+    uint64_t epoch = code_epoch_++;
+    for (auto& it : functions) {
+      RetiredCode retired;
+      retired.offset = size_t(it.second >> 32);
+      retired.length = size_t(uint32_t(it.second)) - retired.offset;
+      retired.epoch = epoch;
+      retired_code_.push_back(retired);
+    }
+    retired_code_epoch_ = epoch;
+  }
+  return functions.size();
+}
+
+void X64CodeCache::ReclaimRetiredCode() {
+  // Code retired before the epoch every thread with guest frames entered in
+  // is unreachable. Threads without any have nothing to finish.
+  uint64_t oldest_epoch = code_epoch_;
+  {
+    std::lock_guard<std::mutex> lock(thread_epochs_mutex_);
+    for (auto epoch_slot : thread_epoch_slots_) {
+      uint64_t epoch = *epoch_slot;
+      if (epoch != kThreadOutsideCode) {
+        oldest_epoch = std::min(oldest_epoch, epoch);
+      }
+    }
+  }
+
+  auto mmio_handler = MMIOHandler::global_handler();
+  auto end = std::remove_if(
+      retired_code_.begin(), retired_code_.end(),
+      [this, oldest_epoch, mmio_handler](const RetiredCode& retired) {
+        if (retired.epoch >= oldest_epoch) {
+          return false;
+        }
+        EraseCodeMapEntry(retired.offset);
+        if (mmio_handler) {
+          // Whatever ends up here next is decoded afresh.
+          uint64_t start = reinterpret_cast<uint64_t>(generated_code_base_) +
+                           retired.offset;
+          mmio_handler->InvalidateAccessSites(start, start + retired.length);
         }
+        if (can_reuse_code_space()) {
+          FreeRange(retired.offset, retired.length);
+        }
+        return true;
+      });
+  retired_code_.erase(end, retired_code_.end());
+
+  uint64_t retired_epoch = 0;
+  for (auto& retired : retired_code_) {
+    retired_epoch = std::max(retired_epoch, retired.epoch);
+  }
+  retired_code_epoch_ = retired_epoch;
+}
+
+void X64CodeCache::ReserveCodeMapEntry() {
+  auto& code_map = *generated_code_map_;
+  if (code_map.size() < code_map.capacity()) {
+    return;
+  }
+  auto grown_map = std::make_shared<CodeMap>();
+  grown_map->reserve(
+      std::max(code_map.capacity() * 2, size_t(kInitialFunctionMapCapacity)));
+  grown_map->assign(code_map.begin(), code_map.end());
+  ++generated_code_map_sequence_;
+  std::atomic_store(&generated_code_map_, grown_map);
+  ++generated_code_map_sequence_;
+}
+
+void X64CodeCache::EraseCodeMapEntry(size_t offset) {
+  auto& code_map = *generated_code_map_;
+  auto it = std::lower_bound(
+      code_map.begin(), code_map.end(), uint64_t(offset) << 32,
+      [](const std::pair<uint64_t, GuestFunction*>& entry, uint64_t key) {
+        return entry.first < key;
       });
-  if (fn_entry) {
-    return reinterpret_cast<const std::pair<uint64_t, GuestFunction*>*>(
-               fn_entry)
-        ->second;
-  } else {
-    return nullptr;
+  if (it != code_map.end() && (it->first >> 32) == offset) {
+    ++generated_code_map_sequence_;
+    code_map.erase(it);
+    ++generated_code_map_sequence_;
+  }
+}
+
+uint8_t* X64CodeCache::AllocateFreeRange(size_t length) {
+  // First fit, which keeps code packed towards the bottom.
+  for (auto it = free_ranges_.begin(); it != free_ranges_.end(); ++it) {
+    if (it->second < length) {
+      continue;
+    }
+    size_t offset = it->first;
+    size_t remaining = it->second - length;
+    free_ranges_.erase(it);
+    if (remaining) {
+      free_ranges_[offset + length] = remaining;
+    }
+    return generated_code_base_ + offset;
+  }
+  return nullptr;
+}
+
+void X64CodeCache::FreeRange(size_t offset, size_t length) {
+  // Trap anything still jumping in here.
+  std::memset(generated_code_base_ + offset, 0xCC, length);
+
+  auto next = free_ranges_.lower_bound(offset);
+  if (next != free_ranges_.end() && offset + length == next->first) {
+    length += next->second;
+    next = free_ranges_.erase(next);
+  }
+  if (next != free_ranges_.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      offset = prev->first;
+      length += prev->second;
+      free_ranges_.erase(prev);
+    }
+  }
+  if (offset + length == generated_code_offset_) {
+    // Nothing above, so just give it back to the bump allocation.
+    generated_code_offset_ = offset;
+    return;
+  }
+  free_ranges_[offset] = length;
+}
+
+uint64_t X64CodeCache::HashGuestCode(Module* module, uint32_t start_address,
+                                     uint32_t end_address) {
+  if (!start_address || end_address < start_address) {
+    return 0;
+  }
+  // End addresses are inclusive of the last instruction.
+  return XXH64(module->memory()->TranslateVirtual(start_address),
+               end_address - start_address + 4, 0);
+}
+
+bool X64CodeCache::LoadPersistentCache(Module* module) {
+  if (!has_persistent_cache() || !module->image_hash()) {
+    return false;
+  }
+
+  auto persistent_module = std::make_unique<PersistentModule>();
+  persistent_module->image_hash = module->image_hash();
+  persistent_module->path = xe::join_paths(
+      persistent_cache_path_,
+      xe::format_string(L"%.16llX.xjc", persistent_module->image_hash));
+  bool loaded = ReadPersistentCache(persistent_module.get());
+  if (loaded) {
+    XELOGI("Loaded %d cached functions for module %s",
+           int(persistent_module->functions.size()), module->name().c_str());
+  }
+
+  std::lock_guard<std::mutex> lock(persistent_mutex_);
+  persistent_modules_[module] = std::move(persistent_module);
+  return loaded;
+}
+
+bool X64CodeCache::ReadPersistentCache(PersistentModule* persistent_module) {
+  if (!xe::filesystem::PathExists(persistent_module->path)) {
+    return false;
+  }
+  FILE* file = xe::filesystem::OpenFile(persistent_module->path, "rb");
+  if (!file) {
+    return false;
+  }
+  fseek(file, 0, SEEK_END);
+  size_t file_length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  std::vector<uint8_t> data(file_length);
+  bool read_ok = fread(data.data(), 1, file_length, file) == file_length;
+  fclose(file);
+  if (!read_ok) {
+    return false;
+  }
+
+  size_t offset = 0;
+  auto read = [&data, &offset](void* dest, size_t length) {
+    if (offset + length > data.size()) {
+      return false;
+    }
+    std::memcpy(dest, data.data() + offset, length);
+    offset += length;
+    return true;
+  };
+
+  PersistentCacheHeader header;
+  if (!read(&header, sizeof(header)) ||
+      header.magic != kPersistentCacheMagic ||
+      header.version != kPersistentCacheVersion) {
+    XELOGW("Ignoring JIT cache %S: unrecognized format",
+           persistent_module->path.c_str());
+    return false;
+  }
+  if (header.image_hash != persistent_module->image_hash ||
+      header.host_environment_hash != host_environment_hash_) {
+    // Built by a different emulator build or on a different host; it'll be
+    // overwritten when the module is saved.
+    XELOGW("Ignoring stale JIT cache %S", persistent_module->path.c_str());
+    return false;
   }
+
+  int64_t host_image_delta =
+      int64_t(host_image_anchor() - header.host_image_anchor);
+  for (uint32_t i = 0; i < header.function_count; ++i) {
+    PersistentFunctionHeader function_header;
+    if (!read(&function_header, sizeof(function_header))) {
+      return false;
+    }
+    PersistentFunction record;
+    record.guest_end_address = function_header.guest_end_address;
+    record.guest_hash = function_header.guest_hash;
+    record.stack_size = function_header.stack_size;
+    record.name.resize(function_header.name_length);
+    record.machine_code.resize(function_header.code_size);
+    record.relocations.resize(function_header.relocation_count);
+    record.source_map.resize(function_header.source_map_count);
+    if (!read(const_cast<char*>(record.name.data()), record.name.size()) ||
+        !read(record.machine_code.data(), record.machine_code.size()) ||
+        !read(record.relocations.data(),
+              record.relocations.size() * sizeof(CodeRelocation)) ||
+        !read(record.source_map.data(),
+              record.source_map.size() * sizeof(SourceMapEntry))) {
+      XELOGW("Truncated JIT cache %S", persistent_module->path.c_str());
+      return false;
+    }
+    // Rebase now so everything we hold refers to the current process.
+    if (!RebaseRelocations(record.machine_code.data(),
+                           record.machine_code.size(), record.relocations,
+                           host_image_delta)) {
+      continue;
+    }
+    persistent_module->functions[function_header.guest_address] =
+        std::move(record);
+  }
+
+  return true;
+}
+
+bool X64CodeCache::RebaseRelocations(
+    uint8_t* machine_code, size_t code_size,
+    const std::vector<CodeRelocation>& relocations, int64_t host_image_delta) {
+  for (auto& relocation : relocations) {
+    if (relocation.code_offset + relocation.size > code_size) {
+      return false;
+    }
+    if (relocation.type == CodeRelocation::Type::kCallSite) {
+      // Linked on placement. The target is the immediate of the preceding
+      // `mov ebx, imm32`.
+      if (relocation.size != 4 || relocation.code_offset < 6) {
+        return false;
+      }
+      continue;
+    } else if (relocation.type != CodeRelocation::Type::kHostImage) {
+      return false;
+    }
+    uint8_t* p = machine_code + relocation.code_offset;
+    if (relocation.size == 4) {
+      uint32_t value;
+      std::memcpy(&value, p, sizeof(value));
+      uint64_t new_value = uint64_t(value) + host_image_delta;
+      if (new_value >> 32) {
+        // Moved out of the range the original instruction can encode.
+        return false;
+      }
+      value = uint32_t(new_value);
+      std::memcpy(p, &value, sizeof(value));
+    } else if (relocation.size == 8) {
+      uint64_t value;
+      std::memcpy(&value, p, sizeof(value));
+      value += host_image_delta;
+      std::memcpy(p, &value, sizeof(value));
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool X64CodeCache::SavePersistentCache(Module* module) {
+  std::lock_guard<std::mutex> lock(persistent_mutex_);
+  auto it = persistent_modules_.find(module);
+  if (it == persistent_modules_.end()) {
+    return false;
+  }
+  auto persistent_module = it->second.get();
+
+  std::vector<uint8_t> data;
+  auto append = [&data](const void* src, size_t length) {
+    auto p = reinterpret_cast<const uint8_t*>(src);
+    data.insert(data.end(), p, p + length);
+  };
+
+  PersistentCacheHeader header = {0};
+  header.magic = kPersistentCacheMagic;
+  header.version = kPersistentCacheVersion;
+  header.image_hash = persistent_module->image_hash;
+  header.host_environment_hash = host_environment_hash_;
+  header.host_image_anchor = host_image_anchor();
+  append(&header, sizeof(header));
+
+  std::vector<SourceMapEntry> live_source_map;
+  for (auto& it : persistent_module->functions) {
+    auto& record = it.second;
+    const uint8_t* machine_code;
+    size_t code_size;
+    const std::vector<SourceMapEntry>* source_map;
+    const std::string* name;
+    if (record.function) {
+      if (!record.function->machine_code()) {
+        // Still being placed; caches written while running skip it.
+        continue;
+      }
+      machine_code = record.function->machine_code();
+      code_size = record.function->machine_code_length();
+      record.function->source_map().Decode(&live_source_map);
+      source_map = &live_source_map;
+      name = &record.function->name();
+    } else if (!record.machine_code.empty()) {
+      // Loaded but never used this session - keep it around.
+      machine_code = record.machine_code.data();
+      code_size = record.machine_code.size();
+      source_map = &record.source_map;
+      name = &record.name;
+    } else {
+      continue;
+    }
+
+    PersistentFunctionHeader function_header = {0};
+    function_header.guest_address = it.first;
+    function_header.guest_end_address = record.guest_end_address;
+    function_header.guest_hash = record.guest_hash;
+    function_header.stack_size = record.stack_size;
+    function_header.code_size = uint32_t(code_size);
+    function_header.relocation_count = uint32_t(record.relocations.size());
+    function_header.source_map_count = uint32_t(source_map->size());
+    function_header.name_length = uint32_t(name->size());
+    append(&function_header, sizeof(function_header));
+    append(name->data(), name->size());
+    append(machine_code, code_size);
+    append(record.relocations.data(),
+           record.relocations.size() * sizeof(CodeRelocation));
+    append(source_map->data(), source_map->size() * sizeof(SourceMapEntry));
+    ++header.function_count;
+  }
+  std::memcpy(data.data(), &header, sizeof(header));
+
+  xe::filesystem::CreateFolder(persistent_cache_path_);
+  FILE* file = xe::filesystem::OpenFile(persistent_module->path, "wb");
+  if (!file) {
+    XELOGE("Unable to write JIT cache %S", persistent_module->path.c_str());
+    return false;
+  }
+  fwrite(data.data(), 1, data.size(), file);
+  fclose(file);
+
+  XELOGI("Saved %d functions to the JIT cache for module %s",
+         int(header.function_count), module->name().c_str());
+  return true;
+}
+
+void X64CodeCache::AddPersistentFunction(
+    GuestFunction* function, size_t stack_size,
+    const std::vector<CodeRelocation>& relocations) {
+  if (!has_persistent_cache()) {
+    return;
+  }
+  auto module = function->module();
+  uint64_t guest_hash =
+      HashGuestCode(module, function->address(), function->end_address());
+
+  std::lock_guard<std::mutex> lock(persistent_mutex_);
+  auto it = persistent_modules_.find(module);
+  if (it == persistent_modules_.end()) {
+    // Module isn't cacheable.
+    return;
+  }
+  auto& record = it->second->functions[function->address()];
+  record.guest_end_address = function->end_address();
+  record.guest_hash = guest_hash;
+  record.stack_size = uint32_t(stack_size);
+  record.name.clear();
+  record.relocations = relocations;
+  record.machine_code.clear();
+  record.source_map.clear();
+  record.function = function;
+}
+
+bool X64CodeCache::PlaceCachedFunction(GuestFunction* function) {
+  if (!has_persistent_cache()) {
+    return false;
+  }
+  auto module = function->module();
+
+  uint32_t guest_end_address;
+  uint32_t stack_size;
+  std::vector<uint8_t> machine_code;
+  std::vector<SourceMapEntry> source_map;
+  std::vector<CodeRelocation> relocations;
+  std::vector<ChainedCallSite> call_sites;
+  {
+    std::lock_guard<std::mutex> lock(persistent_mutex_);
+    auto module_it = persistent_modules_.find(module);
+    if (module_it == persistent_modules_.end()) {
+      return false;
+    }
+    auto& functions = module_it->second->functions;
+    auto it = functions.find(function->address());
+    if (it == functions.end() || it->second.machine_code.empty()) {
+      return false;
+    }
+    auto& record = it->second;
+
+    // The guest may have patched or replaced the code since the cache was
+    // written, in which case our code no longer applies.
+    if (HashGuestCode(module, function->address(), record.guest_end_address) !=
+        record.guest_hash) {
+      functions.erase(it);
+      return false;
+    }
+
+    guest_end_address = record.guest_end_address;
+    stack_size = record.stack_size;
+    machine_code = std::move(record.machine_code);
+    source_map = std::move(record.source_map);
+    relocations = record.relocations;
+    record.machine_code.clear();
+    record.source_map.clear();
+    record.function = function;
+  }
+
+  for (auto& relocation : relocations) {
+    if (relocation.type != CodeRelocation::Type::kCallSite) {
+      continue;
+    }
+    ChainedCallSite call_site = {0};
+    call_site.code_offset = relocation.code_offset;
+    std::memcpy(&call_site.target_address,
+                machine_code.data() + relocation.code_offset - 5,
+                sizeof(call_site.target_address));
+    call_sites.push_back(call_site);
+  }
+
+  // NOTE: placement takes the global lock and must not happen under ours.
+  function->set_end_address(guest_end_address);
+  void* code_address =
+      PlaceGuestCode(function->address(), machine_code.data(),
+                     machine_code.size(), stack_size, function, &call_sites,
+                     &source_map);
+  function->source_map().Assign(source_map);
+  static_cast<X64Function*>(function)->Setup(
+      reinterpret_cast<uint8_t*>(code_address), machine_code.size());
+  return true;
 }
 
 }  // namespace x64
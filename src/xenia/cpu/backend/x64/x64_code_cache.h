@@ -11,20 +11,66 @@
 #define XENIA_CPU_BACKEND_X64_X64_CODE_CACHE_H_
 
 #include <atomic>
+#include <functional>
+#include <deque>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 #include "xenia/base/memory.h"
 #include "xenia/base/mutex.h"
 #include "xenia/cpu/backend/code_cache.h"
+#include "xenia/cpu/backend/x64/x64_perf_jit_writer.h"
 
 namespace xe {
 namespace cpu {
 namespace backend {
 namespace x64 {
 
+// A location in generated code holding an absolute host address that must be
+// rebased if the code is moved into a different process (such as when it is
+// loaded from the persistent cache).
+struct CodeRelocation {
+  enum class Type : uint32_t {
+    // Address within the host executable image (functions, static tables).
+    kHostImage = 0,
+    // Displacement of a chained call site (see ChainedCallSite). Linked when
+    // the code is placed rather than rebased.
+    kCallSite = 1,
+  };
+
+  Type type;
+  uint32_t code_offset;  // Offset of the immediate from the code start.
+  uint32_t size;         // Immediate size in bytes (4 = zero-extended, or 8).
+};
+
+// Counters for a chained call site, kept with --count_call_sites.
+struct CallSiteStats {
+  // Nonzero while the site is linked directly to its target. Read by the
+  // emitted counting code to pick the counter to bump.
+  uint32_t linked;
+  uint32_t caller_address;  // Guest address of the calling function.
+  uint32_t target_address;  // Guest address of the called function.
+  uint64_t direct_calls;
+  uint64_t table_calls;
+};
+
+// A guest call emitted as `mov ebx, target_address` directly followed by a
+// `call rel32` (or `jmp rel32` for tail calls). The displacement starts out
+// pointing at the indirect call thunk, which dispatches through the
+// indirection table, and is patched to point straight at the target's code
+// whenever it has some. Displacements are 4b aligned so that they can be
+// patched while other threads are running the code.
+struct ChainedCallSite {
+  uint32_t code_offset;     // Offset of the displacement from the code start.
+  uint32_t target_address;  // Guest function being called.
+  CallSiteStats* stats;     // Only with --count_call_sites.
+};
+
 class X64CodeCache : public CodeCache {
  public:
   ~X64CodeCache() override;
@@ -37,25 +83,97 @@ class X64CodeCache : public CodeCache {
   uint32_t base_address() const override { return kGeneratedCodeBase; }
   uint32_t total_size() const override { return kGeneratedCodeSize; }
 
-  // TODO(benvanik): ELF serialization/etc
-  // TODO(benvanik): keep track of code blocks
   // TODO(benvanik): padding/guards/etc
 
+  // Value of a thread's code epoch slot while it has no guest frames at all.
+  static const uint64_t kThreadOutsideCode = ~0ull;
+  // Tracks the epoch slot of a thread that may run generated code. The slot is
+  // written by the thread itself whenever it enters or leaves generated code.
+  void RegisterThread(volatile uint64_t* epoch_slot);
+  void UnregisterThread(volatile uint64_t* epoch_slot);
+  // Marks the calling thread as running generated code as of the current
+  // epoch, returning the previous value of its slot. A thread re-entering from
+  // host code it was called into keeps the epoch of its outermost guest frame,
+  // as it will return into those frames.
+  uint64_t EnterCode(volatile uint64_t* epoch_slot);
+  // Moves the calling thread's epoch past all retired code that nothing on
+  // its stack between stack_low and stack_high refers to. The stack is
+  // scanned conservatively, so only code the thread may return into holds it
+  // back. Called on the way out to host code by threads that may be delaying
+  // reclamation, as a thread can run guest code for as long as the title does.
+  void RepublishEpoch(volatile uint64_t* epoch_slot, const void* stack_low,
+                      const void* stack_high);
+  // Epoch of the last retired code still waiting to be reclaimed, or 0 if
+  // there is none. Threads with an epoch at or below it may be holding it
+  // back.
+  const std::atomic<uint64_t>* retired_code_epoch_ptr() const {
+    return &retired_code_epoch_;
+  }
+
+  // Releases all code placed for functions in the module. Nothing may call
+  // into the module anymore, but threads that were already past the
+  // indirection table can finish what they were doing: the space is only
+  // reused once every thread that had guest frames when it was released has
+  // unwound all of them. Returns the number of functions released.
+  size_t ReleaseModuleCode(Module* module);
+
   bool has_indirection_table() { return indirection_table_base_ != nullptr; }
   void set_indirection_default(uint32_t default_value);
+  // Sets the code for the guest function, relinking any call sites to it.
   void AddIndirection(uint32_t guest_address, uint32_t host_address);
+  // Reverts the guest function to being resolved on its next call and points
+  // all call sites linked to it back at the indirection table. Used when its
+  // code can no longer be used.
+  void RemoveIndirection(uint32_t guest_address);
+
+  // Thunk that chained call sites use while their target has no code.
+  void set_indirect_call_thunk(uint32_t host_address) {
+    indirect_call_thunk_ = host_address;
+  }
+  // Allocates counters for a call site emitted with --count_call_sites. They
+  // live until the code cache is destroyed, when a summary is logged.
+  CallSiteStats* AllocateCallSiteStats(uint32_t caller_address,
+                                       uint32_t target_address);
 
   void CommitExecutableRange(uint32_t guest_low, uint32_t guest_high);
 
   void* PlaceHostCode(uint32_t guest_address, void* machine_code,
                       size_t code_size, size_t stack_size);
-  void* PlaceGuestCode(uint32_t guest_address, void* machine_code,
-                       size_t code_size, size_t stack_size,
-                       GuestFunction* function_info);
+  // Chained call sites within the code are linked before the code is made
+  // visible to other threads. The source map is only used to describe the
+  // code to external profilers.
+  void* PlaceGuestCode(
+      uint32_t guest_address, void* machine_code, size_t code_size,
+      size_t stack_size, GuestFunction* function_info,
+      const std::vector<ChainedCallSite>* call_sites = nullptr,
+      const std::vector<SourceMapEntry>* source_map = nullptr);
   uint32_t PlaceData(const void* data, size_t length);
 
   GuestFunction* LookupFunction(uint64_t host_pc) override;
 
+  // True if placed guest code is being tracked for the persistent cache.
+  bool has_persistent_cache() const { return !persistent_cache_path_.empty(); }
+  // Sets a hash of everything outside of the guest code that generated code
+  // depends on (thunk addresses, emitter constants, host CPU features/etc).
+  // Caches written with a different hash are discarded on load.
+  void set_host_environment_hash(uint64_t value) {
+    host_environment_hash_ = value;
+  }
+  // Loads the persistent cache for the given module, if one exists and was
+  // generated for the same image and host environment. This also starts
+  // tracking newly placed functions in the module so they can be saved.
+  bool LoadPersistentCache(Module* module);
+  // Writes all tracked functions in the module to its persistent cache file.
+  bool SavePersistentCache(Module* module);
+  // Tracks a placed function so that it can be written to the cache.
+  // Relocations are relative to the code start.
+  void AddPersistentFunction(GuestFunction* function, size_t stack_size,
+                             const std::vector<CodeRelocation>& relocations);
+  // Places the cached machine code for the function, if the cache has code
+  // for it and the guest code it was generated from has not changed.
+  // Returns false if the function must be translated instead.
+  bool PlaceCachedFunction(GuestFunction* function);
+
  protected:
   // All executable code falls within 0x80000000 to 0x9FFFFFFF, so we can
   // only map enough for lookups within that range.
@@ -67,10 +185,8 @@ class X64CodeCache : public CodeCache {
   static const uint64_t kGeneratedCodeBase = 0xA0000000;
   static const uint64_t kGeneratedCodeSize = 0x0FFFFFFF;
 
-  // This is picked to be high enough to cover whatever we can reasonably
-  // expect. If we hit issues with this it probably means some corner case
-  // in analysis triggering.
-  static const size_t kMaximumFunctionCount = 50000;
+  // Functions the code map has room for before it first has to grow.
+  static const size_t kInitialFunctionMapCapacity = 4096;
 
   struct UnwindReservation {
     size_t data_size = 0;
@@ -87,10 +203,34 @@ class X64CodeCache : public CodeCache {
                          size_t code_size, size_t stack_size,
                          void* code_address,
                          UnwindReservation unwind_reservation) {}
+  // Whether the space of released code can be used for new code. Platforms
+  // that need unwind entries sorted in placement order can't.
+  virtual bool can_reuse_code_space() const { return true; }
+
+  // Takes space for new code from the ranges freed by released code.
+  // Must be called with the global critical region held.
+  uint8_t* AllocateFreeRange(size_t length);
+  void FreeRange(size_t offset, size_t length);
+  // Reuses the space of retired code that no thread can still be running.
+  // Must be called with the global critical region held.
+  void ReclaimRetiredCode();
+  // Unlinks and retires the code of all placed functions matching the
+  // predicate. Returns the number of functions retired.
+  size_t RetireCode(std::function<bool(GuestFunction*)> predicate);
+  // Makes room for one more generated_code_map_ entry, so that it can be
+  // added without reallocating under concurrent lookups.
+  // Must be called with the global critical region held.
+  void ReserveCodeMapEntry();
+  // Erases the generated_code_map_ entry for the code starting at the offset.
+  // Must be called with the global critical region held.
+  void EraseCodeMapEntry(size_t offset);
 
   std::wstring file_name_;
   xe::memory::FileMappingHandle mapping_ = nullptr;
 
+  // Only with --perf_map or --perf_jitdump.
+  std::unique_ptr<X64PerfJitWriter> perf_jit_writer_;
+
   // NOTE: the global critical region must be held when manipulating the offsets
   // or counts of anything, to keep the tables consistent and ordered.
   xe::global_critical_region global_critical_region_;
@@ -112,7 +252,95 @@ class X64CodeCache : public CodeCache {
   // Sorted map by host PC base offsets to source function info.
   // This can be used to bsearch on host PC to find the guest function.
   // The key is [start address | end address].
-  std::vector<std::pair<uint64_t, GuestFunction*>> generated_code_map_;
+  // Lookups don't take the global lock, so the storage is never reallocated
+  // in place. Growing it publishes a larger copy instead, and the old one
+  // stays alive until the last lookup using it is done.
+  typedef std::vector<std::pair<uint64_t, GuestFunction*>> CodeMap;
+  std::shared_ptr<CodeMap> generated_code_map_ = std::make_shared<CodeMap>();
+  // Incremented before and after generated_code_map_ is modified or replaced,
+  // so that lookups from other threads can detect when they raced with it.
+  std::atomic<uint32_t> generated_code_map_sequence_ = {0};
+
+  // Space below generated_code_offset_ freed by reclaimed code, as offset to
+  // length. Adjacent ranges are merged.
+  std::map<size_t, size_t> free_ranges_;
+  // Code that has been unlinked but may still be running on some thread.
+  struct RetiredCode {
+    size_t offset;
+    size_t length;
+    // Epoch the code was retired in. Threads that entered generated code in a
+    // later epoch can't reach it.
+    uint64_t epoch;
+  };
+  std::vector<RetiredCode> retired_code_;
+  // Highest epoch in retired_code_, or 0 if it's empty.
+  std::atomic<uint64_t> retired_code_epoch_ = {0};
+  // Modules whose code has been released. Code still being compiled for them
+  // is retired as soon as it is placed.
+  std::vector<Module*> released_modules_;
+
+  std::atomic<uint64_t> code_epoch_ = {1};
+  // Guards thread_epoch_slots_.
+  std::mutex thread_epochs_mutex_;
+  // Per-thread epoch slots, holding the code epoch each thread last entered
+  // generated code in, or kThreadOutsideCode.
+  std::vector<volatile uint64_t*> thread_epoch_slots_;
+
+  struct CallSite {
+    uint8_t* displacement;
+    CallSiteStats* stats;
+  };
+  struct CallTarget {
+    // Code of the target function, or 0 if it has none.
+    uint32_t host_address = 0;
+    std::vector<CallSite> sites;
+  };
+  // Must be called with call_sites_mutex_ held.
+  void LinkCallTarget(uint32_t guest_address, uint32_t host_address);
+  void PatchCallSite(const CallSite& site, uint32_t host_address);
+  void DumpCallSiteStats();
+
+  uint32_t indirect_call_thunk_ = 0;
+  // Guards call_targets_ and call_site_stats_.
+  std::mutex call_sites_mutex_;
+  // All chained call sites, keyed by the guest address they call.
+  std::unordered_map<uint32_t, CallTarget> call_targets_;
+  std::deque<CallSiteStats> call_site_stats_;
+
+  struct PersistentFunction {
+    uint32_t guest_end_address = 0;
+    uint64_t guest_hash = 0;
+    uint32_t stack_size = 0;
+    std::string name;
+    std::vector<CodeRelocation> relocations;
+    // Only set for functions loaded from disk and not yet placed. Relocations
+    // have already been rebased to the current process.
+    std::vector<uint8_t> machine_code;
+    std::vector<SourceMapEntry> source_map;
+    // Live function once placed in this session, either freshly generated or
+    // loaded from the cache.
+    GuestFunction* function = nullptr;
+  };
+  struct PersistentModule {
+    uint64_t image_hash = 0;
+    std::wstring path;
+    std::unordered_map<uint32_t, PersistentFunction> functions;
+  };
+
+  static uint64_t HashGuestCode(Module* module, uint32_t start_address,
+                                uint32_t end_address);
+  bool ReadPersistentCache(PersistentModule* persistent_module);
+  bool RebaseRelocations(uint8_t* machine_code, size_t code_size,
+                         const std::vector<CodeRelocation>& relocations,
+                         int64_t host_image_delta);
+
+  // Folder cache files are placed in. Empty if disabled.
+  std::wstring persistent_cache_path_;
+  uint64_t host_environment_hash_ = 0;
+  // Guards persistent_modules_ and all of the records within.
+  std::mutex persistent_mutex_;
+  std::unordered_map<Module*, std::unique_ptr<PersistentModule>>
+      persistent_modules_;
 };
 
 }  // namespace x64
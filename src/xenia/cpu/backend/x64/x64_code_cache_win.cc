@@ -115,6 +115,9 @@ class Win32X64CodeCache : public X64CodeCache {
   void PlaceCode(uint32_t guest_address, void* machine_code, size_t code_size,
                  size_t stack_size, void* code_address,
                  UnwindReservation unwind_reservation) override;
+  // Growable function tables must be sorted and can only be appended to, so
+  // unwind entries can't be placed in between existing ones.
+  bool can_reuse_code_space() const override { return false; }
 
   void InitializeUnwindEntry(uint8_t* unwind_entry_address,
                              size_t unwind_table_slot, void* code_address,
@@ -41,6 +41,9 @@ DEFINE_bool(ignore_undefined_externs, true,
             "Don't exit when an undefined extern is called.");
 DEFINE_bool(emit_source_annotations, false,
             "Add extra movs and nops to make disassembly easier to read.");
+DEFINE_bool(count_call_sites, false,
+            "Count calls made directly and through the indirection table at "
+            "each call site, logging the busiest on exit.");
 
 namespace xe {
 namespace cpu {
@@ -99,8 +102,20 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
   // Reset.
   debug_info_ = debug_info;
   debug_info_flags_ = debug_info_flags;
+  function_ = function;
   trace_data_ = &function->trace_data();
   source_map_arena_.Reset();
+  inlined_source_map_.clear();
+  inlined_ranges_.clear();
+  is_relocatable_ = true;
+  relocations_.clear();
+  call_sites_.clear();
+
+  // The persistent cache only checks that the function's own guest code is
+  // unchanged, which isn't enough once other functions are inlined into it.
+  if (builder->attributes() & hir::FUNCTION_ATTRIB_HAS_INLINED_CALLS) {
+    MarkNotRelocatable();
+  }
 
   // Fill the generator with code.
   size_t stack_size = 0;
@@ -108,17 +123,18 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
     return false;
   }
 
-  // Copy the final code to the cache and relocate it.
-  *out_code_size = getSize();
-  *out_code_address = Emplace(stack_size, function);
-
   // Stash source map.
   source_map_arena_.CloneContents(out_source_map);
 
+  // Copy the final code to the cache and relocate it.
+  *out_code_size = getSize();
+  *out_code_address = Emplace(stack_size, function, out_source_map);
+
   return true;
 }
 
-void* X64Emitter::Emplace(size_t stack_size, GuestFunction* function) {
+void* X64Emitter::Emplace(size_t stack_size, GuestFunction* function,
+                          const std::vector<SourceMapEntry>* source_map) {
   // To avoid changing xbyak, we do a switcharoo here.
   // top_ points to the Xbyak buffer, and since we are in AutoGrow mode
   // it has pending relocations. We copy the top_ to our buffer, swap the
@@ -126,8 +142,10 @@ void* X64Emitter::Emplace(size_t stack_size, GuestFunction* function) {
   uint8_t* old_address = top_;
   void* new_address;
   if (function) {
-    new_address = code_cache_->PlaceGuestCode(function->address(), top_, size_,
-                                              stack_size, function);
+    new_address =
+        code_cache_->PlaceGuestCode(function->address(), top_, size_,
+                                    stack_size, function, &call_sites_,
+                                    source_map);
   } else {
     new_address = code_cache_->PlaceHostCode(0, top_, size_, stack_size);
   }
@@ -138,6 +156,16 @@ void* X64Emitter::Emplace(size_t stack_size, GuestFunction* function) {
   return new_address;
 }
 
+// Called from baseline code when its entry count reaches the tier-up
+// threshold.
+extern "C" uint64_t RequestFunctionRecompile(void* raw_context,
+                                             uint64_t function_ptr) {
+  auto thread_state = *reinterpret_cast<ThreadState**>(raw_context);
+  thread_state->processor()->OnFunctionHot(
+      reinterpret_cast<GuestFunction*>(function_ptr));
+  return 0;
+}
+
 bool X64Emitter::Emit(HIRBuilder* builder, size_t* out_stack_size) {
   Xbyak::Label epilog_label;
   epilog_label_ = &epilog_label;
@@ -205,6 +233,26 @@ bool X64Emitter::Emit(HIRBuilder* builder, size_t* out_stack_size) {
     bts(qword[low_address(&trace_header->function_thread_use)], rax);
   }
 
+  // Baseline code counts its entries and asks to be recompiled once it gets
+  // hot. The count is per-process, so this can't be persisted. The increment
+  // is atomic so that exactly one entry, on whichever thread, sees the count
+  // cross the threshold. rcx has been saved above.
+  if (function_->tier() == GuestFunction::Tier::kBaseline) {
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+                  "Entry count must be a plain dword for lock xadd");
+    MarkNotRelocatable();
+    Xbyak::Label not_hot;
+    mov(rax, reinterpret_cast<uint64_t>(function_->entry_count_ptr()));
+    mov(ecx, 1);
+    lock();
+    xadd(dword[rax], ecx);
+    cmp(ecx, uint32_t(FLAGS_tier_up_threshold) - 1);
+    jne(not_hot);
+    CallNative(&RequestFunctionRecompile,
+               reinterpret_cast<uint64_t>(function_));
+    L(not_hot);
+  }
+
   // Load membase.
   mov(GetMembaseReg(),
       qword[GetContextReg() + offsetof(ppc::PPCContext, virtual_membase)]);
@@ -236,6 +284,7 @@ bool X64Emitter::Emit(HIRBuilder* builder, size_t* out_stack_size) {
 
     block = block->next;
   }
+  EndInlinedRange();
 
   // Function epilog.
   L(epilog_label);
@@ -257,7 +306,22 @@ bool X64Emitter::Emit(HIRBuilder* builder, size_t* out_stack_size) {
 }
 
 void X64Emitter::MarkSourceOffset(const Instr* i) {
-  auto entry = source_map_arena_.Alloc<SourceMapEntry>();
+  // An inlined copy runs until the next one starts or our own code resumes.
+  // The inlining pass appends copies after all of our blocks, so that's
+  // usually the end of the body.
+  SourceMapEntry* entry;
+  if (i->flags & hir::SOURCE_OFFSET_INLINED) {
+    if (i->flags & hir::SOURCE_OFFSET_INLINED_ENTRY) {
+      EndInlinedRange();
+      inlined_ranges_.push_back({static_cast<uint32_t>(i->src1.offset),
+                                 static_cast<uint32_t>(getSize()), 0});
+    }
+    inlined_source_map_.emplace_back();
+    entry = &inlined_source_map_.back();
+  } else {
+    EndInlinedRange();
+    entry = source_map_arena_.Alloc<SourceMapEntry>();
+  }
   entry->guest_address = static_cast<uint32_t>(i->src1.offset);
   entry->hir_offset = uint32_t(i->block->ordinal << 16) | i->ordinal;
   entry->code_offset = static_cast<uint32_t>(getSize());
@@ -270,7 +334,9 @@ void X64Emitter::MarkSourceOffset(const Instr* i) {
     nop();
   }
 
-  if (debug_info_flags_ & DebugInfoFlags::kDebugInfoTraceFunctionCoverage) {
+  // Tracing disables inlining, but the counts only cover our own code anyway.
+  if ((debug_info_flags_ & DebugInfoFlags::kDebugInfoTraceFunctionCoverage) &&
+      !(i->flags & hir::SOURCE_OFFSET_INLINED)) {
     uint32_t instruction_index =
         (entry->guest_address - trace_data_->start_address()) / 4;
     lock();
@@ -279,6 +345,12 @@ void X64Emitter::MarkSourceOffset(const Instr* i) {
   }
 }
 
+void X64Emitter::EndInlinedRange() {
+  if (!inlined_ranges_.empty() && !inlined_ranges_.back().code_end_offset) {
+    inlined_ranges_.back().code_end_offset = static_cast<uint32_t>(getSize());
+  }
+}
+
 void X64Emitter::EmitGetCurrentThreadId() {
   // rsi must point to context. We could fetch from the stack if needed.
   mov(ax, word[GetContextReg() + offsetof(ppc::PPCContext, thread_id)]);
@@ -352,9 +424,12 @@ extern "C" uint64_t ResolveFunction(void* raw_context,
   // TODO(benvanik): required?
   assert_not_zero(target_address);
 
-  auto fn =
-      thread_state->processor()->ResolveFunction((uint32_t)target_address);
+  auto fn = static_cast<GuestFunction*>(
+      thread_state->processor()->ResolveFunction((uint32_t)target_address));
   assert_not_null(fn);
+  if (fn->optimized_function()) {
+    fn = fn->optimized_function();
+  }
   auto x64_fn = static_cast<X64Function*>(fn);
   uint64_t addr = reinterpret_cast<uint64_t>(x64_fn->machine_code());
 
@@ -363,28 +438,54 @@ extern "C" uint64_t ResolveFunction(void* raw_context,
 
 void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
   assert_not_null(function);
-  auto fn = static_cast<X64Function*>(function);
-  // Resolve address to the function to call and store in rax.
-  if (fn->machine_code()) {
-    // TODO(benvanik): is it worth it to do this? It removes the need for
-    // a ResolveFunction call, but makes the table less useful.
-    assert_zero(uint64_t(fn->machine_code()) & 0xFFFFFFFF00000000);
-    mov(eax, uint32_t(uint64_t(fn->machine_code())));
-  } else if (code_cache_->has_indirection_table()) {
-    // Load the pointer to the indirection table maintained in X64CodeCache.
-    // The target dword will either contain the address of the generated code
-    // or a thunk to ResolveAddress.
-    mov(ebx, function->address());
-    mov(eax, dword[ebx]);
-  } else {
+  if (!code_cache_->has_indirection_table()) {
     // Old-style resolve.
     // Not too important because indirection table is almost always available.
-    // TODO: Overwrite the call-site with a straight call.
     CallNative(&ResolveFunction, function->address());
+
+    // Actually jump/call to rax.
+    if (instr->flags & hir::CALL_TAIL) {
+      // Since we skip the prolog we need to mark the return here.
+      EmitTraceUserCallReturn();
+
+      // Pass the callers return address over.
+      mov(rcx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
+
+      add(rsp, static_cast<uint32_t>(stack_size()));
+      jmp(rax);
+    } else {
+      // Return address is from the previous SET_RETURN_ADDRESS.
+      mov(rcx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
+
+      call(rax);
+    }
+    return;
   }
 
-  // Actually jump/call to rax.
-  if (instr->flags & hir::CALL_TAIL) {
+  // Chained call: the code cache points the call straight at the target's
+  // code once it has some (and again whenever it changes, such as when
+  // recompiled), and at a thunk dispatching through the indirection table
+  // otherwise. See ChainedCallSite.
+  ChainedCallSite call_site = {0};
+  call_site.target_address = function->address();
+  if (FLAGS_count_call_sites) {
+    MarkNotRelocatable();
+    call_site.stats = code_cache_->AllocateCallSiteStats(
+        function_->address(), function->address());
+    Xbyak::Label table_call;
+    Xbyak::Label counted;
+    mov(rax, reinterpret_cast<uint64_t>(call_site.stats));
+    cmp(dword[rax + offsetof(CallSiteStats, linked)], 0);
+    je(table_call);
+    add(qword[rax + offsetof(CallSiteStats, direct_calls)], 1);
+    jmp(counted);
+    L(table_call);
+    add(qword[rax + offsetof(CallSiteStats, table_calls)], 1);
+    L(counted);
+  }
+
+  bool is_tail = (instr->flags & hir::CALL_TAIL) != 0;
+  if (is_tail) {
     // Since we skip the prolog we need to mark the return here.
     EmitTraceUserCallReturn();
 
@@ -392,13 +493,27 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
     mov(rcx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
 
     add(rsp, static_cast<uint32_t>(stack_size()));
-    jmp(rax);
   } else {
     // Return address is from the previous SET_RETURN_ADDRESS.
     mov(rcx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
+  }
 
-    call(rax);
+  // mov ebx, imm32 (5b) + call/jmp opcode (1b), then the displacement, which
+  // must be 4b aligned. Code is always placed 16b aligned.
+  while ((getSize() + 6) & 3) {
+    nop();
   }
+  mov(ebx, function->address());
+  db(is_tail ? 0xE9 : 0xE8);
+  call_site.code_offset = static_cast<uint32_t>(getSize());
+  dd(0);
+  call_sites_.push_back(call_site);
+
+  CodeRelocation relocation;
+  relocation.type = CodeRelocation::Type::kCallSite;
+  relocation.code_offset = call_site.code_offset;
+  relocation.size = 4;
+  relocations_.push_back(relocation);
 }
 
 void X64Emitter::CallIndirect(const hir::Instr* instr,
@@ -421,7 +536,7 @@ void X64Emitter::CallIndirect(const hir::Instr* instr,
     // Old-style resolve.
     // Not too important because indirection table is almost always available.
     mov(edx, reg.cvt32());
-    mov(rax, reinterpret_cast<uint64_t>(ResolveFunction));
+    MovHostImageAddress(rax, reinterpret_cast<void*>(ResolveFunction));
     mov(rcx, GetContextReg());
     call(rax);
   }
@@ -467,9 +582,12 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
       // r9  = arg2
       auto thunk = backend()->guest_to_host_thunk();
       mov(rax, reinterpret_cast<uint64_t>(thunk));
-      mov(rcx, reinterpret_cast<uint64_t>(builtin_function->handler()));
+      MovHostImageAddress(
+          rcx, reinterpret_cast<void*>(builtin_function->handler()));
       mov(rdx, reinterpret_cast<uint64_t>(builtin_function->arg0()));
       mov(r8, reinterpret_cast<uint64_t>(builtin_function->arg1()));
+      // Builtin args are usually heap objects.
+      MarkNotRelocatable();
       call(rax);
       // rax = host return
     }
@@ -483,7 +601,8 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
       // r9  = arg2
       auto thunk = backend()->guest_to_host_thunk();
       mov(rax, reinterpret_cast<uint64_t>(thunk));
-      mov(rcx, reinterpret_cast<uint64_t>(extern_function->extern_handler()));
+      MovHostImageAddress(
+          rcx, reinterpret_cast<void*>(extern_function->extern_handler()));
       mov(rdx,
           qword[GetContextReg() + offsetof(ppc::PPCContext, kernel_state)]);
       call(rax);
@@ -491,6 +610,7 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
     }
   }
   if (undefined) {
+    MarkNotRelocatable();
     CallNative(UndefinedCallExtern, reinterpret_cast<uint64_t>(function));
   }
 }
@@ -518,11 +638,23 @@ void X64Emitter::CallNativeSafe(void* fn) {
   // r9  = arg2
   auto thunk = backend()->guest_to_host_thunk();
   mov(rax, reinterpret_cast<uint64_t>(thunk));
-  mov(rcx, reinterpret_cast<uint64_t>(fn));
+  MovHostImageAddress(rcx, fn);
   call(rax);
   // rax = host return
 }
 
+void X64Emitter::MovHostImageAddress(const Xbyak::Reg64& dest,
+                                     const void* address) {
+  uint64_t value = reinterpret_cast<uint64_t>(address);
+  mov(dest, value);
+  // xbyak picks the shortest encoding; the immediate is always last.
+  CodeRelocation relocation;
+  relocation.type = CodeRelocation::Type::kHostImage;
+  relocation.size = value <= 0xFFFFFFFFull ? 4 : 8;
+  relocation.code_offset = uint32_t(getSize() - relocation.size);
+  relocations_.push_back(relocation);
+}
+
 void X64Emitter::SetReturnAddress(uint64_t value) {
   mov(rax, value);
   mov(qword[rsp + StackLayout::GUEST_CALL_RET_ADDR], rax);
@@ -731,7 +863,8 @@ uintptr_t X64Emitter::PlaceConstData() {
 }
 
 void X64Emitter::FreeConstData(uintptr_t data) {
-  memory::DeallocFixed(reinterpret_cast<void*>(data), 0,
+  memory::DeallocFixed(reinterpret_cast<void*>(data),
+                       xe::round_up(kConstDataSize, memory::page_size()),
                        memory::DeallocationType::kRelease);
 }
 
@@ -13,6 +13,7 @@
 #include <vector>
 
 #include "xenia/base/arena.h"
+#include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/function_trace_data.h"
 #include "xenia/cpu/hir/hir_builder.h"
@@ -37,7 +38,6 @@ namespace backend {
 namespace x64 {
 
 class X64Backend;
-class X64CodeCache;
 
 enum RegisterFlags {
   REG_DEST = (1 << 0),
@@ -187,6 +187,18 @@ class X64Emitter : public Xbyak::CodeGenerator {
   void CallNativeSafe(void* fn);
   void SetReturnAddress(uint64_t value);
 
+  // Moves the address of something within the host executable image (a
+  // function or static table) into the register, recording a relocation so
+  // the code can be persisted and reloaded by another process.
+  void MovHostImageAddress(const Xbyak::Reg64& dest, const void* address);
+  // Marks the function being emitted as referencing process-specific data
+  // (heap pointers/etc) and thus unsuitable for the persistent cache.
+  void MarkNotRelocatable() { is_relocatable_ = false; }
+  bool is_relocatable() const { return is_relocatable_; }
+  const std::vector<CodeRelocation>& relocations() const {
+    return relocations_;
+  }
+
   Xbyak::Reg64 GetNativeParam(uint32_t param);
 
   Xbyak::Reg64 GetContextReg();
@@ -208,6 +220,7 @@ class X64Emitter : public Xbyak::CodeGenerator {
   void LoadConstantXmm(Xbyak::Xmm dest, const vec128_t& v);
   Xbyak::Address StashXmm(int index, const Xbyak::Xmm& r);
 
+  uint32_t feature_flags() const { return feature_flags_; }
   bool IsFeatureEnabled(uint32_t feature_flag) const {
     return (feature_flags_ & feature_flag) != 0;
   }
@@ -216,9 +229,20 @@ class X64Emitter : public Xbyak::CodeGenerator {
 
   size_t stack_size() const { return stack_size_; }
 
+  // Code inlined from other functions by the last Emit, kept out of the
+  // function's own source map.
+  const std::vector<InlinedFunctionRange>& inlined_ranges() const {
+    return inlined_ranges_;
+  }
+  const std::vector<SourceMapEntry>& inlined_source_map() const {
+    return inlined_source_map_;
+  }
+
  protected:
-  void* Emplace(size_t stack_size, GuestFunction* function = nullptr);
+  void* Emplace(size_t stack_size, GuestFunction* function = nullptr,
+                const std::vector<SourceMapEntry>* source_map = nullptr);
   bool Emit(hir::HIRBuilder* builder, size_t* out_stack_size);
+  void EndInlinedRange();
   void EmitGetCurrentThreadId();
   void EmitTraceUserCallReturn();
 
@@ -234,13 +258,20 @@ class X64Emitter : public Xbyak::CodeGenerator {
 
   hir::Instr* current_instr_ = nullptr;
 
+  GuestFunction* function_ = nullptr;
   FunctionDebugInfo* debug_info_ = nullptr;
   uint32_t debug_info_flags_ = 0;
   FunctionTraceData* trace_data_ = nullptr;
   Arena source_map_arena_;
+  std::vector<SourceMapEntry> inlined_source_map_;
+  std::vector<InlinedFunctionRange> inlined_ranges_;
 
   size_t stack_size_ = 0;
 
+  bool is_relocatable_ = true;
+  std::vector<CodeRelocation> relocations_;
+  std::vector<ChainedCallSite> call_sites_;
+
   static const uint32_t gpr_reg_map_[GPR_COUNT];
   static const uint32_t xmm_reg_map_[XMM_COUNT];
 };
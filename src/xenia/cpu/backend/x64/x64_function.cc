@@ -10,6 +10,7 @@
 #include "xenia/cpu/backend/x64/x64_function.h"
 
 #include "xenia/cpu/backend/x64/x64_backend.h"
+#include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/cpu/thread_state.h"
 
@@ -34,8 +35,18 @@ bool X64Function::CallImpl(ThreadState* thread_state, uint32_t return_address) {
   auto backend =
       reinterpret_cast<X64Backend*>(thread_state->processor()->backend());
   auto thunk = backend->host_to_guest_thunk();
-  thunk(machine_code_, thread_state->context(),
+  auto context = thread_state->context();
+  // This may be a callback from host code called by generated code, in which
+  // case the thread keeps the epoch of the guest frames below it. Otherwise
+  // this is the outermost entry, and the guest frames are all below here.
+  uint64_t previous_epoch =
+      backend->code_cache()->EnterCode(&context->code_epoch);
+  if (previous_epoch == X64CodeCache::kThreadOutsideCode) {
+    context->code_stack_top = reinterpret_cast<uint64_t>(&previous_epoch);
+  }
+  thunk(machine_code_, context,
         reinterpret_cast<void*>(uintptr_t(return_address)));
+  context->code_epoch = previous_epoch;
   return true;
 }
 
@@ -0,0 +1,69 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_BACKEND_X64_X64_PERF_JIT_WRITER_H_
+#define XENIA_CPU_BACKEND_X64_X64_PERF_JIT_WRITER_H_
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "xenia/cpu/source_map.h"
+
+namespace xe {
+namespace cpu {
+namespace backend {
+namespace x64 {
+
+// Describes generated code to Linux perf, which otherwise only sees anonymous
+// executable memory:
+//  - /tmp/perf-<pid>.map names each function for `perf report`.
+//  - /tmp/jit-<pid>.dump has the code bytes and guest addresses of each
+//    function for `perf inject --jit`, after which `perf annotate` works on
+//    guest functions. Line numbers are guest addresses, in decimal. Record
+//    with `perf record -k mono` so that timestamps match.
+class X64PerfJitWriter {
+ public:
+  // Returns nullptr if neither file could be opened.
+  static std::unique_ptr<X64PerfJitWriter> Create(bool write_map,
+                                                  bool write_jitdump);
+  ~X64PerfJitWriter();
+
+  // Records code placed at code_address. The source map is optional and
+  // relative to code_address; source_name is reported as its file name.
+  void WriteCode(const std::string& name, const void* code_address,
+                 size_t code_size, const std::string& source_name,
+                 const std::vector<SourceMapEntry>* source_map);
+
+ private:
+  X64PerfJitWriter();
+
+  bool OpenMap();
+  bool OpenJitDump();
+  void WriteJitDumpCode(const std::string& name, const void* code_address,
+                        size_t code_size, const std::string& source_name,
+                        const std::vector<SourceMapEntry>* source_map);
+
+  std::mutex mutex_;
+  FILE* map_file_ = nullptr;
+  FILE* jitdump_file_ = nullptr;
+  // perf finds the jitdump by looking for an executable mapping of it.
+  void* jitdump_marker_ = nullptr;
+  size_t jitdump_marker_size_ = 0;
+  uint64_t code_index_ = 0;
+};
+
+}  // namespace x64
+}  // namespace backend
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_BACKEND_X64_X64_PERF_JIT_WRITER_H_
@@ -0,0 +1,248 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/backend/x64/x64_perf_jit_writer.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cinttypes>
+
+#include "xenia/base/logging.h"
+
+namespace xe {
+namespace cpu {
+namespace backend {
+namespace x64 {
+
+namespace {
+
+// See tools/perf/Documentation/jitdump-specification.txt in the kernel tree.
+const uint32_t kJitDumpMagic = 0x4A695444;
+const uint32_t kJitDumpVersion = 1;
+
+enum JitDumpRecordType : uint32_t {
+  kJitCodeLoad = 0,
+  kJitCodeDebugInfo = 2,
+  kJitCodeClose = 3,
+};
+
+struct JitDumpHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t total_size;
+  uint32_t elf_mach;
+  uint32_t pad1;
+  uint32_t pid;
+  uint64_t timestamp;
+  uint64_t flags;
+};
+
+struct JitDumpRecordHeader {
+  uint32_t id;
+  uint32_t total_size;
+  uint64_t timestamp;
+};
+
+// Followed by the name and the code bytes.
+struct JitDumpCodeLoad {
+  JitDumpRecordHeader header;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t vma;
+  uint64_t code_address;
+  uint64_t code_size;
+  uint64_t code_index;
+};
+
+// Followed by entry_count entries.
+struct JitDumpDebugInfo {
+  JitDumpRecordHeader header;
+  uint64_t code_address;
+  uint64_t entry_count;
+};
+
+// Followed by the file name.
+struct JitDumpDebugEntry {
+  uint64_t code_address;
+  uint32_t line;
+  uint32_t discriminator;
+};
+
+uint64_t GetTimestamp() {
+  // perf record -k mono.
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+}
+
+}  // namespace
+
+std::unique_ptr<X64PerfJitWriter> X64PerfJitWriter::Create(bool write_map,
+                                                           bool write_jitdump) {
+  std::unique_ptr<X64PerfJitWriter> writer(new X64PerfJitWriter());
+  bool opened = false;
+  if (write_map) {
+    opened |= writer->OpenMap();
+  }
+  if (write_jitdump) {
+    opened |= writer->OpenJitDump();
+  }
+  if (!opened) {
+    return nullptr;
+  }
+  return writer;
+}
+
+X64PerfJitWriter::X64PerfJitWriter() = default;
+
+X64PerfJitWriter::~X64PerfJitWriter() {
+  if (map_file_) {
+    fclose(map_file_);
+  }
+  if (jitdump_file_) {
+    JitDumpRecordHeader close_record;
+    close_record.id = kJitCodeClose;
+    close_record.total_size = sizeof(close_record);
+    close_record.timestamp = GetTimestamp();
+    fwrite(&close_record, sizeof(close_record), 1, jitdump_file_);
+    fclose(jitdump_file_);
+  }
+  if (jitdump_marker_) {
+    munmap(jitdump_marker_, jitdump_marker_size_);
+  }
+}
+
+bool X64PerfJitWriter::OpenMap() {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/perf-%d.map", int(getpid()));
+  map_file_ = fopen(path, "w");
+  if (!map_file_) {
+    XELOGE("Unable to open perf map %s", path);
+    return false;
+  }
+  XELOGI("Writing perf map to %s", path);
+  return true;
+}
+
+bool X64PerfJitWriter::OpenJitDump() {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/jit-%d.dump", int(getpid()));
+  int fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+  if (fd == -1) {
+    XELOGE("Unable to open jitdump %s", path);
+    return false;
+  }
+  jitdump_marker_size_ = size_t(sysconf(_SC_PAGESIZE));
+  jitdump_marker_ = mmap(nullptr, jitdump_marker_size_, PROT_READ | PROT_EXEC,
+                         MAP_PRIVATE, fd, 0);
+  if (jitdump_marker_ == MAP_FAILED) {
+    XELOGE("Unable to map jitdump %s", path);
+    jitdump_marker_ = nullptr;
+    close(fd);
+    return false;
+  }
+  jitdump_file_ = fdopen(fd, "wb");
+  if (!jitdump_file_) {
+    close(fd);
+    return false;
+  }
+
+  JitDumpHeader header = {0};
+  header.magic = kJitDumpMagic;
+  header.version = kJitDumpVersion;
+  header.total_size = sizeof(header);
+  header.elf_mach = EM_X86_64;
+  header.pid = uint32_t(getpid());
+  header.timestamp = GetTimestamp();
+  fwrite(&header, sizeof(header), 1, jitdump_file_);
+  fflush(jitdump_file_);
+  XELOGI("Writing jitdump to %s", path);
+  return true;
+}
+
+void X64PerfJitWriter::WriteCode(
+    const std::string& name, const void* code_address, size_t code_size,
+    const std::string& source_name,
+    const std::vector<SourceMapEntry>* source_map) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (map_file_) {
+    fprintf(map_file_, "%" PRIx64 " %zx %s\n",
+            uint64_t(reinterpret_cast<uintptr_t>(code_address)), code_size,
+            name.c_str());
+    // perf may read it while we are still running.
+    fflush(map_file_);
+  }
+  if (jitdump_file_) {
+    WriteJitDumpCode(name, code_address, code_size, source_name, source_map);
+  }
+}
+
+void X64PerfJitWriter::WriteJitDumpCode(
+    const std::string& name, const void* code_address, size_t code_size,
+    const std::string& source_name,
+    const std::vector<SourceMapEntry>* source_map) {
+  uint64_t code_base = uint64_t(reinterpret_cast<uintptr_t>(code_address));
+  uint64_t timestamp = GetTimestamp();
+
+  // Line info must come before the code it describes. Consecutive entries
+  // for the same guest instruction are merged.
+  if (source_map && !source_map->empty()) {
+    std::vector<JitDumpDebugEntry> entries;
+    for (auto& source_entry : *source_map) {
+      if (!entries.empty() &&
+          entries.back().line == source_entry.guest_address) {
+        continue;
+      }
+      JitDumpDebugEntry entry;
+      entry.code_address = code_base + source_entry.code_offset;
+      entry.line = source_entry.guest_address;
+      entry.discriminator = 0;
+      entries.push_back(entry);
+    }
+    size_t entry_size = sizeof(JitDumpDebugEntry) + source_name.size() + 1;
+    JitDumpDebugInfo debug_info;
+    debug_info.header.id = kJitCodeDebugInfo;
+    debug_info.header.total_size =
+        uint32_t(sizeof(debug_info) + entries.size() * entry_size);
+    debug_info.header.timestamp = timestamp;
+    debug_info.code_address = code_base;
+    debug_info.entry_count = entries.size();
+    fwrite(&debug_info, sizeof(debug_info), 1, jitdump_file_);
+    for (auto& entry : entries) {
+      fwrite(&entry, sizeof(entry), 1, jitdump_file_);
+      fwrite(source_name.c_str(), source_name.size() + 1, 1, jitdump_file_);
+    }
+  }
+
+  JitDumpCodeLoad code_load;
+  code_load.header.id = kJitCodeLoad;
+  code_load.header.total_size =
+      uint32_t(sizeof(code_load) + name.size() + 1 + code_size);
+  code_load.header.timestamp = timestamp;
+  code_load.pid = uint32_t(getpid());
+  code_load.tid = uint32_t(syscall(SYS_gettid));
+  code_load.vma = code_base;
+  code_load.code_address = code_base;
+  code_load.code_size = code_size;
+  code_load.code_index = code_index_++;
+  fwrite(&code_load, sizeof(code_load), 1, jitdump_file_);
+  fwrite(name.c_str(), name.size() + 1, 1, jitdump_file_);
+  fwrite(code_address, code_size, 1, jitdump_file_);
+  fflush(jitdump_file_);
+}
+
+}  // namespace x64
+}  // namespace backend
+}  // namespace cpu
+}  // namespace xe
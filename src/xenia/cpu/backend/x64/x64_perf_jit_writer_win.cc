@@ -0,0 +1,38 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/backend/x64/x64_perf_jit_writer.h"
+
+#include "xenia/base/logging.h"
+
+namespace xe {
+namespace cpu {
+namespace backend {
+namespace x64 {
+
+// perf is Linux only; VTune (ENABLE_VTUNE) covers Windows.
+std::unique_ptr<X64PerfJitWriter> X64PerfJitWriter::Create(bool write_map,
+                                                           bool write_jitdump) {
+  XELOGW("perf map/jitdump output is only supported on Linux");
+  return nullptr;
+}
+
+X64PerfJitWriter::X64PerfJitWriter() = default;
+
+X64PerfJitWriter::~X64PerfJitWriter() = default;
+
+void X64PerfJitWriter::WriteCode(
+    const std::string& name, const void* code_address, size_t code_size,
+    const std::string& source_name,
+    const std::vector<SourceMapEntry>* source_map) {}
+
+}  // namespace x64
+}  // namespace backend
+}  // namespace cpu
+}  // namespace xe
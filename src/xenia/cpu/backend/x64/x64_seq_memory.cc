@@ -14,6 +14,8 @@
 
 #include "xenia/cpu/backend/x64/x64_op.h"
 #include "xenia/cpu/backend/x64/x64_tracers.h"
+#include "xenia/cpu/mmio_handler.h"
+#include "xenia/cpu/ppc/ppc_context.h"
 
 namespace xe {
 namespace cpu {
@@ -90,6 +92,57 @@ RegExp ComputeMemoryAddress(X64Emitter& e, const T& guest) {
   }
 }
 
+// Loads and stores flagged LOAD_STORE_MMIO were seen faulting on an MMIO
+// range. They call these, which go to the MMIO handler for MMIO addresses and
+// to memory otherwise. Values are in guest byte order, as with a plain mov.
+uint64_t LoadMaybeMMIOI32(void* raw_context, uint64_t host_address) {
+  auto context = reinterpret_cast<ppc::PPCContext*>(raw_context);
+  auto address = reinterpret_cast<uint8_t*>(host_address);
+  uint32_t value;
+  if (MMIOHandler::global_handler()->CheckLoad(
+          uint32_t(address - context->virtual_membase), &value)) {
+    return xe::byte_swap(value);
+  }
+  return *reinterpret_cast<uint32_t*>(address);
+}
+
+void StoreMaybeMMIOI32(void* raw_context, uint64_t host_address,
+                       uint32_t value) {
+  auto context = reinterpret_cast<ppc::PPCContext*>(raw_context);
+  auto address = reinterpret_cast<uint8_t*>(host_address);
+  if (MMIOHandler::global_handler()->CheckStore(
+          uint32_t(address - context->virtual_membase),
+          xe::byte_swap(value))) {
+    return;
+  }
+  *reinterpret_cast<uint32_t*>(address) = value;
+}
+
+// Leaves the loaded value in eax.
+void EmitLoadMaybeMMIOI32(X64Emitter& e, const RegExp& addr, bool byte_swap) {
+  e.lea(e.GetNativeParam(0), e.ptr[addr]);
+  e.CallNativeSafe(reinterpret_cast<void*>(LoadMaybeMMIOI32));
+  if (byte_swap) {
+    e.bswap(e.eax);
+  }
+}
+
+void EmitStoreMaybeMMIOI32(X64Emitter& e, const RegExp& addr,
+                           const I32Op& value, bool byte_swap) {
+  e.lea(e.GetNativeParam(0), e.ptr[addr]);
+  if (value.is_constant) {
+    uint32_t constant = uint32_t(value.constant());
+    e.mov(e.GetNativeParam(1).cvt32(),
+          byte_swap ? xe::byte_swap(constant) : constant);
+  } else {
+    e.mov(e.GetNativeParam(1).cvt32(), value);
+    if (byte_swap) {
+      e.bswap(e.GetNativeParam(1).cvt32());
+    }
+  }
+  e.CallNativeSafe(reinterpret_cast<void*>(StoreMaybeMMIOI32));
+}
+
 // ============================================================================
 // OPCODE_ATOMIC_EXCHANGE
 // ============================================================================
@@ -523,6 +576,8 @@ struct LOAD_MMIO_I32
     // uint64_t (context, addr)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto read_address = uint32_t(i.src2.value);
+    // The callback context is a heap object.
+    e.MarkNotRelocatable();
     e.mov(e.GetNativeParam(0), uint64_t(mmio_range->callback_context));
     e.mov(e.GetNativeParam(1).cvt32(), read_address);
     e.CallNativeSafe(reinterpret_cast<void*>(mmio_range->read));
@@ -548,6 +603,8 @@ struct STORE_MMIO_I32
     // void (context, addr, value)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto write_address = uint32_t(i.src2.value);
+    // The callback context is a heap object.
+    e.MarkNotRelocatable();
     e.mov(e.GetNativeParam(0), uint64_t(mmio_range->callback_context));
     e.mov(e.GetNativeParam(1).cvt32(), write_address);
     if (i.src3.is_constant) {
@@ -602,7 +659,12 @@ struct LOAD_OFFSET_I32
     : Sequence<LOAD_OFFSET_I32, I<OPCODE_LOAD_OFFSET, I32Op, I64Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     auto addr = ComputeMemoryAddressOffset(e, i.src1, i.src2);
-    if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
+    if (i.instr->flags & LoadStoreFlags::LOAD_STORE_MMIO) {
+      EmitLoadMaybeMMIOI32(
+          e, addr,
+          (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) != 0);
+      e.mov(i.dest, e.eax);
+    } else if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
       if (e.IsFeatureEnabled(kX64EmitMovbe)) {
         e.movbe(i.dest, e.dword[addr]);
       } else {
@@ -677,7 +739,11 @@ struct STORE_OFFSET_I32
                I<OPCODE_STORE_OFFSET, VoidOp, I64Op, I64Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     auto addr = ComputeMemoryAddressOffset(e, i.src1, i.src2);
-    if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
+    if (i.instr->flags & LoadStoreFlags::LOAD_STORE_MMIO) {
+      EmitStoreMaybeMMIOI32(
+          e, addr, i.src3,
+          (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) != 0);
+    } else if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
       assert_false(i.src3.is_constant);
       if (e.IsFeatureEnabled(kX64EmitMovbe)) {
         e.movbe(e.dword[addr], i.src3);
@@ -755,7 +821,15 @@ struct LOAD_I16 : Sequence<LOAD_I16, I<OPCODE_LOAD, I16Op, I64Op>> {
 struct LOAD_I32 : Sequence<LOAD_I32, I<OPCODE_LOAD, I32Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     auto addr = ComputeMemoryAddress(e, i.src1);
-    if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
+    if (i.instr->flags & LoadStoreFlags::LOAD_STORE_MMIO) {
+      EmitLoadMaybeMMIOI32(
+          e, addr,
+          (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) != 0);
+      e.mov(i.dest, e.eax);
+      if (IsTracingData()) {
+        addr = ComputeMemoryAddress(e, i.src1);
+      }
+    } else if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
       if (e.IsFeatureEnabled(kX64EmitMovbe)) {
         e.movbe(i.dest, e.dword[addr]);
       } else {
@@ -887,7 +961,11 @@ struct STORE_I16 : Sequence<STORE_I16, I<OPCODE_STORE, VoidOp, I64Op, I16Op>> {
 struct STORE_I32 : Sequence<STORE_I32, I<OPCODE_STORE, VoidOp, I64Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     auto addr = ComputeMemoryAddress(e, i.src1);
-    if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
+    if (i.instr->flags & LoadStoreFlags::LOAD_STORE_MMIO) {
+      EmitStoreMaybeMMIOI32(
+          e, addr, i.src2,
+          (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) != 0);
+    } else if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
       assert_false(i.src2.is_constant);
       if (e.IsFeatureEnabled(kX64EmitMovbe)) {
         e.movbe(e.dword[addr], i.src2);
@@ -64,6 +64,7 @@ struct COMMENT : Sequence<COMMENT, I<OPCODE_COMMENT, VoidOp, OffsetOp>> {
       // TODO(benvanik): pass through.
       // TODO(benvanik): don't just leak this memory.
       auto str_copy = strdup(str);
+      e.MarkNotRelocatable();
       e.mov(e.rdx, reinterpret_cast<uint64_t>(str_copy));
       e.CallNative(reinterpret_cast<void*>(TraceString));
     }
@@ -125,7 +126,12 @@ struct ASSIGN_F64 : Sequence<ASSIGN_F64, I<OPCODE_ASSIGN, F64Op, F64Op>> {
 };
 struct ASSIGN_V128 : Sequence<ASSIGN_V128, I<OPCODE_ASSIGN, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    e.vmovaps(i.dest, i.src1);
+    if (i.src1.is_constant) {
+      // Materialized constant (see HIRBuilder::AssignConstant).
+      e.LoadConstantXmm(i.dest, i.src1.constant());
+    } else {
+      e.vmovaps(i.dest, i.src1);
+    }
   }
 };
 EMITTER_OPCODE_TABLE(OPCODE_ASSIGN, ASSIGN_I8, ASSIGN_I16, ASSIGN_I32,
@@ -3051,7 +3057,7 @@ struct SET_ROUNDING_MODE_I32
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     e.mov(e.rcx, i.src1);
     e.and_(e.rcx, 0x7);
-    e.mov(e.rax, uintptr_t(mxcsr_table));
+    e.MovHostImageAddress(e.rax, mxcsr_table);
     e.vldmxcsr(e.ptr[e.rax + e.rcx * 4]);
   }
 };
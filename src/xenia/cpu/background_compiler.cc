@@ -0,0 +1,209 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/background_compiler.h"
+
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/profiling.h"
+#include "xenia/base/string.h"
+#include "xenia/cpu/processor.h"
+
+namespace xe {
+namespace cpu {
+
+BackgroundCompiler::BackgroundCompiler(Processor* processor)
+    : processor_(processor) {}
+
+BackgroundCompiler::~BackgroundCompiler() { Shutdown(); }
+
+bool BackgroundCompiler::Initialize(uint32_t worker_count) {
+  for (uint32_t i = 0; i < worker_count; ++i) {
+    xe::threading::Thread::CreationParameters params;
+    auto worker = xe::threading::Thread::Create(params, [this]() {
+      xe::Profiler::ThreadEnter("Background Compiler");
+      WorkerMain();
+      xe::Profiler::ThreadExit();
+    });
+    if (!worker) {
+      XELOGE("Unable to create background compiler thread");
+      return false;
+    }
+    worker->set_name(xe::format_string("Background Compiler %u", i));
+    // Guest threads should always win when they need the CPU.
+    worker->set_priority(xe::threading::ThreadPriority::kBelowNormal);
+    workers_.push_back(std::move(worker));
+  }
+  return true;
+}
+
+void BackgroundCompiler::Shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutting_down_ = true;
+    queue_.clear();
+    recompile_queue_.clear();
+  }
+  work_cv_.notify_all();
+  idle_cv_.notify_all();
+  for (auto& worker : workers_) {
+    xe::threading::Wait(worker.get(), false);
+  }
+  workers_.clear();
+}
+
+void BackgroundCompiler::Enqueue(uint32_t address) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (shutting_down_ || failed_addresses_.count(address) ||
+        !queued_addresses_.insert(address).second) {
+      return;
+    }
+    BeginBatch();
+    queue_.push_back(address);
+  }
+  work_cv_.notify_one();
+}
+
+void BackgroundCompiler::Enqueue(const std::vector<uint32_t>& addresses) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (shutting_down_) {
+      return;
+    }
+    for (uint32_t address : addresses) {
+      if (!failed_addresses_.count(address) &&
+          queued_addresses_.insert(address).second) {
+        BeginBatch();
+        queue_.push_back(address);
+      }
+    }
+  }
+  work_cv_.notify_all();
+}
+
+void BackgroundCompiler::EnqueueRecompile(GuestFunction* function) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (shutting_down_ || !queued_recompiles_.insert(function).second) {
+      return;
+    }
+    recompile_queue_.push_back(function);
+  }
+  work_cv_.notify_one();
+}
+
+void BackgroundCompiler::WaitForIdle() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_cv_.wait(lock, [this]() {
+    return shutting_down_ ||
+           (queue_.empty() && recompile_queue_.empty() && !busy_count_);
+  });
+}
+
+void BackgroundCompiler::ForgetRange(uint32_t low_address,
+                                     uint32_t high_address) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto it = failed_addresses_.begin(); it != failed_addresses_.end();) {
+    if (*it >= low_address && *it < high_address) {
+      it = failed_addresses_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void BackgroundCompiler::BeginBatch() {
+  if (in_batch_) {
+    return;
+  }
+  in_batch_ = true;
+  batch_start_ticks_ = Clock::QueryHostTickCount();
+  batch_compiled_count_ = 0;
+  batch_failed_count_ = 0;
+}
+
+void BackgroundCompiler::EndBatch() {
+  if (!in_batch_) {
+    return;
+  }
+  in_batch_ = false;
+  if (!batch_compiled_count_) {
+    return;
+  }
+  double elapsed_seconds =
+      double(Clock::QueryHostTickCount() - batch_start_ticks_) /
+      Clock::host_tick_frequency();
+  XELOGI(
+      "Background compiler: %u functions (%u failed) in %.3fs on %u workers "
+      "(%.1f functions/sec)",
+      batch_compiled_count_, batch_failed_count_, elapsed_seconds,
+      worker_count(), batch_compiled_count_ / elapsed_seconds);
+}
+
+void BackgroundCompiler::WorkerMain() {
+  while (true) {
+    uint32_t address = 0;
+    GuestFunction* recompile_function = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_cv_.wait(lock, [this]() {
+        return shutting_down_ || !queue_.empty() || !recompile_queue_.empty();
+      });
+      if (shutting_down_) {
+        return;
+      }
+      if (!recompile_queue_.empty()) {
+        recompile_function = recompile_queue_.front();
+        recompile_queue_.pop_front();
+      } else {
+        address = queue_.front();
+        queue_.pop_front();
+      }
+      ++busy_count_;
+    }
+
+    if (recompile_function) {
+      processor_->RecompileFunction(recompile_function);
+      std::lock_guard<std::mutex> lock(mutex_);
+      // May be queued again if it needs rebuilding for another reason.
+      queued_recompiles_.erase(recompile_function);
+      --busy_count_;
+      if (queue_.empty() && recompile_queue_.empty() && !busy_count_) {
+        EndBatch();
+        idle_cv_.notify_all();
+      }
+      continue;
+    }
+
+    // Guest threads may have gotten to it first.
+    bool already_compiled = processor_->QueryFunction(address) != nullptr;
+    bool succeeded =
+        already_compiled || processor_->ResolveFunction(address) != nullptr;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      --busy_count_;
+      queued_addresses_.erase(address);
+      if (!succeeded) {
+        failed_addresses_.insert(address);
+        ++batch_failed_count_;
+      } else if (!already_compiled) {
+        ++batch_compiled_count_;
+      }
+      if (queue_.empty() && recompile_queue_.empty() && !busy_count_) {
+        EndBatch();
+        idle_cv_.notify_all();
+      }
+    }
+  }
+}
+
+}  // namespace cpu
+}  // namespace xe
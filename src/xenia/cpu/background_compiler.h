@@ -0,0 +1,94 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_BACKGROUND_COMPILER_H_
+#define XENIA_CPU_BACKGROUND_COMPILER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace cpu {
+
+class GuestFunction;
+class Processor;
+
+// Compiles guest functions ahead of time on a pool of worker threads.
+// Functions are resolved through the processor exactly as if a guest thread
+// had called them, so a guest thread that needs a function currently being
+// compiled just waits on it in the entry table.
+// The same workers recompile hot baseline functions with full optimizations,
+// which takes priority over ahead-of-time work.
+class BackgroundCompiler {
+ public:
+  explicit BackgroundCompiler(Processor* processor);
+  ~BackgroundCompiler();
+
+  uint32_t worker_count() const { return uint32_t(workers_.size()); }
+
+  bool Initialize(uint32_t worker_count);
+  void Shutdown();
+
+  // Queues the given guest function start for compilation. Addresses that have
+  // already been queued are ignored.
+  void Enqueue(uint32_t address);
+  void Enqueue(const std::vector<uint32_t>& addresses);
+  // Queues a hot baseline function for recompilation. Functions that have
+  // already been queued are ignored.
+  void EnqueueRecompile(GuestFunction* function);
+
+  // Blocks until all queued functions have been compiled.
+  void WaitForIdle();
+
+  // Forgets the addresses in [low_address, high_address) that failed, such as
+  // when the module containing them is unloaded, so that code loaded there
+  // later is compiled.
+  void ForgetRange(uint32_t low_address, uint32_t high_address);
+
+ private:
+  void WorkerMain();
+  // Must be called with mutex_ held.
+  void BeginBatch();
+  void EndBatch();
+
+  Processor* processor_ = nullptr;
+  std::vector<std::unique_ptr<xe::threading::Thread>> workers_;
+
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable idle_cv_;
+  bool shutting_down_ = false;
+  std::deque<uint32_t> queue_;
+  // Queued or being compiled. Compiled functions are found in the entry table
+  // instead.
+  std::unordered_set<uint32_t> queued_addresses_;
+  // The entry table keeps failed entries, so these are never queued again.
+  std::unordered_set<uint32_t> failed_addresses_;
+  std::deque<GuestFunction*> recompile_queue_;
+  std::unordered_set<GuestFunction*> queued_recompiles_;
+  uint32_t busy_count_ = 0;
+
+  // Statistics for the current batch (from the queue becoming non-empty to it
+  // draining), reported when the batch completes.
+  bool in_batch_ = false;
+  uint64_t batch_start_ticks_ = 0;
+  uint32_t batch_compiled_count_ = 0;
+  uint32_t batch_failed_count_ = 0;
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_BACKGROUND_COMPILER_H_
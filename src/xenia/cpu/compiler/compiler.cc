@@ -9,8 +9,11 @@
 
 #include "xenia/cpu/compiler/compiler.h"
 
+#include <chrono>
+
 #include "xenia/base/profiling.h"
 #include "xenia/cpu/compiler/compiler_pass.h"
+#include "xenia/cpu/cpu_flags.h"
 
 namespace xe {
 namespace cpu {
@@ -30,12 +33,39 @@ void Compiler::Reset() {}
 bool Compiler::Compile(xe::cpu::hir::HIRBuilder* builder) {
   // TODO(benvanik): sophisticated stuff. Run passes in parallel, run until they
   //                 stop changing things, etc.
+  bool collect_stats = CompilerStats::is_enabled();
+  pass_samples_.clear();
+  HIRCounts counts;
+  if (collect_stats) {
+    counts = HIRCounts::Count(builder);
+  }
   for (size_t i = 0; i < passes_.size(); ++i) {
     auto& pass = passes_[i];
     scratch_arena_.Reset();
+    std::chrono::steady_clock::time_point start_time;
+    if (collect_stats) {
+      start_time = std::chrono::steady_clock::now();
+    }
     if (!pass->Run(builder)) {
       return false;
     }
+    // Nodes unlinked by the pass can no longer be referenced, so they can
+    // back the next pass's allocations.
+    if (FLAGS_recycle_hir_nodes) {
+      builder->arena()->ReclaimRetired();
+    }
+    if (collect_stats) {
+      PassSample sample;
+      sample.name = pass->name();
+      sample.duration_ns = uint64_t(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start_time)
+              .count());
+      sample.before = counts;
+      counts = HIRCounts::Count(builder);
+      sample.after = counts;
+      pass_samples_.push_back(sample);
+    }
   }
 
   return true;
@@ -14,6 +14,7 @@
 #include <vector>
 
 #include "xenia/base/arena.h"
+#include "xenia/cpu/compiler/compiler_stats.h"
 #include "xenia/cpu/hir/hir_builder.h"
 
 namespace xe {
@@ -42,11 +43,17 @@ class Compiler {
 
   bool Compile(hir::HIRBuilder* builder);
 
+  // Per-pass measurements of the last Compile, if CompilerStats are enabled.
+  const std::vector<PassSample>& pass_samples() const {
+    return pass_samples_;
+  }
+
  private:
   Processor* processor_;
   Arena scratch_arena_;
 
   std::vector<std::unique_ptr<CompilerPass>> passes_;
+  std::vector<PassSample> pass_samples_;
 };
 
 }  // namespace compiler
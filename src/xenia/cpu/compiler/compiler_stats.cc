@@ -0,0 +1,231 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/compiler_stats.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <map>
+#include <mutex>
+
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/cpu_flags.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+
+using namespace xe::cpu::hir;
+
+namespace {
+
+struct PassTotals {
+  std::string name;
+  uint64_t run_count = 0;
+  uint64_t total_ns = 0;
+  uint64_t max_ns = 0;
+  uint64_t blocks_before = 0;
+  uint64_t blocks_after = 0;
+  uint64_t instrs_before = 0;
+  uint64_t instrs_after = 0;
+  uint64_t values_before = 0;
+  uint64_t values_after = 0;
+};
+
+struct PipelineTotals {
+  uint64_t function_count = 0;
+  uint64_t total_ns = 0;
+  uint64_t code_size = 0;
+  // In pipeline order, as the same pass may run more than once.
+  std::vector<PassTotals> passes;
+};
+
+struct ModuleTotals {
+  PipelineTotals optimized;
+  PipelineTotals baseline;
+};
+
+std::mutex stats_mutex_;
+std::map<std::string, ModuleTotals> module_totals_;
+
+const char* PipelineName(const ModuleTotals& module,
+                         const PipelineTotals& pipeline) {
+  return &pipeline == &module.baseline ? "baseline" : "optimized";
+}
+
+void WriteJsonString(FILE* file, const std::string& value) {
+  fputc('"', file);
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      fputc('\\', file);
+      fputc(c, file);
+    } else if (uint8_t(c) < 0x20) {
+      fprintf(file, "\\u%04x", uint8_t(c));
+    } else {
+      fputc(c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+}  // namespace
+
+HIRCounts HIRCounts::Count(HIRBuilder* builder) {
+  HIRCounts counts;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    ++counts.block_count;
+    for (auto i = block->instr_head; i; i = i->next) {
+      ++counts.instr_count;
+      if (i->dest) {
+        ++counts.value_count;
+      }
+    }
+  }
+  return counts;
+}
+
+bool CompilerStats::is_enabled() {
+  return FLAGS_report_compiler_stats || !FLAGS_compiler_stats_path.empty();
+}
+
+void CompilerStats::RecordFunction(const std::string& module_name,
+                                   bool baseline,
+                                   const std::vector<PassSample>& samples,
+                                   size_t code_size) {
+  uint64_t total_ns = 0;
+  for (auto& sample : samples) {
+    total_ns += sample.duration_ns;
+  }
+  COUNT_profile_add("cpu/compiler/functions", 1);
+  COUNT_profile_add("cpu/compiler/pass_time_us", total_ns / 1000);
+  COUNT_profile_add("cpu/compiler/code_bytes", code_size);
+  if (!samples.empty()) {
+    COUNT_profile_add("cpu/compiler/hir_instrs_in",
+                      samples.front().before.instr_count);
+    COUNT_profile_add("cpu/compiler/hir_instrs_out",
+                      samples.back().after.instr_count);
+  }
+
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  auto& module = module_totals_[module_name];
+  auto& pipeline = baseline ? module.baseline : module.optimized;
+  ++pipeline.function_count;
+  pipeline.total_ns += total_ns;
+  pipeline.code_size += code_size;
+  if (pipeline.passes.size() < samples.size()) {
+    pipeline.passes.resize(samples.size());
+  }
+  for (size_t n = 0; n < samples.size(); ++n) {
+    auto& sample = samples[n];
+    auto& totals = pipeline.passes[n];
+    if (totals.name.empty()) {
+      totals.name = sample.name;
+    }
+    ++totals.run_count;
+    totals.total_ns += sample.duration_ns;
+    totals.max_ns = std::max(totals.max_ns, sample.duration_ns);
+    totals.blocks_before += sample.before.block_count;
+    totals.blocks_after += sample.after.block_count;
+    totals.instrs_before += sample.before.instr_count;
+    totals.instrs_after += sample.after.instr_count;
+    totals.values_before += sample.before.value_count;
+    totals.values_after += sample.after.value_count;
+  }
+}
+
+void CompilerStats::Dump() {
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  for (auto& it : module_totals_) {
+    for (auto pipeline : {&it.second.optimized, &it.second.baseline}) {
+      if (!pipeline->function_count) {
+        continue;
+      }
+      XELOGI("Compiler stats for %s (%s): %" PRIu64
+             " functions, %.2f ms in passes, %" PRIu64 " bytes of code",
+             it.first.c_str(), PipelineName(it.second, *pipeline),
+             pipeline->function_count, pipeline->total_ns / 1000000.0,
+             pipeline->code_size);
+      std::vector<const PassTotals*> passes;
+      for (auto& pass : pipeline->passes) {
+        passes.push_back(&pass);
+      }
+      std::stable_sort(passes.begin(), passes.end(),
+                       [](const PassTotals* a, const PassTotals* b) {
+                         return a->total_ns > b->total_ns;
+                       });
+      for (auto pass : passes) {
+        XELOGI("  %-28s %9.2f ms %5.1f%% (max %.2f ms) instrs %" PRIu64
+               " -> %" PRIu64 ", values %" PRIu64 " -> %" PRIu64
+               ", blocks %" PRIu64 " -> %" PRIu64,
+               pass->name.c_str(), pass->total_ns / 1000000.0,
+               pipeline->total_ns
+                   ? 100.0 * pass->total_ns / double(pipeline->total_ns)
+                   : 0.0,
+               pass->max_ns / 1000000.0, pass->instrs_before,
+               pass->instrs_after, pass->values_before, pass->values_after,
+               pass->blocks_before, pass->blocks_after);
+      }
+    }
+  }
+}
+
+bool CompilerStats::WriteJson(const std::wstring& path) {
+  auto file = xe::filesystem::OpenFile(path, "w");
+  if (!file) {
+    XELOGE("Unable to open %S for writing", path.c_str());
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  fprintf(file, "{\n  \"pipelines\": [");
+  bool first_pipeline = true;
+  for (auto& it : module_totals_) {
+    for (auto pipeline : {&it.second.optimized, &it.second.baseline}) {
+      if (!pipeline->function_count) {
+        continue;
+      }
+      fprintf(file, "%s\n    {\n      \"module\": ", first_pipeline ? "" : ",");
+      first_pipeline = false;
+      WriteJsonString(file, it.first);
+      fprintf(file,
+              ",\n      \"pipeline\": \"%s\",\n"
+              "      \"function_count\": %" PRIu64 ",\n"
+              "      \"total_ns\": %" PRIu64 ",\n"
+              "      \"code_size\": %" PRIu64 ",\n"
+              "      \"passes\": [",
+              PipelineName(it.second, *pipeline), pipeline->function_count,
+              pipeline->total_ns, pipeline->code_size);
+      for (size_t n = 0; n < pipeline->passes.size(); ++n) {
+        auto& pass = pipeline->passes[n];
+        fprintf(file,
+                "%s\n        {\"name\": \"%s\", \"runs\": %" PRIu64 ", "
+                "\"total_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64 ", "
+                "\"blocks_before\": %" PRIu64 ", "
+                "\"blocks_after\": %" PRIu64 ", "
+                "\"instrs_before\": %" PRIu64 ", "
+                "\"instrs_after\": %" PRIu64 ", "
+                "\"values_before\": %" PRIu64 ", "
+                "\"values_after\": %" PRIu64 "}",
+                n ? "," : "", pass.name.c_str(), pass.run_count,
+                pass.total_ns, pass.max_ns, pass.blocks_before,
+                pass.blocks_after, pass.instrs_before, pass.instrs_after,
+                pass.values_before, pass.values_after);
+      }
+      fprintf(file, "\n      ]\n    }");
+    }
+  }
+  fprintf(file, "\n  ]\n}\n");
+  fclose(file);
+  return true;
+}
+
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
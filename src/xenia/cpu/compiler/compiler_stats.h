@@ -0,0 +1,62 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_COMPILER_STATS_H_
+#define XENIA_CPU_COMPILER_COMPILER_STATS_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "xenia/cpu/hir/hir_builder.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+
+// Size of the HIR at some point in the pipeline.
+struct HIRCounts {
+  uint32_t block_count = 0;
+  uint32_t instr_count = 0;
+  // Instructions defining a value.
+  uint32_t value_count = 0;
+
+  static HIRCounts Count(hir::HIRBuilder* builder);
+};
+
+// Measurements of one pass over one function.
+struct PassSample {
+  const char* name;
+  uint64_t duration_ns;
+  HIRCounts before;
+  HIRCounts after;
+};
+
+// Process-wide totals of compiler pass timings and HIR sizes, per module and
+// per pipeline (baseline or optimized), for --report_compiler_stats and
+// --compiler_stats_path. Safe to use from multiple compiling threads.
+class CompilerStats {
+ public:
+  static bool is_enabled();
+
+  // Adds one compiled function. Samples are in pipeline order.
+  static void RecordFunction(const std::string& module_name, bool baseline,
+                             const std::vector<PassSample>& samples,
+                             size_t code_size);
+
+  // Logs the totals with the most expensive passes first.
+  static void Dump();
+  static bool WriteJson(const std::wstring& path);
+};
+
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_COMPILER_STATS_H_
@@ -0,0 +1,223 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/loop_analysis.h"
+
+#include <algorithm>
+
+#include "xenia/base/profiling.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+
+LoopAnalysis::LoopAnalysis() = default;
+
+LoopAnalysis::~LoopAnalysis() = default;
+
+void LoopAnalysis::Analyze(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("cpu");
+
+  blocks_.clear();
+  uint16_t block_ordinal = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    block->ordinal = block_ordinal++;
+    blocks_.push_back(block);
+  }
+
+  FindEdges(builder);
+  ComputeDominators(builder);
+  FindLoops(builder);
+}
+
+void LoopAnalysis::FindEdges(HIRBuilder* builder) {
+  predecessors_.resize(blocks_.size());
+  successors_.resize(blocks_.size());
+  for (size_t n = 0; n < blocks_.size(); ++n) {
+    predecessors_[n].clear();
+    successors_[n].clear();
+  }
+  auto add_edge = [this](Block* src, Block* dest) {
+    auto& successors = successors_[src->ordinal];
+    if (std::find(successors.begin(), successors.end(), dest) ==
+        successors.end()) {
+      successors.push_back(dest);
+      predecessors_[dest->ordinal].push_back(src);
+    }
+  };
+  for (auto block : blocks_) {
+    block->VisitBranchTargets(
+        [&add_edge, block](Block* target) { add_edge(block, target); });
+    if (block->FallsThrough() && block->next) {
+      add_edge(block, block->next);
+    }
+  }
+}
+
+void LoopAnalysis::ComputeDominators(HIRBuilder* builder) {
+  // Simple iterative data flow. Blocks are mostly in program order, so this
+  // converges in a few passes outside of irreducible control flow.
+  uint32_t block_count = static_cast<uint32_t>(blocks_.size());
+  dominators_.resize(block_count);
+  std::vector<bool> reachable(block_count);
+  std::vector<Block*> worklist;
+  if (block_count) {
+    reachable[0] = true;
+    worklist.push_back(blocks_[0]);
+  }
+  while (!worklist.empty()) {
+    auto block = worklist.back();
+    worklist.pop_back();
+    for (auto successor : successors_[block->ordinal]) {
+      if (!reachable[successor->ordinal]) {
+        reachable[successor->ordinal] = true;
+        worklist.push_back(successor);
+      }
+    }
+  }
+  for (uint32_t n = 0; n < block_count; ++n) {
+    dominators_[n].clear();
+    if (reachable[n]) {
+      dominators_[n].resize(block_count, n != 0);
+      dominators_[n].set(n);
+    }
+  }
+
+  llvm::BitVector dominators(block_count);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (uint32_t n = 1; n < block_count; ++n) {
+      if (!reachable[n]) {
+        continue;
+      }
+      dominators.set();
+      for (auto predecessor : predecessors_[n]) {
+        if (reachable[predecessor->ordinal]) {
+          dominators &= dominators_[predecessor->ordinal];
+        }
+      }
+      dominators.set(n);
+      if (dominators != dominators_[n]) {
+        dominators_[n] = dominators;
+        changed = true;
+      }
+    }
+  }
+}
+
+void LoopAnalysis::FindLoops(HIRBuilder* builder) {
+  uint32_t block_count = static_cast<uint32_t>(blocks_.size());
+  loops_.clear();
+
+  // One loop per header, covering all of its back edges.
+  std::vector<Loop*> header_loops(block_count, nullptr);
+  std::vector<Block*> worklist;
+  for (auto block : blocks_) {
+    if (dominators_[block->ordinal].empty()) {
+      continue;
+    }
+    for (auto header : successors_[block->ordinal]) {
+      if (!Dominates(header, block)) {
+        continue;
+      }
+      auto loop = header_loops[header->ordinal];
+      if (!loop) {
+        loops_.emplace_back(new Loop());
+        loop = loops_.back().get();
+        loop->header = header;
+        loop->blocks.resize(block_count);
+        loop->blocks.set(header->ordinal);
+        loop->block_count = 1;
+        loop->parent = nullptr;
+        loop->depth = 0;
+        loop->preheader = nullptr;
+        header_loops[header->ordinal] = loop;
+      }
+      worklist.push_back(block);
+      while (!worklist.empty()) {
+        auto body_block = worklist.back();
+        worklist.pop_back();
+        if (loop->Contains(body_block)) {
+          continue;
+        }
+        loop->blocks.set(body_block->ordinal);
+        ++loop->block_count;
+        for (auto predecessor : predecessors_[body_block->ordinal]) {
+          if (!dominators_[predecessor->ordinal].empty()) {
+            worklist.push_back(predecessor);
+          }
+        }
+      }
+    }
+  }
+
+  // Natural loops either nest or are disjoint, so the smallest loop that
+  // contains a header is its parent.
+  std::sort(loops_.begin(), loops_.end(),
+            [](const std::unique_ptr<Loop>& a, const std::unique_ptr<Loop>& b) {
+              return a->block_count < b->block_count;
+            });
+  for (size_t n = 0; n < loops_.size(); ++n) {
+    auto loop = loops_[n].get();
+    for (size_t m = n + 1; m < loops_.size(); ++m) {
+      if (loops_[m]->Contains(loop->header) &&
+          loops_[m]->header != loop->header) {
+        loop->parent = loops_[m].get();
+        break;
+      }
+    }
+    loop->preheader = FindPreheader(loop);
+  }
+  for (auto& loop : loops_) {
+    for (auto parent = loop->parent; parent; parent = parent->parent) {
+      ++loop->depth;
+    }
+  }
+}
+
+Block* LoopAnalysis::FindPreheader(const Loop* loop) {
+  Block* preheader = nullptr;
+  for (auto predecessor : predecessors_[loop->header->ordinal]) {
+    if (loop->Contains(predecessor) ||
+        dominators_[predecessor->ordinal].empty()) {
+      continue;
+    }
+    if (preheader) {
+      // Entered from more than one place.
+      return nullptr;
+    }
+    preheader = predecessor;
+  }
+  if (!preheader) {
+    return nullptr;
+  }
+  // Code is added before the trailing branches, which must not be able to
+  // change anything it depends on.
+  for (auto i = preheader->instr_tail;
+       i && (i->opcode->flags & OPCODE_FLAG_BRANCH); i = i->prev) {
+    if (i->opcode != &OPCODE_BRANCH_info &&
+        i->opcode != &OPCODE_BRANCH_TRUE_info &&
+        i->opcode != &OPCODE_BRANCH_FALSE_info) {
+      return nullptr;
+    }
+  }
+  return preheader;
+}
+
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,95 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_LOOP_ANALYSIS_H_
+#define XENIA_CPU_COMPILER_LOOP_ANALYSIS_H_
+
+#include <memory>
+#include <vector>
+
+#include "xenia/base/platform.h"
+#include "xenia/cpu/hir/hir_builder.h"
+
+#if XE_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#pragma warning(disable : 4267)
+#include <llvm/ADT/BitVector.h>
+#pragma warning(pop)
+#else
+#include <llvm/ADT/BitVector.h>
+#endif  // XE_COMPILER_MSVC
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+
+// Finds the natural loops of a function: a back edge is a branch to a block
+// that dominates the branching block, and the loop is every block that can
+// reach the back edge without passing through that header.
+// Edges are taken from the branch instructions, so this stays valid as long
+// as no blocks are added or removed.
+class LoopAnalysis {
+ public:
+  struct Loop {
+    hir::Block* header;
+    // Loop blocks (including the header) by ordinal.
+    llvm::BitVector blocks;
+    size_t block_count;
+    // Innermost loop containing this one, if any.
+    Loop* parent;
+    uint32_t depth;
+    // The only block entering the loop from outside, if it ends with nothing
+    // but plain branches. Code placed at its end runs once before the loop.
+    hir::Block* preheader;
+
+    bool Contains(const hir::Block* block) const {
+      return blocks.test(block->ordinal);
+    }
+  };
+
+  LoopAnalysis();
+  ~LoopAnalysis();
+
+  // Renumbers the blocks of the function and finds its loops.
+  void Analyze(hir::HIRBuilder* builder);
+
+  // All blocks, indexed by ordinal.
+  const std::vector<hir::Block*>& blocks() const { return blocks_; }
+  // Innermost loops first.
+  const std::vector<std::unique_ptr<Loop>>& loops() const { return loops_; }
+  const std::vector<hir::Block*>& predecessors(const hir::Block* block) const {
+    return predecessors_[block->ordinal];
+  }
+  const std::vector<hir::Block*>& successors(const hir::Block* block) const {
+    return successors_[block->ordinal];
+  }
+  bool Dominates(const hir::Block* a, const hir::Block* b) const {
+    return dominators_[b->ordinal].test(a->ordinal);
+  }
+
+ private:
+  void FindEdges(hir::HIRBuilder* builder);
+  void ComputeDominators(hir::HIRBuilder* builder);
+  void FindLoops(hir::HIRBuilder* builder);
+  hir::Block* FindPreheader(const Loop* loop);
+
+  std::vector<hir::Block*> blocks_;
+  std::vector<std::vector<hir::Block*>> predecessors_;
+  std::vector<std::vector<hir::Block*>> successors_;
+  // Dominators of each block, by ordinal. Empty for unreachable blocks.
+  std::vector<llvm::BitVector> dominators_;
+  std::vector<std::unique_ptr<Loop>> loops_;
+};
+
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_LOOP_ANALYSIS_H_
@@ -22,6 +22,7 @@ class ConstantPropagationPass : public ConditionalGroupSubpass {
   ConstantPropagationPass();
   ~ConstantPropagationPass() override;
 
+  const char* name() const override { return "constant_propagation"; }
   bool Run(hir::HIRBuilder* builder, bool& result) override;
 
  private:
@@ -11,8 +11,12 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <iterator>
+
 #include "xenia/base/profiling.h"
 #include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/ppc/ppc_context.h"
 #include "xenia/cpu/processor.h"
 
@@ -67,11 +71,18 @@ bool ContextPromotionPass::Run(HIRBuilder* builder) {
   // instead as it may be faster (at least on the block-level).
 
   // Promote loads to values.
-  // Process each block independently, for now.
-  auto block = builder->first_block();
-  while (block) {
-    PromoteBlock(block);
-    block = block->next;
+  // Values can only be used across blocks if the register allocator keeps
+  // them there; otherwise process each block independently.
+  Block* block;
+  if (FLAGS_global_context_promotion &&
+      FLAGS_linear_scan_register_allocation) {
+    PromoteFunction(builder);
+  } else {
+    block = builder->first_block();
+    while (block) {
+      PromoteBlock(block, AvailableValues(), true);
+      block = block->next;
+    }
   }
 
   // Remove all dead stores.
@@ -88,25 +99,149 @@ bool ContextPromotionPass::Run(HIRBuilder* builder) {
   return true;
 }
 
-void ContextPromotionPass::PromoteBlock(Block* block) {
+void ContextPromotionPass::PromoteFunction(HIRBuilder* builder) {
+  // A value stored to (or loaded from) a context offset is available in a
+  // block when every predecessor ends with that same value there. Its def is
+  // then on all paths to the block and dominates it, so the load can be
+  // replaced. In loops this keeps registers that aren't changed by the loop
+  // body out of memory.
+  // Example:
+  //   v0 = load_context +100
+  // loop:
+  //   v1 = load_context +100  <-- replace with v1 = v0
+  //   ...
+  //   branch_true v2, loop
+  // Registers that do change in a loop still go through the context, as HIR
+  // has no way to merge values.
+  uint16_t block_ordinal = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    block->ordinal = block_ordinal++;
+  }
+  uint32_t block_count = block_ordinal;
+  FindPredecessors(builder, block_count);
+  outgoing_values_.clear();
+  outgoing_values_.resize(block_count);
+  visited_.assign(block_count, false);
+
+  // Blocks whose predecessors haven't been visited yet are assumed to have
+  // everything available, and the sets only shrink from there.
+  AvailableValues incoming;
+  AvailableValues outgoing;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto block = builder->first_block(); block; block = block->next) {
+      if (!GetIncomingValues(block, &incoming)) {
+        continue;
+      }
+      PromoteBlock(block, incoming, false);
+      outgoing.clear();
+      auto offset = context_validity_.find_first();
+      while (offset != -1) {
+        outgoing.emplace_back(offset, context_values_[offset]);
+        offset = context_validity_.find_next(offset);
+      }
+      if (!visited_[block->ordinal] ||
+          outgoing != outgoing_values_[block->ordinal]) {
+        visited_[block->ordinal] = true;
+        outgoing_values_[block->ordinal] = outgoing;
+        changed = true;
+      }
+    }
+  }
+
+  for (auto block = builder->first_block(); block; block = block->next) {
+    if (!GetIncomingValues(block, &incoming)) {
+      // Unreachable.
+      incoming.clear();
+    }
+    PromoteBlock(block, incoming, true);
+  }
+}
+
+void ContextPromotionPass::FindPredecessors(HIRBuilder* builder,
+                                            uint32_t block_count) {
+  // The CFG may be stale after simplification, so edges are taken from the
+  // branches.
+  predecessors_.resize(block_count);
+  for (auto& predecessors : predecessors_) {
+    predecessors.clear();
+  }
+  auto add_edge = [this](Block* src, Block* dest) {
+    auto& predecessors = predecessors_[dest->ordinal];
+    if (std::find(predecessors.begin(), predecessors.end(), src) ==
+        predecessors.end()) {
+      predecessors.push_back(src);
+    }
+  };
+  for (auto block = builder->first_block(); block; block = block->next) {
+    if (block->FallsThrough() && block->next) {
+      add_edge(block, block->next);
+    }
+    block->VisitBranchTargets(
+        [&add_edge, block](Block* target) { add_edge(block, target); });
+  }
+}
+
+bool ContextPromotionPass::GetIncomingValues(Block* block,
+                                             AvailableValues* values) {
+  values->clear();
+  if (!block->prev) {
+    // Function entry, where nothing is known.
+    return true;
+  }
+  bool any_visited = false;
+  for (auto predecessor : predecessors_[block->ordinal]) {
+    if (!visited_[predecessor->ordinal]) {
+      continue;
+    }
+    auto& outgoing = outgoing_values_[predecessor->ordinal];
+    if (!any_visited) {
+      *values = outgoing;
+      any_visited = true;
+      continue;
+    }
+    // Keep only the offsets holding the same value. Both are sorted.
+    AvailableValues merged;
+    std::set_intersection(values->begin(), values->end(), outgoing.begin(),
+                          outgoing.end(), std::back_inserter(merged));
+    values->swap(merged);
+  }
+  return any_visited;
+}
+
+void ContextPromotionPass::PromoteBlock(Block* block,
+                                        const AvailableValues& incoming,
+                                        bool rewrite) {
   auto& validity = context_validity_;
   validity.reset();
+  for (auto& available : incoming) {
+    context_values_[available.first] = available.second;
+    validity.set(available.first);
+  }
 
   Instr* i = block->instr_head;
   while (i) {
     auto next = i->next;
-    if (i->opcode->flags & OPCODE_FLAG_VOLATILE) {
+    if (i->opcode == &OPCODE_BRANCH_TRUE_info ||
+        i->opcode == &OPCODE_BRANCH_FALSE_info) {
+      // Doesn't touch the context, even though it's volatile.
+    } else if (i->opcode->flags & OPCODE_FLAG_VOLATILE) {
       // Volatile instruction - requires all context values be flushed.
       validity.reset();
     } else if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
       size_t offset = i->src1.offset;
-      if (validity.test(static_cast<uint32_t>(offset))) {
+      if (validity.test(static_cast<uint32_t>(offset)) &&
+          context_values_[offset]->type == i->dest->type) {
         // Legit previous value, reuse.
-        Value* previous_value = context_values_[offset];
-        i->opcode = &hir::OPCODE_ASSIGN_info;
-        i->set_src1(previous_value);
+        if (rewrite) {
+          Value* previous_value = context_values_[offset];
+          i->opcode = &hir::OPCODE_ASSIGN_info;
+          i->set_src1(previous_value);
+        }
       } else {
         // Store the loaded value into the table.
+        InvalidateOverlapping(offset, GetTypeSize(i->dest->type));
         context_values_[offset] = i->dest;
         validity.set(static_cast<uint32_t>(offset));
       }
@@ -114,6 +249,7 @@ void ContextPromotionPass::PromoteBlock(Block* block) {
       size_t offset = i->src1.offset;
       Value* value = i->src2.value;
       // Store value into the table for later.
+      InvalidateOverlapping(offset, GetTypeSize(value->type));
       context_values_[offset] = value;
       validity.set(static_cast<uint32_t>(offset));
     }
@@ -121,26 +257,49 @@ void ContextPromotionPass::PromoteBlock(Block* block) {
   }
 }
 
+void ContextPromotionPass::InvalidateOverlapping(size_t offset, size_t size) {
+  // Values are at most 16 bytes, so only nearby offsets can overlap.
+  auto& validity = context_validity_;
+  size_t start = offset >= 15 ? offset - 15 : 0;
+  for (size_t n = start; n < offset + size && n < context_values_.size();
+       ++n) {
+    if (n != offset && validity.test(static_cast<uint32_t>(n)) &&
+        n + GetTypeSize(context_values_[n]->type) > offset) {
+      validity.reset(static_cast<uint32_t>(n));
+    }
+  }
+}
+
 void ContextPromotionPass::RemoveDeadStoresBlock(Block* block) {
   auto& validity = context_validity_;
   validity.reset();
 
-  // Walk backwards and mark offsets that are written to.
-  // If the offset was written to earlier, ignore the store.
+  // Walk backwards and mark the bytes that are written to.
+  // If every byte of a store is written again later, ignore the store.
   Instr* i = block->instr_tail;
   while (i) {
     Instr* prev = i->prev;
     if (i->opcode->flags & (OPCODE_FLAG_VOLATILE | OPCODE_FLAG_BRANCH)) {
       // Volatile instruction - requires all context values be flushed.
       validity.reset();
+    } else if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+      // Loads left after promotion (of another type or width) read whatever
+      // was stored before them.
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      uint32_t size = static_cast<uint32_t>(GetTypeSize(i->dest->type));
+      validity.reset(offset, offset + size);
     } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
-      size_t offset = i->src1.offset;
-      if (!validity.test(static_cast<uint32_t>(offset))) {
-        // Offset not yet written, mark and continue.
-        validity.set(static_cast<uint32_t>(offset));
-      } else {
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      uint32_t size = static_cast<uint32_t>(GetTypeSize(i->src2.value->type));
+      bool overwritten = true;
+      for (uint32_t n = offset; n < offset + size; ++n) {
+        overwritten &= validity.test(n);
+      }
+      if (overwritten) {
         // Already written to. Remove this store.
         i->Remove();
+      } else {
+        validity.set(offset, offset + size);
       }
     }
     i = prev;
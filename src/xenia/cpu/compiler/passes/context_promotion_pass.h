@@ -11,6 +11,7 @@
 #define XENIA_CPU_COMPILER_PASSES_CONTEXT_PROMOTION_PASS_H_
 
 #include <cmath>
+#include <utility>
 #include <vector>
 
 #include "xenia/base/platform.h"
@@ -38,15 +39,31 @@ class ContextPromotionPass : public CompilerPass {
 
   bool Initialize(Compiler* compiler) override;
 
+  const char* name() const override { return "context_promotion"; }
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
-  void PromoteBlock(hir::Block* block);
+  // Context offsets and the values known to be stored there, by offset.
+  typedef std::vector<std::pair<uint32_t, hir::Value*>> AvailableValues;
+
+  void PromoteFunction(hir::HIRBuilder* builder);
+  void FindPredecessors(hir::HIRBuilder* builder, uint32_t block_count);
+  bool GetIncomingValues(hir::Block* block, AvailableValues* values);
+  // Forwards values to loads in the block, starting with the incoming ones.
+  // Without rewrite only the values available at the end are computed.
+  void PromoteBlock(hir::Block* block, const AvailableValues& incoming,
+                    bool rewrite);
+  void InvalidateOverlapping(size_t offset, size_t size);
   void RemoveDeadStoresBlock(hir::Block* block);
 
  private:
   std::vector<hir::Value*> context_values_;
   llvm::BitVector context_validity_;
+
+  std::vector<std::vector<hir::Block*>> predecessors_;
+  // Values available at the end of each block, by ordinal, once visited.
+  std::vector<AvailableValues> outgoing_values_;
+  std::vector<bool> visited_;
 };
 
 }  // namespace passes
@@ -31,10 +31,15 @@ ControlFlowAnalysisPass::~ControlFlowAnalysisPass() {}
 
 bool ControlFlowAnalysisPass::Run(HIRBuilder* builder) {
   // Reset edges for all blocks. Needed to be re-runnable.
-  // Note that this wastes a bunch of arena memory, so we shouldn't
-  // re-run too often.
+  // The old edges are handed back to the arena for the next pass to reuse.
   auto block = builder->first_block();
   while (block) {
+    auto edge = block->outgoing_edge_head;
+    while (edge) {
+      auto next = edge->outgoing_next;
+      builder->arena()->Retire(edge);
+      edge = next;
+    }
     block->incoming_edge_head = nullptr;
     block->outgoing_edge_head = nullptr;
     block = block->next;
@@ -22,6 +22,7 @@ class ControlFlowAnalysisPass : public CompilerPass {
   ControlFlowAnalysisPass();
   ~ControlFlowAnalysisPass() override;
 
+  const char* name() const override { return "control_flow_analysis"; }
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
@@ -22,6 +22,7 @@ class ControlFlowSimplificationPass : public CompilerPass {
   ControlFlowSimplificationPass();
   ~ControlFlowSimplificationPass() override;
 
+  const char* name() const override { return "control_flow_simplification"; }
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
@@ -35,7 +35,9 @@ namespace passes {
 // TODO(benvanik): remove when enums redefined.
 using namespace xe::cpu::hir;
 
+using xe::cpu::hir::Block;
 using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
 using xe::cpu::hir::OpcodeSignatureType;
 using xe::cpu::hir::Value;
 
@@ -208,6 +210,79 @@ void DataFlowAnalysisPass::AnalyzeFlow(HIRBuilder* builder,
   }
 }
 
+void DataFlowAnalysisPass::ComputeLiveness(
+    HIRBuilder* builder, uint32_t block_count,
+    std::vector<llvm::BitVector>* live_ins,
+    std::vector<llvm::BitVector>* live_outs) {
+  uint32_t value_count = builder->max_value_ordinal();
+  live_ins->resize(block_count);
+  live_outs->resize(block_count);
+  for (uint32_t n = 0; n < block_count; ++n) {
+    (*live_ins)[n].clear();
+    (*live_ins)[n].resize(value_count);
+    (*live_outs)[n].clear();
+    (*live_outs)[n].resize(value_count);
+  }
+
+  // Values used in a block before being defined in it, and values defined in
+  // it. As this is SSA the only uses preceding a def are from other blocks.
+  std::vector<llvm::BitVector> used(block_count);
+  std::vector<llvm::BitVector> defined(block_count);
+  for (auto block = builder->first_block(); block; block = block->next) {
+    auto& block_used = used[block->ordinal];
+    auto& block_defined = defined[block->ordinal];
+    block_used.resize(value_count);
+    block_defined.resize(value_count);
+    for (auto i = block->instr_head; i; i = i->next) {
+      uint32_t signature = i->opcode->signature;
+#define SET_USED_VALUE(v)                                     \
+  if (!v->IsConstant() && v->def && v->def->block != block) { \
+    block_used.set(v->ordinal);                               \
+  }
+      if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V) {
+        SET_USED_VALUE(i->src1.value);
+      }
+      if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V) {
+        SET_USED_VALUE(i->src2.value);
+      }
+      if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V) {
+        SET_USED_VALUE(i->src3.value);
+      }
+#undef SET_USED_VALUE
+      if (i->dest) {
+        block_defined.set(i->dest->ordinal);
+      }
+    }
+  }
+
+  // Iterate to a fixed point, walking backwards as liveness flows that way.
+  llvm::BitVector live(value_count);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto block = builder->last_block(); block; block = block->prev) {
+      // Live out is the union of everything live into the successors. The CFG
+      // may be stale by now, so they are taken from the branches.
+      auto& live_out = (*live_outs)[block->ordinal];
+      live_out.reset();
+      if (block->FallsThrough() && block->next) {
+        live_out |= (*live_ins)[block->next->ordinal];
+      }
+      block->VisitBranchTargets([&live_out, live_ins](Block* target) {
+        live_out |= (*live_ins)[target->ordinal];
+      });
+      live = live_out;
+      live.reset(defined[block->ordinal]);
+      live |= used[block->ordinal];
+      auto& live_in = (*live_ins)[block->ordinal];
+      if (live != live_in) {
+        live_in = live;
+        changed = true;
+      }
+    }
+  }
+}
+
 }  // namespace passes
 }  // namespace compiler
 }  // namespace cpu
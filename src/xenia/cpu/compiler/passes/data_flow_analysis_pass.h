@@ -10,8 +10,21 @@
 #ifndef XENIA_CPU_COMPILER_PASSES_DATA_FLOW_ANALYSIS_PASS_H_
 #define XENIA_CPU_COMPILER_PASSES_DATA_FLOW_ANALYSIS_PASS_H_
 
+#include <vector>
+
+#include "xenia/base/platform.h"
 #include "xenia/cpu/compiler/compiler_pass.h"
 
+#if XE_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#pragma warning(disable : 4267)
+#include <llvm/ADT/BitVector.h>
+#pragma warning(pop)
+#else
+#include <llvm/ADT/BitVector.h>
+#endif  // XE_COMPILER_MSVC
+
 namespace xe {
 namespace cpu {
 namespace compiler {
@@ -22,8 +35,17 @@ class DataFlowAnalysisPass : public CompilerPass {
   DataFlowAnalysisPass();
   ~DataFlowAnalysisPass() override;
 
+  const char* name() const override { return "data_flow_analysis"; }
   bool Run(hir::HIRBuilder* builder) override;
 
+  // Computes the values live on entry to and exit from each block, indexed by
+  // block ordinal and then value ordinal. Unlike Run this follows loop back
+  // edges and leaves the HIR untouched, so values may stay live across blocks.
+  // Blocks must already have sequential ordinals.
+  static void ComputeLiveness(hir::HIRBuilder* builder, uint32_t block_count,
+                              std::vector<llvm::BitVector>* live_ins,
+                              std::vector<llvm::BitVector>* live_outs);
+
  private:
   uint32_t LinearizeBlocks(hir::HIRBuilder* builder);
   void AnalyzeFlow(hir::HIRBuilder* builder, uint32_t block_count);
@@ -158,6 +158,7 @@ void DeadCodeEliminationPass::MakeNopRecursive(Instr* i) {
     i->src##n##_use = NULL;                              \
     i->src##n.value = NULL;                              \
     value->RemoveUse(use);                               \
+    i->block->arena->Retire(use);                        \
     if (!value->use_head) {                              \
       /* Value is now unused, so recursively kill it. */ \
       if (value->def && value->def != i) {               \
@@ -22,6 +22,7 @@ class DeadCodeEliminationPass : public CompilerPass {
   DeadCodeEliminationPass();
   ~DeadCodeEliminationPass() override;
 
+  const char* name() const override { return "dead_code_elimination"; }
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
@@ -0,0 +1,244 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/dead_store_elimination_pass.h"
+
+#include <gflags/gflags.h>
+
+#include <atomic>
+#include <cinttypes>
+
+#include "xenia/base/logging.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+#include "xenia/cpu/processor.h"
+
+DECLARE_bool(debug);
+DECLARE_bool(store_all_context_values);
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+namespace {
+
+struct {
+  std::atomic<uint64_t> store_count;
+  std::atomic<uint64_t> removed_gpr_count;
+  std::atomic<uint64_t> removed_cr_count;
+  std::atomic<uint64_t> removed_xer_count;
+  std::atomic<uint64_t> removed_other_count;
+  std::atomic<uint64_t> function_count;
+  std::atomic<uint64_t> code_size;
+} dead_store_stats;
+
+// Whether the instruction may expose the whole context to something else:
+// the code we call or return to, or a trap/debugger handler.
+bool ReadsAllContext(const Instr* i) {
+  switch (i->opcode->num) {
+    case OPCODE_DEBUG_BREAK:
+    case OPCODE_DEBUG_BREAK_TRUE:
+    case OPCODE_TRAP:
+    case OPCODE_TRAP_TRUE:
+    case OPCODE_CALL:
+    case OPCODE_CALL_TRUE:
+    case OPCODE_CALL_INDIRECT:
+    case OPCODE_CALL_INDIRECT_TRUE:
+    case OPCODE_CALL_EXTERN:
+    case OPCODE_RETURN:
+    case OPCODE_RETURN_TRUE:
+    case OPCODE_CONTEXT_BARRIER:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void RecordRemovedStore(size_t offset) {
+  if (offset >= offsetof(ppc::PPCContext, r) &&
+      offset < offsetof(ppc::PPCContext, f)) {
+    ++dead_store_stats.removed_gpr_count;
+  } else if (offset >= offsetof(ppc::PPCContext, cr0) &&
+             offset < offsetof(ppc::PPCContext, fpscr)) {
+    ++dead_store_stats.removed_cr_count;
+  } else if (offset >= offsetof(ppc::PPCContext, xer_ca) &&
+             offset <= offsetof(ppc::PPCContext, xer_so)) {
+    ++dead_store_stats.removed_xer_count;
+  } else {
+    ++dead_store_stats.removed_other_count;
+  }
+}
+
+}  // namespace
+
+DeadStoreEliminationPass::DeadStoreEliminationPass() : CompilerPass() {}
+
+DeadStoreEliminationPass::~DeadStoreEliminationPass() {}
+
+bool DeadStoreEliminationPass::Initialize(Compiler* compiler) {
+  if (!CompilerPass::Initialize(compiler)) {
+    return false;
+  }
+  context_size_ = sizeof(ppc::PPCContext);
+  return true;
+}
+
+bool DeadStoreEliminationPass::Run(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("cpu");
+
+  // Same as in ContextPromotionPass: dead values are needed when debugging.
+  if (FLAGS_debug || FLAGS_store_all_context_values) {
+    return true;
+  }
+
+  // Example, where the first store survives block-local elimination:
+  //   store_context +100, v0  <-- removed as both successors overwrite it
+  //   branch_true v1, label0
+  // label1:
+  //   store_context +100, v2
+  //   ...
+  // label0:
+  //   store_context +100, v3
+  //   ...
+  uint32_t block_count = LinearizeBlocks(builder);
+  ComputeLiveness(builder, block_count);
+
+  llvm::BitVector live(static_cast<uint32_t>(context_size_));
+  for (auto block = builder->first_block(); block; block = block->next) {
+    GetLiveOut(block, &live);
+    TransferBlock(block, &live, true);
+  }
+
+  return true;
+}
+
+uint32_t DeadStoreEliminationPass::LinearizeBlocks(HIRBuilder* builder) {
+  uint16_t block_ordinal = 0;
+  auto block = builder->first_block();
+  while (block) {
+    block->ordinal = block_ordinal++;
+    block = block->next;
+  }
+  return block_ordinal;
+}
+
+void DeadStoreEliminationPass::ComputeLiveness(HIRBuilder* builder,
+                                               uint32_t block_count) {
+  live_in_.resize(block_count);
+  for (uint32_t n = 0; n < block_count; ++n) {
+    live_in_[n].clear();
+    live_in_[n].resize(static_cast<uint32_t>(context_size_));
+  }
+
+  // Iterate to a fixed point, walking backwards as liveness flows that way.
+  // Blocks are mostly in program order so this converges quickly outside of
+  // loops.
+  llvm::BitVector live(static_cast<uint32_t>(context_size_));
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto block = builder->last_block(); block; block = block->prev) {
+      GetLiveOut(block, &live);
+      TransferBlock(block, &live, false);
+      auto& live_in = live_in_[block->ordinal];
+      if (live != live_in) {
+        live_in = live;
+        changed = true;
+      }
+    }
+  }
+}
+
+void DeadStoreEliminationPass::GetLiveOut(Block* block,
+                                          llvm::BitVector* live) {
+  live->reset();
+  if (block->FallsThrough()) {
+    // Should not happen after finalization, but passes may have removed a
+    // conditional branch at the end of a block.
+    if (block->next) {
+      *live |= live_in_[block->next->ordinal];
+    } else {
+      live->set();
+      return;
+    }
+  }
+  block->VisitBranchTargets(
+      [this, live](Block* target) { *live |= live_in_[target->ordinal]; });
+}
+
+void DeadStoreEliminationPass::TransferBlock(Block* block,
+                                             llvm::BitVector* live,
+                                             bool remove_dead_stores) {
+  Instr* i = block->instr_tail;
+  while (i) {
+    Instr* prev = i->prev;
+    if (ReadsAllContext(i)) {
+      live->set();
+    } else if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      uint32_t size = static_cast<uint32_t>(GetTypeSize(i->dest->type));
+      live->set(offset, offset + size);
+    } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      uint32_t size = static_cast<uint32_t>(GetTypeSize(i->src2.value->type));
+      if (remove_dead_stores) {
+        ++dead_store_stats.store_count;
+        bool is_live = false;
+        for (uint32_t n = offset; n < offset + size; ++n) {
+          is_live |= live->test(n);
+        }
+        if (!is_live) {
+          RecordRemovedStore(offset);
+          i->Remove();
+        }
+      }
+      live->reset(offset, offset + size);
+    }
+    i = prev;
+  }
+}
+
+void DeadStoreEliminationPass::RecordEmittedCode(size_t code_size) {
+  ++dead_store_stats.function_count;
+  dead_store_stats.code_size += code_size;
+}
+
+void DeadStoreEliminationPass::DumpStats() {
+  uint64_t removed_count = dead_store_stats.removed_gpr_count +
+                           dead_store_stats.removed_cr_count +
+                           dead_store_stats.removed_xer_count +
+                           dead_store_stats.removed_other_count;
+  XELOGI(
+      "Dead store elimination: removed %" PRIu64 " of %" PRIu64
+      " context stores (%" PRIu64 " gpr, %" PRIu64 " cr, %" PRIu64
+      " xer, %" PRIu64 " other)",
+      removed_count, dead_store_stats.store_count.load(),
+      dead_store_stats.removed_gpr_count.load(),
+      dead_store_stats.removed_cr_count.load(),
+      dead_store_stats.removed_xer_count.load(),
+      dead_store_stats.removed_other_count.load());
+  XELOGI("Optimized code: %" PRIu64 " functions, %" PRIu64 " bytes",
+         dead_store_stats.function_count.load(),
+         dead_store_stats.code_size.load());
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
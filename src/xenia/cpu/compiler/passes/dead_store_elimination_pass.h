@@ -0,0 +1,71 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
+
+#include <vector>
+
+#include "xenia/base/platform.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+#if XE_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#pragma warning(disable : 4267)
+#include <llvm/ADT/BitVector.h>
+#pragma warning(pop)
+#else
+#include <llvm/ADT/BitVector.h>
+#endif  // XE_COMPILER_MSVC
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Removes context stores that are overwritten on every path before anything
+// can read them. Liveness of each context byte is tracked across blocks using
+// the CFG, with calls, returns and traps reading the entire context.
+class DeadStoreEliminationPass : public CompilerPass {
+ public:
+  DeadStoreEliminationPass();
+  ~DeadStoreEliminationPass() override;
+
+  bool Initialize(Compiler* compiler) override;
+
+  const char* name() const override { return "dead_store_elimination"; }
+  bool Run(hir::HIRBuilder* builder) override;
+
+  // Totals across all functions compiled, for --report_dead_store_stats.
+  // The size of the optimized code is recorded so that runs with and without
+  // the pass can be compared.
+  static void RecordEmittedCode(size_t code_size);
+  static void DumpStats();
+
+ private:
+  uint32_t LinearizeBlocks(hir::HIRBuilder* builder);
+  void ComputeLiveness(hir::HIRBuilder* builder, uint32_t block_count);
+  void GetLiveOut(hir::Block* block, llvm::BitVector* live);
+  // Walks the block backwards turning live-out into live-in, optionally
+  // removing stores that nothing reads.
+  void TransferBlock(hir::Block* block, llvm::BitVector* live,
+                     bool remove_dead_stores);
+
+  size_t context_size_ = 0;
+  // Context bytes live on entry to each block, by ordinal.
+  std::vector<llvm::BitVector> live_in_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
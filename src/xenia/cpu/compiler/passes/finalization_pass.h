@@ -22,6 +22,7 @@ class FinalizationPass : public CompilerPass {
   FinalizationPass();
   ~FinalizationPass() override;
 
+  const char* name() const override { return "finalization"; }
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
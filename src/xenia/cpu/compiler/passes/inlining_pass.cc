@@ -0,0 +1,325 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/inlining_pass.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "xenia/base/logging.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/function.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Label;
+using xe::cpu::hir::Value;
+
+InliningPass::InliningPass(EmitFunction emit_function)
+    : CompilerPass(), emit_function_(std::move(emit_function)) {}
+
+InliningPass::~InliningPass() = default;
+
+bool InliningPass::Run(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("cpu");
+
+  // Gather direct calls to small guest functions, grouped by target. The
+  // caller size is taken in guest instructions, same as the callee limits.
+  uint32_t guest_size = 0;
+  std::vector<Candidate> candidates;
+  std::unordered_map<GuestFunction*, size_t> candidate_indices;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i->opcode == &OPCODE_SOURCE_OFFSET_info) {
+        ++guest_size;
+        continue;
+      }
+      auto function = GetCandidateFunction(i);
+      if (!function) {
+        continue;
+      }
+      auto it = candidate_indices.find(function);
+      if (it == candidate_indices.end()) {
+        it = candidate_indices.emplace(function, candidates.size()).first;
+        candidates.push_back(
+            {function,
+             (function->end_address() - function->address()) / 4 + 1,
+             function->entry_count(),
+             {}});
+      }
+      candidates[it->second].call_sites.push_back(i);
+    }
+  }
+  if (candidates.empty()) {
+    return true;
+  }
+
+  // Functions called from only one place don't duplicate any code here, so
+  // they may be larger. Of the rest, prefer the ones entered most often (when
+  // tiering has counted them) and then the cheapest.
+  uint32_t max_size = uint32_t(FLAGS_inline_max_instructions);
+  candidates.erase(
+      std::remove_if(candidates.begin(), candidates.end(),
+                     [max_size](const Candidate& candidate) {
+                       uint32_t limit = candidate.call_sites.size() == 1
+                                            ? max_size * 2
+                                            : max_size;
+                       return candidate.guest_size > limit;
+                     }),
+      candidates.end());
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Candidate& a, const Candidate& b) {
+              if (a.entry_count != b.entry_count) {
+                return a.entry_count > b.entry_count;
+              }
+              return a.guest_size * a.call_sites.size() <
+                     b.guest_size * b.call_sites.size();
+            });
+
+  // Bound the growth of the function, but always allow at least one inline.
+  uint32_t budget = std::max(
+      uint32_t(uint64_t(guest_size) * FLAGS_inline_max_growth / 100), max_size);
+  bool inlined_any = false;
+  for (auto& candidate : candidates) {
+    if (candidate.guest_size > budget) {
+      continue;
+    }
+    auto callee_builder = emit_function_(candidate.function);
+    if (!callee_builder || !IsInlinableLeaf(callee_builder)) {
+      continue;
+    }
+    for (auto call_instr : candidate.call_sites) {
+      if (candidate.guest_size > budget) {
+        break;
+      }
+      if (InlineCall(builder, call_instr, candidate.function,
+                     callee_builder)) {
+        budget -= candidate.guest_size;
+        inlined_any = true;
+      }
+    }
+  }
+
+  if (inlined_any) {
+    builder->set_attributes(builder->attributes() |
+                            FUNCTION_ATTRIB_HAS_INLINED_CALLS);
+  }
+  return true;
+}
+
+GuestFunction* InliningPass::GetCandidateFunction(Instr* call_instr) {
+  if (call_instr->opcode != &OPCODE_CALL_info) {
+    return nullptr;
+  }
+  auto function = call_instr->src1.symbol;
+  if (!function->is_guest() ||
+      function->behavior() == Function::Behavior::kExtern) {
+    return nullptr;
+  }
+  // Only functions that have been fully defined have final extents; anything
+  // else may still be being scanned by another thread.
+  if (function->status() != Symbol::Status::kDefined ||
+      !function->has_end_address()) {
+    return nullptr;
+  }
+  auto guest_function = static_cast<GuestFunction*>(function);
+  if (guest_function->extern_handler()) {
+    return nullptr;
+  }
+  return guest_function;
+}
+
+bool InliningPass::IsInlinableLeaf(HIRBuilder* callee_builder) {
+  if (!callee_builder->locals().empty()) {
+    return false;
+  }
+  // Returns are indirect calls to LR and are the only calls allowed. This
+  // also rules out recursion.
+  for (auto block = callee_builder->first_block(); block;
+       block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i->opcode == &OPCODE_CALL_INDIRECT_info ||
+          i->opcode == &OPCODE_CALL_INDIRECT_TRUE_info) {
+        auto target = i->opcode == &OPCODE_CALL_INDIRECT_info
+                          ? i->src1.value
+                          : i->src2.value;
+        if (!(i->flags & CALL_POSSIBLE_RETURN) || !target->def ||
+            target->def->opcode != &OPCODE_LOAD_CONTEXT_info) {
+          return false;
+        }
+      } else if (i->opcode == &OPCODE_CALL_info ||
+                 i->opcode == &OPCODE_CALL_TRUE_info ||
+                 i->opcode == &OPCODE_CALL_EXTERN_info ||
+                 i->opcode == &OPCODE_SET_RETURN_ADDRESS_info) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool InliningPass::InlineCall(HIRBuilder* builder, Instr* call_instr,
+                              GuestFunction* function,
+                              HIRBuilder* callee_builder) {
+  // Tail calls return straight to our caller, so the callee can be used as-is:
+  // its returns check against the same return address ours do. Other calls
+  // set the return address (and LR) just before calling; returns to it become
+  // branches to the instruction following the call.
+  bool is_tail = (call_instr->flags & CALL_TAIL) != 0;
+  uint64_t return_address = 0;
+  uint32_t call_address = 0;
+  for (auto i = call_instr->prev; i; i = i->prev) {
+    if (i->opcode == &OPCODE_SET_RETURN_ADDRESS_info && !return_address &&
+        i->src1.value->IsConstant()) {
+      return_address = i->src1.value->AsUint64();
+    } else if (i->opcode == &OPCODE_SOURCE_OFFSET_info) {
+      call_address = static_cast<uint32_t>(i->src1.offset);
+      break;
+    }
+  }
+  if (!is_tail && (!return_address || !call_instr->next)) {
+    return false;
+  }
+
+  // Map everything the callee defines or references into our builder. The
+  // callee HIR is reused for each call site, so all tags are reassigned.
+  for (auto block = callee_builder->first_block(); block;
+       block = block->next) {
+    for (auto label = block->label_head; label; label = label->next) {
+      label->tag = builder->NewLabel();
+    }
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i->dest) {
+        i->dest->tag = builder->AllocValue(i->dest->type);
+      }
+      Value* srcs[] = {nullptr, nullptr, nullptr};
+      auto signature = i->opcode->signature;
+      if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V) {
+        srcs[0] = i->src1.value;
+      }
+      if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V) {
+        srcs[1] = i->src2.value;
+      }
+      if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V) {
+        srcs[2] = i->src3.value;
+      }
+      for (auto src : srcs) {
+        if (src && src->IsConstant()) {
+          src->tag = builder->CloneValue(src);
+        }
+      }
+    }
+  }
+
+  Label* continuation = nullptr;
+  if (!is_tail) {
+    continuation = builder->NewLabel();
+    builder->InsertLabel(continuation, call_instr);
+  }
+
+  // The callee blocks are all terminated, so they can be appended to the end
+  // of the function in any order. Its source offsets are marked so that the
+  // backend maps them separately from our own, as a range resolving to the
+  // callee.
+  Label* entry = nullptr;
+  uint16_t source_offset_flags =
+      SOURCE_OFFSET_INLINED | SOURCE_OFFSET_INLINED_ENTRY;
+  for (auto block = callee_builder->first_block(); block;
+       block = block->next) {
+    auto block_label = builder->NewLabel();
+    builder->MarkLabel(block_label);
+    if (!entry) {
+      entry = block_label;
+    }
+    for (auto label = block->label_head; label; label = label->next) {
+      builder->MarkLabel(reinterpret_cast<Label*>(label->tag),
+                         builder->current_block());
+    }
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i->opcode == &OPCODE_COMMENT_info) {
+        // Points into the callee arena.
+        continue;
+      }
+      if (!is_tail) {
+        if (i->opcode == &OPCODE_RETURN_info) {
+          builder->Branch(continuation);
+          continue;
+        } else if (i->opcode == &OPCODE_RETURN_TRUE_info) {
+          builder->BranchTrue(reinterpret_cast<Value*>(i->src1.value->tag),
+                              continuation);
+          continue;
+        } else if (i->opcode == &OPCODE_CALL_INDIRECT_info) {
+          EmitReturn(builder, i->src1.value->def, return_address,
+                     continuation);
+          continue;
+        } else if (i->opcode == &OPCODE_CALL_INDIRECT_TRUE_info) {
+          auto skip = builder->NewLabel();
+          builder->BranchFalse(reinterpret_cast<Value*>(i->src1.value->tag),
+                               skip);
+          EmitReturn(builder, i->src2.value->def, return_address,
+                     continuation);
+          builder->MarkLabel(skip);
+          continue;
+        }
+      }
+      auto clone = builder->CloneInstr(i);
+      if (i->opcode == &OPCODE_SOURCE_OFFSET_info) {
+        clone->flags = source_offset_flags;
+        source_offset_flags = SOURCE_OFFSET_INLINED;
+      }
+    }
+  }
+
+  call_instr->Replace(&OPCODE_BRANCH_info, 0);
+  call_instr->src1.label = entry;
+
+  if (FLAGS_report_inlining) {
+    XELOGI("Inlined %.8X %s%s at %.8X", function->address(),
+           function->name().c_str(), is_tail ? " (tail)" : "", call_address);
+  }
+  return true;
+}
+
+void InliningPass::EmitReturn(HIRBuilder* builder, Instr* target_def,
+                              uint64_t return_address, Label* continuation) {
+  // The target is always a load of LR. Values can't be used across blocks
+  // here, so it's loaded again in each block that needs it.
+  auto load_target = [builder, target_def]() {
+    return builder->LoadContext(size_t(target_def->src1.offset),
+                                target_def->dest->type);
+  };
+
+  // Almost always a return back to us.
+  auto is_return = builder->CompareEQ(
+      builder->Truncate(load_target(), INT32_TYPE),
+      builder->LoadConstantUint32(uint32_t(return_address)));
+  builder->BranchTrue(is_return, continuation);
+
+  // Otherwise LR was changed (longjmp and such). The callee would have jumped
+  // away with us as the return address, so do the same.
+  builder->SetReturnAddress(builder->LoadConstantUint64(return_address));
+  builder->CallIndirect(load_target());
+  builder->Branch(continuation);
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
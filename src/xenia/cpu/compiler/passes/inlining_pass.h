@@ -0,0 +1,70 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_INLINING_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_INLINING_PASS_H_
+
+#include <functional>
+#include <vector>
+
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+namespace xe {
+namespace cpu {
+class GuestFunction;
+}  // namespace cpu
+}  // namespace xe
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Replaces direct calls to small guest leaf functions with a copy of their
+// HIR so that later passes can optimize across the call.
+// Must run before the CFG is built, as it adds blocks without edges.
+class InliningPass : public CompilerPass {
+ public:
+  // Builds the finalized HIR of a guest function into a builder owned by the
+  // frontend, valid until the next call. Returns nullptr if the function
+  // can't be provided.
+  typedef std::function<hir::HIRBuilder*(GuestFunction* function)>
+      EmitFunction;
+
+  explicit InliningPass(EmitFunction emit_function);
+  ~InliningPass() override;
+
+  const char* name() const override { return "inlining"; }
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  struct Candidate {
+    GuestFunction* function;
+    uint32_t guest_size;
+    // Read once, as running guest code keeps counting while we sort.
+    uint32_t entry_count;
+    std::vector<hir::Instr*> call_sites;
+  };
+
+  GuestFunction* GetCandidateFunction(hir::Instr* call_instr);
+  bool IsInlinableLeaf(hir::HIRBuilder* callee_builder);
+  bool InlineCall(hir::HIRBuilder* builder, hir::Instr* call_instr,
+                  GuestFunction* function, hir::HIRBuilder* callee_builder);
+  void EmitReturn(hir::HIRBuilder* builder, hir::Instr* target_def,
+                  uint64_t return_address, hir::Label* continuation);
+
+  EmitFunction emit_function_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_INLINING_PASS_H_
@@ -0,0 +1,401 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/linear_scan_allocation_pass.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/compiler/passes/data_flow_analysis_pass.h"
+#include "xenia/cpu/cpu_flags.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::backend::MachineInfo;
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+namespace {
+
+// Guest code doesn't preserve any of our registers. Host calls go through
+// thunks that do, so only these need values moved out of the way.
+bool IsGuestCall(const Instr* i) {
+  return i->opcode == &OPCODE_CALL_info ||
+         i->opcode == &OPCODE_CALL_TRUE_info ||
+         i->opcode == &OPCODE_CALL_INDIRECT_info ||
+         i->opcode == &OPCODE_CALL_INDIRECT_TRUE_info;
+}
+
+// Constants are encoded into instructions and local slots are only addresses.
+bool IsAllocatable(const Value* value) {
+  return !value->IsConstant() && value->def;
+}
+
+// Spilled values and their reloads have intervals only an instruction long,
+// so spilling them again would never help.
+bool IsSpillable(const Value* value) { return !value->local_slot; }
+
+}  // namespace
+
+LinearScanAllocationPass::LinearScanAllocationPass(
+    const MachineInfo* machine_info)
+    : CompilerPass() {
+  std::memset(set_for_type_, 0, sizeof(set_for_type_));
+  auto mi_sets = machine_info->register_sets;
+  for (uint32_t n = 0; n < xe::countof(machine_info->register_sets) &&
+                       mi_sets[n].count;
+       ++n) {
+    auto& mi_set = mi_sets[n];
+    RegisterSetState state;
+    state.set = &mi_set;
+    sets_.push_back(state);
+    for (uint32_t type = 0; type < MAX_TYPENAME; ++type) {
+      uint32_t type_mask;
+      if (type <= INT64_TYPE) {
+        type_mask = MachineInfo::RegisterSet::INT_TYPES;
+      } else if (type <= FLOAT64_TYPE) {
+        type_mask = MachineInfo::RegisterSet::FLOAT_TYPES;
+      } else {
+        type_mask = MachineInfo::RegisterSet::VEC_TYPES;
+      }
+      if (mi_set.types & type_mask) {
+        set_for_type_[type] = n;
+      }
+    }
+  }
+}
+
+LinearScanAllocationPass::~LinearScanAllocationPass() = default;
+
+bool LinearScanAllocationPass::Run(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("cpu");
+
+  // Each round spills whatever didn't fit and starts over. New values are
+  // never spillable, so this settles within a few rounds.
+  uint32_t spill_count = 0;
+  uint32_t reload_count = 0;
+  while (true) {
+    uint32_t block_count = NumberInstructions(builder);
+    BuildIntervals(builder, block_count);
+    if (!AllocateIntervals()) {
+      // Nothing left to spill - this shouldn't happen.
+      XELOGE("Register allocation failed");
+      assert_always();
+      return false;
+    }
+    if (spilled_values_.empty()) {
+      break;
+    }
+    for (auto value : spilled_values_) {
+      reload_count += InsertSpillCode(builder, value);
+    }
+    spill_count += uint32_t(spilled_values_.size());
+  }
+
+  if (FLAGS_report_spills) {
+    uint32_t address = 0;
+    for (auto block = builder->first_block(); block && !address;
+         block = block->next) {
+      for (auto i = block->instr_head; i; i = i->next) {
+        if (i->opcode == &OPCODE_SOURCE_OFFSET_info) {
+          address = static_cast<uint32_t>(i->src1.offset);
+          break;
+        }
+      }
+    }
+    XELOGI("%.8X: %d values spilled, %d reloads, %d moves coalesced", address,
+           spill_count, reload_count, coalesced_count_);
+  }
+  return true;
+}
+
+uint32_t LinearScanAllocationPass::NumberInstructions(HIRBuilder* builder) {
+  uint16_t block_ordinal = 0;
+  uint32_t instr_ordinal = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    block->ordinal = block_ordinal++;
+    for (auto i = block->instr_head; i; i = i->next) {
+      i->ordinal = instr_ordinal++;
+    }
+  }
+  return block_ordinal;
+}
+
+void LinearScanAllocationPass::BuildIntervals(HIRBuilder* builder,
+                                              uint32_t block_count) {
+  intervals_.clear();
+  intervals_.resize(builder->max_value_ordinal(),
+                    {nullptr, 0, 0, 0, nullptr});
+  call_positions_.clear();
+
+  // Start every value at its def. Registers from earlier rounds are dropped.
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (!i->dest) {
+        continue;
+      }
+      auto& interval = intervals_[i->dest->ordinal];
+      interval.value = i->dest;
+      interval.start = interval.end = i->ordinal * 2 + 1;
+      interval.set_index = set_for_type_[i->dest->type];
+      if (GET_OPCODE_SIG_TYPE_SRC1(i->opcode->signature) ==
+              OPCODE_SIG_TYPE_V &&
+          IsAllocatable(i->src1.value)) {
+        interval.hint = i->src1.value;
+      }
+      i->dest->reg.set = nullptr;
+      i->dest->reg.index = 0;
+    }
+  }
+
+  // Then stretch them over their uses and any blocks they are live through.
+  // One interval per value is conservative around lifetime holes, but keeps
+  // the scan simple.
+  std::vector<llvm::BitVector> live_ins;
+  std::vector<llvm::BitVector> live_outs;
+  DataFlowAnalysisPass::ComputeLiveness(builder, block_count, &live_ins,
+                                        &live_outs);
+  for (auto block = builder->first_block(); block; block = block->next) {
+    if (!block->instr_head) {
+      continue;
+    }
+    uint32_t block_start = block->instr_head->ordinal * 2;
+    uint32_t block_end = block->instr_tail->ordinal * 2 + 1;
+    auto& live_in = live_ins[block->ordinal];
+    for (int n = live_in.find_first(); n != -1; n = live_in.find_next(n)) {
+      ExtendInterval(intervals_[n].value, block_start);
+    }
+    auto& live_out = live_outs[block->ordinal];
+    for (int n = live_out.find_first(); n != -1; n = live_out.find_next(n)) {
+      ExtendInterval(intervals_[n].value, block_end);
+    }
+    for (auto i = block->instr_head; i; i = i->next) {
+      uint32_t signature = i->opcode->signature;
+      if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
+          IsAllocatable(i->src1.value)) {
+        ExtendInterval(i->src1.value, i->ordinal * 2);
+      }
+      if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V &&
+          IsAllocatable(i->src2.value)) {
+        ExtendInterval(i->src2.value, i->ordinal * 2);
+      }
+      if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V &&
+          IsAllocatable(i->src3.value)) {
+        ExtendInterval(i->src3.value, i->ordinal * 2);
+      }
+      if (IsGuestCall(i)) {
+        call_positions_.push_back(i->ordinal * 2);
+      }
+    }
+  }
+}
+
+void LinearScanAllocationPass::ExtendInterval(Value* value,
+                                              uint32_t position) {
+  assert_not_null(value);
+  auto& interval = intervals_[value->ordinal];
+  interval.start = std::min(interval.start, position);
+  interval.end = std::max(interval.end, position);
+}
+
+bool LinearScanAllocationPass::AllocateIntervals() {
+  spilled_values_.clear();
+  coalesced_count_ = 0;
+  for (auto& state : sets_) {
+    state.availability.reset();
+    for (uint32_t n = 0; n < state.set->count; ++n) {
+      state.availability.set(n);
+    }
+    state.active.clear();
+  }
+
+  std::vector<Interval*> intervals;
+  for (auto& interval : intervals_) {
+    if (interval.value) {
+      intervals.push_back(&interval);
+    }
+  }
+  std::sort(intervals.begin(), intervals.end(),
+            [](const Interval* a, const Interval* b) {
+              return a->start < b->start;
+            });
+
+  for (auto interval : intervals) {
+    auto state = &sets_[interval->set_index];
+    ExpireIntervals(state, interval->start);
+
+    // Values live across a call would be clobbered in any register.
+    auto call_it = std::upper_bound(call_positions_.begin(),
+                                    call_positions_.end(), interval->start);
+    if (call_it != call_positions_.end() && *call_it < interval->end &&
+        IsSpillable(interval->value)) {
+      spilled_values_.push_back(interval->value);
+      continue;
+    }
+
+    if (TryAllocateHint(state, interval)) {
+      continue;
+    }
+    uint32_t index = 0;
+    while (index < state->set->count && !state->availability.test(index)) {
+      ++index;
+    }
+    if (index < state->set->count) {
+      interval->value->reg.set = state->set;
+      interval->value->reg.index = index;
+      state->availability.reset(index);
+      state->active.push_back(interval);
+    } else if (!SpillInterval(state, interval)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void LinearScanAllocationPass::ExpireIntervals(RegisterSetState* state,
+                                               uint32_t position) {
+  auto& active = state->active;
+  for (size_t n = 0; n < active.size();) {
+    if (active[n]->end < position) {
+      state->availability.set(active[n]->value->reg.index);
+      active.erase(active.begin() + n);
+    } else {
+      ++n;
+    }
+  }
+}
+
+bool LinearScanAllocationPass::TryAllocateHint(RegisterSetState* state,
+                                               Interval* interval) {
+  // Only useful when the hint dies at our def, so the emitter can operate in
+  // place (or skip a move entirely for assignments).
+  auto value = interval->value;
+  auto hint = interval->hint;
+  if (!hint || interval->start != value->def->ordinal * 2 + 1) {
+    return false;
+  }
+  auto& hint_interval = intervals_[hint->ordinal];
+  if (hint_interval.end != interval->start - 1 ||
+      hint->reg.set != state->set ||
+      !state->availability.test(hint->reg.index)) {
+    return false;
+  }
+  value->reg = hint->reg;
+  state->availability.reset(hint->reg.index);
+  state->active.push_back(interval);
+  if (value->def->opcode == &OPCODE_ASSIGN_info) {
+    ++coalesced_count_;
+  }
+  return true;
+}
+
+bool LinearScanAllocationPass::SpillInterval(RegisterSetState* state,
+                                             Interval* interval) {
+  // Spill whichever lives longest, freeing its register for the rest of it.
+  auto furthest = state->active.end();
+  for (auto it = state->active.begin(); it != state->active.end(); ++it) {
+    if (IsSpillable((*it)->value) &&
+        (furthest == state->active.end() || (*it)->end > (*furthest)->end)) {
+      furthest = it;
+    }
+  }
+  if (furthest != state->active.end() &&
+      (!IsSpillable(interval->value) || (*furthest)->end > interval->end)) {
+    auto spill_value = (*furthest)->value;
+    interval->value->reg = spill_value->reg;
+    spill_value->reg.set = nullptr;
+    state->active.erase(furthest);
+    state->active.push_back(interval);
+    spilled_values_.push_back(spill_value);
+    return true;
+  }
+  if (IsSpillable(interval->value)) {
+    spilled_values_.push_back(interval->value);
+    return true;
+  }
+  return false;
+}
+
+uint32_t LinearScanAllocationPass::InsertSpillCode(HIRBuilder* builder,
+                                                   Value* value) {
+  // Store right after the def, or after anything paired with it.
+  auto def = value->def;
+  auto store_before = def->next;
+  while (store_before &&
+         store_before->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
+    store_before = store_before->next;
+  }
+  auto def_tail = def->block->instr_tail;
+  value->local_slot = builder->AllocLocal(value->type);
+  builder->StoreLocal(value->local_slot, value);
+  auto store = builder->last_instr();
+  if (store_before) {
+    store->MoveBefore(store_before);
+  } else if (store->prev != def_tail) {
+    // Nothing follows the def in its block.
+    store->MoveBefore(def_tail);
+    def_tail->MoveBefore(store);
+  }
+
+  // Reload before each use. Uses are gathered first as renaming edits the
+  // use list.
+  std::vector<Instr*> use_instrs;
+  for (auto use = value->use_head; use; use = use->next) {
+    if (use->instr != store &&
+        std::find(use_instrs.begin(), use_instrs.end(), use->instr) ==
+            use_instrs.end()) {
+      use_instrs.push_back(use->instr);
+    }
+  }
+  for (auto use_instr : use_instrs) {
+    auto load_before = use_instr;
+    while (load_before->prev &&
+           load_before->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
+      load_before = load_before->prev;
+    }
+    auto new_value = builder->LoadLocal(value->local_slot);
+    builder->last_instr()->MoveBefore(load_before);
+    new_value->local_slot = value->local_slot;
+    new_value->last_use = use_instr;
+
+    uint32_t signature = use_instr->opcode->signature;
+    if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
+        use_instr->src1.value == value) {
+      use_instr->set_src1(new_value);
+    }
+    if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V &&
+        use_instr->src2.value == value) {
+      use_instr->set_src2(new_value);
+    }
+    if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V &&
+        use_instr->src3.value == value) {
+      use_instr->set_src3(new_value);
+    }
+  }
+  value->last_use = store;
+  return uint32_t(use_instrs.size());
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
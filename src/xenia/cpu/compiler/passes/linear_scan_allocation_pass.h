@@ -0,0 +1,80 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_LINEAR_SCAN_ALLOCATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_LINEAR_SCAN_ALLOCATION_PASS_H_
+
+#include <bitset>
+#include <vector>
+
+#include "xenia/cpu/backend/machine_info.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Function-wide register allocator. Each value gets a single live interval
+// over the linearized instructions (covering any blocks it is live through)
+// and intervals are assigned registers in order of their start. Values that
+// don't fit, or that are live across a guest call, are spilled to locals and
+// allocation is redone with the reloads.
+class LinearScanAllocationPass : public CompilerPass {
+ public:
+  explicit LinearScanAllocationPass(const backend::MachineInfo* machine_info);
+  ~LinearScanAllocationPass() override;
+
+  const char* name() const override { return "linear_scan_allocation"; }
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  struct Interval {
+    hir::Value* value;
+    // Instruction positions: uses are at ordinal * 2 and defs just after,
+    // so a value may take the register of a source that dies at its def.
+    uint32_t start;
+    uint32_t end;
+    uint32_t set_index;
+    // Preferred register donor: the first source of the def, to help along
+    // the two operand x86 instructions and coalesce assignments.
+    hir::Value* hint;
+  };
+  struct RegisterSetState {
+    const backend::MachineInfo::RegisterSet* set;
+    std::bitset<32> availability;
+    std::vector<Interval*> active;
+  };
+
+  uint32_t NumberInstructions(hir::HIRBuilder* builder);
+  void BuildIntervals(hir::HIRBuilder* builder, uint32_t block_count);
+  void ExtendInterval(hir::Value* value, uint32_t position);
+  bool AllocateIntervals();
+  void ExpireIntervals(RegisterSetState* state, uint32_t position);
+  bool TryAllocateHint(RegisterSetState* state, Interval* interval);
+  bool SpillInterval(RegisterSetState* state, Interval* interval);
+  // Returns the number of reloads added.
+  uint32_t InsertSpillCode(hir::HIRBuilder* builder, hir::Value* value);
+
+  std::vector<RegisterSetState> sets_;
+  uint32_t set_for_type_[hir::MAX_TYPENAME];
+
+  // Intervals by value ordinal; values without a def are unused.
+  std::vector<Interval> intervals_;
+  std::vector<uint32_t> call_positions_;
+  std::vector<hir::Value*> spilled_values_;
+  uint32_t coalesced_count_ = 0;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_LINEAR_SCAN_ALLOCATION_PASS_H_
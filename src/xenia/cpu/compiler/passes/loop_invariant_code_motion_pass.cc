@@ -0,0 +1,487 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/loop_invariant_code_motion_pass.h"
+
+#include "xenia/base/math.h"
+#include "xenia/base/profiling.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+namespace {
+
+// Vector constants kept in registers across a loop. Each one costs a register
+// for the whole loop, so only a few are worth it.
+const size_t kMaxLoopConstants = 4;
+
+bool IsPureOpcode(const OpcodeInfo* opcode) {
+  switch (opcode->num) {
+    case OPCODE_ASSIGN:
+    case OPCODE_CAST:
+    case OPCODE_ZERO_EXTEND:
+    case OPCODE_SIGN_EXTEND:
+    case OPCODE_TRUNCATE:
+    case OPCODE_CONVERT:
+    case OPCODE_ROUND:
+    case OPCODE_VECTOR_CONVERT_I2F:
+    case OPCODE_VECTOR_CONVERT_F2I:
+    case OPCODE_LOAD_VECTOR_SHL:
+    case OPCODE_LOAD_VECTOR_SHR:
+    case OPCODE_MAX:
+    case OPCODE_VECTOR_MAX:
+    case OPCODE_MIN:
+    case OPCODE_VECTOR_MIN:
+    case OPCODE_SELECT:
+    case OPCODE_IS_TRUE:
+    case OPCODE_IS_FALSE:
+    case OPCODE_IS_NAN:
+    case OPCODE_COMPARE_EQ:
+    case OPCODE_COMPARE_NE:
+    case OPCODE_COMPARE_SLT:
+    case OPCODE_COMPARE_SLE:
+    case OPCODE_COMPARE_SGT:
+    case OPCODE_COMPARE_SGE:
+    case OPCODE_COMPARE_ULT:
+    case OPCODE_COMPARE_ULE:
+    case OPCODE_COMPARE_UGT:
+    case OPCODE_COMPARE_UGE:
+    case OPCODE_VECTOR_COMPARE_EQ:
+    case OPCODE_VECTOR_COMPARE_SGT:
+    case OPCODE_VECTOR_COMPARE_SGE:
+    case OPCODE_VECTOR_COMPARE_UGT:
+    case OPCODE_VECTOR_COMPARE_UGE:
+    case OPCODE_ADD:
+    case OPCODE_ADD_CARRY:
+    case OPCODE_VECTOR_ADD:
+    case OPCODE_SUB:
+    case OPCODE_VECTOR_SUB:
+    case OPCODE_MUL:
+    case OPCODE_MUL_HI:
+    case OPCODE_MUL_ADD:
+    case OPCODE_MUL_SUB:
+    case OPCODE_NEG:
+    case OPCODE_ABS:
+    case OPCODE_SQRT:
+    case OPCODE_RSQRT:
+    case OPCODE_RECIP:
+    case OPCODE_POW2:
+    case OPCODE_LOG2:
+    case OPCODE_DOT_PRODUCT_3:
+    case OPCODE_DOT_PRODUCT_4:
+    case OPCODE_AND:
+    case OPCODE_OR:
+    case OPCODE_XOR:
+    case OPCODE_NOT:
+    case OPCODE_SHL:
+    case OPCODE_SHR:
+    case OPCODE_SHA:
+    case OPCODE_VECTOR_SHL:
+    case OPCODE_VECTOR_SHR:
+    case OPCODE_VECTOR_SHA:
+    case OPCODE_ROTATE_LEFT:
+    case OPCODE_VECTOR_ROTATE_LEFT:
+    case OPCODE_VECTOR_AVERAGE:
+    case OPCODE_BYTE_SWAP:
+    case OPCODE_CNTLZ:
+    case OPCODE_INSERT:
+    case OPCODE_EXTRACT:
+    case OPCODE_SPLAT:
+    case OPCODE_PERMUTE:
+    case OPCODE_SWIZZLE:
+    case OPCODE_PACK:
+    case OPCODE_UNPACK:
+      return true;
+    default:
+      // Division may fault, and everything else touches memory or state.
+      return false;
+  }
+}
+
+// Opcodes whose sequences load constant vector operands from memory on every
+// execution but take registers just as well. Opcodes with cheaper paths for
+// constants (shifts, permutes) are left alone.
+bool IsVectorConstantConsumer(const OpcodeInfo* opcode) {
+  switch (opcode->num) {
+    case OPCODE_MAX:
+    case OPCODE_VECTOR_MAX:
+    case OPCODE_MIN:
+    case OPCODE_VECTOR_MIN:
+    case OPCODE_SELECT:
+    case OPCODE_VECTOR_COMPARE_EQ:
+    case OPCODE_VECTOR_COMPARE_SGT:
+    case OPCODE_VECTOR_COMPARE_SGE:
+    case OPCODE_VECTOR_COMPARE_UGT:
+    case OPCODE_VECTOR_COMPARE_UGE:
+    case OPCODE_ADD:
+    case OPCODE_VECTOR_ADD:
+    case OPCODE_SUB:
+    case OPCODE_VECTOR_SUB:
+    case OPCODE_MUL:
+    case OPCODE_MUL_ADD:
+    case OPCODE_MUL_SUB:
+    case OPCODE_DOT_PRODUCT_3:
+    case OPCODE_DOT_PRODUCT_4:
+    case OPCODE_AND:
+    case OPCODE_OR:
+    case OPCODE_XOR:
+    case OPCODE_VECTOR_AVERAGE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Zero and all ones are a single register-only instruction to build.
+bool IsCheapVectorConstant(const Value* value) {
+  auto& v = value->constant.v128;
+  return (!v.low && !v.high) || (v.low == ~0ull && v.high == ~0ull);
+}
+
+}  // namespace
+
+LoopInvariantCodeMotionPass::LoopInvariantCodeMotionPass() : CompilerPass() {}
+
+LoopInvariantCodeMotionPass::~LoopInvariantCodeMotionPass() {}
+
+bool LoopInvariantCodeMotionPass::Run(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("cpu");
+
+  loop_analysis_.Analyze(builder);
+
+  // Innermost first, so things hoisted into a preheader that is itself in an
+  // outer loop can keep going.
+  for (auto& it : loop_analysis_.loops()) {
+    auto loop = it.get();
+    if (!CanOptimizeLoop(loop)) {
+      continue;
+    }
+    FindStoredContext(loop);
+
+    // Reassociation exposes new invariants and hoisting makes new operands
+    // invariant, so alternate until neither finds anything.
+    bool changed;
+    do {
+      changed = StrengthReduce(builder, loop);
+      changed = HoistInvariants(loop) > 0 || changed;
+    } while (changed);
+
+    if (IsInnermost(loop)) {
+      MaterializeConstants(builder, loop);
+    }
+  }
+
+  return true;
+}
+
+bool LoopInvariantCodeMotionPass::CanOptimizeLoop(const Loop* loop) {
+  if (!loop->preheader || !loop->preheader->instr_tail) {
+    return false;
+  }
+  // Calls, traps, barriers and rounding mode changes can change what the
+  // instructions we'd hoist compute, so leave those loops alone.
+  for (auto block : loop_analysis_.blocks()) {
+    if (!loop->Contains(block)) {
+      continue;
+    }
+    for (auto i = block->instr_head; i; i = i->next) {
+      if ((i->opcode->flags & OPCODE_FLAG_VOLATILE) &&
+          i->opcode != &OPCODE_BRANCH_info &&
+          i->opcode != &OPCODE_BRANCH_TRUE_info &&
+          i->opcode != &OPCODE_BRANCH_FALSE_info) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void LoopInvariantCodeMotionPass::FindStoredContext(const Loop* loop) {
+  stored_context_.clear();
+  for (auto block : loop_analysis_.blocks()) {
+    if (!loop->Contains(block)) {
+      continue;
+    }
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+        auto offset = static_cast<uint32_t>(i->src1.offset);
+        auto size = static_cast<uint32_t>(GetTypeSize(i->src2.value->type));
+        stored_context_.emplace_back(offset, offset + size);
+      } else if (i->opcode == &OPCODE_CONTEXT_BARRIER_info) {
+        stored_context_.emplace_back(0, UINT32_MAX);
+      }
+    }
+  }
+}
+
+bool LoopInvariantCodeMotionPass::IsInvariant(const Loop* loop,
+                                              const Value* value) {
+  if (value->IsConstant()) {
+    return true;
+  }
+  return value->def && !loop->Contains(value->def->block);
+}
+
+bool LoopInvariantCodeMotionPass::IsHoistable(const Loop* loop,
+                                              const Instr* i) {
+  if (!i->dest || (i->opcode->flags & OPCODE_FLAG_PAIRED_PREV) ||
+      (i->next && (i->next->opcode->flags & OPCODE_FLAG_PAIRED_PREV))) {
+    return false;
+  }
+  if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+    auto start = static_cast<uint32_t>(i->src1.offset);
+    auto end = start + static_cast<uint32_t>(GetTypeSize(i->dest->type));
+    for (auto& range : stored_context_) {
+      if (range.first < end && start < range.second) {
+        return false;
+      }
+    }
+    return true;
+  }
+  if (!IsPureOpcode(i->opcode)) {
+    return false;
+  }
+  uint32_t signature = i->opcode->signature;
+  if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
+      !IsInvariant(loop, i->src1.value)) {
+    return false;
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V &&
+      !IsInvariant(loop, i->src2.value)) {
+    return false;
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V &&
+      !IsInvariant(loop, i->src3.value)) {
+    return false;
+  }
+  return true;
+}
+
+bool LoopInvariantCodeMotionPass::StrengthReduce(HIRBuilder* builder,
+                                                 const Loop* loop) {
+  bool changed = false;
+  for (auto block : loop_analysis_.blocks()) {
+    if (!loop->Contains(block)) {
+      continue;
+    }
+    for (auto i = block->instr_head; i;) {
+      auto next = i->next;
+      if (i->opcode == &OPCODE_MUL_info && i->dest->type <= INT64_TYPE) {
+        // Index scaling: x * 2^n -> x << n.
+        auto value = i->src1.value;
+        auto scale = i->src2.value;
+        if (value->IsConstant()) {
+          std::swap(value, scale);
+        }
+        if (scale->IsConstant() && !value->IsConstant()) {
+          uint64_t multiplier = scale->AsUint64();
+          if (multiplier > 1 && !(multiplier & (multiplier - 1))) {
+            auto shift = builder->LoadConstantInt8(
+                static_cast<int8_t>(xe::log2_floor(multiplier)));
+            i->Replace(&OPCODE_SHL_info, 0);
+            i->set_src1(value);
+            i->set_src2(shift);
+            changed = true;
+          }
+        }
+      } else if (i->opcode == &OPCODE_ADD_info) {
+        changed = ReassociateAdd(builder, loop, i) || changed;
+      }
+      i = next;
+    }
+  }
+  return changed;
+}
+
+bool LoopInvariantCodeMotionPass::ReassociateAdd(HIRBuilder* builder,
+                                                 const Loop* loop, Instr* i) {
+  // (variant + a) + b -> variant + (a + b), where a and b are loop invariant
+  // and (a + b) can then be hoisted. This is the usual shape of addresses
+  // built from an induction variable, a base register and a displacement.
+  if (i->flags || i->dest->type > INT64_TYPE) {
+    return false;
+  }
+  for (int n = 0; n < 2; ++n) {
+    auto inner_value = n ? i->src2.value : i->src1.value;
+    auto outer_invariant = n ? i->src1.value : i->src2.value;
+    if (!IsInvariant(loop, outer_invariant) ||
+        IsInvariant(loop, inner_value)) {
+      continue;
+    }
+    auto inner = inner_value->def;
+    if (!inner || inner->opcode != &OPCODE_ADD_info || inner->flags ||
+        inner_value->use_head->next) {
+      continue;
+    }
+    Value* variant;
+    Value* inner_invariant;
+    if (IsInvariant(loop, inner->src2.value)) {
+      variant = inner->src1.value;
+      inner_invariant = inner->src2.value;
+    } else if (IsInvariant(loop, inner->src1.value)) {
+      variant = inner->src2.value;
+      inner_invariant = inner->src1.value;
+    } else {
+      continue;
+    }
+    if (IsInvariant(loop, variant)) {
+      // Both invariant: the inner add will be hoisted on its own.
+      continue;
+    }
+
+    // The builder has been finalized, so the new add is linked in right
+    // before its use instead of appended to a block.
+    Value* sum;
+    if (inner_invariant->IsConstant() && outer_invariant->IsConstant()) {
+      sum = builder->CloneValue(inner_invariant);
+      sum->Add(outer_invariant);
+    } else {
+      auto add = builder->InsertInstr(
+          OPCODE_ADD_info, 0, i, builder->AllocValue(inner_invariant->type));
+      add->set_src1(inner_invariant);
+      add->set_src2(outer_invariant);
+      sum = add->dest;
+    }
+    i->set_src1(variant);
+    i->set_src2(sum);
+    inner->Remove();
+    return true;
+  }
+  return false;
+}
+
+uint32_t LoopInvariantCodeMotionPass::HoistInvariants(const Loop* loop) {
+  uint32_t hoisted_count = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto block : loop_analysis_.blocks()) {
+      if (!loop->Contains(block)) {
+        continue;
+      }
+      for (auto i = block->instr_head; i;) {
+        auto next = i->next;
+        if (IsHoistable(loop, i)) {
+          AppendToPreheader(loop, i);
+          ++hoisted_count;
+          changed = true;
+        }
+        i = next;
+      }
+    }
+  }
+  return hoisted_count;
+}
+
+uint32_t LoopInvariantCodeMotionPass::MaterializeConstants(HIRBuilder* builder,
+                                                           const Loop* loop) {
+  std::vector<Value*> materialized;
+  auto materialize = [&](Value* constant) -> Value* {
+    for (auto value : materialized) {
+      auto& v = value->def->src1.value->constant.v128;
+      if (v.low == constant->constant.v128.low &&
+          v.high == constant->constant.v128.high) {
+        return value;
+      }
+    }
+    if (materialized.size() >= kMaxLoopConstants) {
+      return nullptr;
+    }
+    auto assign = builder->InsertInstr(OPCODE_ASSIGN_info, 0,
+                                       loop->preheader->instr_tail,
+                                       builder->AllocValue(constant->type));
+    assign->set_src1(constant);
+    AppendToPreheader(loop, assign);
+    auto value = assign->dest;
+    materialized.push_back(value);
+    return value;
+  };
+  auto is_candidate = [](Value* value) {
+    return value->IsConstant() && value->type == VEC128_TYPE &&
+           !IsCheapVectorConstant(value);
+  };
+
+  uint32_t replaced_count = 0;
+  for (auto block : loop_analysis_.blocks()) {
+    if (!loop->Contains(block)) {
+      continue;
+    }
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (!IsVectorConstantConsumer(i->opcode)) {
+        continue;
+      }
+      uint32_t signature = i->opcode->signature;
+      if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
+          is_candidate(i->src1.value)) {
+        if (auto value = materialize(i->src1.value)) {
+          i->set_src1(value);
+          ++replaced_count;
+        }
+      }
+      if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V &&
+          is_candidate(i->src2.value)) {
+        if (auto value = materialize(i->src2.value)) {
+          i->set_src2(value);
+          ++replaced_count;
+        }
+      }
+      if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V &&
+          is_candidate(i->src3.value)) {
+        if (auto value = materialize(i->src3.value)) {
+          i->set_src3(value);
+          ++replaced_count;
+        }
+      }
+    }
+  }
+  return replaced_count;
+}
+
+void LoopInvariantCodeMotionPass::AppendToPreheader(const Loop* loop,
+                                                    Instr* i) {
+  // Before the branches that end the preheader, or at its very end if it
+  // falls through into the loop.
+  auto preheader = loop->preheader;
+  Instr* first_branch = nullptr;
+  for (auto tail = preheader->instr_tail;
+       tail && (tail->opcode->flags & OPCODE_FLAG_BRANCH); tail = tail->prev) {
+    first_branch = tail;
+  }
+  if (first_branch) {
+    i->MoveBefore(first_branch);
+  } else {
+    auto tail = preheader->instr_tail;
+    i->MoveBefore(tail);
+    tail->MoveBefore(i);
+  }
+}
+
+bool LoopInvariantCodeMotionPass::IsInnermost(const Loop* loop) {
+  for (auto& other : loop_analysis_.loops()) {
+    if (other->parent == loop) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,64 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
+
+#include <utility>
+#include <vector>
+
+#include "xenia/cpu/compiler/compiler_pass.h"
+#include "xenia/cpu/compiler/loop_analysis.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Moves computations whose inputs don't change inside a loop into the loop
+// preheader: pure arithmetic, context loads of registers the loop never
+// stores, and vector constants that would otherwise be rebuilt on every use.
+// Address arithmetic is reassociated first so the invariant part of it can be
+// hoisted too.
+// Hoisted values are live across blocks, so this must run after DCE and be
+// followed by LinearScanAllocationPass.
+class LoopInvariantCodeMotionPass : public CompilerPass {
+ public:
+  LoopInvariantCodeMotionPass();
+  ~LoopInvariantCodeMotionPass() override;
+
+  const char* name() const override { return "loop_invariant_code_motion"; }
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  typedef LoopAnalysis::Loop Loop;
+
+  bool CanOptimizeLoop(const Loop* loop);
+  void FindStoredContext(const Loop* loop);
+  bool IsInvariant(const Loop* loop, const hir::Value* value);
+  bool IsHoistable(const Loop* loop, const hir::Instr* i);
+  bool StrengthReduce(hir::HIRBuilder* builder, const Loop* loop);
+  bool ReassociateAdd(hir::HIRBuilder* builder, const Loop* loop,
+                      hir::Instr* i);
+  uint32_t HoistInvariants(const Loop* loop);
+  uint32_t MaterializeConstants(hir::HIRBuilder* builder, const Loop* loop);
+  void AppendToPreheader(const Loop* loop, hir::Instr* i);
+  bool IsInnermost(const Loop* loop);
+
+  LoopAnalysis loop_analysis_;
+  // Context byte ranges ([start, end)) stored within the current loop.
+  std::vector<std::pair<uint32_t, uint32_t>> stored_context_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
@@ -16,6 +16,7 @@
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/profiling.h"
+#include "xenia/cpu/cpu_flags.h"
 
 namespace xe {
 namespace cpu {
@@ -79,6 +80,8 @@ bool RegisterAllocationPass::Run(HIRBuilder* builder) {
 
   uint16_t block_ordinal = 0;
   uint32_t instr_ordinal = 0;
+  spilled_value_count_ = 0;
+  reload_count_ = 0;
   auto block = builder->first_block();
   while (block) {
     // Sequential block ordinals.
@@ -170,6 +173,23 @@ bool RegisterAllocationPass::Run(HIRBuilder* builder) {
     block = block->next;
   }
 
+  if (FLAGS_report_spills) {
+    // Registers don't live across blocks here, so there are no moves to
+    // coalesce as with --linear_scan_register_allocation.
+    uint32_t address = 0;
+    for (block = builder->first_block(); block && !address;
+         block = block->next) {
+      for (auto i = block->instr_head; i; i = i->next) {
+        if (i->opcode == &OPCODE_SOURCE_OFFSET_info) {
+          address = static_cast<uint32_t>(i->src1.offset);
+          break;
+        }
+      }
+    }
+    XELOGI("%.8X: %d values spilled, %d reloads", address,
+           spilled_value_count_, reload_count_);
+  }
+
   return true;
 }
 
@@ -374,6 +394,7 @@ bool RegisterAllocationPass::SpillOneRegister(HIRBuilder* builder, Block* block,
   } else {
     // Allocate a local slot.
     spill_value->local_slot = builder->AllocLocal(spill_value->type);
+    ++spilled_value_count_;
 
     // Add store.
     builder->StoreLocal(spill_value->local_slot, spill_value);
@@ -420,6 +441,7 @@ bool RegisterAllocationPass::SpillOneRegister(HIRBuilder* builder, Block* block,
   auto new_value = builder->LoadLocal(spill_value->local_slot);
   auto spill_load = builder->last_instr();
   spill_load->MoveBefore(next_use->instr);
+  ++reload_count_;
   // Note: implicit first use added.
 
 #if ASSERT_NO_CYCLES
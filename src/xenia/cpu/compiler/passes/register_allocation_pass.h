@@ -28,6 +28,7 @@ class RegisterAllocationPass : public CompilerPass {
   explicit RegisterAllocationPass(const backend::MachineInfo* machine_info);
   ~RegisterAllocationPass() override;
 
+  const char* name() const override { return "register_allocation"; }
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
@@ -78,6 +79,9 @@ class RegisterAllocationPass : public CompilerPass {
     RegisterSetUsage* vec_set = nullptr;
     RegisterSetUsage* all_sets[3];
   } usage_sets_;
+  // For --report_spills.
+  uint32_t spilled_value_count_ = 0;
+  uint32_t reload_count_ = 0;
 };
 
 }  // namespace passes
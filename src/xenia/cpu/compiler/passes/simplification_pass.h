@@ -22,6 +22,7 @@ class SimplificationPass : public ConditionalGroupSubpass {
   SimplificationPass();
   ~SimplificationPass() override;
 
+  const char* name() const override { return "simplification"; }
   bool Run(hir::HIRBuilder* builder, bool& result) override;
 
  private:
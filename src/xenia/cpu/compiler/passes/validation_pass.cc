@@ -9,6 +9,10 @@
 
 #include "xenia/cpu/compiler/passes/validation_pass.h"
 
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/profiling.h"
 #include "xenia/cpu/backend/backend.h"
@@ -42,6 +46,8 @@ bool ValidationPass::Run(HIRBuilder* builder) {
   str.Reset();
 #endif  // 0
 
+  ComputeDominators(builder);
+
   auto block = builder->first_block();
   while (block) {
     auto label = block->label_head;
@@ -75,9 +81,16 @@ bool ValidationPass::ValidateInstruction(Block* block, Instr* instr) {
 
   if (instr->dest) {
     assert_true(instr->dest->def == instr);
+    // Uses may be in other blocks once context promotion forwards values
+    // across them or loop invariant code motion hoists their defs, as long
+    // as the def dominates them.
     auto use = instr->dest->use_head;
     while (use) {
-      assert_true(use->instr->block == block);
+      assert_true(use->instr->block == block ||
+                  Dominates(block, use->instr->block));
+      if (use->instr->block != block && !Dominates(block, use->instr->block)) {
+        return false;
+      }
       use = use->next;
     }
   }
@@ -113,6 +126,104 @@ bool ValidationPass::ValidateValue(Block* block, Instr* instr, Value* value) {
   return true;
 }
 
+void ValidationPass::ComputeDominators(HIRBuilder* builder) {
+  // Cooper, Harvey and Kennedy's "A Simple, Fast Dominance Algorithm". The
+  // CFG may be stale after simplification, so edges are taken from the
+  // branches.
+  postorder_numbers_.clear();
+  idoms_.clear();
+  auto entry = builder->first_block();
+  if (!entry) {
+    return;
+  }
+  auto get_successors = [](Block* block) {
+    std::vector<Block*> successors;
+    if (block->FallsThrough() && block->next) {
+      successors.push_back(block->next);
+    }
+    block->VisitBranchTargets(
+        [&successors](Block* target) { successors.push_back(target); });
+    return successors;
+  };
+
+  // Number the reachable blocks in postorder, without recursing as functions
+  // may have thousands of blocks.
+  std::unordered_map<Block*, std::vector<Block*>> predecessors;
+  std::vector<Block*> postorder;
+  std::unordered_set<Block*> visited = {entry};
+  std::vector<std::pair<Block*, std::vector<Block*>>> stack;
+  stack.emplace_back(entry, get_successors(entry));
+  while (!stack.empty()) {
+    auto block = stack.back().first;
+    auto& successors = stack.back().second;
+    if (successors.empty()) {
+      postorder_numbers_[block] = uint32_t(postorder.size());
+      postorder.push_back(block);
+      stack.pop_back();
+      continue;
+    }
+    auto successor = successors.back();
+    successors.pop_back();
+    predecessors[successor].push_back(block);
+    if (visited.insert(successor).second) {
+      stack.emplace_back(successor, get_successors(successor));
+    }
+  }
+
+  // Iterate in reverse postorder until the dominators settle. The entry is
+  // last in postorder.
+  idoms_[entry] = entry;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto it = postorder.rbegin() + 1; it != postorder.rend(); ++it) {
+      Block* new_idom = nullptr;
+      for (auto predecessor : predecessors[*it]) {
+        if (!idoms_.count(predecessor)) {
+          continue;
+        }
+        new_idom = new_idom ? IntersectDominators(predecessor, new_idom)
+                            : predecessor;
+      }
+      auto idom_it = idoms_.find(*it);
+      if (idom_it == idoms_.end()) {
+        idoms_.emplace(*it, new_idom);
+        changed = true;
+      } else if (idom_it->second != new_idom) {
+        idom_it->second = new_idom;
+        changed = true;
+      }
+    }
+  }
+}
+
+Block* ValidationPass::IntersectDominators(Block* a, Block* b) {
+  while (a != b) {
+    while (postorder_numbers_[a] < postorder_numbers_[b]) {
+      a = idoms_[a];
+    }
+    while (postorder_numbers_[b] < postorder_numbers_[a]) {
+      b = idoms_[b];
+    }
+  }
+  return a;
+}
+
+bool ValidationPass::Dominates(Block* dominator, Block* block) {
+  if (!postorder_numbers_.count(block)) {
+    // Unreachable, so never run.
+    return true;
+  }
+  while (block != dominator) {
+    auto idom = idoms_[block];
+    if (idom == block) {
+      return false;
+    }
+    block = idom;
+  }
+  return true;
+}
+
 }  // namespace passes
 }  // namespace compiler
 }  // namespace cpu
@@ -10,6 +10,8 @@
 #ifndef XENIA_CPU_COMPILER_PASSES_VALIDATION_PASS_H_
 #define XENIA_CPU_COMPILER_PASSES_VALIDATION_PASS_H_
 
+#include <unordered_map>
+
 #include "xenia/cpu/compiler/compiler_pass.h"
 
 namespace xe {
@@ -22,11 +24,21 @@ class ValidationPass : public CompilerPass {
   ValidationPass();
   ~ValidationPass() override;
 
+  const char* name() const override { return "validation"; }
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
   bool ValidateInstruction(hir::Block* block, hir::Instr* instr);
   bool ValidateValue(hir::Block* block, hir::Instr* instr, hir::Value* value);
+
+  void ComputeDominators(hir::HIRBuilder* builder);
+  hir::Block* IntersectDominators(hir::Block* a, hir::Block* b);
+  bool Dominates(hir::Block* dominator, hir::Block* block);
+
+  // Postorder numbers of the blocks reachable from the entry.
+  std::unordered_map<hir::Block*, uint32_t> postorder_numbers_;
+  // Immediate dominators. The entry block is its own.
+  std::unordered_map<hir::Block*, hir::Block*> idoms_;
 };
 
 }  // namespace passes
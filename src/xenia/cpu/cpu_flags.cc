@@ -28,13 +28,81 @@ DEFINE_bool(trace_function_references, false,
 DEFINE_bool(trace_function_data, false,
             "Generate tracing for function result data.");
 
+DEFINE_string(guest_profile_path, "",
+              "Sample running guest code and write collapsed stacks (for "
+              "flamegraph.pl) to this file on exit.");
+DEFINE_int32(guest_profile_rate, 1000,
+             "Samples per second for --guest_profile_path (of process CPU "
+             "time on Linux, of each running guest thread on Windows).");
+
+DEFINE_bool(replace_library_routines, true,
+            "Run recognized guest memcpy/memset/strlen/etc natively.");
+DEFINE_string(library_routine_signatures, "",
+              "File of '<code hash> <routine name>' lines identifying library "
+              "routines in titles without symbols. Hashes of routines named "
+              "by --load_module_map are logged at debug level.");
+
 DEFINE_bool(
     disable_global_lock, false,
     "Disables global lock usage in guest code. Does not affect host code.");
 
+DEFINE_bool(dirty_page_write_watches, false,
+            "Where the host supports it, track writes to watched physical "
+            "memory with dirty page bits collected at GPU sync points instead "
+            "of one access violation per page.");
+
 DEFINE_bool(validate_hir, false,
             "Perform validation checks on the HIR during compilation.");
 
+DEFINE_string(jit_cache_path, "",
+              "Folder to persist generated machine code in between runs. "
+              "Empty disables the persistent JIT cache.");
+DEFINE_int32(jit_cache_flush_interval, 60,
+             "Seconds between writes of the persistent JIT cache while "
+             "running, so a crash keeps most of the session's code. 0 only "
+             "writes it when modules load and at shutdown.");
+
+DEFINE_int32(aot_compile_threads, 0,
+             "Number of background threads compiling discovered functions "
+             "ahead of time. 0 disables, -1 uses all but one core.");
+DEFINE_int32(tier_up_threshold, 0,
+             "Compile functions with a fast baseline pipeline first and "
+             "recompile them with full optimizations in the background once "
+             "entered this many times. 0 optimizes everything up front.");
+DEFINE_int32(inline_max_instructions, 0,
+             "Largest guest leaf function (in instructions) inlined into its "
+             "callers by the optimizing compiler. 0 disables inlining.");
+DEFINE_int32(inline_max_growth, 100,
+             "Percentage a function may grow by through inlining.");
+DEFINE_bool(report_inlining, false, "Log each call inlined by the compiler.");
+DEFINE_bool(eliminate_dead_stores, true,
+            "Remove context stores that are overwritten before being read, "
+            "across blocks.");
+DEFINE_bool(report_dead_store_stats, false,
+            "Log the number of context stores removed and the total size of "
+            "optimized code on exit.");
+DEFINE_bool(linear_scan_register_allocation, true,
+            "Allocate registers across the whole function in optimized code "
+            "instead of block by block.");
+DEFINE_bool(global_context_promotion, true,
+            "Forward guest register values across blocks and loops instead of "
+            "reloading them from the context. Requires "
+            "--linear_scan_register_allocation.");
+DEFINE_bool(loop_invariant_code_motion, true,
+            "Hoist loop invariant computations and context loads out of "
+            "loops. Requires --linear_scan_register_allocation.");
+DEFINE_bool(recycle_hir_nodes, true,
+            "Reuse the instructions, uses and edges removed by each compiler "
+            "pass for the following passes instead of growing the arena.");
+DEFINE_bool(report_spills, false,
+            "Log the values spilled by register allocation in each function.");
+DEFINE_bool(report_compiler_stats, false,
+            "Log the time spent in each compiler pass and how it changed the "
+            "HIR, per module, on shutdown.");
+DEFINE_string(compiler_stats_path, "",
+              "Write compiler pass timings and HIR sizes to this JSON file on "
+              "shutdown.");
+
 // Breakpoints:
 DEFINE_uint64(break_on_instruction, 0,
               "int3 before the given guest address is executed.");
@@ -23,10 +23,34 @@ DECLARE_bool(trace_function_coverage);
 DECLARE_bool(trace_function_references);
 DECLARE_bool(trace_function_data);
 
+DECLARE_string(guest_profile_path);
+DECLARE_int32(guest_profile_rate);
+
+DECLARE_bool(replace_library_routines);
+DECLARE_string(library_routine_signatures);
 DECLARE_bool(disable_global_lock);
+DECLARE_bool(dirty_page_write_watches);
 
 DECLARE_bool(validate_hir);
 
+DECLARE_string(jit_cache_path);
+DECLARE_int32(jit_cache_flush_interval);
+
+DECLARE_int32(aot_compile_threads);
+DECLARE_int32(tier_up_threshold);
+DECLARE_int32(inline_max_instructions);
+DECLARE_int32(inline_max_growth);
+DECLARE_bool(report_inlining);
+DECLARE_bool(eliminate_dead_stores);
+DECLARE_bool(report_dead_store_stats);
+DECLARE_bool(linear_scan_register_allocation);
+DECLARE_bool(global_context_promotion);
+DECLARE_bool(loop_invariant_code_motion);
+DECLARE_bool(recycle_hir_nodes);
+DECLARE_bool(report_spills);
+DECLARE_bool(report_compiler_stats);
+DECLARE_string(compiler_stats_path);
+
 DECLARE_uint64(break_on_instruction);
 DECLARE_int32(break_condition_gpr);
 DECLARE_uint64(break_condition_value);
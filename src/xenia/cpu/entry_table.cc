@@ -9,26 +9,90 @@
 
 #include "xenia/cpu/entry_table.h"
 
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
-#include "xenia/base/threading.h"
 
 namespace xe {
 namespace cpu {
 
-EntryTable::EntryTable() = default;
+EntryTable::EntryTable() {
+  slots_ = reinterpret_cast<std::atomic<Entry*>*>(xe::memory::AllocFixed(
+      nullptr, kSlotTableSize, xe::memory::AllocationType::kReserve,
+      xe::memory::PageAccess::kNoAccess));
+  if (!slots_) {
+    // Everything will go through the map instead.
+    XELOGE("Unable to reserve function entry table");
+    return;
+  }
+  slot_page_size_ = xe::memory::page_size();
+  size_t page_count = kSlotTableSize / slot_page_size_;
+  committed_pages_.reset(new std::atomic<uint32_t>[(page_count + 31) / 32]);
+  for (size_t i = 0; i < (page_count + 31) / 32; ++i) {
+    committed_pages_[i] = 0;
+  }
+}
 
 EntryTable::~EntryTable() {
-  auto global_lock = global_critical_region_.Acquire();
-  for (auto it : map_) {
-    Entry* entry = it.second;
+  std::lock_guard<std::mutex> lock(entries_mutex_);
+  for (auto entry : entries_) {
     delete entry;
   }
+  for (auto entry : removed_entries_) {
+    delete entry;
+  }
+  if (slots_) {
+    xe::memory::DeallocFixed(slots_, kSlotTableSize,
+                             xe::memory::DeallocationType::kRelease);
+  }
+}
+
+std::atomic<Entry*>* EntryTable::LookupSlot(uint32_t address, bool commit) {
+  if (!slots_ || address < kCodeBase || address - kCodeBase >= kCodeSize) {
+    return nullptr;
+  }
+  auto slot = &slots_[(address - kCodeBase) / 4];
+
+  size_t page =
+      (reinterpret_cast<uint8_t*>(slot) - reinterpret_cast<uint8_t*>(slots_)) /
+      slot_page_size_;
+  auto& page_bits = committed_pages_[page / 32];
+  uint32_t page_bit = 1u << (page % 32);
+  if (page_bits.load(std::memory_order_acquire) & page_bit) {
+    return slot;
+  }
+  if (!commit) {
+    // Nothing has ever been created in this page.
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(commit_mutex_);
+  if (!(page_bits.load(std::memory_order_relaxed) & page_bit)) {
+    if (!xe::memory::AllocFixed(
+            reinterpret_cast<uint8_t*>(slots_) + page * slot_page_size_,
+            slot_page_size_, xe::memory::AllocationType::kCommit,
+            xe::memory::PageAccess::kReadWrite)) {
+      // Fall back to the map for this address.
+      return nullptr;
+    }
+    page_bits.fetch_or(page_bit, std::memory_order_release);
+  }
+  return slot;
 }
 
 Entry* EntryTable::Get(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
-  const auto& it = map_.find(address);
-  Entry* entry = it != map_.end() ? it->second : nullptr;
+  Entry* entry;
+  auto slot = LookupSlot(address, false);
+  if (slot) {
+    entry = slot->load(std::memory_order_acquire);
+  } else {
+    std::lock_guard<std::mutex> lock(entries_mutex_);
+    const auto& it = map_.find(address);
+    entry = it != map_.end() ? it->second : nullptr;
+  }
   if (entry) {
     // TODO(benvanik): wait if needed?
     if (entry->status != Entry::STATUS_READY) {
@@ -39,45 +103,81 @@ Entry* EntryTable::Get(uint32_t address) {
 }
 
 Entry::Status EntryTable::GetOrCreate(uint32_t address, Entry** out_entry) {
-  // TODO(benvanik): replace with a map with wait-free for find.
-  // https://github.com/facebook/folly/blob/master/folly/AtomicHashMap.h
-
-  auto global_lock = global_critical_region_.Acquire();
-  const auto& it = map_.find(address);
-  Entry* entry = it != map_.end() ? it->second : nullptr;
-  Entry::Status status;
-  if (entry) {
-    // If we aren't ready yet spin and wait.
-    if (entry->status == Entry::STATUS_COMPILING) {
-      // Still compiling, so spin.
-      do {
-        global_lock.unlock();
-        // TODO(benvanik): sleep for less time?
-        xe::threading::Sleep(std::chrono::microseconds(10));
-        global_lock.lock();
-      } while (entry->status == Entry::STATUS_COMPILING);
+  Entry* entry = nullptr;
+  bool created = false;
+  auto slot = LookupSlot(address, true);
+  if (slot) {
+    entry = slot->load(std::memory_order_acquire);
+    if (!entry) {
+      // Race to install a new entry; losers use the winner's.
+      auto new_entry = new Entry();
+      new_entry->address = address;
+      new_entry->end_address = 0;
+      new_entry->status = Entry::STATUS_COMPILING;
+      new_entry->function = nullptr;
+      if (slot->compare_exchange_strong(entry, new_entry,
+                                        std::memory_order_acq_rel)) {
+        entry = new_entry;
+        created = true;
+        std::lock_guard<std::mutex> lock(entries_mutex_);
+        entries_.push_back(entry);
+      } else {
+        delete new_entry;
+      }
     }
-    status = entry->status;
   } else {
-    // Create and return for initialization.
-    entry = new Entry();
-    entry->address = address;
-    entry->end_address = 0;
-    entry->status = Entry::STATUS_COMPILING;
-    entry->function = 0;
-    map_[address] = entry;
-    status = Entry::STATUS_NEW;
+    std::lock_guard<std::mutex> lock(entries_mutex_);
+    const auto& it = map_.find(address);
+    if (it != map_.end()) {
+      entry = it->second;
+    } else {
+      entry = new Entry();
+      entry->address = address;
+      entry->end_address = 0;
+      entry->status = Entry::STATUS_COMPILING;
+      entry->function = nullptr;
+      map_[address] = entry;
+      entries_.push_back(entry);
+      created = true;
+    }
   }
-  global_lock.unlock();
+
   *out_entry = entry;
+  if (created) {
+    return Entry::STATUS_NEW;
+  }
+  return WaitForEntry(entry);
+}
+
+void EntryTable::SetStatus(Entry* entry, Entry::Status status) {
+  entry->status = status;
+  // Taking the bucket lock orders this against waiters that have checked the
+  // status but not yet gone to sleep.
+  auto& bucket = wait_buckets_[(entry->address >> 2) % kWaitBucketCount];
+  { std::lock_guard<std::mutex> lock(bucket.mutex); }
+  bucket.cv.notify_all();
+}
+
+Entry::Status EntryTable::WaitForEntry(Entry* entry) {
+  Entry::Status status = entry->status;
+  if (status != Entry::STATUS_COMPILING) {
+    return status;
+  }
+  // If we aren't ready yet sleep until the compiling thread finishes.
+  SCOPE_profile_cpu_f("cpu");
+  auto& bucket = wait_buckets_[(entry->address >> 2) % kWaitBucketCount];
+  std::unique_lock<std::mutex> lock(bucket.mutex);
+  bucket.cv.wait(lock, [entry, &status]() {
+    status = entry->status;
+    return status != Entry::STATUS_COMPILING;
+  });
   return status;
 }
 
 std::vector<Function*> EntryTable::FindWithAddress(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
+  std::lock_guard<std::mutex> lock(entries_mutex_);
   std::vector<Function*> fns;
-  for (auto& it : map_) {
-    Entry* entry = it.second;
+  for (auto entry : entries_) {
     if (address >= entry->address && address <= entry->end_address) {
       if (entry->status == Entry::STATUS_READY) {
         fns.push_back(entry->function);
@@ -87,5 +187,25 @@ std::vector<Function*> EntryTable::FindWithAddress(uint32_t address) {
   return fns;
 }
 
+void EntryTable::RemoveRange(uint32_t low_address, uint32_t high_address) {
+  std::lock_guard<std::mutex> lock(entries_mutex_);
+  auto end = std::remove_if(
+      entries_.begin(), entries_.end(),
+      [this, low_address, high_address](Entry* entry) {
+        if (entry->address < low_address || entry->address >= high_address) {
+          return false;
+        }
+        auto slot = LookupSlot(entry->address, false);
+        if (slot) {
+          slot->store(nullptr, std::memory_order_release);
+        } else {
+          map_.erase(entry->address);
+        }
+        removed_entries_.push_back(entry);
+        return true;
+      });
+  entries_.erase(end, entries_.end());
+}
+
 }  // namespace cpu
 }  // namespace xe
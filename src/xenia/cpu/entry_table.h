@@ -10,11 +10,13 @@
 #ifndef XENIA_CPU_ENTRY_TABLE_H_
 #define XENIA_CPU_ENTRY_TABLE_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <vector>
 
-#include "xenia/base/mutex.h"
-
 namespace xe {
 namespace cpu {
 
@@ -30,24 +32,73 @@ typedef struct Entry_t {
 
   uint32_t address;
   uint32_t end_address;
-  Status status;
+  // Written only through EntryTable::SetStatus so that waiters are woken.
+  // function/end_address must be set before the entry becomes ready.
+  std::atomic<Status> status;
   Function* function;
 } Entry;
 
+// Maps guest function addresses to their resolution state.
+// Addresses within the guest code range are held in a direct-mapped table of
+// entry pointers (one slot per instruction) that is read without locks.
+// Pages of the table are committed as entries are created in them. Anything
+// outside of the range (such as builtins) goes to a locked map.
 class EntryTable {
  public:
+  static const uint32_t kCodeBase = 0x80000000;
+  static const uint32_t kCodeSize = 0x20000000;
+
   EntryTable();
   ~EntryTable();
 
+  // Returns the entry for the function at the given address if it is ready.
   Entry* Get(uint32_t address);
+  // Gets the entry for the given address, waiting if another thread is still
+  // compiling it. If STATUS_NEW is returned the caller owns the entry and must
+  // complete it with SetStatus.
   Entry::Status GetOrCreate(uint32_t address, Entry** out_entry);
+  // Sets the status of an entry and wakes all threads waiting on it.
+  void SetStatus(Entry* entry, Entry::Status status);
 
   std::vector<Function*> FindWithAddress(uint32_t address);
 
+  // Forgets all entries in [low_address, high_address), such as when the
+  // module containing them is unloaded. Entries are kept alive as other
+  // threads may still be looking at them.
+  void RemoveRange(uint32_t low_address, uint32_t high_address);
+
  private:
-  xe::global_critical_region global_critical_region_;
-  // TODO(benvanik): replace with a better data structure.
+  static const size_t kSlotCount = kCodeSize / 4;
+  static const size_t kSlotTableSize =
+      kSlotCount * sizeof(std::atomic<Entry*>);
+  static const size_t kWaitBucketCount = 64;
+
+  // Returns the slot for the address, or nullptr if it falls outside of the
+  // table, its page has never been committed (if !commit) or committing it
+  // failed.
+  std::atomic<Entry*>* LookupSlot(uint32_t address, bool commit);
+  Entry::Status WaitForEntry(Entry* entry);
+
+  // kSlotCount entries, reserved up front.
+  std::atomic<Entry*>* slots_ = nullptr;
+  size_t slot_page_size_ = 0;
+  // One bit per page of slots_, set once the page has been committed.
+  std::unique_ptr<std::atomic<uint32_t>[]> committed_pages_;
+  std::mutex commit_mutex_;
+
+  // Waiters on compiling entries park here, bucketed by address.
+  struct WaitBucket {
+    std::mutex mutex;
+    std::condition_variable cv;
+  };
+  WaitBucket wait_buckets_[kWaitBucketCount];
+
+  // Guards the entry list and the map of out-of-range entries.
+  std::mutex entries_mutex_;
+  std::vector<Entry*> entries_;
   std::unordered_map<uint32_t, Entry*> map_;
+  // Removed by RemoveRange, deleted along with the table.
+  std::vector<Entry*> removed_entries_;
 };
 
 }  // namespace cpu
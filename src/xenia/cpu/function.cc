@@ -9,6 +9,9 @@
 
 #include "xenia/cpu/function.h"
 
+#include <algorithm>
+
+#include "xenia/base/assert.h"
 #include "xenia/base/logging.h"
 #include "xenia/cpu/symbol.h"
 #include "xenia/cpu/thread_state.h"
@@ -66,59 +69,85 @@ void GuestFunction::SetupExtern(ExternHandler handler, Export* export_data) {
   export_data_ = export_data;
 }
 
-const SourceMapEntry* GuestFunction::LookupGuestAddress(
-    uint32_t guest_address) const {
-  // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (size_t i = 0; i < source_map_.size(); ++i) {
-    const auto& entry = source_map_[i];
-    if (entry.guest_address == guest_address) {
-      return &entry;
-    }
+void GuestFunction::set_optimized_function(
+    std::unique_ptr<GuestFunction> function) {
+  if (optimized_function_) {
+    replaced_functions_.push_back(std::move(optimized_function_));
   }
-  return nullptr;
+  optimized_function_ = std::move(function);
+  optimized_function_ptr_.store(optimized_function_.get(),
+                                std::memory_order_release);
 }
 
-const SourceMapEntry* GuestFunction::LookupHIROffset(uint32_t offset) const {
-  // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (size_t i = 0; i < source_map_.size(); ++i) {
-    const auto& entry = source_map_[i];
-    if (entry.hir_offset >= offset) {
-      return &entry;
-    }
-  }
-  return nullptr;
+bool GuestFunction::LookupGuestAddress(uint32_t guest_address,
+                                       SourceMapEntry* out_entry) const {
+  return source_map_.LookupGuestAddress(guest_address, out_entry);
 }
 
-const SourceMapEntry* GuestFunction::LookupMachineCodeOffset(
-    uint32_t offset) const {
-  // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (int64_t i = source_map_.size() - 1; i >= 0; --i) {
-    const auto& entry = source_map_[i];
-    if (entry.code_offset <= offset) {
-      return &entry;
-    }
-  }
-  return source_map_.empty() ? nullptr : &source_map_[0];
+bool GuestFunction::LookupHIROffset(uint32_t offset,
+                                    SourceMapEntry* out_entry) const {
+  return source_map_.LookupHIROffset(offset, out_entry);
+}
+
+bool GuestFunction::LookupMachineCodeOffset(uint32_t offset,
+                                            SourceMapEntry* out_entry) const {
+  return source_map_.LookupMachineCodeOffset(offset, out_entry);
 }
 
 uint32_t GuestFunction::MapGuestAddressToMachineCodeOffset(
     uint32_t guest_address) const {
-  auto entry = LookupGuestAddress(guest_address);
-  return entry ? entry->code_offset : 0;
+  SourceMapEntry entry;
+  return LookupGuestAddress(guest_address, &entry) ? entry.code_offset : 0;
 }
 
 uintptr_t GuestFunction::MapGuestAddressToMachineCode(
     uint32_t guest_address) const {
-  auto entry = LookupGuestAddress(guest_address);
+  SourceMapEntry entry;
   return reinterpret_cast<uintptr_t>(machine_code()) +
-         (entry ? entry->code_offset : 0);
+         (LookupGuestAddress(guest_address, &entry) ? entry.code_offset : 0);
+}
+
+void GuestFunction::SetInlinedCode(
+    const std::vector<InlinedFunctionRange>& ranges,
+    const std::vector<SourceMapEntry>& source_map) {
+  inlined_ranges_ = ranges;
+  inlined_source_map_.Assign(source_map);
+}
+
+const InlinedFunctionRange* GuestFunction::LookupInlinedRange(
+    uint32_t code_offset) const {
+  // Ranges are in emission order and don't overlap.
+  auto it = std::upper_bound(
+      inlined_ranges_.begin(), inlined_ranges_.end(), code_offset,
+      [](uint32_t offset, const InlinedFunctionRange& range) {
+        return offset < range.code_offset;
+      });
+  if (it == inlined_ranges_.begin()) {
+    return nullptr;
+  }
+  --it;
+  return code_offset < it->code_end_offset ? &*it : nullptr;
 }
 
 uint32_t GuestFunction::MapMachineCodeToGuestAddress(
     uintptr_t host_address) const {
-  auto entry = LookupMachineCodeOffset(static_cast<uint32_t>(
+  uint32_t code_offset = static_cast<uint32_t>(
+      host_address - reinterpret_cast<uintptr_t>(machine_code()));
+  SourceMapEntry entry;
+  if (LookupInlinedRange(code_offset)) {
+    return inlined_source_map_.LookupMachineCodeOffset(code_offset, &entry)
+               ? entry.guest_address
+               : address();
+  }
+  return LookupMachineCodeOffset(code_offset, &entry) ? entry.guest_address
+                                                      : address();
+}
+
+uint32_t GuestFunction::MapMachineCodeToInlinedFunction(
+    uintptr_t host_address) const {
+  auto range = LookupInlinedRange(static_cast<uint32_t>(
       host_address - reinterpret_cast<uintptr_t>(machine_code())));
-  return entry ? entry->guest_address : address();
+  return range ? range->function_address : 0;
 }
 
 bool GuestFunction::Call(ThreadState* thread_state, uint32_t return_address) {
@@ -129,7 +158,11 @@ bool GuestFunction::Call(ThreadState* thread_state, uint32_t return_address) {
     ThreadState::Bind(thread_state);
   }
 
-  bool result = CallImpl(thread_state, return_address);
+  auto optimized_function = this->optimized_function();
+  bool result =
+      optimized_function
+          ? optimized_function->CallImpl(thread_state, return_address)
+          : CallImpl(thread_state, return_address);
 
   if (original_thread_state != thread_state) {
     ThreadState::Bind(original_thread_state);
@@ -10,12 +10,14 @@
 #ifndef XENIA_CPU_FUNCTION_H_
 #define XENIA_CPU_FUNCTION_H_
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
 #include "xenia/cpu/function_debug_info.h"
 #include "xenia/cpu/function_trace_data.h"
 #include "xenia/cpu/ppc/ppc_context.h"
+#include "xenia/cpu/source_map.h"
 #include "xenia/cpu/symbol.h"
 #include "xenia/cpu/thread_state.h"
 
@@ -26,12 +28,6 @@ class Export;
 
 namespace cpu {
 
-struct SourceMapEntry {
-  uint32_t guest_address;  // PPC guest address (0x82....).
-  uint32_t hir_offset;     // Block ordinal (16b) | Instr ordinal (16b)
-  uint32_t code_offset;    // Offset from emitted code start.
-};
-
 class Function : public Symbol {
  public:
   enum class Behavior {
@@ -100,6 +96,14 @@ class GuestFunction : public Function {
   typedef void (*ExternHandler)(ppc::PPCContext* ppc_context,
                                 kernel::KernelState* kernel_state);
 
+  // Quality of the generated machine code. Baseline code is quick to build
+  // and counts its entries so that hot functions can be recompiled with all
+  // optimizations.
+  enum class Tier {
+    kBaseline,
+    kOptimized,
+  };
+
   GuestFunction(Module* module, uint32_t address);
   ~GuestFunction() override;
 
@@ -116,31 +120,73 @@ class GuestFunction : public Function {
     debug_info_ = std::move(debug_info);
   }
   FunctionTraceData& trace_data() { return trace_data_; }
-  std::vector<SourceMapEntry>& source_map() { return source_map_; }
+  Tier tier() const { return tier_; }
+  void set_tier(Tier value) { tier_ = value; }
+  // Incremented with a locked add by every entry into baseline code, so
+  // compiler threads only ever read it with an atomic load.
+  std::atomic<uint32_t>* entry_count_ptr() { return &entry_count_; }
+  uint32_t entry_count() const {
+    return entry_count_.load(std::memory_order_relaxed);
+  }
+  // Fully optimized replacement of baseline code, once it has been built.
+  // Calls made through this function are forwarded to it.
+  GuestFunction* optimized_function() const {
+    return optimized_function_ptr_.load(std::memory_order_acquire);
+  }
+  // Replacing an existing optimized function keeps it alive, as threads may
+  // still be running its code.
+  void set_optimized_function(std::unique_ptr<GuestFunction> function);
+  // Only covers this function's own guest code. Code inlined from other
+  // functions is mapped separately, so looking up one of their guest
+  // addresses never finds a copy inlined here.
+  SourceMap& source_map() { return source_map_; }
+  const SourceMap& source_map() const { return source_map_; }
+  const std::vector<InlinedFunctionRange>& inlined_ranges() const {
+    return inlined_ranges_;
+  }
+  // Entries are for the guest code of the inlined functions, in the ranges
+  // given.
+  void SetInlinedCode(const std::vector<InlinedFunctionRange>& ranges,
+                      const std::vector<SourceMapEntry>& source_map);
 
   ExternHandler extern_handler() const { return extern_handler_; }
   Export* export_data() const { return export_data_; }
   void SetupExtern(ExternHandler handler, Export* export_data = nullptr);
 
-  const SourceMapEntry* LookupGuestAddress(uint32_t guest_address) const;
-  const SourceMapEntry* LookupHIROffset(uint32_t offset) const;
-  const SourceMapEntry* LookupMachineCodeOffset(uint32_t offset) const;
+  bool LookupGuestAddress(uint32_t guest_address,
+                          SourceMapEntry* out_entry) const;
+  bool LookupHIROffset(uint32_t offset, SourceMapEntry* out_entry) const;
+  bool LookupMachineCodeOffset(uint32_t offset,
+                               SourceMapEntry* out_entry) const;
 
   uint32_t MapGuestAddressToMachineCodeOffset(uint32_t guest_address) const;
   uintptr_t MapGuestAddressToMachineCode(uint32_t guest_address) const;
+  // Addresses in inlined code map to the guest code of the inlined function.
   uint32_t MapMachineCodeToGuestAddress(uintptr_t host_address) const;
+  // Returns the guest address of the function whose code was inlined at the
+  // host address, or 0 if it's this function's own code.
+  uint32_t MapMachineCodeToInlinedFunction(uintptr_t host_address) const;
 
   bool Call(ThreadState* thread_state, uint32_t return_address) override;
 
  protected:
   virtual bool CallImpl(ThreadState* thread_state, uint32_t return_address) = 0;
 
+  const InlinedFunctionRange* LookupInlinedRange(uint32_t code_offset) const;
+
  protected:
   std::unique_ptr<FunctionDebugInfo> debug_info_;
   FunctionTraceData trace_data_;
-  std::vector<SourceMapEntry> source_map_;
+  SourceMap source_map_;
+  std::vector<InlinedFunctionRange> inlined_ranges_;
+  SourceMap inlined_source_map_;
   ExternHandler extern_handler_ = nullptr;
   Export* export_data_ = nullptr;
+  Tier tier_ = Tier::kOptimized;
+  std::atomic<uint32_t> entry_count_ = {0};
+  std::unique_ptr<GuestFunction> optimized_function_;
+  std::atomic<GuestFunction*> optimized_function_ptr_ = {nullptr};
+  std::vector<std::unique_ptr<GuestFunction>> replaced_functions_;
 };
 
 }  // namespace cpu
@@ -11,6 +11,7 @@
 
 #include "xenia/base/assert.h"
 #include "xenia/cpu/hir/instr.h"
+#include "xenia/cpu/hir/label.h"
 
 namespace xe {
 namespace cpu {
@@ -39,6 +40,32 @@ void Block::AssertNoCycles() {
   }
 }
 
+bool Block::FallsThrough() const {
+  auto tail = instr_tail;
+  if (!tail) {
+    return true;
+  }
+  if (tail->opcode == &OPCODE_CALL_info ||
+      tail->opcode == &OPCODE_CALL_INDIRECT_info) {
+    return !(tail->flags & CALL_TAIL);
+  }
+  return tail->opcode != &OPCODE_BRANCH_info &&
+         tail->opcode != &OPCODE_RETURN_info;
+}
+
+void Block::VisitBranchTargets(
+    const std::function<void(Block*)>& visitor) const {
+  for (auto i = instr_tail; i && (i->opcode->flags & OPCODE_FLAG_BRANCH);
+       i = i->prev) {
+    if (i->opcode == &OPCODE_BRANCH_info) {
+      visitor(i->src1.label->block);
+    } else if (i->opcode == &OPCODE_BRANCH_TRUE_info ||
+               i->opcode == &OPCODE_BRANCH_FALSE_info) {
+      visitor(i->src2.label->block);
+    }
+  }
+}
+
 }  // namespace hir
 }  // namespace cpu
 }  // namespace xe
@@ -10,6 +10,8 @@
 #ifndef XENIA_CPU_HIR_BLOCK_H_
 #define XENIA_CPU_HIR_BLOCK_H_
 
+#include <functional>
+
 #include "xenia/base/arena.h"
 
 namespace llvm {
@@ -64,6 +66,13 @@ class Block {
   uint16_t ordinal;
 
   void AssertNoCycles();
+
+  // Whether execution can continue past the end of the block into the next
+  // one. Finalized blocks end in a jump, but passes may remove it.
+  bool FallsThrough() const;
+  // Calls the visitor with the target of each branch at the end of the block,
+  // possibly more than once. The fall through block isn't included.
+  void VisitBranchTargets(const std::function<void(Block*)>& visitor) const;
 };
 
 }  // namespace hir
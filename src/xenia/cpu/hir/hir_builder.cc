@@ -510,6 +510,8 @@ void HIRBuilder::RemoveEdge(Edge* edge) {
     // Dest is now dominated by the last remaining edge.
     edge->dest->incoming_edge_head->flags |= Edge::DOMINATES;
   }
+
+  arena_->Retire(edge);
 }
 
 void HIRBuilder::RemoveBlock(Block* block) {
@@ -703,6 +705,32 @@ Instr* HIRBuilder::AppendInstr(const OpcodeInfo& opcode_info, uint16_t flags,
   return instr;
 }
 
+Instr* HIRBuilder::InsertInstr(const OpcodeInfo& opcode_info, uint16_t flags,
+                               Instr* before, Value* dest) {
+  Block* block = before->block;
+
+  Instr* instr = arena_->Alloc<Instr>();
+  instr->next = before;
+  instr->prev = before->prev;
+  if (before->prev) {
+    before->prev->next = instr;
+  } else {
+    block->instr_head = instr;
+  }
+  before->prev = instr;
+  instr->ordinal = UINT32_MAX;
+  instr->block = block;
+  instr->opcode = &opcode_info;
+  instr->flags = flags;
+  instr->dest = dest;
+  instr->src1.value = instr->src2.value = instr->src3.value = NULL;
+  instr->src1_use = instr->src2_use = instr->src3_use = NULL;
+  if (dest) {
+    dest->def = instr;
+  }
+  return instr;
+}
+
 Value* HIRBuilder::AllocValue(TypeName type) {
   Value* value = arena_->Alloc<Value>();
   value->ordinal = next_value_ordinal_++;
@@ -776,6 +804,40 @@ void HIRBuilder::Nop() {
   i->src1.value = i->src2.value = i->src3.value = NULL;
 }
 
+Instr* HIRBuilder::CloneInstr(const Instr* source) {
+  const OpcodeInfo* info = source->opcode;
+  Value* dest =
+      source->dest ? reinterpret_cast<Value*>(source->dest->tag) : nullptr;
+  Instr* i = AppendInstr(*info, source->flags, dest);
+  auto map_op = [](OpcodeSignatureType sig_type, Instr::Op op) {
+    if (sig_type == OPCODE_SIG_TYPE_L) {
+      op.label = reinterpret_cast<Label*>(op.label->tag);
+    } else if (sig_type == OPCODE_SIG_TYPE_V && op.value) {
+      op.value = reinterpret_cast<Value*>(op.value->tag);
+    }
+    return op;
+  };
+  auto src1_type = GET_OPCODE_SIG_TYPE_SRC1(info->signature);
+  auto src2_type = GET_OPCODE_SIG_TYPE_SRC2(info->signature);
+  auto src3_type = GET_OPCODE_SIG_TYPE_SRC3(info->signature);
+  if (src1_type == OPCODE_SIG_TYPE_V) {
+    i->set_src1(map_op(src1_type, source->src1).value);
+  } else {
+    i->src1 = map_op(src1_type, source->src1);
+  }
+  if (src2_type == OPCODE_SIG_TYPE_V) {
+    i->set_src2(map_op(src2_type, source->src2).value);
+  } else {
+    i->src2 = map_op(src2_type, source->src2);
+  }
+  if (src3_type == OPCODE_SIG_TYPE_V) {
+    i->set_src3(map_op(src3_type, source->src3).value);
+  } else {
+    i->src3 = map_op(src3_type, source->src3);
+  }
+  return i;
+}
+
 void HIRBuilder::SourceOffset(uint32_t offset) {
   Instr* i = AppendInstr(OPCODE_SOURCE_OFFSET_info, 0);
   i->src1.offset = offset;
@@ -963,6 +1025,15 @@ Value* HIRBuilder::Assign(Value* value) {
   return i->dest;
 }
 
+Value* HIRBuilder::AssignConstant(Value* value) {
+  assert_true(value->IsConstant());
+
+  Instr* i = AppendInstr(OPCODE_ASSIGN_info, 0, AllocValue(value->type));
+  i->set_src1(value);
+  i->src2.value = i->src3.value = NULL;
+  return i->dest;
+}
+
 Value* HIRBuilder::Cast(Value* value, TypeName target_type) {
   if (value->type == target_type) {
     return value;
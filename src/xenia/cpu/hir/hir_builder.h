@@ -27,6 +27,8 @@ namespace hir {
 
 enum FunctionAttributes {
   FUNCTION_ATTRIB_INLINE = (1 << 1),
+  // Contains code from other functions inlined into it.
+  FUNCTION_ATTRIB_HAS_INLINED_CALLS = (1 << 2),
 };
 
 class HIRBuilder {
@@ -74,6 +76,16 @@ class HIRBuilder {
 
   void Nop();
 
+  // Appends a copy of an instruction from another builder. The values and
+  // labels it references must have been mapped to ones in this builder through
+  // their tag fields.
+  Instr* CloneInstr(const Instr* source);
+  // Adds an instruction directly before an existing one, for passes that run
+  // once the builder has been finalized and there is no block to append to.
+  // Sources are left for the caller to set.
+  Instr* InsertInstr(const OpcodeInfo& opcode, uint16_t flags, Instr* before,
+                     Value* dest = 0);
+
   void SourceOffset(uint32_t offset);
 
   // trace info/etc
@@ -102,6 +114,9 @@ class HIRBuilder {
 
   // phi type_name, Block* b1, Value* v1, Block* b2, Value* v2, etc
   Value* Assign(Value* value);
+  // Like Assign but always emits the assignment, so a constant that is
+  // expensive to rematerialize can be kept in a register.
+  Value* AssignConstant(Value* value);
   Value* Cast(Value* value, TypeName target_type);
   Value* ZeroExtend(Value* value, TypeName target_type);
   Value* SignExtend(Value* value, TypeName target_type);
@@ -9,6 +9,7 @@
 
 #include "xenia/cpu/hir/instr.h"
 
+#include "xenia/base/arena.h"
 #include "xenia/cpu/hir/block.h"
 
 namespace xe {
@@ -21,6 +22,7 @@ void Instr::set_src1(Value* value) {
   }
   if (src1_use) {
     src1.value->RemoveUse(src1_use);
+    block->arena->Retire(src1_use);
   }
   src1.value = value;
   src1_use = value ? value->AddUse(block->arena, this) : NULL;
@@ -32,6 +34,7 @@ void Instr::set_src2(Value* value) {
   }
   if (src2_use) {
     src2.value->RemoveUse(src2_use);
+    block->arena->Retire(src2_use);
   }
   src2.value = value;
   src2_use = value ? value->AddUse(block->arena, this) : NULL;
@@ -43,6 +46,7 @@ void Instr::set_src3(Value* value) {
   }
   if (src3_use) {
     src3.value->RemoveUse(src3_use);
+    block->arena->Retire(src3_use);
   }
   src3.value = value;
   src3_use = value ? value->AddUse(block->arena, this) : NULL;
@@ -84,16 +88,19 @@ void Instr::Replace(const OpcodeInfo* new_opcode, uint16_t new_flags) {
 
   if (src1_use) {
     src1.value->RemoveUse(src1_use);
+    block->arena->Retire(src1_use);
     src1.value = NULL;
     src1_use = NULL;
   }
   if (src2_use) {
     src2.value->RemoveUse(src2_use);
+    block->arena->Retire(src2_use);
     src2.value = NULL;
     src2_use = NULL;
   }
   if (src3_use) {
     src3.value->RemoveUse(src3_use);
+    block->arena->Retire(src3_use);
     src3.value = NULL;
     src3_use = NULL;
   }
@@ -113,6 +120,13 @@ void Instr::Remove() {
   } else {
     block->instr_tail = prev;
   }
+
+  // The dest may outlive us (as a constant, say); don't leave it pointing at
+  // memory that will be reused. Links are kept so loops can step past us.
+  if (dest && dest->def == this) {
+    dest->def = NULL;
+  }
+  block->arena->Retire(this);
 }
 
 }  // namespace hir
@@ -21,6 +21,13 @@ enum CallFlags {
   CALL_POSSIBLE_RETURN = (1 << 2),
 };
 
+enum SourceOffsetFlags {
+  // Guest code of another function inlined into this one. The first source
+  // offset of each inlined copy is also marked as its entry.
+  SOURCE_OFFSET_INLINED = (1 << 1),
+  SOURCE_OFFSET_INLINED_ENTRY = (1 << 2),
+};
+
 enum BranchFlags {
   BRANCH_LIKELY = (1 << 1),
   BRANCH_UNLIKELY = (1 << 2),
@@ -37,6 +44,10 @@ enum RoundMode {
 
 enum LoadStoreFlags {
   LOAD_STORE_BYTE_SWAP = 1 << 0,
+  // The guest instruction has been seen accessing an MMIO range, so the
+  // address is checked against the MMIO handler at runtime instead of relying
+  // on an access violation.
+  LOAD_STORE_MMIO = 1 << 1,
 };
 
 enum PrefetchFlags {
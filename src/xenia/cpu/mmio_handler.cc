@@ -9,12 +9,18 @@
 
 #include "xenia/cpu/mmio_handler.h"
 
+#include <cinttypes>
+#include <iterator>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_order.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/exception_handler.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/cpu_flags.h"
 
 namespace xe {
 namespace cpu {
@@ -40,9 +46,30 @@ std::unique_ptr<MMIOHandler> MMIOHandler::Install(uint8_t* virtual_membase,
   return handler;
 }
 
+MMIOHandler::MMIOHandler(uint8_t* virtual_membase, uint8_t* physical_membase,
+                         uint8_t* membase_end)
+    : virtual_membase_(virtual_membase),
+      physical_membase_(physical_membase),
+      memory_end_(membase_end) {
+  if (FLAGS_dirty_page_write_watches) {
+    dirty_page_tracking_ = memory::IsDirtyPageTrackingSupported() &&
+                           EnableDirtyPhysicalPageTracking();
+    if (!dirty_page_tracking_) {
+      XELOGW("Dirty page tracking is unavailable; write watches will protect "
+             "their pages");
+    }
+  }
+}
+
 MMIOHandler::~MMIOHandler() {
   ExceptionHandler::Uninstall(ExceptionCallbackThunk, this);
 
+  if (watch_fault_count_) {
+    auto stats = QueryAccessWatchStats();
+    XELOGI("Access watches: %" PRIu64 " faults, %.2f ms in the fault handler",
+           stats.fault_count, stats.fault_handler_ns / 1000000.0);
+  }
+
   assert_true(global_handler_ == this);
   global_handler_ = nullptr;
 }
@@ -62,6 +89,25 @@ bool MMIOHandler::RegisterRange(uint32_t virtual_address, uint32_t mask,
   return true;
 }
 
+void MMIOHandler::SetAccessSiteCallback(AccessSiteCallback callback,
+                                        void* callback_context) {
+  std::lock_guard<std::mutex> lock(access_sites_mutex_);
+  access_site_callback_ = callback;
+  access_site_callback_context_ = callback_context;
+}
+
+void MMIOHandler::InvalidateAccessSites(uint64_t host_start,
+                                        uint64_t host_end) {
+  std::lock_guard<std::mutex> lock(access_sites_mutex_);
+  for (auto it = access_sites_.begin(); it != access_sites_.end();) {
+    if (it->first >= host_start && it->first < host_end) {
+      it = access_sites_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
 MMIORange* MMIOHandler::LookupRange(uint32_t virtual_address) {
   for (auto& range : mapped_ranges_) {
     if ((virtual_address & range.mask) == range.address) {
@@ -109,49 +155,28 @@ uintptr_t MMIOHandler::AddPhysicalAccessWatch(uint32_t guest_address,
 
   auto lock = global_critical_region_.Acquire();
 
-  // Fire any access watches that overlap this region.
-  for (auto it = access_watches_.begin(); it != access_watches_.end();) {
-    // Case 1: 2222222|222|11111111
-    // Case 2: 1111111|222|22222222
-    // Case 3: 1111111|222|11111111 (fragmentation)
-    // Case 4: 2222222|222|22222222 (complete overlap)
-    bool hit = false;
-    auto entry = *it;
-
-    if (base_address <= (*it)->address &&
-        base_address + length > (*it)->address) {
-      hit = true;
-    } else if ((*it)->address <= base_address &&
-               (*it)->address + (*it)->length > base_address) {
-      hit = true;
-    } else if ((*it)->address <= base_address &&
-               (*it)->address + (*it)->length > base_address + length) {
-      hit = true;
-    } else if ((*it)->address >= base_address &&
-               (*it)->address + (*it)->length < base_address + length) {
-      hit = true;
-    }
+  // Fire any access watches that overlap this region. This keeps the table
+  // free of overlapping entries.
+  std::vector<AccessWatchEntry*> overlapping;
+  TakeOverlappingWatches(base_address, uint64_t(base_address) + length,
+                         &overlapping);
+  FireAccessWatches(overlapping);
 
-    if (hit) {
-      FireAccessWatch(*it);
-      it = access_watches_.erase(it);
-      delete entry;
-      continue;
-    }
-
-    ++it;
-  }
-
-  // Add to table. The slot reservation may evict a previous watch, which
-  // could include our target, so we do it first.
   auto entry = new AccessWatchEntry();
   entry->address = base_address;
   entry->length = uint32_t(length);
   entry->type = type;
+  // Only writes from here on count.
+  entry->dirty_tracked = dirty_page_tracking_ && type == kWatchWrite &&
+                         ResetDirtyPhysicalPages(base_address, uint32_t(length));
+  if (entry->dirty_tracked) {
+    ++dirty_tracked_watch_count_;
+  }
   entry->callback = callback;
   entry->callback_context = callback_context;
   entry->callback_data = callback_data;
-  access_watches_.push_back(entry);
+  access_watches_.emplace(base_address, entry);
+  COUNT_profile_set("cpu/mmio/access_watches", access_watches_.size());
 
   auto page_access = memory::PageAccess::kNoAccess;
   switch (type) {
@@ -167,33 +192,109 @@ uintptr_t MMIOHandler::AddPhysicalAccessWatch(uint32_t guest_address,
   }
 
   // Protect the range under all address spaces
-  memory::Protect(physical_membase_ + entry->address, entry->length,
-                  page_access, nullptr);
-  memory::Protect(virtual_membase_ + 0xA0000000 + entry->address, entry->length,
-                  page_access, nullptr);
-  memory::Protect(virtual_membase_ + 0xC0000000 + entry->address, entry->length,
-                  page_access, nullptr);
-  memory::Protect(virtual_membase_ + 0xE0000000 + entry->address + 0x1000, entry->length,
-                  page_access, nullptr);
+  if (!entry->dirty_tracked) {
+    ProtectPhysicalRange(entry->address, entry->length, page_access);
+  }
 
   return reinterpret_cast<uintptr_t>(entry);
 }
 
-void MMIOHandler::FireAccessWatch(AccessWatchEntry* entry) {
-  ClearAccessWatch(entry);
-  entry->callback(entry->callback_context, entry->callback_data,
-                  entry->address);
+void MMIOHandler::ProtectPhysicalRange(uint32_t address, uint32_t length,
+                                       memory::PageAccess access) {
+  memory::Protect(physical_membase_ + address, length, access, nullptr);
+  memory::Protect(virtual_membase_ + 0xA0000000 + address, length, access,
+                  nullptr);
+  memory::Protect(virtual_membase_ + 0xC0000000 + address, length, access,
+                  nullptr);
+  memory::Protect(virtual_membase_ + 0xE0000000 + address + 0x1000, length,
+                  access, nullptr);
+}
+
+bool MMIOHandler::EnableDirtyPhysicalPageTracking() {
+  return memory::EnableDirtyPageTracking(physical_membase_, 0x20000000) &&
+         memory::EnableDirtyPageTracking(virtual_membase_ + 0xA0000000,
+                                         0x20000000) &&
+         memory::EnableDirtyPageTracking(virtual_membase_ + 0xC0000000,
+                                         0x20000000) &&
+         memory::EnableDirtyPageTracking(virtual_membase_ + 0xE0000000,
+                                         0x20000000);
+}
+
+bool MMIOHandler::ResetDirtyPhysicalPages(uint32_t address, uint32_t length) {
+  return memory::ResetDirtyPages(physical_membase_ + address, length) &&
+         memory::ResetDirtyPages(virtual_membase_ + 0xA0000000 + address,
+                                 length) &&
+         memory::ResetDirtyPages(virtual_membase_ + 0xC0000000 + address,
+                                 length) &&
+         memory::ResetDirtyPages(
+             virtual_membase_ + 0xE0000000 + address + 0x1000, length);
+}
+
+bool MMIOHandler::QueryAndResetDirtyPhysicalPages(uint32_t address,
+                                                  uint32_t length,
+                                                  uint64_t* dirty_bitmap) {
+  return memory::QueryAndResetDirtyPages(physical_membase_ + address, length,
+                                         dirty_bitmap) &&
+         memory::QueryAndResetDirtyPages(
+             virtual_membase_ + 0xA0000000 + address, length, dirty_bitmap) &&
+         memory::QueryAndResetDirtyPages(
+             virtual_membase_ + 0xC0000000 + address, length, dirty_bitmap) &&
+         memory::QueryAndResetDirtyPages(
+             virtual_membase_ + 0xE0000000 + address + 0x1000, length,
+             dirty_bitmap);
 }
 
-void MMIOHandler::ClearAccessWatch(AccessWatchEntry* entry) {
-  memory::Protect(physical_membase_ + entry->address, entry->length,
-                  xe::memory::PageAccess::kReadWrite, nullptr);
-  memory::Protect(virtual_membase_ + 0xA0000000 + entry->address, entry->length,
-                  xe::memory::PageAccess::kReadWrite, nullptr);
-  memory::Protect(virtual_membase_ + 0xC0000000 + entry->address, entry->length,
-                  xe::memory::PageAccess::kReadWrite, nullptr);
-  memory::Protect(virtual_membase_ + 0xE0000000 + entry->address + 0x1000, entry->length,
-                  xe::memory::PageAccess::kReadWrite, nullptr);
+void MMIOHandler::TakeOverlappingWatches(
+    uint32_t address, uint64_t end,
+    std::vector<AccessWatchEntry*>* out_entries) {
+  // Entries don't overlap, so only the last one starting at or below the
+  // address can contain it. Everything after that starting before the end of
+  // the range overlaps.
+  auto first = access_watches_.upper_bound(address);
+  auto it = first;
+  if (first != access_watches_.begin()) {
+    auto prev = std::prev(first);
+    if (uint64_t(prev->second->address) + prev->second->length > address) {
+      out_entries->push_back(prev->second);
+      first = prev;
+    }
+  }
+  for (; it != access_watches_.end() && it->first < end; ++it) {
+    out_entries->push_back(it->second);
+  }
+  if (first != it) {
+    access_watches_.erase(first, it);
+    COUNT_profile_set("cpu/mmio/access_watches", access_watches_.size());
+  }
+}
+
+void MMIOHandler::FireAccessWatches(
+    const std::vector<AccessWatchEntry*>& entries) {
+  // Restore access to all pages first, so callbacks see the final protection
+  // and adjacent watches (common for neighbouring textures) cost one call.
+  for (size_t i = 0; i < entries.size();) {
+    if (entries[i]->dirty_tracked) {
+      ++i;
+      continue;
+    }
+    uint32_t run_address = entries[i]->address;
+    uint32_t run_end = run_address + entries[i]->length;
+    for (++i; i < entries.size() && !entries[i]->dirty_tracked &&
+              entries[i]->address == run_end;
+         ++i) {
+      run_end += entries[i]->length;
+    }
+    ProtectPhysicalRange(run_address, run_end - run_address,
+                         memory::PageAccess::kReadWrite);
+  }
+  for (auto entry : entries) {
+    if (entry->dirty_tracked) {
+      --dirty_tracked_watch_count_;
+    }
+    entry->callback(entry->callback_context, entry->callback_data,
+                    entry->address);
+    delete entry;
+  }
 }
 
 void MMIOHandler::CancelAccessWatch(uintptr_t watch_handle) {
@@ -201,14 +302,20 @@ void MMIOHandler::CancelAccessWatch(uintptr_t watch_handle) {
   auto lock = global_critical_region_.Acquire();
 
   // Allow access to the range again.
-  ClearAccessWatch(entry);
+  if (entry->dirty_tracked) {
+    --dirty_tracked_watch_count_;
+  } else {
+    ProtectPhysicalRange(entry->address, entry->length,
+                         memory::PageAccess::kReadWrite);
+  }
 
   // Remove from table.
-  auto it = std::find(access_watches_.begin(), access_watches_.end(), entry);
-  assert_false(it == access_watches_.end());
+  auto it = access_watches_.find(entry->address);
+  assert_false(it == access_watches_.end() || it->second != entry);
 
-  if (it != access_watches_.end()) {
+  if (it != access_watches_.end() && it->second == entry) {
     access_watches_.erase(it);
+    COUNT_profile_set("cpu/mmio/access_watches", access_watches_.size());
   }
 
   delete entry;
@@ -217,95 +324,162 @@ void MMIOHandler::CancelAccessWatch(uintptr_t watch_handle) {
 void MMIOHandler::InvalidateRange(uint32_t physical_address, size_t length) {
   auto lock = global_critical_region_.Acquire();
 
-  for (auto it = access_watches_.begin(); it != access_watches_.end();) {
-    auto entry = *it;
-    if ((entry->address <= physical_address &&
-         entry->address + entry->length > physical_address) ||
-        (entry->address >= physical_address &&
-         entry->address < physical_address + length)) {
-      // This watch lies within the range. End it.
-      FireAccessWatch(entry);
-      it = access_watches_.erase(it);
-      delete entry;
-      continue;
-    }
-
-    ++it;
-  }
+  // Any watch that lies within the range is ended.
+  std::vector<AccessWatchEntry*> overlapping;
+  TakeOverlappingWatches(physical_address, uint64_t(physical_address) + length,
+                         &overlapping);
+  FireAccessWatches(overlapping);
 }
 
 bool MMIOHandler::IsRangeWatched(uint32_t physical_address, size_t length) {
   auto lock = global_critical_region_.Acquire();
 
-  for (auto it = access_watches_.begin(); it != access_watches_.end(); ++it) {
-    auto entry = *it;
-    if ((entry->address <= physical_address &&
-         entry->address + entry->length > physical_address + length)) {
-      // This range lies entirely within this watch.
+  // Walk the run of adjacent watches starting at the one containing the
+  // address until the range is covered or there is a gap.
+  uint64_t address = physical_address;
+  uint64_t end = address + length;
+  auto it = access_watches_.upper_bound(physical_address);
+  if (it == access_watches_.begin()) {
+    return false;
+  }
+  --it;
+  while (it != access_watches_.end() && it->first <= address) {
+    address = uint64_t(it->first) + it->second->length;
+    if (address >= end) {
       return true;
     }
-
-    // TODO(DrChat): Check if the range is partially covered, and subtract the
-    // covered portion if it is.
-    if ((entry->address <= physical_address &&
-         entry->address + entry->length > physical_address)) {
-      // The beginning of range lies partially within this watch.
-    } else if ((entry->address < physical_address + length &&
-                entry->address + entry->length > physical_address + length)) {
-      // The ending of this range lies partially within this watch.
-    }
+    ++it;
   }
 
   return false;
 }
 
-bool MMIOHandler::CheckAccessWatch(uint32_t physical_address) {
+void MMIOHandler::ReadWatchedMemory(const std::function<void()>& fn) {
   auto lock = global_critical_region_.Acquire();
 
-  bool hit = false;
+  // Write watches leave their pages readable already.
+  for (auto& it : access_watches_) {
+    auto entry = it.second;
+    if (entry->type == kWatchReadWrite) {
+      ProtectPhysicalRange(entry->address, entry->length,
+                           memory::PageAccess::kReadOnly);
+    }
+  }
+  fn();
+  for (auto& it : access_watches_) {
+    auto entry = it.second;
+    if (entry->type == kWatchReadWrite) {
+      ProtectPhysicalRange(entry->address, entry->length,
+                           memory::PageAccess::kNoAccess);
+    }
+  }
+}
+
+void MMIOHandler::SyncDirtyWatches() {
+  if (!dirty_page_tracking_) {
+    return;
+  }
+  SCOPE_profile_cpu_f("cpu");
+
+  auto lock = global_critical_region_.Acquire();
+  if (!dirty_tracked_watch_count_) {
+    return;
+  }
+
+  size_t page_size = memory::page_size();
+  std::vector<AccessWatchEntry*> dirty;
+  std::vector<uint64_t> dirty_bitmap;
   for (auto it = access_watches_.begin(); it != access_watches_.end();) {
-    auto entry = *it;
-    if (entry->address <= physical_address &&
-        entry->address + entry->length > physical_address) {
-      // Hit! Remove the watch.
-      hit = true;
-      FireAccessWatch(entry);
-      it = access_watches_.erase(it);
-      delete entry;
+    if (!it->second->dirty_tracked) {
+      ++it;
       continue;
     }
-    ++it;
+
+    // Query runs of adjacent watches together.
+    auto run_begin = it;
+    uint32_t run_address = it->first;
+    uint32_t run_end = run_address + it->second->length;
+    for (++it; it != access_watches_.end() && it->second->dirty_tracked &&
+               it->first == run_end;
+         ++it) {
+      run_end += it->second->length;
+    }
+    uint32_t run_length = run_end - run_address;
+    dirty_bitmap.assign((run_length / page_size + 63) / 64, 0);
+    // Pages are marked clean as they are read, so writes racing with this are
+    // seen here or by the next sync. If the query fails assume everything was
+    // written.
+    bool queried = QueryAndResetDirtyPhysicalPages(run_address, run_length,
+                                                   dirty_bitmap.data());
+
+    for (auto entry_it = run_begin; entry_it != it;) {
+      auto entry = entry_it->second;
+      size_t first_page = (entry->address - run_address) / page_size;
+      size_t end_page = first_page + entry->length / page_size;
+      bool hit = !queried;
+      for (size_t page = first_page; !hit && page < end_page; ++page) {
+        hit = (dirty_bitmap[page / 64] >> (page % 64)) & 1;
+      }
+      if (hit) {
+        dirty.push_back(entry);
+        entry_it = access_watches_.erase(entry_it);
+      } else {
+        ++entry_it;
+      }
+    }
   }
 
-  if (!hit) {
+  COUNT_profile_add("cpu/mmio/dirty_watches_fired", dirty.size());
+  COUNT_profile_set("cpu/mmio/access_watches", access_watches_.size());
+  FireAccessWatches(dirty);
+}
+
+bool MMIOHandler::CheckAccessWatch(uint32_t physical_address) {
+  auto lock = global_critical_region_.Acquire();
+
+  std::vector<AccessWatchEntry*> hits;
+  TakeOverlappingWatches(physical_address, physical_address, &hits);
+  if (hits.empty()) {
     // Rethrow access violation - range was not being watched.
     return false;
   }
 
+  // Hit! Remove the watch.
+  FireAccessWatches(hits);
+
   // Range was watched, so lets eat this access violation.
   return true;
 }
 
-struct DecodedMov {
-  size_t length;
-  // Inidicates this is a load (or conversely a store).
-  bool is_load;
-  // Indicates the memory must be swapped.
-  bool byte_swap;
-  // Source (for store) or target (for load) register.
-  // AX  CX  DX  BX  SP  BP  SI  DI   // REX.R=0
-  // R8  R9  R10 R11 R12 R13 R14 R15  // REX.R=1
-  uint32_t value_reg;
-  // [base + (index * scale) + displacement]
-  bool mem_has_base;
-  uint8_t mem_base_reg;
-  bool mem_has_index;
-  uint8_t mem_index_reg;
-  uint8_t mem_scale;
-  int32_t mem_displacement;
-  bool is_constant;
-  int32_t constant;
-};
+void MMIOHandler::RecordWatchFault(uint64_t start_ticks) {
+  uint64_t now = Clock::QueryHostTickCount();
+  ++watch_fault_count_;
+  watch_fault_ticks_ += now - start_ticks;
+  ++watch_fault_window_count_;
+  if (now - watch_fault_window_start_ >= Clock::host_tick_frequency()) {
+    watch_faults_per_second_ = watch_fault_window_count_;
+    watch_fault_window_count_ = 0;
+    watch_fault_window_start_ = now;
+    COUNT_profile_set("cpu/mmio/watch_faults_per_second",
+                      watch_faults_per_second_);
+  }
+  COUNT_profile_add("cpu/mmio/watch_faults", 1);
+  COUNT_profile_add("cpu/mmio/watch_fault_us",
+                    (now - start_ticks) * 1000000 /
+                        Clock::host_tick_frequency());
+}
+
+MMIOHandler::AccessWatchStats MMIOHandler::QueryAccessWatchStats() {
+  auto lock = global_critical_region_.Acquire();
+  AccessWatchStats stats;
+  stats.watch_count = access_watches_.size();
+  stats.fault_count = watch_fault_count_;
+  stats.faults_per_second = watch_faults_per_second_;
+  stats.fault_handler_ns =
+      uint64_t(double(watch_fault_ticks_) * 1000000000.0 /
+               double(Clock::host_tick_frequency()));
+  return stats;
+}
 
 bool TryDecodeMov(const uint8_t* p, DecodedMov* mov) {
   uint8_t i = 0;  // Current byte decode index.
@@ -492,6 +666,7 @@ bool MMIOHandler::ExceptionCallback(Exception* ex) {
     // HACK: Recheck if the pages are still protected (race condition - another
     // thread clears the writewatch we just hit)
     // Do this under the lock so we don't introduce another race condition.
+    uint64_t start_ticks = Clock::QueryHostTickCount();
     auto lock = global_critical_region_.Acquire();
     memory::PageAccess cur_access;
     size_t page_length = memory::page_size();
@@ -499,22 +674,45 @@ bool MMIOHandler::ExceptionCallback(Exception* ex) {
     if (cur_access != memory::PageAccess::kReadOnly &&
         cur_access != memory::PageAccess::kNoAccess) {
       // Another thread has cleared this write watch. Abort.
+      RecordWatchFault(start_ticks);
       return true;
     }
 
     // Access is not found within any range, so fail and let the caller handle
     // it (likely by aborting).
-    return CheckAccessWatch(guest_address);
+    bool handled = CheckAccessWatch(guest_address);
+    if (handled) {
+      RecordWatchFault(start_ticks);
+    }
+    return handled;
   }
 
   auto rip = ex->pc();
-  auto p = reinterpret_cast<const uint8_t*>(rip);
   DecodedMov mov = {0};
-  bool decoded = TryDecodeMov(p, &mov);
-  if (!decoded) {
-    XELOGE("Unable to decode MMIO mov at %p", p);
-    assert_always("Unknown MMIO instruction type");
-    return false;
+  bool new_site = false;
+  AccessSiteCallback access_site_callback = nullptr;
+  void* access_site_callback_context = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(access_sites_mutex_);
+    auto it = access_sites_.find(rip);
+    if (it != access_sites_.end()) {
+      mov = it->second;
+    } else {
+      auto p = reinterpret_cast<const uint8_t*>(rip);
+      if (!TryDecodeMov(p, &mov)) {
+        XELOGE("Unable to decode MMIO mov at %p", p);
+        assert_always("Unknown MMIO instruction type");
+        return false;
+      }
+      access_sites_.emplace(rip, mov);
+      new_site = true;
+      access_site_callback = access_site_callback_;
+      access_site_callback_context = access_site_callback_context_;
+    }
+  }
+  COUNT_profile_add("cpu/mmio/access_faults", 1);
+  if (new_site && access_site_callback) {
+    access_site_callback(access_site_callback_context, rip);
   }
 
   if (mov.is_load) {
@@ -10,10 +10,14 @@
 #ifndef XENIA_CPU_MMIO_HANDLER_H_
 #define XENIA_CPU_MMIO_HANDLER_H_
 
-#include <list>
+#include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <unordered_map>
 #include <vector>
 
+#include "xenia/base/memory.h"
 #include "xenia/base/mutex.h"
 
 namespace xe {
@@ -30,6 +34,7 @@ typedef void (*MMIOWriteCallback)(void* ppc_context, void* callback_context,
                                   uint32_t addr, uint32_t value);
 typedef void (*AccessWatchCallback)(void* context_ptr, void* data_ptr,
                                     uint32_t address);
+typedef void (*AccessSiteCallback)(void* context_ptr, uint64_t host_pc);
 
 struct MMIORange {
   uint32_t address;
@@ -40,6 +45,27 @@ struct MMIORange {
   MMIOWriteCallback write;
 };
 
+struct DecodedMov {
+  size_t length;
+  // Inidicates this is a load (or conversely a store).
+  bool is_load;
+  // Indicates the memory must be swapped.
+  bool byte_swap;
+  // Source (for store) or target (for load) register.
+  // AX  CX  DX  BX  SP  BP  SI  DI   // REX.R=0
+  // R8  R9  R10 R11 R12 R13 R14 R15  // REX.R=1
+  uint32_t value_reg;
+  // [base + (index * scale) + displacement]
+  bool mem_has_base;
+  uint8_t mem_base_reg;
+  bool mem_has_index;
+  uint8_t mem_index_reg;
+  uint8_t mem_scale;
+  int32_t mem_displacement;
+  bool is_constant;
+  int32_t constant;
+};
+
 // NOTE: only one can exist at a time!
 class MMIOHandler {
  public:
@@ -64,6 +90,15 @@ class MMIOHandler {
   bool CheckLoad(uint32_t virtual_address, uint32_t* out_value);
   bool CheckStore(uint32_t virtual_address, uint32_t value);
 
+  // Called once for each host instruction the first time it faults on an MMIO
+  // range, so that the code containing it can be rebuilt to call the range
+  // directly. Faults are handled either way; the decoded instruction is kept.
+  void SetAccessSiteCallback(AccessSiteCallback callback,
+                             void* callback_context);
+  // Forgets the decoded instructions in [host_start, host_end). Must be called
+  // before code there is freed, as the space may be reused for other code.
+  void InvalidateAccessSites(uint64_t host_start, uint64_t host_end);
+
   // Memory watches: These are one-shot alarms that fire a callback (in the
   // context of the thread that caused the callback) when a memory range is
   // either written to or read from, depending on the watch type. These fire as
@@ -80,28 +115,62 @@ class MMIOHandler {
   // Returns true if /all/ of this range is watched.
   bool IsRangeWatched(uint32_t physical_address, size_t length);
 
+  // Calls fn with every watched page readable and without firing the watches,
+  // then protects the pages again. Watches can't be added or removed meanwhile.
+  // For copying out memory while the guest is stopped, such as saving state.
+  void ReadWatchedMemory(const std::function<void()>& fn);
+
+  // With --dirty_page_write_watches, write watches don't protect their pages.
+  // Instead the pages written since the last call are collected here and the
+  // watches on them fired in one batch. Must be called at points where the
+  // guest expects its writes to be visible, such as GPU coherency requests.
+  // A write racing with the call fires its watches now or on the next call.
+  void SyncDirtyWatches();
+
+  struct AccessWatchStats {
+    size_t watch_count;
+    // Access violations taken on watched pages since install.
+    uint64_t fault_count;
+    // Faults taken during the last full second.
+    uint64_t faults_per_second;
+    // Total time spent handling those faults, including callbacks.
+    uint64_t fault_handler_ns;
+  };
+  AccessWatchStats QueryAccessWatchStats();
+
  protected:
   struct AccessWatchEntry {
     uint32_t address;
     uint32_t length;
     WatchType type;
+    // Found with dirty page tracking rather than page protection.
+    bool dirty_tracked;
     AccessWatchCallback callback;
     void* callback_context;
     void* callback_data;
   };
 
   MMIOHandler(uint8_t* virtual_membase, uint8_t* physical_membase,
-              uint8_t* membase_end)
-      : virtual_membase_(virtual_membase),
-        physical_membase_(physical_membase),
-        memory_end_(membase_end) {}
+              uint8_t* membase_end);
 
   static bool ExceptionCallbackThunk(Exception* ex, void* data);
   bool ExceptionCallback(Exception* ex);
 
-  void FireAccessWatch(AccessWatchEntry* entry);
-  void ClearAccessWatch(AccessWatchEntry* entry);
+  void ProtectPhysicalRange(uint32_t address, uint32_t length,
+                            memory::PageAccess access);
+  bool EnableDirtyPhysicalPageTracking();
+  bool ResetDirtyPhysicalPages(uint32_t address, uint32_t length);
+  bool QueryAndResetDirtyPhysicalPages(uint32_t address, uint32_t length,
+                                       uint64_t* dirty_bitmap);
+  // Removes all watches overlapping [address, end) (or containing address if
+  // the range is empty) from the table and appends them in address order.
+  void TakeOverlappingWatches(uint32_t address, uint64_t end,
+                              std::vector<AccessWatchEntry*>* out_entries);
+  // Unprotects the pages of the given watches (in address order), one call per
+  // run of contiguous protected watches, then fires and deletes them.
+  void FireAccessWatches(const std::vector<AccessWatchEntry*>& entries);
   bool CheckAccessWatch(uint32_t guest_address);
+  void RecordWatchFault(uint64_t start_ticks);
 
   uint8_t* virtual_membase_;
   uint8_t* physical_membase_;
@@ -109,9 +178,26 @@ class MMIOHandler {
 
   std::vector<MMIORange> mapped_ranges_;
 
+  bool dirty_page_tracking_ = false;
+  size_t dirty_tracked_watch_count_ = 0;
+
+  // Host instructions seen faulting on MMIO ranges, by address.
+  std::mutex access_sites_mutex_;
+  std::unordered_map<uint64_t, DecodedMov> access_sites_;
+  AccessSiteCallback access_site_callback_ = nullptr;
+  void* access_site_callback_context_ = nullptr;
+
   xe::global_critical_region global_critical_region_;
-  // TODO(benvanik): data structure magic.
-  std::list<AccessWatchEntry*> access_watches_;
+  // Watches keyed by their page aligned base address. Adding a watch fires
+  // every watch it overlaps, so entries never overlap each other and any
+  // address is covered by at most one entry.
+  std::map<uint32_t, AccessWatchEntry*> access_watches_;
+
+  uint64_t watch_fault_count_ = 0;
+  uint64_t watch_fault_ticks_ = 0;
+  uint64_t watch_fault_window_start_ = 0;
+  uint64_t watch_fault_window_count_ = 0;
+  uint64_t watch_faults_per_second_ = 0;
 
   static MMIOHandler* global_handler_;
 };
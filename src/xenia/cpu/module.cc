@@ -15,7 +15,6 @@
 #include <string>
 
 #include "xenia/base/profiling.h"
-#include "xenia/base/threading.h"
 #include "xenia/cpu/processor.h"
 
 namespace xe {
@@ -28,53 +27,55 @@ Module::~Module() = default;
 
 bool Module::ContainsAddress(uint32_t address) { return true; }
 
+void Module::WaitForSymbolStatus(std::unique_lock<std::mutex>& shard_lock,
+                                 Symbol* symbol, Symbol::Status status) {
+  auto& shard = GetShard(symbol->address());
+  shard.cv.wait(shard_lock,
+                [symbol, status]() { return symbol->status() != status; });
+}
+
+void Module::NotifySymbolStatusChanged(Symbol* symbol) {
+  // Taking the lock orders this against waiters that have checked the status
+  // but not yet gone to sleep.
+  auto& shard = GetShard(symbol->address());
+  { std::lock_guard<std::mutex> lock(shard.mutex); }
+  shard.cv.notify_all();
+}
+
 Symbol* Module::LookupSymbol(uint32_t address, bool wait) {
-  auto global_lock = global_critical_region_.Acquire();
-  const auto it = map_.find(address);
-  Symbol* symbol = it != map_.end() ? it->second : nullptr;
+  auto& shard = GetShard(address);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  const auto it = shard.map.find(address);
+  Symbol* symbol = it != shard.map.end() ? it->second : nullptr;
   if (symbol) {
     if (symbol->status() == Symbol::Status::kDeclaring) {
       // Some other thread is declaring the symbol - wait.
       if (wait) {
-        do {
-          global_lock.unlock();
-          // TODO(benvanik): sleep for less time?
-          xe::threading::Sleep(std::chrono::microseconds(100));
-          global_lock.lock();
-        } while (symbol->status() == Symbol::Status::kDeclaring);
+        WaitForSymbolStatus(lock, symbol, Symbol::Status::kDeclaring);
       } else {
         // Immediate request, just return.
         symbol = nullptr;
       }
     }
   }
-  global_lock.unlock();
   return symbol;
 }
 
 Symbol::Status Module::DeclareSymbol(Symbol::Type type, uint32_t address,
                                      Symbol** out_symbol) {
   *out_symbol = nullptr;
-  auto global_lock = global_critical_region_.Acquire();
-  auto it = map_.find(address);
-  Symbol* symbol = it != map_.end() ? it->second : nullptr;
+  auto& shard = GetShard(address);
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  auto it = shard.map.find(address);
+  Symbol* symbol = it != shard.map.end() ? it->second : nullptr;
   Symbol::Status status;
   if (symbol) {
     // If we exist but are the wrong type, die.
     if (symbol->type() != type) {
-      global_lock.unlock();
       return Symbol::Status::kFailed;
     }
-    // If we aren't ready yet spin and wait.
-    if (symbol->status() == Symbol::Status::kDeclaring) {
-      // Still declaring, so spin.
-      do {
-        global_lock.unlock();
-        // TODO(benvanik): sleep for less time?
-        xe::threading::Sleep(std::chrono::microseconds(100));
-        global_lock.lock();
-      } while (symbol->status() == Symbol::Status::kDeclaring);
-    }
+    // If we aren't ready yet wait for the declaring thread to finish.
+    WaitForSymbolStatus(lock, symbol, Symbol::Status::kDeclaring);
     status = symbol->status();
   } else {
     // Create and return for initialization.
@@ -86,11 +87,16 @@ Symbol::Status Module::DeclareSymbol(Symbol::Type type, uint32_t address,
         symbol = new Symbol(Symbol::Type::kVariable, this, address);
         break;
     }
-    map_[address] = symbol;
-    list_.emplace_back(symbol);
+    // Other threads will wait until the caller sets a new status.
+    symbol->status_ = Symbol::Status::kDeclaring;
+    shard.map[address] = symbol;
+    {
+      std::lock_guard<std::mutex> list_lock(list_mutex_);
+      list_.emplace_back(symbol);
+    }
     status = Symbol::Status::kNew;
   }
-  global_lock.unlock();
+  lock.unlock();
   *out_symbol = symbol;
 
   // Get debug info from providers, if this is new.
@@ -117,25 +123,18 @@ Symbol::Status Module::DeclareVariable(uint32_t address, Symbol** out_symbol) {
 }
 
 Symbol::Status Module::DefineSymbol(Symbol* symbol) {
-  auto global_lock = global_critical_region_.Acquire();
+  auto& shard = GetShard(symbol->address());
+  std::unique_lock<std::mutex> lock(shard.mutex);
   Symbol::Status status;
   if (symbol->status() == Symbol::Status::kDeclared) {
     // Declared but undefined, so request caller define it.
-    symbol->set_status(Symbol::Status::kDefining);
+    symbol->status_ = Symbol::Status::kDefining;
     status = Symbol::Status::kNew;
-  } else if (symbol->status() == Symbol::Status::kDefining) {
-    // Still defining, so spin.
-    do {
-      global_lock.unlock();
-      // TODO(benvanik): sleep for less time?
-      xe::threading::Sleep(std::chrono::microseconds(100));
-      global_lock.lock();
-    } while (symbol->status() == Symbol::Status::kDefining);
-    status = symbol->status();
   } else {
+    // If still defining wait for the defining thread to finish.
+    WaitForSymbolStatus(lock, symbol, Symbol::Status::kDefining);
     status = symbol->status();
   }
-  global_lock.unlock();
   return status;
 }
 
@@ -148,10 +147,18 @@ Symbol::Status Module::DefineVariable(Symbol* symbol) {
 }
 
 void Module::ForEachFunction(std::function<void(Function*)> callback) {
-  auto global_lock = global_critical_region_.Acquire();
-  for (auto& symbol : list_) {
+  // Snapshot so that callbacks may declare new symbols.
+  std::vector<Symbol*> symbols;
+  {
+    std::lock_guard<std::mutex> lock(list_mutex_);
+    symbols.reserve(list_.size());
+    for (auto& symbol : list_) {
+      symbols.push_back(symbol.get());
+    }
+  }
+  for (auto symbol : symbols) {
     if (symbol->type() == Symbol::Type::kFunction) {
-      Function* info = static_cast<Function*>(symbol.get());
+      Function* info = static_cast<Function*>(symbol);
       callback(info);
     }
   }
@@ -159,17 +166,23 @@ void Module::ForEachFunction(std::function<void(Function*)> callback) {
 
 void Module::ForEachSymbol(size_t start_index, size_t end_index,
                            std::function<void(Symbol*)> callback) {
-  auto global_lock = global_critical_region_.Acquire();
-  start_index = std::min(start_index, list_.size());
-  end_index = std::min(end_index, list_.size());
-  for (size_t i = start_index; i <= end_index; ++i) {
-    auto& symbol = list_[i];
-    callback(symbol.get());
+  std::vector<Symbol*> symbols;
+  {
+    std::lock_guard<std::mutex> lock(list_mutex_);
+    start_index = std::min(start_index, list_.size());
+    end_index = std::min(end_index, list_.size());
+    for (size_t i = start_index; i <= end_index && i < list_.size(); ++i) {
+      auto& symbol = list_[i];
+      symbols.push_back(symbol.get());
+    }
+  }
+  for (auto symbol : symbols) {
+    callback(symbol);
   }
 }
 
 size_t Module::QuerySymbolCount() {
-  auto global_lock = global_critical_region_.Acquire();
+  std::lock_guard<std::mutex> lock(list_mutex_);
   return list_.size();
 }
 
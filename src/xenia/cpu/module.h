@@ -10,13 +10,14 @@
 #ifndef XENIA_CPU_MODULE_H_
 #define XENIA_CPU_MODULE_H_
 
+#include <condition_variable>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
-#include "xenia/base/mutex.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/symbol.h"
 #include "xenia/memory.h"
@@ -35,8 +36,16 @@ class Module {
 
   virtual const std::string& name() const = 0;
   virtual bool is_executable() const = 0;
+  // Hash of the module code, used to key persisted data. 0 if not supported.
+  virtual uint64_t image_hash() const { return 0; }
 
   virtual bool ContainsAddress(uint32_t address);
+  // Gets the [low, high) guest address range of the module, if it is a single
+  // contiguous range. Modules with a range are found by binary search.
+  virtual bool GetAddressRange(uint32_t* out_low_address,
+                               uint32_t* out_high_address) {
+    return false;
+  }
 
   Symbol* LookupSymbol(uint32_t address, bool wait = true);
   virtual Symbol::Status DeclareFunction(uint32_t address,
@@ -53,6 +62,10 @@ class Module {
 
   bool ReadMap(const char* file_name);
 
+  // Wakes any threads waiting for the symbol to leave the declaring/defining
+  // states. Called by Symbol::set_status.
+  void NotifySymbolStatusChanged(Symbol* symbol);
+
  protected:
   virtual std::unique_ptr<Function> CreateFunction(uint32_t address) = 0;
 
@@ -64,9 +77,25 @@ class Module {
                                Symbol** out_symbol);
   Symbol::Status DefineSymbol(Symbol* symbol);
 
-  xe::global_critical_region global_critical_region_;
-  // TODO(benvanik): replace with a better data structure.
-  std::unordered_map<uint32_t, Symbol*> map_;
+  // Symbols are spread over shards by address so that unrelated lookups from
+  // many threads don't contend. Threads waiting on a symbol being declared or
+  // defined sleep on its shard.
+  static const size_t kShardCount = 32;
+  struct Shard {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::unordered_map<uint32_t, Symbol*> map;
+  };
+  Shard& GetShard(uint32_t address) {
+    return shards_[(address >> 2) % kShardCount];
+  }
+  // Waits with the shard lock held until the symbol leaves the given status.
+  void WaitForSymbolStatus(std::unique_lock<std::mutex>& shard_lock,
+                           Symbol* symbol, Symbol::Status status);
+
+  Shard shards_[kShardCount];
+  // All symbols in declaration order.
+  std::mutex list_mutex_;
   std::vector<std::unique_ptr<Symbol>> list_;
 };
 
@@ -426,6 +426,17 @@ typedef struct PPCContext_s {
   // Value of last reserved load
   uint64_t reserved_val;
 
+  // Code cache epoch this thread last entered generated code in, or ~0 while
+  // it is outside of generated code. Tells the code cache when released code
+  // is no longer running anywhere.
+  uint64_t code_epoch;
+  // Host stack address of the outermost entry into generated code. Bounds the
+  // stack scanned when the epoch is republished from host calls.
+  uint64_t code_stack_top;
+
+  // Keeps the size a multiple of 64b.
+  uint8_t padding[48];
+
   static std::string GetRegisterName(PPCRegister reg);
   std::string GetStringFromValue(PPCRegister reg) const;
   void SetValueFromString(PPCRegister reg, std::string value);
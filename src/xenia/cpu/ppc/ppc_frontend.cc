@@ -10,6 +10,9 @@
 #include "xenia/cpu/ppc/ppc_frontend.h"
 
 #include "xenia/base/atomic.h"
+#include "xenia/base/string.h"
+#include "xenia/cpu/compiler/passes/dead_store_elimination_pass.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/ppc/ppc_context.h"
 #include "xenia/cpu/ppc/ppc_emit.h"
 #include "xenia/cpu/ppc/ppc_opcode_info.h"
@@ -48,6 +51,17 @@ PPCFrontend::PPCFrontend(Processor* processor) : processor_(processor) {
 PPCFrontend::~PPCFrontend() {
   // Force cleanup now before we deinit.
   translator_pool_.Reset();
+
+  if (FLAGS_report_dead_store_stats) {
+    compiler::passes::DeadStoreEliminationPass::DumpStats();
+  }
+  if (FLAGS_report_compiler_stats) {
+    compiler::CompilerStats::Dump();
+  }
+  if (!FLAGS_compiler_stats_path.empty()) {
+    compiler::CompilerStats::WriteJson(
+        xe::to_wstring(FLAGS_compiler_stats_path));
+  }
 }
 
 Memory* PPCFrontend::memory() const { return processor_->memory(); }
@@ -87,6 +101,30 @@ bool PPCFrontend::Initialize() {
       processor_->DefineBuiltin("EnterGlobalLock", EnterGlobalLock, arg0, arg1);
   builtins_.leave_global_lock =
       processor_->DefineBuiltin("LeaveGlobalLock", LeaveGlobalLock, arg0, arg1);
+
+  if (FLAGS_replace_library_routines) {
+    static const struct {
+      LibraryRoutine routine;
+      const char* name;
+      BuiltinFunction::Handler handler;
+    } library_routines[] = {
+        {LibraryRoutine::kMemcpy, "LibraryMemcpy", LibraryMemcpy},
+        {LibraryRoutine::kMemmove, "LibraryMemmove", LibraryMemmove},
+        {LibraryRoutine::kMemset, "LibraryMemset", LibraryMemset},
+        {LibraryRoutine::kStrlen, "LibraryStrlen", LibraryStrlen},
+        {LibraryRoutine::kStrcmp, "LibraryStrcmp", LibraryStrcmp},
+    };
+    for (auto& entry : library_routines) {
+      builtins_.library_routines[size_t(entry.routine)] =
+          processor_->DefineBuiltin(entry.name, entry.handler, memory(),
+                                    nullptr);
+    }
+    if (!FLAGS_library_routine_signatures.empty() &&
+        !LoadLibraryRoutineSignatures(FLAGS_library_routine_signatures,
+                                      &library_routine_signatures_)) {
+      return false;
+    }
+  }
   return true;
 }
 
@@ -99,6 +137,15 @@ bool PPCFrontend::DeclareFunction(GuestFunction* function) {
   return true;
 }
 
+Function* PPCFrontend::LookupLibraryRoutine(GuestFunction* function) {
+  if (!FLAGS_replace_library_routines) {
+    return nullptr;
+  }
+  auto routine = IdentifyLibraryRoutine(memory(), function,
+                                        library_routine_signatures_);
+  return builtins_.library_routines[size_t(routine)];
+}
+
 bool PPCFrontend::DefineFunction(GuestFunction* function,
                                  uint32_t debug_info_flags) {
   auto translator = translator_pool_.Allocate(this);
@@ -14,6 +14,7 @@
 
 #include "xenia/base/type_pool.h"
 #include "xenia/cpu/function.h"
+#include "xenia/cpu/ppc/ppc_library_routines.h"
 #include "xenia/memory.h"
 
 namespace xe {
@@ -33,6 +34,8 @@ struct PPCBuiltins {
   Function* check_global_lock;
   Function* enter_global_lock;
   Function* leave_global_lock;
+  // Host implementations of recognized guest routines, by LibraryRoutine.
+  Function* library_routines[size_t(LibraryRoutine::kCount)];
 };
 
 class PPCFrontend {
@@ -49,9 +52,14 @@ class PPCFrontend {
   bool DeclareFunction(GuestFunction* function);
   bool DefineFunction(GuestFunction* function, uint32_t debug_info_flags);
 
+  // Returns the builtin to try before running the given scanned function, if
+  // it is a library routine we can run natively.
+  Function* LookupLibraryRoutine(GuestFunction* function);
+
  private:
   Processor* processor_;
   PPCBuiltins builtins_ = {0};
+  LibraryRoutineSignatures library_routine_signatures_;
   TypePool<PPCTranslator, PPCFrontend*> translator_pool_;
 };
 
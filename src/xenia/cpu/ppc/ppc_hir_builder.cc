@@ -10,6 +10,7 @@
 #include "xenia/cpu/ppc/ppc_hir_builder.h"
 
 #include <stddef.h>
+#include <algorithm>
 #include <cstring>
 
 #include "xenia/base/byte_order.h"
@@ -103,8 +104,24 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
   // Always mark entry with label.
   label_list_[0] = NewLabel();
 
+  // Recognized library routines try their host implementation first and only
+  // run the guest code if it declines (see ppc_library_routines.h).
+  auto library_routine = frontend_->LookupLibraryRoutine(function_);
+  if (library_routine) {
+    if (with_debug_info_) {
+      CommentFormat("library routine %s", library_routine->name().c_str());
+    }
+    CallExtern(library_routine);
+    ReturnTrue(LoadContext(offsetof(PPCContext, scratch), INT64_TYPE));
+  }
+
   uint32_t start_address = function_->address();
   uint32_t end_address = function_->end_address();
+
+  // Loads and stores seen accessing MMIO check for it instead of faulting.
+  std::vector<uint32_t> mmio_access_sites;
+  frontend_->processor()->GetMMIOAccessSites(start_address, end_address,
+                                             &mmio_access_sites);
   for (uint32_t address = start_address, offset = 0; address <= end_address;
        address += 4, offset++) {
     trace_info_.dest_count = 0;
@@ -172,6 +189,19 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
       Comment("UNIMPLEMENTED!");
       DebugBreak();
     }
+
+    if (!mmio_access_sites.empty() &&
+        std::binary_search(mmio_access_sites.begin(), mmio_access_sites.end(),
+                           address)) {
+      for (auto instr = first_instr; instr; instr = instr->next) {
+        if (instr->opcode == &OPCODE_LOAD_info ||
+            instr->opcode == &OPCODE_STORE_info ||
+            instr->opcode == &OPCODE_LOAD_OFFSET_info ||
+            instr->opcode == &OPCODE_STORE_OFFSET_info) {
+          instr->flags |= LoadStoreFlags::LOAD_STORE_MMIO;
+        }
+      }
+    }
   }
 
   if (false) {
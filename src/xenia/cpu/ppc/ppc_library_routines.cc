@@ -0,0 +1,262 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/ppc/ppc_library_routines.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include "third_party/xxhash/xxhash.h"
+#include "xenia/base/byte_order.h"
+#include "xenia/base/logging.h"
+
+namespace xe {
+namespace cpu {
+namespace ppc {
+
+namespace {
+
+const uint32_t kPageSize = 4096;
+
+const struct {
+  const char* name;
+  LibraryRoutine routine;
+} kRoutineNames[] = {
+    {"memcpy", LibraryRoutine::kMemcpy},
+    {"XMemCpy", LibraryRoutine::kMemcpy},
+    {"memmove", LibraryRoutine::kMemmove},
+    {"memset", LibraryRoutine::kMemset},
+    {"XMemSet", LibraryRoutine::kMemset},
+    {"strlen", LibraryRoutine::kStrlen},
+    {"strcmp", LibraryRoutine::kStrcmp},
+};
+
+LibraryRoutine LookupRoutineName(const std::string& name) {
+  // Map files have C names with their leading underscore.
+  size_t start = name.find_first_not_of('_');
+  if (start == std::string::npos) {
+    return LibraryRoutine::kUnknown;
+  }
+  for (auto& entry : kRoutineNames) {
+    if (name.compare(start, std::string::npos, entry.name) == 0) {
+      return entry.routine;
+    }
+  }
+  return LibraryRoutine::kUnknown;
+}
+
+// Whether [address, address + length) can be accessed directly through the
+// host mapping: no MMIO (which needs decoded host moves to emulate) and
+// contiguous in host memory. Write watches are fine, as they fault and
+// resume like any other store.
+bool IsDirectRange(Memory* memory, uint32_t address, uint32_t length) {
+  uint64_t end = uint64_t(address) + length;
+  if (end > 0x100000000ull) {
+    return false;
+  }
+  // See Memory::TranslateVirtual.
+  if (address < 0xE0000000 && end > 0xE0000000) {
+    return false;
+  }
+  for (uint64_t page = address & ~(kPageSize - 1); page < end;
+       page += kPageSize) {
+    if (memory->LookupVirtualMappedRange(static_cast<uint32_t>(page))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint32_t BytesToPageEnd(uint32_t address) {
+  return kPageSize - (address & (kPageSize - 1));
+}
+
+}  // namespace
+
+const char* GetLibraryRoutineName(LibraryRoutine routine) {
+  for (auto& entry : kRoutineNames) {
+    if (entry.routine == routine) {
+      return entry.name;
+    }
+  }
+  return "unknown";
+}
+
+bool LoadLibraryRoutineSignatures(const std::string& path,
+                                  LibraryRoutineSignatures* out_signatures) {
+  std::ifstream infile(path);
+  if (!infile.is_open()) {
+    XELOGE("Unable to open library routine signatures %s", path.c_str());
+    return false;
+  }
+  std::string line;
+  std::stringstream sstream;
+  std::string hash_str;
+  std::string name;
+  while (std::getline(infile, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    sstream.clear();
+    sstream.str(line);
+    sstream >> hash_str >> name;
+    auto routine = LookupRoutineName(name);
+    if (routine == LibraryRoutine::kUnknown) {
+      XELOGW("Unknown library routine '%s' in signatures", name.c_str());
+      continue;
+    }
+    uint64_t hash = std::strtoull(hash_str.c_str(), nullptr, 16);
+    (*out_signatures)[hash] = routine;
+  }
+  return true;
+}
+
+uint64_t HashLibraryRoutineCode(Memory* memory, GuestFunction* function) {
+  std::vector<uint32_t> code;
+  for (uint32_t address = function->address();
+       address <= function->end_address(); address += 4) {
+    uint32_t word =
+        xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
+    if ((word >> 26) == 18) {
+      // b/bl: keep the opcode and AA/LK only.
+      word &= 0xFC000003;
+    }
+    code.push_back(word);
+  }
+  return XXH64(code.data(), code.size() * sizeof(uint32_t), 0);
+}
+
+LibraryRoutine IdentifyLibraryRoutine(
+    Memory* memory, GuestFunction* function,
+    const LibraryRoutineSignatures& signatures) {
+  auto routine = LookupRoutineName(function->name());
+  if (routine != LibraryRoutine::kUnknown) {
+    // Log the hash so that the signature can be used for titles without
+    // symbols.
+    XELOGD("%.8X: %s is %s, hash %.16" PRIX64, function->address(),
+           function->name().c_str(), GetLibraryRoutineName(routine),
+           HashLibraryRoutineCode(memory, function));
+    return routine;
+  }
+  if (signatures.empty()) {
+    return LibraryRoutine::kUnknown;
+  }
+  auto it = signatures.find(HashLibraryRoutineCode(memory, function));
+  return it != signatures.end() ? it->second : LibraryRoutine::kUnknown;
+}
+
+// These are all byte-oriented, so guest and host byte order agree.
+
+void LibraryMemcpy(PPCContext* ppc_context, void* arg0, void* arg1) {
+  auto memory = reinterpret_cast<Memory*>(arg0);
+  auto dest = static_cast<uint32_t>(ppc_context->r[3]);
+  auto src = static_cast<uint32_t>(ppc_context->r[4]);
+  auto length = static_cast<uint32_t>(ppc_context->r[5]);
+  // Overlapping copies are left to the guest, as some code relies on the
+  // order the guest implementation copies in (such as forward copies that
+  // repeat a pattern).
+  bool overlaps = uint64_t(dest) < uint64_t(src) + length &&
+                  uint64_t(src) < uint64_t(dest) + length;
+  if (overlaps || !IsDirectRange(memory, dest, length) ||
+      !IsDirectRange(memory, src, length)) {
+    ppc_context->scratch = 0;
+    return;
+  }
+  std::memcpy(memory->TranslateVirtual(dest), memory->TranslateVirtual(src),
+              length);
+  ppc_context->scratch = 1;
+}
+
+void LibraryMemmove(PPCContext* ppc_context, void* arg0, void* arg1) {
+  auto memory = reinterpret_cast<Memory*>(arg0);
+  auto dest = static_cast<uint32_t>(ppc_context->r[3]);
+  auto src = static_cast<uint32_t>(ppc_context->r[4]);
+  auto length = static_cast<uint32_t>(ppc_context->r[5]);
+  if (!IsDirectRange(memory, dest, length) ||
+      !IsDirectRange(memory, src, length)) {
+    ppc_context->scratch = 0;
+    return;
+  }
+  std::memmove(memory->TranslateVirtual(dest), memory->TranslateVirtual(src),
+               length);
+  ppc_context->scratch = 1;
+}
+
+void LibraryMemset(PPCContext* ppc_context, void* arg0, void* arg1) {
+  auto memory = reinterpret_cast<Memory*>(arg0);
+  auto dest = static_cast<uint32_t>(ppc_context->r[3]);
+  auto value = static_cast<uint8_t>(ppc_context->r[4]);
+  auto length = static_cast<uint32_t>(ppc_context->r[5]);
+  if (!IsDirectRange(memory, dest, length)) {
+    ppc_context->scratch = 0;
+    return;
+  }
+  std::memset(memory->TranslateVirtual(dest), value, length);
+  ppc_context->scratch = 1;
+}
+
+void LibraryStrlen(PPCContext* ppc_context, void* arg0, void* arg1) {
+  auto memory = reinterpret_cast<Memory*>(arg0);
+  auto address = static_cast<uint32_t>(ppc_context->r[3]);
+  uint32_t length = 0;
+  while (true) {
+    // A page at a time, so we never touch a page the guest wouldn't.
+    uint32_t chunk = BytesToPageEnd(address);
+    if (!IsDirectRange(memory, address, chunk)) {
+      ppc_context->scratch = 0;
+      return;
+    }
+    auto p = memory->TranslateVirtual<const uint8_t*>(address);
+    auto terminator = std::memchr(p, 0, chunk);
+    if (terminator) {
+      length += static_cast<uint32_t>(
+          reinterpret_cast<const uint8_t*>(terminator) - p);
+      break;
+    }
+    length += chunk;
+    address += chunk;
+  }
+  ppc_context->r[3] = length;
+  ppc_context->scratch = 1;
+}
+
+void LibraryStrcmp(PPCContext* ppc_context, void* arg0, void* arg1) {
+  auto memory = reinterpret_cast<Memory*>(arg0);
+  auto address1 = static_cast<uint32_t>(ppc_context->r[3]);
+  auto address2 = static_cast<uint32_t>(ppc_context->r[4]);
+  while (true) {
+    uint32_t chunk =
+        std::min(BytesToPageEnd(address1), BytesToPageEnd(address2));
+    if (!IsDirectRange(memory, address1, chunk) ||
+        !IsDirectRange(memory, address2, chunk)) {
+      ppc_context->scratch = 0;
+      return;
+    }
+    auto p1 = memory->TranslateVirtual<const uint8_t*>(address1);
+    auto p2 = memory->TranslateVirtual<const uint8_t*>(address2);
+    for (uint32_t n = 0; n < chunk; ++n) {
+      if (p1[n] != p2[n] || !p1[n]) {
+        int32_t result = int32_t(p1[n]) - int32_t(p2[n]);
+        ppc_context->r[3] = static_cast<uint64_t>(int64_t(result));
+        ppc_context->scratch = 1;
+        return;
+      }
+    }
+    address1 += chunk;
+    address2 += chunk;
+  }
+}
+
+}  // namespace ppc
+}  // namespace cpu
+}  // namespace xe
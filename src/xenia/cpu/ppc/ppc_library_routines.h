@@ -0,0 +1,69 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_PPC_PPC_LIBRARY_ROUTINES_H_
+#define XENIA_CPU_PPC_PPC_LIBRARY_ROUTINES_H_
+
+#include <string>
+#include <unordered_map>
+
+#include "xenia/cpu/function.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+#include "xenia/memory.h"
+
+namespace xe {
+namespace cpu {
+namespace ppc {
+
+// C runtime routines statically linked into titles that we can run natively.
+enum class LibraryRoutine {
+  kUnknown,
+  kMemcpy,
+  kMemmove,
+  kMemset,
+  kStrlen,
+  kStrcmp,
+  kCount,
+};
+
+// Hashes of known routine implementations, from --library_routine_signatures.
+typedef std::unordered_map<uint64_t, LibraryRoutine> LibraryRoutineSignatures;
+
+const char* GetLibraryRoutineName(LibraryRoutine routine);
+
+// Loads lines of '<hex code hash> <routine name>'.
+bool LoadLibraryRoutineSignatures(const std::string& path,
+                                  LibraryRoutineSignatures* out_signatures);
+
+// Hashes the code of a scanned function. Displacements of unconditional
+// branches are ignored, as those are usually calls or tail calls to other
+// functions and differ between titles linking the same library.
+uint64_t HashLibraryRoutineCode(Memory* memory, GuestFunction* function);
+
+// Identifies a scanned function by its name (from a module map) or the hash
+// of its code.
+LibraryRoutine IdentifyLibraryRoutine(
+    Memory* memory, GuestFunction* function,
+    const LibraryRoutineSignatures& signatures);
+
+// Host implementations for use with Processor::DefineBuiltin, taking the
+// Memory as arg0 and the guest arguments in r3-r5. Each sets scratch to 1
+// if it handled the call or to 0 if the guest code must run instead (MMIO
+// ranges, overlapping copies, and so on).
+void LibraryMemcpy(PPCContext* ppc_context, void* arg0, void* arg1);
+void LibraryMemmove(PPCContext* ppc_context, void* arg0, void* arg1);
+void LibraryMemset(PPCContext* ppc_context, void* arg0, void* arg1);
+void LibraryStrlen(PPCContext* ppc_context, void* arg0, void* arg1);
+void LibraryStrcmp(PPCContext* ppc_context, void* arg0, void* arg1);
+
+}  // namespace ppc
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_PPC_PPC_LIBRARY_ROUTINES_H_
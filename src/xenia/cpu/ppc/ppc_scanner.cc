@@ -139,7 +139,7 @@ bool PPCScanner::Scan(GuestFunction* function, FunctionDebugInfo* debug_info) {
       if (d.I.LK()) {
         LOGPPC("bl %.8X -> %.8X", address, target);
         // Queue call target if needed.
-        // GetOrInsertFunction(target);
+        frontend_->processor()->PrecompileFunction(target);
       } else {
         LOGPPC("b %.8X -> %.8X", address, target);
 
@@ -37,12 +37,25 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
 
   scanner_.reset(new PPCScanner(frontend));
   builder_.reset(new PPCHIRBuilder(frontend));
+  inline_builder_.reset(new PPCHIRBuilder(frontend));
   compiler_.reset(new Compiler(frontend->processor()));
   assembler_ = backend->CreateAssembler();
   assembler_->Initialize();
 
   bool validate = FLAGS_validate_hir;
 
+  // Inline small leaf functions before anything else so that all of the
+  // following passes see through the calls. This adds blocks without edges, so
+  // it must come before the CFG is built.
+  if (FLAGS_inline_max_instructions > 0) {
+    compiler_->AddPass(std::make_unique<passes::InliningPass>(
+        [this](GuestFunction* function) {
+          return EmitInlineCandidate(function);
+        }));
+    if (validate)
+      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+
   // Merge blocks early. This will let us use more context in other passes.
   // The CFG is required for simplification and dirtied by it.
   compiler_->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
@@ -73,11 +86,23 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   }
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  // compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
-  // if (validate)
-  // compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  // Removes the context stores promotion left behind because they were live
+  // out of their block.
+  if (FLAGS_eliminate_dead_stores) {
+    compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
+    if (validate)
+      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
   compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  // After DCE so dead code isn't hoisted and materialized constants aren't
+  // folded back into their uses.
+  if (FLAGS_loop_invariant_code_motion &&
+      FLAGS_linear_scan_register_allocation) {
+    compiler_->AddPass(std::make_unique<passes::LoopInvariantCodeMotionPass>());
+    if (validate)
+      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
 
   //// Removes all unneeded variables. Try not to add new ones after this.
   // compiler_->AddPass(new passes::ValueReductionPass());
@@ -87,12 +112,32 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   // Will modify the HIR to add loads/stores.
   // This should be the last pass before finalization, as after this all
   // registers are assigned and ready to be emitted.
-  compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
-      backend->machine_info()));
+  // The linear scan allocator keeps values in registers across blocks.
+  if (FLAGS_linear_scan_register_allocation) {
+    compiler_->AddPass(std::make_unique<passes::LinearScanAllocationPass>(
+        backend->machine_info()));
+  } else {
+    compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
+        backend->machine_info()));
+  }
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
   // Must come last. The HIR is not really HIR after this.
   compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
+
+  // Baseline tier: only what the backend requires, to get cold code running
+  // as quickly as possible. Hot functions are recompiled with the pipeline
+  // above.
+  baseline_compiler_.reset(new Compiler(frontend->processor()));
+  if (validate) {
+    baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+  baseline_compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
+      backend->machine_info()));
+  if (validate) {
+    baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+  baseline_compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
 }
 
 PPCTranslator::~PPCTranslator() = default;
@@ -103,7 +148,9 @@ bool PPCTranslator::Translate(GuestFunction* function,
 
   // Reset() all caching when we leave.
   xe::make_reset_scope(builder_);
+  xe::make_reset_scope(inline_builder_);
   xe::make_reset_scope(compiler_);
+  xe::make_reset_scope(baseline_compiler_);
   xe::make_reset_scope(assembler_);
   xe::make_reset_scope(&string_buffer_);
 
@@ -123,6 +170,11 @@ bool PPCTranslator::Translate(GuestFunction* function,
   if (FLAGS_trace_function_data) {
     debug_info_flags |= DebugInfoFlags::kDebugInfoTraceFunctionData;
   }
+  // Debug info, tracing and breakpoints expect all code in a function to
+  // belong to it.
+  auto processor = frontend_->processor();
+  allow_inlining_ = !debug_info_flags && !processor->is_debugger_attached() &&
+                    !processor->HasBreakpoints();
   std::unique_ptr<FunctionDebugInfo> debug_info;
   if (debug_info_flags) {
     debug_info.reset(new FunctionDebugInfo());
@@ -178,7 +230,10 @@ bool PPCTranslator::Translate(GuestFunction* function,
   }
 
   // Compile/optimize/etc.
-  if (!compiler_->Compile(builder_.get())) {
+  auto compiler = function->tier() == GuestFunction::Tier::kBaseline
+                      ? baseline_compiler_.get()
+                      : compiler_.get();
+  if (!compiler->Compile(builder_.get())) {
     return false;
   }
 
@@ -195,9 +250,31 @@ bool PPCTranslator::Translate(GuestFunction* function,
     return false;
   }
 
+  if (compiler::CompilerStats::is_enabled()) {
+    compiler::CompilerStats::RecordFunction(
+        function->module()->name(), compiler == baseline_compiler_.get(),
+        compiler->pass_samples(), function->machine_code_length());
+  }
+
+  if (FLAGS_report_dead_store_stats && compiler == compiler_.get()) {
+    passes::DeadStoreEliminationPass::RecordEmittedCode(
+        function->machine_code_length());
+  }
+
   return true;
 }
 
+hir::HIRBuilder* PPCTranslator::EmitInlineCandidate(GuestFunction* function) {
+  if (!allow_inlining_) {
+    return nullptr;
+  }
+  inline_builder_->Reset();
+  if (!inline_builder_->Emit(function, 0)) {
+    return nullptr;
+  }
+  return inline_builder_.get();
+}
+
 void PPCTranslator::DumpSource(GuestFunction* function,
                                StringBuffer* string_buffer) {
   Memory* memory = frontend_->memory();
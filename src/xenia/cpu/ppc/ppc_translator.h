@@ -34,11 +34,16 @@ class PPCTranslator {
 
  private:
   void DumpSource(GuestFunction* function, StringBuffer* string_buffer);
+  hir::HIRBuilder* EmitInlineCandidate(GuestFunction* function);
 
   PPCFrontend* frontend_;
   std::unique_ptr<PPCScanner> scanner_;
   std::unique_ptr<PPCHIRBuilder> builder_;
+  // Scratch builder for functions being inlined into the one in builder_.
+  std::unique_ptr<PPCHIRBuilder> inline_builder_;
+  bool allow_inlining_ = false;
   std::unique_ptr<compiler::Compiler> compiler_;
+  std::unique_ptr<compiler::Compiler> baseline_compiler_;
   std::unique_ptr<backend::Assembler> assembler_;
 
   StringBuffer string_buffer_;
@@ -0,0 +1,270 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cwctype>
+#include <sstream>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+#include "xenia/base/mapped_memory.h"
+#include "xenia/base/platform.h"
+#include "xenia/base/string.h"
+#include "xenia/cpu/backend/x64/x64_backend.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/cpu/raw_module.h"
+#include "xenia/cpu/xex_module.h"
+
+#if XE_PLATFORM_WIN32
+#include "xenia/base/platform_win.h"
+// Must come after windows.h.
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif  // XE_PLATFORM_WIN32
+
+DEFINE_int32(benchmark_threads, 1,
+             "Threads compiling functions, or -1 for all but one core.");
+DEFINE_string(benchmark_worker_counts, "",
+              "Comma separated worker counts, such as 1,2,4,8. The image is "
+              "compiled from scratch with each and throughput compared.");
+DEFINE_uint64(raw_base_address, 0x82000000,
+              "Address raw (non-XEX) binaries are loaded at.");
+DEFINE_string(raw_entry_points, "",
+              "Comma separated hex addresses that function discovery starts "
+              "from in raw binaries. Defaults to the base address.");
+
+namespace xe {
+namespace cpu {
+namespace benchmark {
+
+uint64_t QueryPeakMemoryUsage() {
+#if XE_PLATFORM_WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                            sizeof(counters))) {
+    return 0;
+  }
+  return counters.PeakWorkingSetSize;
+#else
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage)) {
+    return 0;
+  }
+  // In KB on Linux.
+  return uint64_t(usage.ru_maxrss) * 1024;
+#endif  // XE_PLATFORM_WIN32
+}
+
+std::unique_ptr<backend::Backend> CreateBackend() {
+  std::unique_ptr<xe::cpu::backend::Backend> backend;
+#if defined(XENIA_HAS_X64_BACKEND) && XENIA_HAS_X64_BACKEND
+  if (FLAGS_cpu == "x64" || FLAGS_cpu == "any") {
+    backend.reset(new xe::cpu::backend::x64::X64Backend());
+  }
+#endif  // XENIA_HAS_X64_BACKEND
+  return backend;
+}
+
+std::vector<uint32_t> ParseEntryPoints() {
+  std::vector<uint32_t> entry_points;
+  std::istringstream stream(FLAGS_raw_entry_points);
+  std::string value;
+  while (std::getline(stream, value, ',')) {
+    if (!value.empty()) {
+      entry_points.push_back(
+          static_cast<uint32_t>(std::strtoul(value.c_str(), nullptr, 16)));
+    }
+  }
+  if (entry_points.empty()) {
+    entry_points.push_back(static_cast<uint32_t>(FLAGS_raw_base_address));
+  }
+  return entry_points;
+}
+
+std::vector<int32_t> ParseWorkerCounts() {
+  std::vector<int32_t> worker_counts;
+  std::istringstream stream(FLAGS_benchmark_worker_counts);
+  std::string value;
+  while (std::getline(stream, value, ',')) {
+    if (!value.empty()) {
+      worker_counts.push_back(std::max(std::atoi(value.c_str()), 1));
+    }
+  }
+  return worker_counts;
+}
+
+struct CompileResult {
+  double elapsed_seconds = 0.0;
+  uint32_t function_count = 0;
+  uint32_t failed_count = 0;
+  uint64_t guest_size = 0;
+  uint64_t code_size = 0;
+};
+
+// Loads the image into a fresh processor and compiles everything reachable
+// from it on worker_count background compiler threads.
+bool CompileImage(const std::wstring& path, bool is_xex, int32_t worker_count,
+                  CompileResult* result) {
+  FLAGS_aot_compile_threads = worker_count;
+
+  auto memory = std::make_unique<Memory>();
+  if (!memory->Initialize()) {
+    XELOGE("Unable to initialize guest memory");
+    return false;
+  }
+  auto processor = std::make_unique<Processor>(memory.get(), nullptr);
+  if (!processor->Setup(CreateBackend())) {
+    XELOGE("Unable to set up the processor");
+    return false;
+  }
+
+  uint64_t start_ticks = 0;
+  Module* module = nullptr;
+  std::unique_ptr<MappedMemory> mapping;
+  if (is_xex) {
+    mapping = MappedMemory::Open(path, MappedMemory::Mode::kRead);
+    if (!mapping) {
+      XELOGE("Unable to open %ls", path.c_str());
+      return false;
+    }
+    auto xex_module = std::make_unique<XexModule>(processor.get(), nullptr);
+    if (!xex_module->Load(xe::to_string(xe::find_name_from_path(path)),
+                          xe::to_string(path), mapping->data(),
+                          mapping->size())) {
+      XELOGE("Unable to load %ls", path.c_str());
+      return false;
+    }
+    module = xex_module.get();
+    processor->AddModule(std::move(xex_module));
+    // Queues the entry point and all functions in .pdata.
+    start_ticks = Clock::QueryHostTickCount();
+    if (!static_cast<XexModule*>(module)->LoadContinue()) {
+      XELOGE("Unable to load %ls", path.c_str());
+      return false;
+    }
+  } else {
+    auto raw_module = std::make_unique<RawModule>(processor.get());
+    if (!raw_module->LoadFile(static_cast<uint32_t>(FLAGS_raw_base_address),
+                              path)) {
+      XELOGE("Unable to load %ls", path.c_str());
+      return false;
+    }
+    raw_module->set_executable(true);
+    module = raw_module.get();
+    processor->AddModule(std::move(raw_module));
+    start_ticks = Clock::QueryHostTickCount();
+    processor->PrecompileFunctions(ParseEntryPoints());
+  }
+  processor->WaitForPrecompile();
+  result->elapsed_seconds =
+      double(Clock::QueryHostTickCount() - start_ticks) /
+      Clock::host_tick_frequency();
+
+  module->ForEachFunction([&](Function* function) {
+    if (!function->is_guest()) {
+      return;
+    }
+    if (function->status() != Symbol::Status::kDefined) {
+      ++result->failed_count;
+      return;
+    }
+    ++result->function_count;
+    result->guest_size += function->end_address() - function->address() + 4;
+    result->code_size +=
+        static_cast<GuestFunction*>(function)->machine_code_length();
+  });
+
+  // Per-pass totals are logged/written as the processor shuts down.
+  processor.reset();
+  memory.reset();
+  return true;
+}
+
+int main(const std::vector<std::wstring>& args) {
+  if (args.size() < 2) {
+    XELOGE("Usage: xenia-cpu-ppc-jit-benchmark [--flags] image.xex|image.bin");
+    return 1;
+  }
+  auto path = xe::fix_path_separators(args[1]);
+  bool is_xex = false;
+  if (path.size() > 4) {
+    auto extension = path.substr(path.size() - 4);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   towlower);
+    is_xex = extension == L".xex";
+  }
+
+  auto worker_counts = ParseWorkerCounts();
+  if (!worker_counts.empty()) {
+    // Compiles the image from scratch once per worker count and compares
+    // throughput against the first run.
+    std::vector<CompileResult> results;
+    for (int32_t worker_count : worker_counts) {
+      CompileResult result;
+      if (!CompileImage(path, is_xex, worker_count, &result)) {
+        return 1;
+      }
+      results.push_back(result);
+    }
+    XELOGI("Workers  Seconds  Functions/sec  Speedup");
+    for (size_t i = 0; i < results.size(); ++i) {
+      auto& result = results[i];
+      XELOGI("%7d %8.3f %14.1f %7.2fx", worker_counts[i],
+             result.elapsed_seconds,
+             result.function_count / result.elapsed_seconds,
+             results[0].elapsed_seconds / result.elapsed_seconds);
+    }
+    XELOGI("Peak memory usage: %.1f MB",
+           QueryPeakMemoryUsage() / (1024.0 * 1024.0));
+    return results[0].failed_count ? 1 : 0;
+  }
+
+  // Functions are compiled by the background compiler, which follows calls
+  // found while scanning just as it does when running a title. Report the
+  // per-pass totals unless they are being written somewhere already.
+  if (FLAGS_compiler_stats_path.empty()) {
+    FLAGS_report_compiler_stats = true;
+  }
+  int32_t worker_count = FLAGS_benchmark_threads ? FLAGS_benchmark_threads : 1;
+  CompileResult result;
+  if (!CompileImage(path, is_xex, worker_count, &result)) {
+    return 1;
+  }
+
+  XELOGI("Compiled %u functions (%u failed) in %.3fs on %d threads",
+         result.function_count, result.failed_count, result.elapsed_seconds,
+         worker_count);
+  XELOGI("  %.1f functions/sec, %.1f guest KB/sec",
+         result.function_count / result.elapsed_seconds,
+         result.guest_size / 1024.0 / result.elapsed_seconds);
+  XELOGI("  %" PRIu64 " bytes of guest code -> %" PRIu64
+         " bytes of host code (%.2fx)",
+         result.guest_size, result.code_size,
+         result.guest_size
+             ? double(result.code_size) / double(result.guest_size)
+             : 0.0);
+  XELOGI("  Peak memory usage: %.1f MB",
+         QueryPeakMemoryUsage() / (1024.0 * 1024.0));
+  return result.failed_count ? 1 : 0;
+}
+
+}  // namespace benchmark
+}  // namespace cpu
+}  // namespace xe
+
+DEFINE_ENTRY_POINT(L"xenia-cpu-ppc-jit-benchmark",
+                   L"xenia-cpu-ppc-jit-benchmark [--flags] image.xex|image.bin",
+                   xe::cpu::benchmark::main);
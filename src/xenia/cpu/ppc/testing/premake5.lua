@@ -14,6 +14,7 @@ project("xenia-cpu-ppc-tests")
     "gflags",
     "capstone", -- cpu-backend-x64
     "mspack",
+    "xxhash",
   })
   files({
     "ppc_testing_main.cc",
@@ -37,6 +38,36 @@ project("xenia-cpu-ppc-tests")
 
     -- xenia-base needs this
     links({"xenia-ui"})
+  filter({})
+
+project("xenia-cpu-ppc-jit-benchmark")
+  uuid("0f53ae33-8c2e-4a5d-9aa4-e1129a1dc231")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "xenia-core",
+    "xenia-cpu-backend-x64",
+    "xenia-cpu",
+    "xenia-base",
+    "gflags",
+    "capstone", -- cpu-backend-x64
+    "mspack",
+    "xxhash",
+
+    -- TODO(benvanik): cut these dependencies?
+    "xenia-kernel",
+  })
+  files({
+    "ppc_jit_benchmark_main.cc",
+    "../../../base/main_"..platform_suffix..".cc",
+  })
+  includedirs({
+    project_root.."/third_party/gflags/src",
+  })
+  filter("platforms:Windows")
+    -- xenia-base needs this
+    links({"xenia-ui"})
+  filter({})
 
 if ARCH == "ppc64" or ARCH == "powerpc64" then
 
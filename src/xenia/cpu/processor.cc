@@ -11,22 +11,29 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/atomic.h"
 #include "xenia/base/byte_order.h"
 #include "xenia/base/byte_stream.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/debugging.h"
 #include "xenia/base/exception_handler.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/threading.h"
+#include "xenia/cpu/backend/code_cache.h"
+#include "xenia/cpu/background_compiler.h"
 #include "xenia/cpu/breakpoint.h"
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/export_resolver.h"
+#include "xenia/cpu/mmio_handler.h"
 #include "xenia/cpu/module.h"
 #include "xenia/cpu/ppc/ppc_decode_data.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
+#include "xenia/cpu/sampling_profiler.h"
 #include "xenia/cpu/stack_walker.h"
 #include "xenia/cpu/thread.h"
 #include "xenia/cpu/thread_state.h"
@@ -78,11 +85,35 @@ class BuiltinModule : public Module {
 };
 
 Processor::Processor(xe::Memory* memory, ExportResolver* export_resolver)
-    : memory_(memory), export_resolver_(export_resolver) {}
+    : memory_(memory), export_resolver_(export_resolver) {
+  last_cache_flush_millis_ = Clock::QueryHostUptimeMillis();
+}
 
 Processor::~Processor() {
+  // Resolving samples needs the code cache and functions.
+  if (sampling_profiler_) {
+    sampling_profiler_->Stop();
+    sampling_profiler_->DumpTopFunctions(20);
+    sampling_profiler_->WriteCollapsedStacks(
+        xe::to_wstring(FLAGS_guest_profile_path));
+    sampling_profiler_.reset();
+  }
+
+  if (backend_) {
+    if (auto mmio_handler = MMIOHandler::global_handler()) {
+      mmio_handler->SetAccessSiteCallback(nullptr, nullptr);
+    }
+  }
+
+  // Workers take the global lock, so they must be stopped before we do.
+  background_compiler_.reset();
+
   {
     auto global_lock = global_critical_region_.Acquire();
+    if (backend_) {
+      // Persist generated code while the functions are still around.
+      FlushCachedCode();
+    }
     modules_.clear();
   }
 
@@ -138,6 +169,29 @@ bool Processor::Setup(std::unique_ptr<backend::Backend> backend) {
     }
   }
 
+  // Code that faults on MMIO gets rebuilt to call the handler directly.
+  if (auto mmio_handler = MMIOHandler::global_handler()) {
+    mmio_handler->SetAccessSiteCallback(MMIOAccessSiteThunk, this);
+  }
+
+  // Start ahead-of-time compilation workers, if requested.
+  int32_t aot_compile_threads = FLAGS_aot_compile_threads;
+  if (aot_compile_threads < 0) {
+    aot_compile_threads =
+        std::max(int32_t(xe::threading::logical_processor_count()) - 1, 1);
+  }
+  // Hot baseline functions are recompiled on the same workers.
+  int32_t worker_count = aot_compile_threads;
+  if (FLAGS_tier_up_threshold > 0) {
+    worker_count = std::max(worker_count, 1);
+  }
+  if (worker_count > 0) {
+    background_compiler_ = std::make_unique<BackgroundCompiler>(this);
+    if (!background_compiler_->Initialize(uint32_t(worker_count))) {
+      background_compiler_.reset();
+    }
+  }
+
   // Open the trace data path, if requested.
   functions_trace_path_ = xe::to_wstring(FLAGS_trace_function_data_path);
   if (!functions_trace_path_.empty()) {
@@ -145,6 +199,15 @@ bool Processor::Setup(std::unique_ptr<backend::Backend> backend) {
         functions_trace_path_, 32 * 1024 * 1024, true);
   }
 
+  if (!FLAGS_guest_profile_path.empty()) {
+    sampling_profiler_ = std::make_unique<SamplingProfiler>(this);
+    if (!sampling_profiler_->Start(
+            uint32_t(std::max(FLAGS_guest_profile_rate, 1)))) {
+      XELOGW("Unable to start the guest sampling profiler");
+      sampling_profiler_.reset();
+    }
+  }
+
   return true;
 }
 
@@ -162,10 +225,126 @@ void Processor::PreLaunch() {
 
 bool Processor::AddModule(std::unique_ptr<Module> module) {
   auto global_lock = global_critical_region_.Acquire();
+  // Module loads are a natural checkpoint for what was generated so far.
+  if (backend_ && !FLAGS_jit_cache_path.empty()) {
+    FlushCachedCode();
+  }
   modules_.push_back(std::move(module));
+  IndexModuleRanges();
   return true;
 }
 
+void Processor::IndexModuleRanges() {
+  // Where ranges overlap, the module registered first wins, as it would when
+  // asking each module in turn. Later ranges are split around earlier ones so
+  // the index stays disjoint.
+  auto module_ranges = std::make_shared<std::vector<ModuleRange>>();
+  for (const auto& module : modules_) {
+    uint32_t low_address;
+    uint32_t high_address;
+    if (!module->GetAddressRange(&low_address, &high_address)) {
+      continue;
+    }
+    std::vector<ModuleRange> pieces;
+    for (const auto& range : *module_ranges) {
+      if (low_address >= high_address || range.low_address >= high_address) {
+        break;
+      }
+      if (range.high_address <= low_address) {
+        continue;
+      }
+      if (range.low_address > low_address) {
+        pieces.push_back({low_address, range.low_address, module.get()});
+      }
+      low_address = std::max(low_address, range.high_address);
+    }
+    if (low_address < high_address) {
+      pieces.push_back({low_address, high_address, module.get()});
+    }
+    module_ranges->insert(module_ranges->end(), pieces.begin(), pieces.end());
+    std::sort(module_ranges->begin(), module_ranges->end(),
+              [](const ModuleRange& a, const ModuleRange& b) {
+                return a.low_address < b.low_address;
+              });
+  }
+  std::atomic_store(
+      &module_ranges_,
+      std::shared_ptr<const std::vector<ModuleRange>>(module_ranges));
+  ++module_ranges_generation_;
+}
+
+// The module most recently found by LookupModule on this thread. Guest threads
+// tend to stay within the same module.
+struct LastModuleCache {
+  Processor* processor = nullptr;
+  uint32_t generation = 0;
+  uint32_t low_address = 0;
+  uint32_t high_address = 0;
+  Module* module = nullptr;
+};
+static thread_local LastModuleCache last_module_cache_;
+
+Module* Processor::LookupModule(uint32_t address) {
+  auto& cache = last_module_cache_;
+  uint32_t generation = module_ranges_generation_;
+  if (cache.processor == this && cache.generation == generation &&
+      address >= cache.low_address && address < cache.high_address) {
+    return cache.module;
+  }
+
+  // Binary search the modules with known ranges.
+  auto module_ranges = std::atomic_load(&module_ranges_);
+  if (module_ranges) {
+    auto it = std::upper_bound(
+        module_ranges->begin(), module_ranges->end(), address,
+        [](uint32_t address, const ModuleRange& range) {
+          return address < range.low_address;
+        });
+    if (it != module_ranges->begin()) {
+      --it;
+      if (address < it->high_address) {
+        cache.processor = this;
+        cache.generation = generation;
+        cache.low_address = it->low_address;
+        cache.high_address = it->high_address;
+        cache.module = it->module;
+        return it->module;
+      }
+    }
+  }
+
+  // Fall back to asking each module, for those without a simple range or
+  // whose range was not yet known when they were added.
+  auto global_lock = global_critical_region_.Acquire();
+  for (const auto& module : modules_) {
+    if (module->ContainsAddress(address)) {
+      uint32_t low_address;
+      uint32_t high_address;
+      if (module->GetAddressRange(&low_address, &high_address)) {
+        IndexModuleRanges();
+      }
+      return module.get();
+    }
+  }
+  return nullptr;
+}
+
+void Processor::OnModuleUnloaded(Module* module, uint32_t low_address,
+                                 uint32_t high_address) {
+  {
+    // The module no longer reports its range, so it drops out of the index.
+    auto global_lock = global_critical_region_.Acquire();
+    IndexModuleRanges();
+  }
+  if (high_address > low_address) {
+    entry_table_.RemoveRange(low_address, high_address);
+    if (background_compiler_) {
+      background_compiler_->ForgetRange(low_address, high_address);
+    }
+  }
+  backend_->ReleaseModuleCode(module);
+}
+
 Module* Processor::GetModule(const char* name) {
   auto global_lock = global_critical_region_.Acquire();
   for (const auto& module : modules_) {
@@ -224,17 +403,19 @@ Function* Processor::ResolveFunction(uint32_t address) {
     // Grab symbol declaration.
     auto function = LookupFunction(address);
     if (!function) {
-      entry->status = Entry::STATUS_FAILED;
+      entry_table_.SetStatus(entry, Entry::STATUS_FAILED);
       return nullptr;
     }
 
     if (!DemandFunction(function)) {
-      entry->status = Entry::STATUS_FAILED;
+      entry_table_.SetStatus(entry, Entry::STATUS_FAILED);
       return nullptr;
     }
     entry->function = function;
     entry->end_address = function->end_address();
-    status = entry->status = Entry::STATUS_READY;
+    status = Entry::STATUS_READY;
+    entry_table_.SetStatus(entry, status);
+    MaybeFlushCachedCode();
   }
   if (status == Entry::STATUS_READY) {
     // Ready to use.
@@ -245,22 +426,150 @@ Function* Processor::ResolveFunction(uint32_t address) {
   }
 }
 
-Function* Processor::LookupFunction(uint32_t address) {
-  // TODO(benvanik): fast reject invalid addresses/log errors.
+void Processor::FlushCachedCode() {
+  last_cache_flush_millis_ = Clock::QueryHostUptimeMillis();
+  for (const auto& module : modules_) {
+    backend_->SaveCachedCode(module.get());
+  }
+}
 
-  // Find the module that contains the address.
-  Module* code_module = nullptr;
+void Processor::MaybeFlushCachedCode() {
+  if (FLAGS_jit_cache_path.empty() || FLAGS_jit_cache_flush_interval <= 0) {
+    return;
+  }
+  uint64_t now = Clock::QueryHostUptimeMillis();
+  uint64_t last = last_cache_flush_millis_;
+  if (now - last < uint64_t(FLAGS_jit_cache_flush_interval) * 1000 ||
+      !last_cache_flush_millis_.compare_exchange_strong(last, now)) {
+    // Not due yet, or another thread is already on it.
+    return;
+  }
+  auto global_lock = global_critical_region_.Acquire();
+  FlushCachedCode();
+}
+
+void Processor::PrecompileFunction(uint32_t address) {
+  // The scanner asks for every call target, most of which are compiled by
+  // now. Those are found without taking the background compiler's lock.
+  if (background_compiler_ && FLAGS_aot_compile_threads &&
+      !entry_table_.Get(address)) {
+    background_compiler_->Enqueue(address);
+  }
+}
+
+void Processor::PrecompileFunctions(const std::vector<uint32_t>& addresses) {
+  if (!background_compiler_ || !FLAGS_aot_compile_threads) {
+    return;
+  }
+  std::vector<uint32_t> uncompiled_addresses;
+  uncompiled_addresses.reserve(addresses.size());
+  for (uint32_t address : addresses) {
+    if (!entry_table_.Get(address)) {
+      uncompiled_addresses.push_back(address);
+    }
+  }
+  background_compiler_->Enqueue(uncompiled_addresses);
+}
+
+void Processor::WaitForPrecompile() {
+  if (background_compiler_) {
+    background_compiler_->WaitForIdle();
+  }
+}
+
+void Processor::OnFunctionHot(GuestFunction* function) {
+  if (background_compiler_) {
+    background_compiler_->EnqueueRecompile(function);
+  }
+}
+
+bool Processor::RecompileFunction(GuestFunction* function) {
+  SCOPE_profile_cpu_f("cpu");
+
+  bool mmio_stale;
   {
-    auto global_lock = global_critical_region_.Acquire();
-    // TODO(benvanik): sort by code address (if contiguous) so can bsearch.
-    // TODO(benvanik): cache last module low/high, as likely to be in there.
-    for (const auto& module : modules_) {
-      if (module->ContainsAddress(address)) {
-        code_module = module.get();
-        break;
-      }
+    std::lock_guard<std::mutex> lock(mmio_access_sites_mutex_);
+    mmio_stale = mmio_stale_functions_.erase(function) != 0;
+  }
+  if (!mmio_stale && (function->tier() != GuestFunction::Tier::kBaseline ||
+                      function->optimized_function())) {
+    return true;
+  }
+
+  // Build into a new function so that the baseline code and its source map
+  // stay valid for any thread still running it. Placing the code updates the
+  // indirection table entry, which redirects all callers going through it.
+  auto optimized_function =
+      backend_->CreateGuestFunction(function->module(), function->address());
+  optimized_function->set_name(function->name());
+  optimized_function->set_behavior(function->behavior());
+  if (function->behavior() == Function::Behavior::kExtern) {
+    optimized_function->SetupExtern(function->extern_handler(),
+                                    function->export_data());
+  }
+  if (!frontend_->DefineFunction(optimized_function.get(), 0)) {
+    XELOGW("Unable to recompile hot function %.8X", function->address());
+    return false;
+  }
+  function->set_optimized_function(std::move(optimized_function));
+  return true;
+}
+
+void Processor::MMIOAccessSiteThunk(void* context_ptr, uint64_t host_pc) {
+  reinterpret_cast<Processor*>(context_ptr)->OnMMIOAccessSite(host_pc);
+}
+
+void Processor::OnMMIOAccessSite(uint64_t host_pc) {
+  auto function = backend_->code_cache()->LookupFunction(host_pc);
+  if (!function) {
+    // Not guest code (a thunk or a host helper).
+    return;
+  }
+  uint32_t guest_address = function->MapMachineCodeToGuestAddress(host_pc);
+
+  // Optimized replacements hang off the function known to the module.
+  auto symbol = function->module()->LookupSymbol(function->address(), false);
+  if (!symbol || symbol->type() != Symbol::Type::kFunction) {
+    return;
+  }
+  auto root_function = static_cast<GuestFunction*>(symbol);
+  {
+    std::lock_guard<std::mutex> lock(mmio_access_sites_mutex_);
+    // The site may already be known if the function was being rebuilt for
+    // another site at the time. Stop if code built with it still faults, as
+    // happens for accesses that aren't 32 bits.
+    if (++mmio_access_sites_[guest_address] > 2) {
+      return;
     }
+    mmio_stale_functions_.insert(root_function);
   }
+  XELOGD("MMIO access at %.8X in %.8X, recompiling", guest_address,
+         root_function->address());
+  if (background_compiler_) {
+    background_compiler_->EnqueueRecompile(root_function);
+  } else {
+    // Nothing else would get to it. Guest code holds no host locks, so this is
+    // no different from compiling it on a call. The faulting access is still
+    // completed by the handler once we return.
+    RecompileFunction(root_function);
+  }
+}
+
+void Processor::GetMMIOAccessSites(uint32_t start_address,
+                                   uint32_t end_address,
+                                   std::vector<uint32_t>* out_addresses) {
+  std::lock_guard<std::mutex> lock(mmio_access_sites_mutex_);
+  for (auto it = mmio_access_sites_.lower_bound(start_address);
+       it != mmio_access_sites_.end() && it->first <= end_address; ++it) {
+    out_addresses->push_back(it->first);
+  }
+}
+
+Function* Processor::LookupFunction(uint32_t address) {
+  // TODO(benvanik): fast reject invalid addresses/log errors.
+
+  // Find the module that contains the address.
+  Module* code_module = LookupModule(address);
   if (!code_module) {
     // No module found that could contain the address.
     return nullptr;
@@ -294,10 +603,21 @@ bool Processor::DemandFunction(Function* function) {
   if (symbol_status == Symbol::Status::kNew) {
     // Symbol is undefined, so define now.
     assert_true(function->is_guest());
-    if (!frontend_->DefineFunction(static_cast<GuestFunction*>(function),
-                                   debug_info_flags_)) {
-      function->set_status(Symbol::Status::kFailed);
-      return false;
+    auto guest_function = static_cast<GuestFunction*>(function);
+    // Reuse machine code from a previous run when possible. Cached code never
+    // carries debug info, so always translate when that's requested.
+    bool defined =
+        !debug_info_flags_ && backend_->DefineCachedFunction(guest_function);
+    if (!defined) {
+      // Start out with quick baseline code, unless debugging where we want
+      // the final code from the start.
+      if (FLAGS_tier_up_threshold > 0 && !debug_info_flags_) {
+        guest_function->set_tier(GuestFunction::Tier::kBaseline);
+      }
+      if (!frontend_->DefineFunction(guest_function, debug_info_flags_)) {
+        function->set_status(Symbol::Status::kFailed);
+        return false;
+      }
     }
 
     // Before we give the symbol back to the rest, let the debugger know.
@@ -532,6 +852,20 @@ std::vector<ThreadDebugInfo*> Processor::QueryThreadDebugInfos() {
   return result;
 }
 
+void Processor::VisitRunningGuestThreads(
+    const std::function<void(Thread*)>& visitor) {
+  auto global_lock = global_critical_region_.Acquire();
+  for (auto& it : thread_debug_infos_) {
+    auto thread_info = it.second.get();
+    if (thread_info->state != ThreadDebugInfo::State::kAlive ||
+        thread_info->suspended || !thread_info->thread ||
+        !thread_info->thread->can_debugger_suspend()) {
+      continue;
+    }
+    visitor(thread_info->thread);
+  }
+}
+
 ThreadDebugInfo* Processor::QueryThreadDebugInfo(uint32_t thread_id) {
   auto global_lock = global_critical_region_.Acquire();
   const auto& it = thread_debug_infos_.find(thread_id);
@@ -575,6 +909,11 @@ Breakpoint* Processor::FindBreakpoint(uint32_t address) {
   return nullptr;
 }
 
+bool Processor::HasBreakpoints() {
+  auto global_lock = global_critical_region_.Acquire();
+  return !breakpoints_.empty();
+}
+
 void Processor::set_debug_listener(DebugListener* debug_listener) {
   if (debug_listener == debug_listener_) {
     return;
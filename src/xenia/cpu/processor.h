@@ -12,9 +12,13 @@
 
 #include <gflags/gflags.h>
 
+#include <atomic>
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 #include "xenia/base/mapped_memory.h"
@@ -35,7 +39,9 @@ DECLARE_bool(debug);
 namespace xe {
 namespace cpu {
 
+class BackgroundCompiler;
 class Breakpoint;
+class SamplingProfiler;
 class StackWalker;
 class XexModule;
 
@@ -116,6 +122,32 @@ class Processor {
   Function* LookupFunction(Module* module, uint32_t address);
   Function* ResolveFunction(uint32_t address);
 
+  // Queues functions to be compiled ahead of time on background threads, if
+  // enabled. Guest threads calling them before they're ready will wait.
+  void PrecompileFunction(uint32_t address);
+  void PrecompileFunctions(const std::vector<uint32_t>& addresses);
+  // Blocks until all functions queued for ahead-of-time compilation (and the
+  // ones found while scanning them) have been compiled.
+  void WaitForPrecompile();
+
+  // Called by baseline code once it has been entered often enough to be worth
+  // optimizing. The function is recompiled in the background and swapped in.
+  void OnFunctionHot(GuestFunction* function);
+  // Builds the fully optimized version of a baseline function and routes all
+  // further calls to it. Functions with newly found MMIO access sites are
+  // rebuilt even if they are already optimized.
+  bool RecompileFunction(GuestFunction* function);
+
+  // Called the first time the host instruction at host_pc faults on an MMIO
+  // range. The guest load/store it came from is remembered and its function
+  // recompiled so that the access calls the MMIO handler directly. That
+  // happens on the faulting thread when there is no background compiler.
+  void OnMMIOAccessSite(uint64_t host_pc);
+  // Appends the guest addresses of known MMIO accesses within
+  // [start_address, end_address], in order.
+  void GetMMIOAccessSites(uint32_t start_address, uint32_t end_address,
+                          std::vector<uint32_t>* out_addresses);
+
   bool Execute(ThreadState* thread_state, uint32_t address);
   bool ExecuteRaw(ThreadState* thread_state, uint32_t address);
   uint64_t Execute(ThreadState* thread_state, uint32_t address, uint64_t args[],
@@ -137,6 +169,10 @@ class Processor {
   // Returns the debugger info for the given thread.
   ThreadDebugInfo* QueryThreadDebugInfo(uint32_t thread_id);
 
+  // Calls the visitor for each guest thread that is alive and not in a wait,
+  // with the processor lock held so that none of them can go away meanwhile.
+  void VisitRunningGuestThreads(const std::function<void(Thread*)>& visitor);
+
   // Adds a breakpoint to the debugger and activates it (if enabled).
   // The given breakpoint will not be owned by the debugger and must remain
   // allocated so long as it is added.
@@ -151,6 +187,12 @@ class Processor {
   // Returns all currently registered breakpoints.
   std::vector<Breakpoint*> breakpoints() const;
 
+  // True if any breakpoint is registered, installed or not. Functions are
+  // translated without inlining meanwhile so that breakpoints can be placed
+  // in every function's own code; code translated before keeps its inlined
+  // copies.
+  bool HasBreakpoints();
+
   // Shows the debug listener, focusing it if it already exists.
   void ShowDebugger();
 
@@ -195,6 +237,11 @@ class Processor {
   void OnThreadEnteringWait(uint32_t thread_id);
   void OnThreadLeavingWait(uint32_t thread_id);
 
+  // Stops resolving functions in the [low_address, high_address) range of an
+  // unloaded module and frees the code generated for them.
+  void OnModuleUnloaded(Module* module, uint32_t low_address,
+                        uint32_t high_address);
+
   bool OnUnhandledException(Exception* ex);
   bool OnThreadBreakpointHit(Exception* ex);
 
@@ -224,6 +271,8 @@ class Processor {
 
   void OnFunctionDefined(Function* function);
 
+  static void MMIOAccessSiteThunk(void* context_ptr, uint64_t host_pc);
+
   static bool ExceptionCallbackThunk(Exception* ex, void* data);
   bool ExceptionCallback(Exception* ex);
   void OnStepCompleted(ThreadDebugInfo* thread_info);
@@ -236,6 +285,20 @@ class Processor {
                                          uint32_t current_pc);
 
   bool DemandFunction(Function* function);
+  // Writes the persistent JIT cache of every module.
+  // Must be called with the global lock held.
+  void FlushCachedCode();
+  // Flushes the cache if --jit_cache_flush_interval has passed since the last
+  // time.
+  void MaybeFlushCachedCode();
+
+  // Finds the module containing the given address, if any. Modules with a
+  // known range are found before those without one, whatever order they were
+  // added in. Of overlapping ranges, the module added first wins.
+  Module* LookupModule(uint32_t address);
+  // Rebuilds module_ranges_ from all modules with known ranges.
+  // Must be called with the global lock held.
+  void IndexModuleRanges();
 
   Memory* memory_ = nullptr;
   std::unique_ptr<StackWalker> stack_walker_;
@@ -252,12 +315,36 @@ class Processor {
   std::unique_ptr<ppc::PPCFrontend> frontend_;
   std::unique_ptr<backend::Backend> backend_;
   ExportResolver* export_resolver_ = nullptr;
+  std::unique_ptr<BackgroundCompiler> background_compiler_;
+  std::unique_ptr<SamplingProfiler> sampling_profiler_;
+  // Host uptime of the last persistent cache write.
+  std::atomic<uint64_t> last_cache_flush_millis_ = {0};
+
+  // Guest loads/stores known to access MMIO (with the number of rebuilds
+  // they caused), and functions whose code was built before one of those was
+  // found in them.
+  std::mutex mmio_access_sites_mutex_;
+  std::map<uint32_t, uint32_t> mmio_access_sites_;
+  std::unordered_set<GuestFunction*> mmio_stale_functions_;
 
   EntryTable entry_table_;
   xe::global_critical_region global_critical_region_;
   ExecutionState execution_state_ = ExecutionState::kPaused;
   std::vector<std::unique_ptr<Module>> modules_;
   Module* builtin_module_ = nullptr;
+
+  // Disjoint address ranges of the modules with a known range, sorted by low
+  // address. Replaced wholesale so lookups can read it without the global
+  // lock.
+  struct ModuleRange {
+    uint32_t low_address;
+    uint32_t high_address;
+    Module* module;
+  };
+  std::shared_ptr<const std::vector<ModuleRange>> module_ranges_;
+  // Incremented whenever module_ranges_ changes to invalidate the per-thread
+  // last-module cache.
+  std::atomic<uint32_t> module_ranges_generation_ = {0};
   uint32_t next_builtin_address_ = 0xFFFF0000u;
 
   // Maps thread ID to state. Updated on thread create, and threads are never
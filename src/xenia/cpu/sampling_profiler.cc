@@ -0,0 +1,245 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/sampling_profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/profiling.h"
+#include "xenia/base/string.h"
+#include "xenia/cpu/backend/code_cache.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/cpu/thread_state.h"
+
+namespace xe {
+namespace cpu {
+
+namespace {
+
+// Frames further apart than this are assumed to be garbage.
+const uint32_t kMaxFrameSize = 1024 * 1024;
+
+}  // namespace
+
+SamplingProfiler::SamplingProfiler(Processor* processor)
+    : processor_(processor), samples_(new Sample[kSampleCount]) {
+  for (size_t i = 0; i < kSampleCount; ++i) {
+    samples_[i].state = kSampleFree;
+  }
+}
+
+SamplingProfiler::~SamplingProfiler() { Stop(); }
+
+bool SamplingProfiler::Start(uint32_t samples_per_second) {
+  if (running_ || !samples_per_second) {
+    return false;
+  }
+  running_ = true;
+  xe::threading::Thread::CreationParameters params;
+  collector_thread_ = xe::threading::Thread::Create(params, [this]() {
+    xe::Profiler::ThreadEnter("Sampling Profiler");
+    CollectorMain();
+    xe::Profiler::ThreadExit();
+  });
+  if (!collector_thread_) {
+    XELOGE("Unable to create sampling profiler thread");
+    running_ = false;
+    return false;
+  }
+  collector_thread_->set_name("Sampling Profiler");
+  if (!StartTimer(samples_per_second)) {
+    Stop();
+    return false;
+  }
+  XELOGI("Sampling guest code at %u Hz", samples_per_second);
+  return true;
+}
+
+void SamplingProfiler::Stop() {
+  if (!running_) {
+    return;
+  }
+  StopTimer();
+  running_ = false;
+  if (collector_thread_) {
+    xe::threading::Wait(collector_thread_.get(), false);
+    collector_thread_.reset();
+  }
+  // Pick up anything that arrived after the last pass.
+  ProcessSamples();
+  if (dropped_count_) {
+    XELOGW("Sampling profiler dropped %" PRIu64 " samples",
+           uint64_t(dropped_count_));
+  }
+}
+
+void SamplingProfiler::RecordSample(ThreadState* thread_state,
+                                    uint64_t host_pc) {
+  uint32_t index = next_sample_.fetch_add(1) % kSampleCount;
+  auto& sample = samples_[index];
+  uint32_t expected = kSampleFree;
+  if (!sample.state.compare_exchange_strong(expected, kSampleWriting)) {
+    // The collector is behind; rather lose a sample than wait in a signal.
+    ++dropped_count_;
+    return;
+  }
+
+  auto context = thread_state->context();
+  sample.host_pc = host_pc;
+  sample.frame_count = 0;
+  sample.frames[sample.frame_count++] = static_cast<uint32_t>(context->lr);
+
+  // Follow the back chain: each frame starts with a pointer to the caller's
+  // frame, and the return address into the caller is saved just below it.
+  uint32_t sp = static_cast<uint32_t>(context->r[1]);
+  while (sample.frame_count < kMaxFrames) {
+    uint32_t back_chain;
+    if (!ReadGuestWord(sp, &back_chain)) {
+      break;
+    }
+    if (back_chain <= sp || back_chain - sp > kMaxFrameSize) {
+      break;
+    }
+    uint32_t return_address;
+    if (!ReadGuestWord(back_chain - 8, &return_address) || !return_address) {
+      break;
+    }
+    sample.frames[sample.frame_count++] = return_address;
+    sp = back_chain;
+  }
+
+  sample.state.store(kSampleReady, std::memory_order_release);
+}
+
+void SamplingProfiler::CollectorMain() {
+  while (running_) {
+    xe::threading::Sleep(std::chrono::milliseconds(10));
+    ProcessSamples();
+  }
+}
+
+void SamplingProfiler::ProcessSamples() {
+  for (size_t i = 0; i < kSampleCount; ++i) {
+    auto& sample = samples_[i];
+    if (sample.state.load(std::memory_order_acquire) != kSampleReady) {
+      continue;
+    }
+    ProcessSample(sample);
+    sample.state.store(kSampleFree, std::memory_order_release);
+  }
+}
+
+void SamplingProfiler::ProcessSample(const Sample& sample) {
+  // Innermost first while building, reversed at the end.
+  std::vector<uint32_t> stack;
+  uint32_t leaf = 0;
+  auto function = processor_->backend()->code_cache()->LookupFunction(
+      sample.host_pc);
+  if (function) {
+    uint32_t guest_address =
+        function->MapMachineCodeToGuestAddress(sample.host_pc);
+    if (guest_address) {
+      leaf = LookupFunctionAddress(guest_address);
+    }
+    if (!leaf) {
+      // Not yet in the entry table (such as while it is being tiered up).
+      leaf = function->address();
+      function_names_.emplace(leaf, function->name());
+    }
+  }
+  stack.push_back(leaf);
+  for (uint32_t i = 0; i < sample.frame_count; ++i) {
+    uint32_t caller = LookupFunctionAddress(sample.frames[i]);
+    // LR usually points into the leaf (after a call it made) or duplicates
+    // the first saved return address (for frameless leaves).
+    if (caller && caller != stack.back()) {
+      stack.push_back(caller);
+    }
+  }
+  std::reverse(stack.begin(), stack.end());
+
+  ++sample_count_;
+  ++stack_counts_[stack];
+  ++self_counts_[leaf];
+}
+
+uint32_t SamplingProfiler::LookupFunctionAddress(uint32_t guest_address) {
+  auto it = function_addresses_.find(guest_address);
+  if (it != function_addresses_.end()) {
+    return it->second;
+  }
+  uint32_t function_address = 0;
+  auto functions = processor_->FindFunctionsWithAddress(guest_address);
+  if (!functions.empty()) {
+    function_address = functions[0]->address();
+    function_names_.emplace(function_address, functions[0]->name());
+  }
+  function_addresses_.emplace(guest_address, function_address);
+  return function_address;
+}
+
+std::string SamplingProfiler::GetFunctionName(uint32_t function_address) const {
+  if (!function_address) {
+    return "[host]";
+  }
+  auto it = function_names_.find(function_address);
+  if (it != function_names_.end() && !it->second.empty()) {
+    return it->second;
+  }
+  return xe::format_string("sub_%08X", function_address);
+}
+
+bool SamplingProfiler::WriteCollapsedStacks(const std::wstring& path) {
+  auto file = xe::filesystem::OpenFile(path, "w");
+  if (!file) {
+    XELOGE("Unable to open %S for writing", path.c_str());
+    return false;
+  }
+  for (auto& it : stack_counts_) {
+    std::string line;
+    for (uint32_t function_address : it.first) {
+      if (!line.empty()) {
+        line += ';';
+      }
+      line += GetFunctionName(function_address);
+    }
+    fprintf(file, "%s %" PRIu64 "\n", line.c_str(), it.second);
+  }
+  fclose(file);
+  XELOGI("Wrote %" PRIu64 " guest samples (%zu unique stacks) to %S",
+         sample_count_, stack_counts_.size(), path.c_str());
+  return true;
+}
+
+void SamplingProfiler::DumpTopFunctions(size_t count) {
+  if (!sample_count_) {
+    return;
+  }
+  std::vector<std::pair<uint32_t, uint64_t>> functions(self_counts_.begin(),
+                                                       self_counts_.end());
+  std::sort(functions.begin(), functions.end(),
+            [](const std::pair<uint32_t, uint64_t>& a,
+               const std::pair<uint32_t, uint64_t>& b) {
+              return a.second > b.second;
+            });
+  XELOGI("Top guest functions by samples (%" PRIu64 " total):", sample_count_);
+  for (size_t i = 0; i < std::min(count, functions.size()); ++i) {
+    auto& entry = functions[i];
+    XELOGI("  %5.1f%% %8" PRIu64 " %.8X %s",
+           100.0 * double(entry.second) / double(sample_count_), entry.second,
+           entry.first, GetFunctionName(entry.first).c_str());
+  }
+}
+
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,103 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_SAMPLING_PROFILER_H_
+#define XENIA_CPU_SAMPLING_PROFILER_H_
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace cpu {
+
+class Processor;
+class ThreadState;
+
+// Periodically interrupts threads running guest code and records where they
+// are, so hot guest functions can be found without a native profiler (which
+// only sees anonymous JIT code).
+// The host PC is mapped back to a guest function through the code cache and
+// the rest of the stack comes from the guest stack back chain. Results are
+// written as collapsed stacks ("outer;inner;leaf 42"), as consumed by
+// flamegraph.pl and similar tools.
+class SamplingProfiler {
+ public:
+  explicit SamplingProfiler(Processor* processor);
+  ~SamplingProfiler();
+
+  // Only one profiler may be running at a time.
+  bool Start(uint32_t samples_per_second);
+  void Stop();
+
+  // Called by the platform timer while the sampled thread is stopped, either
+  // in a signal handler on it or with it suspended, so this must be async
+  // signal safe: it only fills a preallocated sample slot.
+  void RecordSample(ThreadState* thread_state, uint64_t host_pc);
+
+  bool WriteCollapsedStacks(const std::wstring& path);
+  // Logs the guest functions with the most samples (self time).
+  void DumpTopFunctions(size_t count);
+
+ private:
+  static const size_t kMaxFrames = 64;
+  static const size_t kSampleCount = 4096;
+  enum SampleState : uint32_t {
+    kSampleFree,
+    kSampleWriting,
+    kSampleReady,
+  };
+  struct Sample {
+    std::atomic<uint32_t> state;
+    uint32_t frame_count;
+    uint64_t host_pc;
+    // Guest return addresses, innermost first. The first is LR, which may
+    // point back into the sampled function itself.
+    uint32_t frames[kMaxFrames];
+  };
+
+  // Platform specific.
+  bool StartTimer(uint32_t samples_per_second);
+  void StopTimer();
+  // Reads a guest word without faulting if it is not mapped.
+  bool ReadGuestWord(uint32_t address, uint32_t* out_value);
+
+  void CollectorMain();
+  void ProcessSamples();
+  void ProcessSample(const Sample& sample);
+  uint32_t LookupFunctionAddress(uint32_t guest_address);
+  std::string GetFunctionName(uint32_t function_address) const;
+
+  Processor* processor_;
+  std::unique_ptr<Sample[]> samples_;
+  std::atomic<uint32_t> next_sample_ = {0};
+  std::atomic<uint64_t> dropped_count_ = {0};
+
+  std::unique_ptr<xe::threading::Thread> collector_thread_;
+  std::atomic<bool> running_ = {false};
+
+  // Only touched by the collector thread while running.
+  uint64_t sample_count_ = 0;
+  // Function addresses from the outermost frame in, with 0 for host code.
+  std::map<std::vector<uint32_t>, uint64_t> stack_counts_;
+  std::unordered_map<uint32_t, uint64_t> self_counts_;
+  // Guest address to the start of its function, or 0 if not in one.
+  std::unordered_map<uint32_t, uint32_t> function_addresses_;
+  std::unordered_map<uint32_t, std::string> function_names_;
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_SAMPLING_PROFILER_H_
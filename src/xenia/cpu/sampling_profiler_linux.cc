@@ -0,0 +1,120 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/sampling_profiler.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "xenia/base/byte_order.h"
+#include "xenia/base/logging.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/cpu/thread_state.h"
+
+namespace xe {
+namespace cpu {
+
+namespace {
+
+std::atomic<SamplingProfiler*> active_profiler_ = {nullptr};
+// Handlers currently running, so StopTimer can wait them out.
+std::atomic<uint32_t> handlers_in_flight_ = {0};
+
+void ProfilerSignalHandler(int signal, siginfo_t* info, void* context) {
+  ++handlers_in_flight_;
+  // The back chain walk ends in a failed read, so keep the interrupted
+  // thread's errno intact.
+  int saved_errno = errno;
+  auto profiler = active_profiler_.load();
+  // Only threads running guest code have a thread state.
+  auto thread_state = ThreadState::Get();
+  if (profiler && thread_state) {
+    auto ucontext = reinterpret_cast<ucontext_t*>(context);
+    profiler->RecordSample(
+        thread_state,
+        static_cast<uint64_t>(ucontext->uc_mcontext.gregs[REG_RIP]));
+  }
+  errno = saved_errno;
+  --handlers_in_flight_;
+}
+
+}  // namespace
+
+bool SamplingProfiler::StartTimer(uint32_t samples_per_second) {
+  SamplingProfiler* expected = nullptr;
+  if (!active_profiler_.compare_exchange_strong(expected, this)) {
+    XELOGE("Another sampling profiler is already running");
+    return false;
+  }
+
+  struct sigaction action = {};
+  action.sa_sigaction = ProfilerSignalHandler;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, nullptr) != 0) {
+    XELOGE("Unable to install SIGPROF handler");
+    active_profiler_ = nullptr;
+    return false;
+  }
+
+  // ITIMER_PROF counts CPU time of the whole process, so idle threads are
+  // never sampled and the signal lands on whichever thread is running.
+  uint32_t interval_us = std::max(1000000u / samples_per_second, 1u);
+  struct itimerval timer = {};
+  timer.it_interval.tv_sec = interval_us / 1000000;
+  timer.it_interval.tv_usec = interval_us % 1000000;
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    XELOGE("Unable to start profiling timer");
+    signal(SIGPROF, SIG_IGN);
+    active_profiler_ = nullptr;
+    return false;
+  }
+  return true;
+}
+
+void SamplingProfiler::StopTimer() {
+  if (active_profiler_.load() != this) {
+    return;
+  }
+  struct itimerval timer = {};
+  setitimer(ITIMER_PROF, &timer, nullptr);
+  // The default action terminates the process, so ignore any signal still
+  // pending on other threads.
+  signal(SIGPROF, SIG_IGN);
+  active_profiler_ = nullptr;
+  while (handlers_in_flight_) {
+    sched_yield();
+  }
+}
+
+bool SamplingProfiler::ReadGuestWord(uint32_t address, uint32_t* out_value) {
+  // Guest stack pointers can be anything when we interrupt a thread; let the
+  // kernel do the access so that bad ones fail with EFAULT instead of
+  // faulting in the signal handler.
+  uint32_t value;
+  struct iovec local_iov = {&value, sizeof(value)};
+  struct iovec remote_iov = {
+      processor_->memory()->TranslateVirtual(address & ~3u), sizeof(value)};
+  if (process_vm_readv(getpid(), &local_iov, 1, &remote_iov, 1, 0) !=
+      sizeof(value)) {
+    return false;
+  }
+  *out_value = xe::byte_swap(value);
+  return true;
+}
+
+}  // namespace cpu
+}  // namespace xe
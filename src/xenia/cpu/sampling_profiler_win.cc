@@ -0,0 +1,101 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/sampling_profiler.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "xenia/base/byte_order.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/platform_win.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/cpu/thread.h"
+
+namespace xe {
+namespace cpu {
+
+namespace {
+
+std::atomic<SamplingProfiler*> active_profiler_ = {nullptr};
+std::atomic<bool> timer_running_ = {false};
+std::unique_ptr<xe::threading::Thread> timer_thread_;
+
+}  // namespace
+
+bool SamplingProfiler::StartTimer(uint32_t samples_per_second) {
+  SamplingProfiler* expected = nullptr;
+  if (!active_profiler_.compare_exchange_strong(expected, this)) {
+    XELOGE("Another sampling profiler is already running");
+    return false;
+  }
+
+  // There is no process CPU time signal, so each tick stops every guest thread
+  // that isn't waiting in turn and records where it was.
+  auto interval = std::chrono::microseconds(
+      std::max(1000000u / samples_per_second, 1u));
+  timer_running_ = true;
+  xe::threading::Thread::CreationParameters params;
+  timer_thread_ = xe::threading::Thread::Create(params, [this, interval]() {
+    while (timer_running_) {
+      xe::threading::Sleep(interval);
+      processor_->VisitRunningGuestThreads([this](Thread* thread) {
+        auto handle = HANDLE(thread->thread()->native_handle());
+        if (SuspendThread(handle) == DWORD(-1)) {
+          return;
+        }
+        // Waits for the suspension to take effect.
+        CONTEXT context;
+        context.ContextFlags = CONTEXT_CONTROL;
+        if (GetThreadContext(handle, &context)) {
+          RecordSample(thread->thread_state(), context.Rip);
+        }
+        ResumeThread(handle);
+      });
+    }
+  });
+  if (!timer_thread_) {
+    XELOGE("Unable to create sampling profiler timer thread");
+    timer_running_ = false;
+    active_profiler_ = nullptr;
+    return false;
+  }
+  timer_thread_->set_name("Sampling Profiler Timer");
+  timer_thread_->set_priority(THREAD_PRIORITY_HIGHEST);
+  return true;
+}
+
+void SamplingProfiler::StopTimer() {
+  if (active_profiler_.load() != this) {
+    return;
+  }
+  timer_running_ = false;
+  xe::threading::Wait(timer_thread_.get(), false);
+  timer_thread_.reset();
+  active_profiler_ = nullptr;
+}
+
+bool SamplingProfiler::ReadGuestWord(uint32_t address, uint32_t* out_value) {
+  // Guest stack pointers can be anything when we interrupt a thread; let the
+  // kernel do the access so that bad ones fail instead of faulting.
+  uint32_t value;
+  SIZE_T read_length = 0;
+  if (!ReadProcessMemory(
+          GetCurrentProcess(),
+          processor_->memory()->TranslateVirtual(address & ~3u), &value,
+          sizeof(value), &read_length) ||
+      read_length != sizeof(value)) {
+    return false;
+  }
+  *out_value = xe::byte_swap(value);
+  return true;
+}
+
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,301 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/source_map.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/assert.h"
+
+namespace xe {
+namespace cpu {
+
+namespace {
+
+struct WideGuestIndexEntry {
+  uint32_t guest_address;
+  uint32_t index;
+};
+
+void WriteVarint(std::vector<uint8_t>* out, uint32_t value) {
+  while (value >= 0x80) {
+    out->push_back(uint8_t(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back(uint8_t(value));
+}
+
+uint32_t ReadVarint(const uint8_t** ptr) {
+  const uint8_t* p = *ptr;
+  uint32_t value = 0;
+  uint32_t shift = 0;
+  while (*p & 0x80) {
+    value |= uint32_t(*p++ & 0x7F) << shift;
+    shift += 7;
+  }
+  value |= uint32_t(*p++) << shift;
+  *ptr = p;
+  return value;
+}
+
+// Guest addresses may step backwards (out-of-order blocks), so zigzag them.
+uint32_t EncodeSigned(int32_t value) {
+  return (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+}
+
+int32_t DecodeSigned(uint32_t value) {
+  return int32_t(value >> 1) ^ -int32_t(value & 1);
+}
+
+// Advances entry to the next one in the delta stream.
+void DecodeNext(const uint8_t** ptr, SourceMapEntry* entry) {
+  entry->guest_address += DecodeSigned(ReadVarint(ptr));
+  entry->hir_offset += ReadVarint(ptr);
+  entry->code_offset += ReadVarint(ptr);
+}
+
+}  // namespace
+
+SourceMap::SourceMap() = default;
+
+SourceMap::SourceMap(SourceMap&& other) { *this = std::move(other); }
+
+SourceMap& SourceMap::operator=(SourceMap&& other) {
+  data_ = std::move(other.data_);
+  data_size_ = other.data_size_;
+  count_ = other.count_;
+  guest_index_offset_ = other.guest_index_offset_;
+  delta_offset_ = other.delta_offset_;
+  guest_base_ = other.guest_base_;
+  wide_guest_index_ = other.wide_guest_index_;
+  other.Reset();
+  return *this;
+}
+
+SourceMap::~SourceMap() = default;
+
+void SourceMap::Reset() {
+  data_.reset();
+  data_size_ = 0;
+  count_ = 0;
+  guest_index_offset_ = 0;
+  delta_offset_ = 0;
+  guest_base_ = 0;
+  wide_guest_index_ = false;
+}
+
+void SourceMap::Assign(const SourceMapEntry* entries, size_t count) {
+  Reset();
+  if (!count) {
+    return;
+  }
+
+  // Delta-encode everything but the checkpoints.
+  std::vector<Checkpoint> checkpoint_list;
+  std::vector<uint8_t> delta_list;
+  uint32_t min_guest_address = entries[0].guest_address;
+  uint32_t max_guest_address = entries[0].guest_address;
+  bool guest_aligned = true;
+  for (size_t i = 0; i < count; ++i) {
+    const auto& entry = entries[i];
+    min_guest_address = std::min(min_guest_address, entry.guest_address);
+    max_guest_address = std::max(max_guest_address, entry.guest_address);
+    guest_aligned &= (entry.guest_address & 3) == 0;
+    if (i % kCheckpointInterval == 0) {
+      checkpoint_list.push_back({entry.guest_address, entry.hir_offset,
+                                 entry.code_offset,
+                                 uint32_t(delta_list.size())});
+      continue;
+    }
+    const auto& prev = entries[i - 1];
+    assert_true(entry.hir_offset >= prev.hir_offset);
+    assert_true(entry.code_offset >= prev.code_offset);
+    WriteVarint(&delta_list, EncodeSigned(int32_t(entry.guest_address -
+                                                  prev.guest_address)));
+    WriteVarint(&delta_list, entry.hir_offset - prev.hir_offset);
+    WriteVarint(&delta_list, entry.code_offset - prev.code_offset);
+  }
+
+  count_ = uint32_t(count);
+  guest_base_ = min_guest_address;
+  wide_guest_index_ = !guest_aligned || count > 0x10000 ||
+                      ((max_guest_address - min_guest_address) >> 2) > 0xFFFF;
+  size_t guest_index_entry_size =
+      wide_guest_index_ ? sizeof(WideGuestIndexEntry) : sizeof(uint32_t);
+
+  guest_index_offset_ = uint32_t(checkpoint_list.size() * sizeof(Checkpoint));
+  delta_offset_ = guest_index_offset_ + uint32_t(count * guest_index_entry_size);
+  data_size_ = delta_offset_ + uint32_t(delta_list.size());
+  data_.reset(new uint8_t[data_size_]);
+  std::memcpy(data_.get(), checkpoint_list.data(),
+              checkpoint_list.size() * sizeof(Checkpoint));
+  if (!delta_list.empty()) {
+    std::memcpy(data_.get() + delta_offset_, delta_list.data(),
+                delta_list.size());
+  }
+
+  // Build the guest index. Ties keep emission order so the first entry for an
+  // address is found first.
+  if (wide_guest_index_) {
+    auto index = reinterpret_cast<WideGuestIndexEntry*>(data_.get() +
+                                                        guest_index_offset_);
+    for (uint32_t i = 0; i < count_; ++i) {
+      index[i] = {entries[i].guest_address, i};
+    }
+    std::sort(index, index + count_,
+              [](const WideGuestIndexEntry& a, const WideGuestIndexEntry& b) {
+                return a.guest_address != b.guest_address
+                           ? a.guest_address < b.guest_address
+                           : a.index < b.index;
+              });
+  } else {
+    auto index = reinterpret_cast<uint32_t*>(data_.get() + guest_index_offset_);
+    for (uint32_t i = 0; i < count_; ++i) {
+      index[i] = (((entries[i].guest_address - guest_base_) >> 2) << 16) | i;
+    }
+    std::sort(index, index + count_);
+  }
+}
+
+SourceMapEntry SourceMap::Get(size_t index) const {
+  assert_true(index < count_);
+  const auto& checkpoint = checkpoints()[index / kCheckpointInterval];
+  SourceMapEntry entry = {checkpoint.guest_address, checkpoint.hir_offset,
+                          checkpoint.code_offset};
+  const uint8_t* ptr = deltas() + checkpoint.delta_offset;
+  for (size_t i = 0; i < index % kCheckpointInterval; ++i) {
+    DecodeNext(&ptr, &entry);
+  }
+  return entry;
+}
+
+void SourceMap::Decode(std::vector<SourceMapEntry>* out_entries) const {
+  out_entries->resize(count_);
+  SourceMapEntry entry = {0};
+  const uint8_t* ptr = deltas();
+  for (uint32_t i = 0; i < count_; ++i) {
+    if (i % kCheckpointInterval == 0) {
+      const auto& checkpoint = checkpoints()[i / kCheckpointInterval];
+      entry = {checkpoint.guest_address, checkpoint.hir_offset,
+               checkpoint.code_offset};
+    } else {
+      DecodeNext(&ptr, &entry);
+    }
+    (*out_entries)[i] = entry;
+  }
+}
+
+bool SourceMap::LookupGuestAddress(uint32_t guest_address,
+                                   SourceMapEntry* out_entry) const {
+  uint32_t index;
+  if (wide_guest_index_) {
+    auto begin = reinterpret_cast<const WideGuestIndexEntry*>(guest_index());
+    auto end = begin + count_;
+    auto it = std::lower_bound(begin, end, guest_address,
+                               [](const WideGuestIndexEntry& a, uint32_t b) {
+                                 return a.guest_address < b;
+                               });
+    if (it == end || it->guest_address != guest_address) {
+      return false;
+    }
+    index = it->index;
+  } else {
+    if (guest_address < guest_base_ || guest_address & 3 ||
+        ((guest_address - guest_base_) >> 2) > 0xFFFF) {
+      return false;
+    }
+    uint32_t word = (guest_address - guest_base_) >> 2;
+    auto begin = guest_index();
+    auto end = begin + count_;
+    auto it = std::lower_bound(begin, end, word << 16);
+    if (it == end || (*it >> 16) != word) {
+      return false;
+    }
+    index = *it & 0xFFFF;
+  }
+  *out_entry = Get(index);
+  return true;
+}
+
+bool SourceMap::LookupHIROffset(uint32_t offset,
+                                SourceMapEntry* out_entry) const {
+  if (!count_) {
+    return false;
+  }
+  // Find the last run starting before the offset; the answer is either in it
+  // or is the start of the next run.
+  auto begin = checkpoints();
+  auto end = begin + checkpoint_count();
+  auto it = std::lower_bound(begin, end, offset,
+                             [](const Checkpoint& a, uint32_t b) {
+                               return a.hir_offset < b;
+                             });
+  if (it == begin) {
+    *out_entry = Get(0);
+    return true;
+  }
+  --it;
+  size_t checkpoint_index = it - begin;
+  size_t run_length = std::min(
+      size_t(kCheckpointInterval),
+      size_t(count_) - checkpoint_index * kCheckpointInterval);
+  SourceMapEntry entry = {it->guest_address, it->hir_offset, it->code_offset};
+  const uint8_t* ptr = deltas() + it->delta_offset;
+  for (size_t i = 1; i < run_length; ++i) {
+    DecodeNext(&ptr, &entry);
+    if (entry.hir_offset >= offset) {
+      *out_entry = entry;
+      return true;
+    }
+  }
+  if (++it == end) {
+    return false;
+  }
+  *out_entry = {it->guest_address, it->hir_offset, it->code_offset};
+  return true;
+}
+
+bool SourceMap::LookupMachineCodeOffset(uint32_t offset,
+                                        SourceMapEntry* out_entry) const {
+  if (!count_) {
+    return false;
+  }
+  auto begin = checkpoints();
+  auto end = begin + checkpoint_count();
+  auto it = std::upper_bound(begin, end, offset,
+                             [](uint32_t a, const Checkpoint& b) {
+                               return a < b.code_offset;
+                             });
+  if (it == begin) {
+    // Before the first entry (in the prolog).
+    *out_entry = Get(0);
+    return true;
+  }
+  --it;
+  size_t checkpoint_index = it - begin;
+  size_t run_length = std::min(
+      size_t(kCheckpointInterval),
+      size_t(count_) - checkpoint_index * kCheckpointInterval);
+  SourceMapEntry entry = {it->guest_address, it->hir_offset, it->code_offset};
+  const uint8_t* ptr = deltas() + it->delta_offset;
+  for (size_t i = 1; i < run_length; ++i) {
+    SourceMapEntry next = entry;
+    DecodeNext(&ptr, &next);
+    if (next.code_offset > offset) {
+      break;
+    }
+    entry = next;
+  }
+  *out_entry = entry;
+  return true;
+}
+
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,113 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_SOURCE_MAP_H_
+#define XENIA_CPU_SOURCE_MAP_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace xe {
+namespace cpu {
+
+struct SourceMapEntry {
+  uint32_t guest_address;  // PPC guest address (0x82....).
+  uint32_t hir_offset;     // Block ordinal (16b) | Instr ordinal (16b)
+  uint32_t code_offset;    // Offset from emitted code start.
+};
+
+// Machine code of another guest function inlined into the one being emitted.
+struct InlinedFunctionRange {
+  uint32_t function_address;  // Guest address of the inlined function.
+  uint32_t code_offset;       // Offset from emitted code start.
+  uint32_t code_end_offset;   // Exclusive.
+};
+
+// Immutable mapping between guest instructions, HIR and emitted machine code.
+// Entries are kept in emission order (so sorted by both hir_offset and
+// code_offset) as delta-encoded runs with a full checkpoint every
+// kCheckpointInterval entries, which lets lookups by code or HIR offset
+// binary search the checkpoints and then decode at most one run. A separate
+// index sorted by guest address serves guest lookups.
+// Everything lives in a single allocation as these are kept for every
+// function generated.
+class SourceMap {
+ public:
+  static const uint32_t kCheckpointInterval = 16;
+
+  SourceMap();
+  SourceMap(SourceMap&& other);
+  SourceMap& operator=(SourceMap&& other);
+  ~SourceMap();
+
+  size_t size() const { return count_; }
+  bool empty() const { return count_ == 0; }
+  // Total heap bytes used by the encoded map.
+  size_t memory_usage() const { return data_size_; }
+
+  // Replaces the contents of the map. Entries must be in emission order with
+  // non-decreasing hir_offset and code_offset.
+  void Assign(const SourceMapEntry* entries, size_t count);
+  void Assign(const std::vector<SourceMapEntry>& entries) {
+    Assign(entries.data(), entries.size());
+  }
+  void Reset();
+
+  // Decodes the entry at the given emission-order index.
+  SourceMapEntry Get(size_t index) const;
+  // Decodes all entries in emission order.
+  void Decode(std::vector<SourceMapEntry>* out_entries) const;
+
+  // Finds the first entry for the given guest address.
+  bool LookupGuestAddress(uint32_t guest_address,
+                          SourceMapEntry* out_entry) const;
+  // Finds the first entry at or after the given HIR offset.
+  bool LookupHIROffset(uint32_t offset, SourceMapEntry* out_entry) const;
+  // Finds the last entry at or before the given code offset, or the first
+  // entry if the offset is within the function prolog.
+  bool LookupMachineCodeOffset(uint32_t offset,
+                               SourceMapEntry* out_entry) const;
+
+ private:
+  struct Checkpoint {
+    uint32_t guest_address;
+    uint32_t hir_offset;
+    uint32_t code_offset;
+    uint32_t delta_offset;  // Into the delta stream.
+  };
+
+  const Checkpoint* checkpoints() const {
+    return reinterpret_cast<const Checkpoint*>(data_.get());
+  }
+  uint32_t checkpoint_count() const {
+    return (count_ + kCheckpointInterval - 1) / kCheckpointInterval;
+  }
+  const uint32_t* guest_index() const {
+    return reinterpret_cast<const uint32_t*>(data_.get() + guest_index_offset_);
+  }
+  const uint8_t* deltas() const { return data_.get() + delta_offset_; }
+
+  std::unique_ptr<uint8_t[]> data_;
+  uint32_t data_size_ = 0;
+  uint32_t count_ = 0;
+  uint32_t guest_index_offset_ = 0;
+  uint32_t delta_offset_ = 0;
+  // Guest addresses in the index are stored relative to this in words when
+  // the function is small enough (the common case), packed with the entry
+  // index as [word offset (16b) | entry index (16b)]. Otherwise the index is
+  // pairs of [guest address, entry index].
+  uint32_t guest_base_ = 0;
+  bool wide_guest_index_ = false;
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_SOURCE_MAP_H_
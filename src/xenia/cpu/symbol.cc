@@ -0,0 +1,26 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/symbol.h"
+
+#include "xenia/cpu/module.h"
+
+namespace xe {
+namespace cpu {
+
+void Symbol::set_status(Status value) {
+  status_ = value;
+  if (module_) {
+    // Wake anyone waiting on us to finish declaring/defining.
+    module_->NotifySymbolStatusChanged(this);
+  }
+}
+
+}  // namespace cpu
+}  // namespace xe
@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_SYMBOL_H_
 #define XENIA_CPU_SYMBOL_H_
 
+#include <atomic>
 #include <cstdint>
 #include <string>
 
@@ -41,16 +42,18 @@ class Symbol {
   Type type() const { return type_; }
   Module* module() const { return module_; }
   Status status() const { return status_; }
-  void set_status(Status value) { status_ = value; }
+  void set_status(Status value);
   uint32_t address() const { return address_; }
 
   const std::string& name() const { return name_; }
   void set_name(const std::string& value) { name_ = value; }
 
  protected:
+  friend class Module;
+
   Type type_ = Type::kVariable;
   Module* module_ = nullptr;
-  Status status_ = Status::kDefining;
+  std::atomic<Status> status_ = {Status::kDefining};
   uint32_t address_ = 0;
 
   std::string name_;
@@ -14,6 +14,7 @@
 #include "xenia/base/reset_scope.h"
 #include "xenia/base/string.h"
 #include "xenia/cpu/compiler/compiler_passes.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/processor.h"
 
 namespace xe {
@@ -26,11 +27,13 @@ namespace passes = xe::cpu::compiler::passes;
 
 TestModule::TestModule(Processor* processor, const std::string& name,
                        std::function<bool(uint32_t)> contains_address,
-                       std::function<bool(hir::HIRBuilder&)> generate)
+                       std::function<bool(hir::HIRBuilder&)> generate,
+                       std::function<void(hir::HIRBuilder&)> inspect)
     : Module(processor),
       name_(name),
       contains_address_(contains_address),
-      generate_(generate) {
+      generate_(generate),
+      inspect_(inspect) {
   builder_.reset(new HIRBuilder());
   compiler_.reset(new Compiler(processor));
   assembler_ = processor->backend()->CreateAssembler();
@@ -48,8 +51,14 @@ TestModule::TestModule(Processor* processor, const std::string& name,
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
   compiler_->AddPass(std::make_unique<passes::ConstantPropagationPass>());
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
-  // compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
+  if (FLAGS_eliminate_dead_stores) {
+    compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
+  }
   compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
+  if (FLAGS_loop_invariant_code_motion &&
+      FLAGS_linear_scan_register_allocation) {
+    compiler_->AddPass(std::make_unique<passes::LoopInvariantCodeMotionPass>());
+  }
 
   //// Removes all unneeded variables. Try not to add new ones after this.
   // compiler_->AddPass(new passes::ValueReductionPass());
@@ -58,8 +67,13 @@ TestModule::TestModule(Processor* processor, const std::string& name,
   // Will modify the HIR to add loads/stores.
   // This should be the last pass before finalization, as after this all
   // registers are assigned and ready to be emitted.
-  compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
-      processor->backend()->machine_info()));
+  if (FLAGS_linear_scan_register_allocation) {
+    compiler_->AddPass(std::make_unique<passes::LinearScanAllocationPass>(
+        processor->backend()->machine_info()));
+  } else {
+    compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
+        processor->backend()->machine_info()));
+  }
 
   // Must come last. The HIR is not really HIR after this.
   compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
@@ -93,6 +107,9 @@ Symbol::Status TestModule::DeclareFunction(uint32_t address,
 
     // Run optimization passes.
     compiler_->Compile(builder_.get());
+    if (inspect_) {
+      inspect_(*builder_.get());
+    }
 
     // Assemble the function.
     assembler_->Assemble(function, builder_.get(), 0, nullptr);
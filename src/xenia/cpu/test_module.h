@@ -22,11 +22,14 @@
 namespace xe {
 namespace cpu {
 
+// inspect, if given, is called with the HIR of each function after the
+// compiler passes have run and before it is assembled.
 class TestModule : public Module {
  public:
   TestModule(Processor* processor, const std::string& name,
              std::function<bool(uint32_t)> contains_address,
-             std::function<bool(hir::HIRBuilder&)> generate);
+             std::function<bool(hir::HIRBuilder&)> generate,
+             std::function<void(hir::HIRBuilder&)> inspect = nullptr);
   ~TestModule() override;
 
   const std::string& name() const override { return name_; }
@@ -44,6 +47,7 @@ class TestModule : public Module {
   std::string name_;
   std::function<bool(uint32_t)> contains_address_;
   std::function<bool(hir::HIRBuilder&)> generate_;
+  std::function<void(hir::HIRBuilder&)> inspect_;
 
   std::unique_ptr<hir::HIRBuilder> builder_;
   std::unique_ptr<compiler::Compiler> compiler_;
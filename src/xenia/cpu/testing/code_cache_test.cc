@@ -0,0 +1,247 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <atomic>
+#include <thread>
+
+#include "xenia/base/platform.h"
+#include "xenia/base/threading.h"
+#include "xenia/cpu/backend/code_cache.h"
+#include "xenia/cpu/testing/util.h"
+
+using namespace xe;
+using namespace xe::cpu;
+using namespace xe::cpu::hir;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+namespace {
+
+const uint32_t kCallerAddress = 0x80000000;
+const uint32_t kCalleeAddress = 0x80001000;
+const uint32_t kSpinAddress = 0x80002000;
+const uint32_t kGrowthAddress = 0x80008000;
+
+class CodeCacheTest {
+ public:
+  CodeCacheTest() {
+    memory.reset(new Memory());
+    memory->Initialize();
+    processor = std::make_unique<Processor>(memory.get(), nullptr);
+    processor->Setup(std::make_unique<backend::x64::X64Backend>());
+    processor->backend()->CommitExecutableRange(0x80000000, 0x80010000);
+  }
+
+  // Adds a module holding the function at the address while *loaded is set.
+  Module* AddModule(const std::string& name, uint32_t address,
+                    const bool* loaded,
+                    std::function<void(HIRBuilder& b)> generator) {
+    auto module = std::make_unique<TestModule>(
+        processor.get(), name,
+        [address, loaded](uint32_t a) { return *loaded && a == address; },
+        [generator](HIRBuilder& b) {
+          generator(b);
+          return true;
+        });
+    auto result = module.get();
+    processor->AddModule(std::move(module));
+    return result;
+  }
+
+  GuestFunction* Resolve(uint32_t address) {
+    return static_cast<GuestFunction*>(processor->ResolveFunction(address));
+  }
+
+  void Call(GuestFunction* function, ThreadState* thread_state) {
+    thread_state->context()->lr = 0xBCBCBCBC;
+    function->Call(thread_state, 0xBCBCBCBC);
+  }
+
+  std::unique_ptr<Memory> memory;
+  std::unique_ptr<Processor> processor;
+};
+
+void StoreConstant(HIRBuilder& b, uint64_t value) {
+  StoreGPR(b, 3, b.LoadConstantUint64(value));
+  b.Return();
+}
+
+struct Poller {
+  std::atomic<int> polls = {0};
+  std::atomic<bool> stop = {false};
+};
+
+void Poll(PPCContext* ppc_context, void* arg0, void* arg1) {
+  auto poller = reinterpret_cast<Poller*>(arg0);
+  ++poller->polls;
+  ppc_context->r[3] = poller->stop ? 1 : 0;
+}
+
+void WaitForPolls(const Poller& poller, int polls) {
+  while (poller.polls < polls) {
+    xe::threading::MaybeYield();
+  }
+}
+
+}  // namespace
+
+// Releasing a module unlinks the direct calls into it, so callers reach
+// whatever is loaded at the address next, which may reuse the space.
+TEST_CASE("code_cache_release_module", "[code_cache]") {
+  CodeCacheTest test;
+  auto code_cache = test.processor->backend()->code_cache();
+
+  bool callee_loaded = true;
+  auto callee_module =
+      test.AddModule("callee", kCalleeAddress, &callee_loaded,
+                     [](HIRBuilder& b) { StoreConstant(b, 0x11111111); });
+  auto callee = test.Resolve(kCalleeAddress);
+  REQUIRE(callee);
+  auto callee_code = callee->machine_code();
+
+  // Placed after the callee, so that its space is a hole once released.
+  bool caller_loaded = true;
+  auto processor = test.processor.get();
+  test.AddModule("caller", kCallerAddress, &caller_loaded,
+                 [processor](HIRBuilder& b) {
+                   b.Call(processor->LookupFunction(kCalleeAddress));
+                   b.Return();
+                 });
+  auto caller = test.Resolve(kCallerAddress);
+  REQUIRE(caller);
+
+  ThreadState thread_state(test.processor.get(), 0x100);
+  test.Call(caller, &thread_state);
+  REQUIRE(thread_state.context()->r[3] == 0x11111111);
+
+  callee_loaded = false;
+  test.processor->OnModuleUnloaded(callee_module, kCalleeAddress,
+                                   kCalleeAddress + 4);
+
+  bool new_callee_loaded = true;
+  test.AddModule("new_callee", kCalleeAddress, &new_callee_loaded,
+                 [](HIRBuilder& b) { StoreConstant(b, 0x22222222); });
+  test.Call(caller, &thread_state);
+  REQUIRE(thread_state.context()->r[3] == 0x22222222);
+
+  auto new_callee = test.Resolve(kCalleeAddress);
+  REQUIRE(new_callee != callee);
+#if !XE_PLATFORM_WIN32
+  // Nothing was running the old code, so its space was free to reuse.
+  REQUIRE(new_callee->machine_code() == callee_code);
+#endif  // !XE_PLATFORM_WIN32
+  REQUIRE(code_cache->LookupFunction(
+              reinterpret_cast<uint64_t>(new_callee->machine_code())) ==
+          new_callee);
+}
+
+// A thread that never leaves guest code holds released code back only for as
+// long as it may still return into it.
+TEST_CASE("code_cache_reclaim_while_running", "[code_cache]") {
+  CodeCacheTest test;
+
+  Poller poller;
+  auto poll_function =
+      test.processor->DefineBuiltin("Poll", Poll, &poller, nullptr);
+  bool spin_loaded = true;
+  test.AddModule("spin", kSpinAddress, &spin_loaded,
+                 [poll_function](HIRBuilder& b) {
+                   auto loop = b.NewLabel();
+                   b.MarkLabel(loop);
+                   b.CallExtern(poll_function);
+                   b.BranchTrue(
+                       b.CompareEQ(LoadGPR(b, 3), b.LoadZeroInt64()), loop);
+                   b.Return();
+                 });
+  auto spin = test.Resolve(kSpinAddress);
+  REQUIRE(spin);
+
+  bool callee_loaded = true;
+  auto callee_module =
+      test.AddModule("callee", kCalleeAddress, &callee_loaded,
+                     [](HIRBuilder& b) { StoreConstant(b, 0x11111111); });
+  auto callee = test.Resolve(kCalleeAddress);
+  REQUIRE(callee);
+  auto callee_code = callee->machine_code();
+
+  std::thread spin_thread([&test, spin]() {
+    ThreadState thread_state(test.processor.get(), 0x101);
+    test.Call(spin, &thread_state);
+  });
+  WaitForPolls(poller, 1);
+
+  callee_loaded = false;
+  test.processor->OnModuleUnloaded(callee_module, kCalleeAddress,
+                                   kCalleeAddress + 4);
+  // The poll after next went out to host code entirely after the release.
+  WaitForPolls(poller, poller.polls + 2);
+
+  bool new_callee_loaded = true;
+  test.AddModule("new_callee", kCalleeAddress, &new_callee_loaded,
+                 [](HIRBuilder& b) { StoreConstant(b, 0x22222222); });
+  auto new_callee = test.Resolve(kCalleeAddress);
+  REQUIRE(new_callee != callee);
+#if !XE_PLATFORM_WIN32
+  REQUIRE(new_callee->machine_code() == callee_code);
+#endif  // !XE_PLATFORM_WIN32
+
+  poller.stop = true;
+  spin_thread.join();
+}
+
+// The code map grows while other threads look functions up.
+TEST_CASE("code_cache_map_growth", "[code_cache]") {
+  CodeCacheTest test;
+  auto code_cache = test.processor->backend()->code_cache();
+
+  const uint32_t kFunctionCount = 5000;
+  bool loaded = true;
+  auto module = std::make_unique<TestModule>(
+      test.processor.get(), "growth",
+      [&loaded](uint32_t address) {
+        return loaded && address >= kGrowthAddress &&
+               address < kGrowthAddress + kFunctionCount * 4;
+      },
+      [](HIRBuilder& b) {
+        StoreConstant(b, 0x33333333);
+        return true;
+      });
+  test.processor->AddModule(std::move(module));
+
+  auto first = test.Resolve(kGrowthAddress);
+  REQUIRE(first);
+  auto first_code = reinterpret_cast<uint64_t>(first->machine_code());
+
+  // Lookups racing with placement may give up, but must never see anything
+  // else.
+  std::atomic<bool> done = {false};
+  std::atomic<int> mismatches = {0};
+  std::thread lookup_thread([&]() {
+    while (!done) {
+      auto function = code_cache->LookupFunction(first_code);
+      if (function && function != first) {
+        ++mismatches;
+      }
+    }
+  });
+  std::vector<GuestFunction*> functions;
+  for (uint32_t i = 1; i < kFunctionCount; ++i) {
+    functions.push_back(test.Resolve(kGrowthAddress + i * 4));
+  }
+  done = true;
+  lookup_thread.join();
+
+  REQUIRE(mismatches == 0);
+  for (auto function : functions) {
+    REQUIRE(function);
+    REQUIRE(code_cache->LookupFunction(
+                reinterpret_cast<uint64_t>(function->machine_code())) ==
+            function);
+  }
+}
@@ -0,0 +1,161 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/validation_pass.h"
+#include "xenia/cpu/testing/util.h"
+
+using namespace xe;
+using namespace xe::cpu;
+using namespace xe::cpu::hir;
+using namespace xe::cpu::testing;
+using xe::cpu::compiler::passes::ValidationPass;
+using xe::cpu::ppc::PPCContext;
+
+namespace {
+
+size_t GPROffset(int reg) { return offsetof(PPCContext, r) + reg * 8; }
+
+size_t CountLoads(HIRBuilder& b, size_t offset) {
+  size_t count = 0;
+  for (auto block = b.first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i->opcode == &OPCODE_LOAD_CONTEXT_info && i->src1.offset == offset) {
+        ++count;
+      }
+    }
+  }
+  return count;
+}
+
+}  // namespace
+
+// A register loaded before a diamond is forwarded to the join, one stored
+// with different values on each side is reloaded there.
+TEST_CASE("CONTEXT_PROMOTION_DIAMOND", "[context_promotion]") {
+  // Counted while the HIR is still around.
+  struct {
+    bool valid;
+    size_t r4_loads;
+    size_t r6_loads;
+  } counts = {};
+  TestFunction test(
+      [](HIRBuilder& b) {
+        StoreGPR(b, 7, b.Add(LoadGPR(b, 4), b.LoadConstantUint64(1)));
+        auto other_side = b.NewLabel();
+        auto join = b.NewLabel();
+        b.BranchTrue(b.CompareEQ(LoadGPR(b, 5), b.LoadZeroInt64()),
+                     other_side);
+        StoreGPR(b, 6, b.LoadConstantUint64(100));
+        b.Branch(join);
+        b.MarkLabel(other_side);
+        StoreGPR(b, 6, b.LoadConstantUint64(200));
+        b.MarkLabel(join);
+        StoreGPR(b, 3, b.Add(LoadGPR(b, 4), LoadGPR(b, 6)));
+        b.Return();
+      },
+      [&](HIRBuilder& b) {
+        counts.valid = ValidationPass().Run(&b);
+        counts.r4_loads = CountLoads(b, GPROffset(4));
+        counts.r6_loads = CountLoads(b, GPROffset(6));
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[4] = 10;
+        ctx->r[5] = 1;
+      },
+      [](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 110);
+        REQUIRE(ctx->r[7] == 11);
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[4] = 10;
+        ctx->r[5] = 0;
+      },
+      [](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 210);
+        REQUIRE(ctx->r[7] == 11);
+      });
+  REQUIRE(counts.valid);
+  REQUIRE(counts.r4_loads == 1);
+  REQUIRE(counts.r6_loads == 1);
+}
+
+// A register the loop doesn't change is forwarded into it from before the
+// loop, one it changes is reloaded each iteration.
+TEST_CASE("CONTEXT_PROMOTION_LOOP", "[context_promotion]") {
+  struct {
+    bool valid;
+    size_t r3_loads;
+    size_t r4_loads;
+  } counts = {};
+  TestFunction test(
+      [](HIRBuilder& b) {
+        StoreGPR(b, 7, LoadGPR(b, 4));
+        auto loop = b.NewLabel();
+        b.MarkLabel(loop);
+        StoreGPR(b, 3, b.Add(LoadGPR(b, 3), LoadGPR(b, 4)));
+        auto counter = b.Sub(LoadGPR(b, 5), b.LoadConstantUint64(1));
+        StoreGPR(b, 5, counter);
+        b.BranchTrue(b.CompareNE(counter, b.LoadZeroInt64()), loop);
+        b.Return();
+      },
+      [&](HIRBuilder& b) {
+        counts.valid = ValidationPass().Run(&b);
+        counts.r3_loads = CountLoads(b, GPROffset(3));
+        counts.r4_loads = CountLoads(b, GPROffset(4));
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[3] = 1;
+        ctx->r[4] = 10;
+        ctx->r[5] = 3;
+      },
+      [](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 31);
+        REQUIRE(ctx->r[5] == 0);
+        REQUIRE(ctx->r[7] == 10);
+      });
+  REQUIRE(counts.valid);
+  REQUIRE(counts.r3_loads == 1);
+  REQUIRE(counts.r4_loads == 1);
+}
+
+// Calls may change any register, so nothing is forwarded past them.
+TEST_CASE("CONTEXT_PROMOTION_CALL_BARRIER", "[context_promotion]") {
+  struct {
+    bool valid;
+    size_t r4_loads;
+  } counts = {};
+  TestFunction test(
+      [](HIRBuilder& b) {
+        StoreGPR(b, 3, LoadGPR(b, 4));
+        // Never taken, but it could be.
+        b.CallIndirectTrue(b.CompareNE(LoadGPR(b, 6), b.LoadZeroInt64()),
+                           LoadGPR(b, 7));
+        StoreGPR(b, 8, LoadGPR(b, 4));
+        b.Return();
+      },
+      [&](HIRBuilder& b) {
+        counts.valid = ValidationPass().Run(&b);
+        counts.r4_loads = CountLoads(b, GPROffset(4));
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[4] = 10;
+        ctx->r[6] = 0;
+        ctx->r[7] = 0;
+      },
+      [](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 10);
+        REQUIRE(ctx->r[8] == 10);
+      });
+  REQUIRE(counts.valid);
+  REQUIRE(counts.r4_loads == 2);
+}
@@ -0,0 +1,177 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/testing/util.h"
+
+using namespace xe;
+using namespace xe::cpu;
+using namespace xe::cpu::hir;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+namespace {
+
+size_t GPROffset(int reg) { return offsetof(PPCContext, r) + reg * 8; }
+
+size_t CountStores(HIRBuilder& b, size_t offset) {
+  size_t count = 0;
+  for (auto block = b.first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (i->opcode == &OPCODE_STORE_CONTEXT_info && i->src1.offset == offset) {
+        ++count;
+      }
+    }
+  }
+  return count;
+}
+
+}  // namespace
+
+// A store overwritten on every path out of its block is removed, one that
+// reaches a path where it is not overwritten is kept.
+TEST_CASE("DEAD_STORE_ACROSS_BLOCKS", "[dse]") {
+  // Counted while the HIR is still around.
+  struct {
+    size_t r3_stores;
+    size_t r6_stores;
+  } counts = {};
+  TestFunction test(
+      [](HIRBuilder& b) {
+        StoreGPR(b, 3, b.Add(LoadGPR(b, 4), b.LoadConstantUint64(1)));
+        StoreGPR(b, 6, b.Add(LoadGPR(b, 4), b.LoadConstantUint64(2)));
+        auto skip = b.NewLabel();
+        b.BranchTrue(b.CompareEQ(LoadGPR(b, 5), b.LoadZeroInt64()), skip);
+        StoreGPR(b, 3, LoadGPR(b, 4));
+        b.Return();
+        b.MarkLabel(skip);
+        StoreGPR(b, 3, b.LoadConstantUint64(7));
+        StoreGPR(b, 6, b.LoadConstantUint64(8));
+        b.Return();
+      },
+      [&](HIRBuilder& b) {
+        counts.r3_stores = CountStores(b, GPROffset(3));
+        counts.r6_stores = CountStores(b, GPROffset(6));
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[4] = 10;
+        ctx->r[5] = 1;
+      },
+      [](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 10);
+        REQUIRE(ctx->r[6] == 12);
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[4] = 10;
+        ctx->r[5] = 0;
+      },
+      [](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 7);
+        REQUIRE(ctx->r[6] == 8);
+      });
+  REQUIRE(counts.r3_stores == 2);
+  REQUIRE(counts.r6_stores == 2);
+}
+
+// Calls and traps may look at the whole context, so stores before them are
+// kept even when overwritten right after.
+TEST_CASE("DEAD_STORE_READ_BY_CALL_AND_TRAP", "[dse]") {
+  struct {
+    size_t r3_stores;
+    size_t r8_stores;
+  } counts = {};
+  TestFunction test(
+      [](HIRBuilder& b) {
+        StoreGPR(b, 3, b.Add(LoadGPR(b, 4), b.LoadConstantUint64(1)));
+        // Neither is taken, but either could be.
+        b.CallIndirectTrue(b.CompareNE(LoadGPR(b, 6), b.LoadZeroInt64()),
+                           LoadGPR(b, 7));
+        StoreGPR(b, 3, LoadGPR(b, 4));
+        StoreGPR(b, 8, b.Add(LoadGPR(b, 4), b.LoadConstantUint64(2)));
+        b.TrapTrue(b.CompareNE(LoadGPR(b, 6), b.LoadZeroInt64()));
+        StoreGPR(b, 8, LoadGPR(b, 4));
+        b.Return();
+      },
+      [&](HIRBuilder& b) {
+        counts.r3_stores = CountStores(b, GPROffset(3));
+        counts.r8_stores = CountStores(b, GPROffset(8));
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[4] = 10;
+        ctx->r[6] = 0;
+        ctx->r[7] = 0;
+      },
+      [](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 10);
+        REQUIRE(ctx->r[8] == 10);
+      });
+  REQUIRE(counts.r3_stores == 2);
+  REQUIRE(counts.r8_stores == 2);
+}
+
+// Only stores whose every byte is overwritten are dead, in a block or across
+// blocks.
+TEST_CASE("DEAD_STORE_PARTIAL_OVERLAP", "[dse]") {
+  struct {
+    size_t r3_stores;
+    size_t r4_stores;
+    size_t r8_stores;
+  } counts = {};
+  TestFunction test(
+      [](HIRBuilder& b) {
+        // The low half is overwritten in the same block.
+        StoreGPR(b, 3, LoadGPR(b, 6));
+        b.StoreContext(GPROffset(3), b.Truncate(LoadGPR(b, 7), INT32_TYPE));
+        // Covered by the wider stores on both paths below.
+        b.StoreContext(GPROffset(4), b.Truncate(LoadGPR(b, 7), INT32_TYPE));
+        // Only the low half is overwritten on both paths below.
+        StoreGPR(b, 8, LoadGPR(b, 6));
+        auto skip = b.NewLabel();
+        b.BranchTrue(b.CompareEQ(LoadGPR(b, 5), b.LoadZeroInt64()), skip);
+        StoreGPR(b, 4, LoadGPR(b, 6));
+        b.StoreContext(GPROffset(8), b.Truncate(LoadGPR(b, 7), INT32_TYPE));
+        b.Return();
+        b.MarkLabel(skip);
+        StoreGPR(b, 4, LoadGPR(b, 7));
+        b.StoreContext(GPROffset(8), b.Truncate(LoadGPR(b, 7), INT32_TYPE));
+        b.Return();
+      },
+      [&](HIRBuilder& b) {
+        counts.r3_stores = CountStores(b, GPROffset(3));
+        counts.r4_stores = CountStores(b, GPROffset(4));
+        counts.r8_stores = CountStores(b, GPROffset(8));
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[5] = 1;
+        ctx->r[6] = 0x1111111122222222ull;
+        ctx->r[7] = 0x33333333;
+      },
+      [](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 0x1111111133333333ull);
+        REQUIRE(ctx->r[4] == 0x1111111122222222ull);
+        REQUIRE(ctx->r[8] == 0x1111111133333333ull);
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[5] = 0;
+        ctx->r[6] = 0x1111111122222222ull;
+        ctx->r[7] = 0x33333333;
+      },
+      [](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 0x1111111133333333ull);
+        REQUIRE(ctx->r[4] == 0x33333333);
+        REQUIRE(ctx->r[8] == 0x1111111133333333ull);
+      });
+  REQUIRE(counts.r3_stores == 2);
+  REQUIRE(counts.r4_stores == 2);
+  REQUIRE(counts.r8_stores == 3);
+}
@@ -0,0 +1,249 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "xenia/base/memory.h"
+#include "xenia/cpu/ppc/ppc_library_routines.h"
+#include "xenia/memory.h"
+
+#include "third_party/catch/single_include/catch.hpp"
+
+using namespace xe;
+using namespace xe::cpu;
+using namespace xe::cpu::ppc;
+
+namespace {
+
+// Only its address range is used.
+class CodeRange : public GuestFunction {
+ public:
+  CodeRange(uint32_t address, uint32_t end_address)
+      : GuestFunction(nullptr, address) {
+    set_end_address(end_address);
+  }
+  uint8_t* machine_code() const override { return nullptr; }
+  size_t machine_code_length() const override { return 0; }
+
+ protected:
+  bool CallImpl(ThreadState* thread_state, uint32_t return_address) override {
+    return false;
+  }
+};
+
+class LibraryRoutineTest {
+ public:
+  LibraryRoutineTest() {
+    REQUIRE(memory.Initialize());
+    // Two pages, for strings running over a page boundary.
+    base = memory.SystemHeapAlloc(2 * 4096, 4096);
+    REQUIRE(base);
+    std::memset(memory.TranslateVirtual(base), 0xCD, 2 * 4096);
+  }
+
+  uint8_t* host(uint32_t address) {
+    return memory.TranslateVirtual<uint8_t*>(address);
+  }
+
+  void StoreString(uint32_t address, const char* value) {
+    std::memcpy(host(address), value, std::strlen(value) + 1);
+  }
+
+  // Runs the routine with r3-r5 and returns whether it handled the call.
+  bool Call(void (*routine)(PPCContext*, void*, void*), uint64_t r3,
+            uint64_t r4 = 0, uint64_t r5 = 0) {
+    ctx = PPCContext();
+    ctx.r[3] = r3;
+    ctx.r[4] = r4;
+    ctx.r[5] = r5;
+    ctx.scratch = 0xFF;
+    routine(&ctx, &memory, nullptr);
+    REQUIRE((ctx.scratch == 0 || ctx.scratch == 1));
+    return ctx.scratch == 1;
+  }
+
+  Memory memory;
+  uint32_t base = 0;
+  PPCContext ctx;
+};
+
+}  // namespace
+
+TEST_CASE("library_memcpy", "[library_routines]") {
+  LibraryRoutineTest test;
+  uint32_t src = test.base;
+  uint32_t dest = test.base + 0x100;
+  for (uint32_t n = 0; n < 16; ++n) {
+    test.host(src)[n] = uint8_t(n);
+  }
+  REQUIRE(test.Call(LibraryMemcpy, dest, src, 16));
+  REQUIRE(std::memcmp(test.host(dest), test.host(src), 16) == 0);
+  REQUIRE(test.host(dest)[16] == 0xCD);
+
+  // Nothing to copy.
+  REQUIRE(test.Call(LibraryMemcpy, dest + 0x100, src, 0));
+  REQUIRE(test.host(dest + 0x100)[0] == 0xCD);
+
+  // Overlapping copies are left to the guest, in either direction.
+  REQUIRE_FALSE(test.Call(LibraryMemcpy, src + 4, src, 16));
+  REQUIRE_FALSE(test.Call(LibraryMemcpy, src, src + 4, 16));
+  REQUIRE(test.host(src)[4] == 4);
+  // Adjacent ranges don't overlap.
+  REQUIRE(test.Call(LibraryMemcpy, src + 16, src, 16));
+  REQUIRE(test.host(src + 16)[15] == 15);
+}
+
+TEST_CASE("library_memmove", "[library_routines]") {
+  LibraryRoutineTest test;
+  uint32_t src = test.base;
+  for (uint32_t n = 0; n < 16; ++n) {
+    test.host(src)[n] = uint8_t(n);
+  }
+  // Forward overlap, as memmove would.
+  REQUIRE(test.Call(LibraryMemmove, src + 4, src, 16));
+  for (uint32_t n = 0; n < 16; ++n) {
+    REQUIRE(test.host(src + 4)[n] == n);
+  }
+  // And backwards.
+  REQUIRE(test.Call(LibraryMemmove, src, src + 4, 16));
+  for (uint32_t n = 0; n < 16; ++n) {
+    REQUIRE(test.host(src)[n] == n);
+  }
+  REQUIRE(test.Call(LibraryMemmove, src, src + 4, 0));
+  REQUIRE(test.host(src)[0] == 0);
+}
+
+TEST_CASE("library_memset", "[library_routines]") {
+  LibraryRoutineTest test;
+  // Only the low byte of r4 is the value.
+  REQUIRE(test.Call(LibraryMemset, test.base + 1, 0x1234, 6));
+  REQUIRE(test.host(test.base)[0] == 0xCD);
+  for (uint32_t n = 1; n <= 6; ++n) {
+    REQUIRE(test.host(test.base)[n] == 0x34);
+  }
+  REQUIRE(test.host(test.base)[7] == 0xCD);
+  REQUIRE(test.Call(LibraryMemset, test.base + 8, 0, 0));
+  REQUIRE(test.host(test.base)[8] == 0xCD);
+}
+
+TEST_CASE("library_strlen", "[library_routines]") {
+  LibraryRoutineTest test;
+  // Stored by the guest as a big-endian word, so in memory order "ABC\0".
+  xe::store_and_swap<uint32_t>(test.host(test.base), 0x41424300);
+  REQUIRE(test.Call(LibraryStrlen, test.base));
+  REQUIRE(test.ctx.r[3] == 3);
+
+  test.StoreString(test.base + 0x10, "");
+  REQUIRE(test.Call(LibraryStrlen, test.base + 0x10));
+  REQUIRE(test.ctx.r[3] == 0);
+
+  // Running into the next page.
+  test.StoreString(test.base + 4096 - 3, "abcdefg");
+  REQUIRE(test.Call(LibraryStrlen, test.base + 4096 - 3));
+  REQUIRE(test.ctx.r[3] == 7);
+}
+
+TEST_CASE("library_strcmp", "[library_routines]") {
+  LibraryRoutineTest test;
+  uint32_t a = test.base;
+  uint32_t b = test.base + 0x100;
+
+  test.StoreString(a, "abc");
+  test.StoreString(b, "abc");
+  REQUIRE(test.Call(LibraryStrcmp, a, b));
+  REQUIRE(test.ctx.r[3] == 0);
+
+  // The sign is returned sign extended to 64 bits.
+  test.StoreString(b, "abd");
+  REQUIRE(test.Call(LibraryStrcmp, a, b));
+  REQUIRE(int64_t(test.ctx.r[3]) < 0);
+  REQUIRE(test.Call(LibraryStrcmp, b, a));
+  REQUIRE(int64_t(test.ctx.r[3]) > 0);
+
+  // A prefix sorts first.
+  test.StoreString(b, "ab");
+  REQUIRE(test.Call(LibraryStrcmp, b, a));
+  REQUIRE(int64_t(test.ctx.r[3]) < 0);
+
+  // Bytes compare unsigned, in memory order.
+  xe::store_and_swap<uint32_t>(test.host(a), 0x41800000);
+  xe::store_and_swap<uint32_t>(test.host(b), 0x41010000);
+  REQUIRE(test.Call(LibraryStrcmp, a, b));
+  REQUIRE(int64_t(test.ctx.r[3]) > 0);
+
+  // Strings running into the next page, at different offsets in it.
+  test.StoreString(test.base + 4096 - 2, "xyz1");
+  test.StoreString(test.base + 4096 - 9, "xyz2");
+  REQUIRE(
+      test.Call(LibraryStrcmp, test.base + 4096 - 2, test.base + 4096 - 9));
+  REQUIRE(int64_t(test.ctx.r[3]) < 0);
+}
+
+TEST_CASE("library_routine_hash", "[library_routines]") {
+  LibraryRoutineTest test;
+  auto store_code = [&](uint32_t address, std::vector<uint32_t> code) {
+    for (size_t n = 0; n < code.size(); ++n) {
+      xe::store_and_swap<uint32_t>(test.host(address + uint32_t(n) * 4),
+                                   code[n]);
+    }
+  };
+  // li r4, 0; bl +0x100; blr
+  store_code(test.base, {0x38800000, 0x48000101, 0x4E800020});
+  CodeRange function1(test.base, test.base + 8);
+  // The same calling somewhere else.
+  store_code(test.base + 0x100, {0x38800000, 0x4BFFF001, 0x4E800020});
+  CodeRange function2(test.base + 0x100, test.base + 0x108);
+  // b instead of bl.
+  store_code(test.base + 0x200, {0x38800000, 0x48000100, 0x4E800020});
+  CodeRange function3(test.base + 0x200, test.base + 0x208);
+  // li r4, 1.
+  store_code(test.base + 0x300, {0x38800001, 0x48000101, 0x4E800020});
+  CodeRange function4(test.base + 0x300, test.base + 0x308);
+
+  uint64_t hash = HashLibraryRoutineCode(&test.memory, &function1);
+  REQUIRE(HashLibraryRoutineCode(&test.memory, &function2) == hash);
+  REQUIRE(HashLibraryRoutineCode(&test.memory, &function3) != hash);
+  REQUIRE(HashLibraryRoutineCode(&test.memory, &function4) != hash);
+
+  // Identified by the hash without a name, and by the name regardless of it.
+  LibraryRoutineSignatures signatures = {{hash, LibraryRoutine::kStrlen}};
+  REQUIRE(IdentifyLibraryRoutine(&test.memory, &function2, signatures) ==
+          LibraryRoutine::kStrlen);
+  REQUIRE(IdentifyLibraryRoutine(&test.memory, &function4, signatures) ==
+          LibraryRoutine::kUnknown);
+  function4.set_name("__memcpy");
+  REQUIRE(IdentifyLibraryRoutine(&test.memory, &function4, signatures) ==
+          LibraryRoutine::kMemcpy);
+}
+
+TEST_CASE("library_routine_signatures", "[library_routines]") {
+  std::string path = "library_routine_signatures_test.txt";
+  {
+    std::ofstream file(path);
+    file << "# Comment\n"
+         << "\n"
+         << "0123456789ABCDEF memcpy\n"
+         << "fedcba9876543210 _strcmp\n"
+         << "1111111111111111 unknown_routine\n"
+         << "2222222222222222 XMemSet\n";
+  }
+  LibraryRoutineSignatures signatures;
+  REQUIRE(LoadLibraryRoutineSignatures(path, &signatures));
+  std::remove(path.c_str());
+  REQUIRE(signatures.size() == 3);
+  REQUIRE(signatures[0x0123456789ABCDEFull] == LibraryRoutine::kMemcpy);
+  REQUIRE(signatures[0xFEDCBA9876543210ull] == LibraryRoutine::kStrcmp);
+  REQUIRE(signatures[0x2222222222222222ull] == LibraryRoutine::kMemset);
+
+  REQUIRE_FALSE(LoadLibraryRoutineSignatures(path, &signatures));
+}
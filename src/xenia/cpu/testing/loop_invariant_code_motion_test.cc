@@ -0,0 +1,204 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/testing/util.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace xe;
+using namespace xe::cpu;
+using namespace xe::cpu::hir;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+namespace {
+
+// Instructions before and within the single loop of a function. The loop
+// spans from the target of its back edge to the block holding it; everything
+// before that is on the preheader side.
+struct LoopInstrs {
+  bool found = false;
+  std::vector<Instr*> outside;
+  std::vector<Instr*> inside;
+};
+
+LoopInstrs SplitAtLoop(HIRBuilder& b) {
+  uint16_t block_ordinal = 0;
+  for (auto block = b.first_block(); block; block = block->next) {
+    block->ordinal = block_ordinal++;
+  }
+  LoopInstrs instrs;
+  uint16_t header_ordinal = 0;
+  uint16_t latch_ordinal = 0;
+  for (auto block = b.first_block(); block; block = block->next) {
+    auto tail = block->instr_tail;
+    if (!tail || !(tail->opcode->flags & OPCODE_FLAG_BRANCH)) {
+      continue;
+    }
+    auto label = tail->opcode == &OPCODE_BRANCH_info ? tail->src1.label
+                                                     : tail->src2.label;
+    if (label->block->ordinal <= block->ordinal) {
+      instrs.found = true;
+      header_ordinal = label->block->ordinal;
+      latch_ordinal = block->ordinal;
+      break;
+    }
+  }
+  if (!instrs.found) {
+    return instrs;
+  }
+  for (auto block = b.first_block(); block; block = block->next) {
+    if (block->ordinal > latch_ordinal) {
+      break;
+    }
+    auto& list =
+        block->ordinal < header_ordinal ? instrs.outside : instrs.inside;
+    for (auto i = block->instr_head; i; i = i->next) {
+      list.push_back(i);
+    }
+  }
+  return instrs;
+}
+
+size_t CountInstrs(const std::vector<Instr*>& instrs,
+                   std::function<bool(const Instr*)> predicate) {
+  return std::count_if(instrs.begin(), instrs.end(), predicate);
+}
+
+bool IsLoadR4(const Instr* i) {
+  return i->opcode == &OPCODE_LOAD_CONTEXT_info &&
+         i->src1.offset == offsetof(PPCContext, r) + 4 * 8;
+}
+
+bool IsAdd16(const Instr* i) {
+  if (i->opcode != &OPCODE_ADD_info) {
+    return false;
+  }
+  auto src1 = i->src1.value;
+  auto src2 = i->src2.value;
+  return (src1->IsConstant() && src1->AsUint64() == 16) ||
+         (src2->IsConstant() && src2->AsUint64() == 16);
+}
+
+}  // namespace
+
+// r3 += r5 * 8 + r4 + 16 while --r5 != 0. The load of r4 and the invariant
+// part of the sum are hoisted, and the multiply becomes a shift.
+TEST_CASE("LOOP_INVARIANT_ADDRESS_ARITHMETIC", "[licm]") {
+  // Counted while the HIR is still around.
+  struct {
+    bool found_loop;
+    size_t outside_r4_loads;
+    size_t inside_r4_loads;
+    size_t inside_muls;
+    size_t inside_shls;
+    size_t outside_add16s;
+    size_t inside_add16s;
+  } counts = {};
+  TestFunction test(
+      [](HIRBuilder& b) {
+        StoreGPR(b, 6, LoadGPR(b, 5));
+        auto loop = b.NewLabel();
+        b.MarkLabel(loop);
+        auto count = LoadGPR(b, 5);
+        auto offset = b.Add(b.Add(b.Mul(count, b.LoadConstantUint64(8)),
+                                  LoadGPR(b, 4)),
+                            b.LoadConstantUint64(16));
+        StoreGPR(b, 3, b.Add(LoadGPR(b, 3), offset));
+        count = b.Sub(count, b.LoadConstantUint64(1));
+        StoreGPR(b, 5, count);
+        b.BranchTrue(b.CompareNE(count, b.LoadZeroInt64()), loop);
+        b.Return();
+      },
+      [&](HIRBuilder& b) {
+        auto instrs = SplitAtLoop(b);
+        counts.found_loop = instrs.found;
+        counts.outside_r4_loads = CountInstrs(instrs.outside, IsLoadR4);
+        counts.inside_r4_loads = CountInstrs(instrs.inside, IsLoadR4);
+        counts.inside_muls = CountInstrs(instrs.inside, [](const Instr* i) {
+          return i->opcode == &OPCODE_MUL_info;
+        });
+        counts.inside_shls = CountInstrs(instrs.inside, [](const Instr* i) {
+          return i->opcode == &OPCODE_SHL_info;
+        });
+        counts.outside_add16s = CountInstrs(instrs.outside, IsAdd16);
+        counts.inside_add16s = CountInstrs(instrs.inside, IsAdd16);
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[3] = 0;
+        ctx->r[4] = 100;
+        ctx->r[5] = 3;
+      },
+      [](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 8 * (3 + 2 + 1) + 3 * 116);
+        REQUIRE(ctx->r[5] == 0);
+        REQUIRE(ctx->r[6] == 3);
+      });
+  REQUIRE(counts.found_loop);
+  REQUIRE(counts.outside_r4_loads == 1);
+  REQUIRE(counts.inside_r4_loads == 0);
+  REQUIRE(counts.inside_muls == 0);
+  REQUIRE(counts.inside_shls == 1);
+  // r4 + 16, reassociated out of the address.
+  REQUIRE(counts.outside_add16s == 1);
+  REQUIRE(counts.inside_add16s == 0);
+}
+
+// The vector constant is kept in a register across iterations.
+TEST_CASE("LOOP_INVARIANT_VECTOR_CONSTANT", "[licm]") {
+  struct {
+    bool found_loop;
+    size_t outside_constant_assigns;
+    size_t inside_constant_adds;
+  } counts = {};
+  TestFunction test(
+      [](HIRBuilder& b) {
+        StoreGPR(b, 6, LoadGPR(b, 5));
+        auto loop = b.NewLabel();
+        b.MarkLabel(loop);
+        StoreVR(b, 3, b.VectorAdd(LoadVR(b, 3),
+                                  b.LoadConstantVec128(vec128i(1, 2, 3, 4)),
+                                  INT32_TYPE));
+        auto count = b.Sub(LoadGPR(b, 5), b.LoadConstantUint64(1));
+        StoreGPR(b, 5, count);
+        b.BranchTrue(b.CompareNE(count, b.LoadZeroInt64()), loop);
+        b.Return();
+      },
+      [&](HIRBuilder& b) {
+        auto instrs = SplitAtLoop(b);
+        counts.found_loop = instrs.found;
+        counts.outside_constant_assigns =
+            CountInstrs(instrs.outside, [](const Instr* i) {
+              return i->opcode == &OPCODE_ASSIGN_info &&
+                     i->src1.value->IsConstant() &&
+                     i->src1.value->constant.v128 == vec128i(1, 2, 3, 4);
+            });
+        counts.inside_constant_adds =
+            CountInstrs(instrs.inside, [](const Instr* i) {
+              return i->opcode == &OPCODE_VECTOR_ADD_info &&
+                     (i->src1.value->IsConstant() ||
+                      i->src2.value->IsConstant());
+            });
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->v[3] = vec128i(10);
+        ctx->r[5] = 4;
+      },
+      [](PPCContext* ctx) {
+        REQUIRE(ctx->v[3] == vec128i(14, 18, 22, 26));
+        REQUIRE(ctx->r[5] == 0);
+      });
+  // Assigned to a value in the preheader, which the add uses instead.
+  REQUIRE(counts.found_loop);
+  REQUIRE(counts.outside_constant_assigns == 1);
+  REQUIRE(counts.inside_constant_adds == 0);
+}
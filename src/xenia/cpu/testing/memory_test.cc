@@ -0,0 +1,154 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <vector>
+
+#include "xenia/base/byte_stream.h"
+#include "xenia/memory.h"
+
+#include "third_party/catch/single_include/catch.hpp"
+
+using namespace xe;
+
+namespace {
+
+// 64 pages of the 64KB page heap, followed by a guard page so that free runs
+// never extend past the window.
+const uint32_t kWindowBase = 0x50000000;
+const uint32_t kPageSize = 64 * 1024;
+const uint32_t kWindowPageCount = 64;
+
+struct HeapModel {
+  BaseHeap* heap;
+  uint32_t unreserved_page_count;
+  // Pages of the window (plus the guard page) expected to be reserved.
+  std::vector<bool> used;
+
+  explicit HeapModel(BaseHeap* heap)
+      : heap(heap),
+        unreserved_page_count(heap->GetUnreservedPageCount()),
+        used(kWindowPageCount + 1, false) {}
+
+  void AllocFixed(uint32_t page_number, uint32_t page_count) {
+    REQUIRE(heap->AllocFixed(kWindowBase + page_number * kPageSize,
+                             page_count * kPageSize, kPageSize,
+                             kMemoryAllocationReserve,
+                             kMemoryProtectRead | kMemoryProtectWrite));
+    Mark(page_number, page_count, true);
+  }
+
+  uint32_t AllocRange(uint32_t page_count, uint32_t alignment_pages,
+                      bool top_down) {
+    uint32_t address = 0;
+    REQUIRE(heap->AllocRange(
+        kWindowBase, kWindowBase + kWindowPageCount * kPageSize,
+        page_count * kPageSize, alignment_pages * kPageSize,
+        kMemoryAllocationReserve, kMemoryProtectRead | kMemoryProtectWrite,
+        top_down, &address));
+    uint32_t page_number = (address - kWindowBase) / kPageSize;
+    Mark(page_number, page_count, true);
+    return page_number;
+  }
+
+  void Release(uint32_t page_number, uint32_t page_count) {
+    uint32_t region_size = 0;
+    REQUIRE(heap->Release(kWindowBase + page_number * kPageSize, &region_size));
+    REQUIRE(region_size == page_count * kPageSize);
+    Mark(page_number, page_count, false);
+  }
+
+  void Mark(uint32_t page_number, uint32_t page_count, bool is_used) {
+    for (uint32_t i = page_number; i < page_number + page_count; ++i) {
+      REQUIRE(bool(used[i]) != is_used);
+      used[i] = is_used;
+      if (is_used) {
+        --unreserved_page_count;
+      } else {
+        ++unreserved_page_count;
+      }
+    }
+  }
+
+  // Checks that the heap's free page index and page table agree with what
+  // has been allocated.
+  void Check() {
+    REQUIRE(heap->GetUnreservedPageCount() == unreserved_page_count);
+    for (uint32_t i = 0; i < kWindowPageCount; ++i) {
+      HeapAllocationInfo info;
+      REQUIRE(heap->QueryRegionInfo(kWindowBase + i * kPageSize, &info));
+      if (used[i]) {
+        REQUIRE(info.state != 0);
+        continue;
+      }
+      uint32_t free_run_length = 0;
+      while (!used[i + free_run_length]) {
+        ++free_run_length;
+      }
+      REQUIRE(info.state == 0);
+      REQUIRE(info.region_size == free_run_length * kPageSize);
+    }
+  }
+};
+
+}  // namespace
+
+TEST_CASE("heap_alloc_range_fragmented", "[memory]") {
+  Memory memory;
+  REQUIRE(memory.Initialize());
+  auto heap = memory.LookupHeap(kWindowBase);
+  REQUIRE(heap->page_size() == kPageSize);
+
+  HeapModel model(heap);
+  model.AllocFixed(kWindowPageCount, 1);
+  // Free runs: [4, 10) [12, 30) [31, 40) [44, 64).
+  model.AllocFixed(0, 4);
+  model.AllocFixed(10, 2);
+  model.AllocFixed(30, 1);
+  model.AllocFixed(40, 4);
+  model.Check();
+
+  // Lowest run that fits an aligned start.
+  REQUIRE(model.AllocRange(5, 4, false) == 4);
+  REQUIRE(model.AllocRange(2, 8, false) == 16);
+  model.Check();
+
+  // Highest run, which may end right at the top of the range.
+  REQUIRE(model.AllocRange(3, 1, true) == 61);
+  REQUIRE(model.AllocRange(2, 8, true) == 56);
+  // The top of the highest run that fits, skipping runs that are too small.
+  REQUIRE(model.AllocRange(9, 1, true) == 47);
+  REQUIRE(model.AllocRange(10, 1, true) == 20);
+  model.Check();
+
+  model.Release(4, 5);
+  model.Release(10, 2);
+  model.Release(61, 3);
+  model.Check();
+  // The released space is found again.
+  REQUIRE(model.AllocRange(3, 1, true) == 61);
+  REQUIRE(model.AllocRange(8, 1, false) == 4);
+  model.Check();
+
+  // Restoring brings back the page table and the free index along with it.
+  std::vector<uint8_t> buffer(heap->GetSaveSizeBound());
+  ByteStream save_stream(buffer.data(), buffer.size());
+  REQUIRE(heap->Save(&save_stream));
+  HeapModel saved_model = model;
+  model.Release(4, 8);
+  model.Release(56, 2);
+  model.AllocRange(6, 1, false);
+  model.Check();
+
+  ByteStream restore_stream(buffer.data(), save_stream.offset());
+  REQUIRE(heap->Restore(&restore_stream));
+  saved_model.Check();
+  REQUIRE(saved_model.AllocRange(2, 1, true) == 59);
+  REQUIRE(saved_model.AllocRange(4, 1, false) == 12);
+  saved_model.Check();
+}
@@ -0,0 +1,157 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/memory.h"
+#include "xenia/cpu/mmio_handler.h"
+#include "xenia/cpu/raw_module.h"
+#include "xenia/cpu/testing/util.h"
+
+using namespace xe;
+using namespace xe::cpu;
+using namespace xe::cpu::hir;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+namespace {
+
+struct TestRegisters {
+  uint32_t last_write_address = 0;
+  uint32_t last_write_value = 0;
+  int fault_count = 0;
+};
+
+uint32_t ReadTestRegister(void* ppc_context, void* callback_context,
+                          uint32_t addr) {
+  return 0x10000000 | (addr & 0xFFFF);
+}
+
+void WriteTestRegister(void* ppc_context, void* callback_context,
+                       uint32_t addr, uint32_t value) {
+  auto registers = reinterpret_cast<TestRegisters*>(callback_context);
+  registers->last_write_address = addr;
+  registers->last_write_value = value;
+}
+
+void CountAccessSite(void* context_ptr, uint64_t host_pc) {
+  ++reinterpret_cast<TestRegisters*>(context_ptr)->fault_count;
+}
+
+struct SiteCounter {
+  Processor* processor;
+  int site_count;
+};
+
+// Counts new sites on the way to the processor, which would otherwise get
+// them directly.
+void ForwardAccessSite(void* context_ptr, uint64_t host_pc) {
+  auto counter = reinterpret_cast<SiteCounter*>(context_ptr);
+  ++counter->site_count;
+  counter->processor->OnMMIOAccessSite(host_pc);
+}
+
+}  // namespace
+
+// lwz/stw as rebuilt once their site is known: D-form accesses flagged
+// LOAD_STORE_MMIO reach the register callbacks without faulting.
+TEST_CASE("LOAD_STORE_OFFSET_MMIO", "[mmio]") {
+  TestRegisters registers;
+  TestFunction test([](HIRBuilder& b) {
+    auto base = LoadGPR(b, 4);
+    auto value = b.LoadOffset(base, b.LoadConstantInt64(0x10), INT32_TYPE,
+                              LoadStoreFlags::LOAD_STORE_MMIO);
+    StoreGPR(b, 3, b.ZeroExtend(b.ByteSwap(value), INT64_TYPE));
+    b.StoreOffset(base, b.LoadConstantInt64(0x20),
+                  b.ByteSwap(b.Truncate(LoadGPR(b, 5), INT32_TYPE)),
+                  LoadStoreFlags::LOAD_STORE_MMIO);
+    b.Return();
+  });
+  test.memory->AddVirtualMappedRange(
+      0x7FC80000, 0xFFFF0000, 0x0000FFFF, &registers, ReadTestRegister,
+      WriteTestRegister);
+  MMIOHandler::global_handler()->SetAccessSiteCallback(CountAccessSite,
+                                                       &registers);
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[4] = 0x7FC80100;
+        ctx->r[5] = 0xCAFEF00D;
+      },
+      [&registers](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 0x10000110);
+        REQUIRE(registers.last_write_address == 0x7FC80120);
+        REQUIRE(registers.last_write_value == 0xCAFEF00D);
+        REQUIRE(registers.fault_count == 0);
+      });
+}
+
+// lwz/stw in guest code not known to access MMIO: the first run faults on
+// each, which traces them back to the guest instructions and rebuilds the
+// function (here on the faulting thread, as there's no background compiler).
+// The rebuilt function reaches the registers without faulting.
+TEST_CASE("MMIO_ACCESS_SITE_REBUILD", "[mmio]") {
+  Memory memory;
+  REQUIRE(memory.Initialize());
+  Processor processor(&memory, nullptr);
+  REQUIRE(processor.Setup(std::make_unique<backend::x64::X64Backend>()));
+
+  const uint32_t kCodeAddress = 0x82000000;
+  REQUIRE(memory.LookupHeap(kCodeAddress)
+              ->AllocFixed(kCodeAddress, 0x10000, 0x10000,
+                           kMemoryAllocationReserve | kMemoryAllocationCommit,
+                           kMemoryProtectRead | kMemoryProtectWrite));
+  const uint32_t code[] = {
+      0x80640010,  // lwz r3, 0x10(r4)
+      0x90A40020,  // stw r5, 0x20(r4)
+      0x4E800020,  // blr
+  };
+  for (uint32_t i = 0; i < 3; ++i) {
+    xe::store_and_swap<uint32_t>(memory.TranslateVirtual(kCodeAddress + i * 4),
+                                 code[i]);
+  }
+  auto module = std::make_unique<RawModule>(&processor);
+  module->SetAddressRange(kCodeAddress, 0x10000);
+  processor.AddModule(std::move(module));
+  processor.backend()->CommitExecutableRange(kCodeAddress,
+                                             kCodeAddress + 0x10000);
+
+  TestRegisters registers;
+  memory.AddVirtualMappedRange(0x7FC80000, 0xFFFF0000, 0x0000FFFF,
+                               &registers, ReadTestRegister,
+                               WriteTestRegister);
+  SiteCounter counter = {&processor, 0};
+  MMIOHandler::global_handler()->SetAccessSiteCallback(ForwardAccessSite,
+                                                       &counter);
+
+  auto function =
+      static_cast<GuestFunction*>(processor.ResolveFunction(kCodeAddress));
+  REQUIRE(function);
+  ThreadState thread_state(&processor, 0x100);
+  auto run = [&]() {
+    auto ctx = thread_state.context();
+    ctx->lr = 0xBCBCBCBC;
+    ctx->r[3] = 0;
+    ctx->r[4] = 0x7FC80100;
+    ctx->r[5] = 0xCAFEF00D;
+    registers.last_write_address = 0;
+    registers.last_write_value = 0;
+    function->Call(&thread_state, uint32_t(ctx->lr));
+    REQUIRE(ctx->r[3] == 0x10000110);
+    REQUIRE(registers.last_write_address == 0x7FC80120);
+    REQUIRE(registers.last_write_value == 0xCAFEF00D);
+  };
+
+  run();
+  REQUIRE(counter.site_count == 2);
+  std::vector<uint32_t> sites;
+  processor.GetMMIOAccessSites(kCodeAddress, kCodeAddress + 8, &sites);
+  REQUIRE(sites == std::vector<uint32_t>({kCodeAddress, kCodeAddress + 4}));
+  REQUIRE(function->optimized_function());
+
+  run();
+  REQUIRE(counter.site_count == 2);
+}
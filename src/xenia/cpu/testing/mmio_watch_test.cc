@@ -0,0 +1,163 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <vector>
+
+#include "xenia/base/memory.h"
+#include "xenia/cpu/mmio_handler.h"
+#include "xenia/memory.h"
+
+#include "third_party/catch/single_include/catch.hpp"
+
+using namespace xe;
+using namespace xe::cpu;
+
+namespace {
+
+// Physical pages backed by guest memory, with watches recording the address
+// of each one as it fires.
+class WatchTest {
+ public:
+  WatchTest() {
+    memory.Initialize();
+    page_size = uint32_t(xe::memory::page_size());
+    uint32_t address = 0;
+    memory.LookupHeapByType(true, 64 * 1024)
+        ->Alloc(16 * page_size, 64 * 1024,
+                kMemoryAllocationReserve | kMemoryAllocationCommit,
+                kMemoryProtectRead | kMemoryProtectWrite, false, &address);
+    base = address & 0x1FFFFFFF;
+    handler = MMIOHandler::global_handler();
+  }
+
+  ~WatchTest() {
+    // Leaves nothing protected behind.
+    handler->InvalidateRange(base, 16 * page_size);
+  }
+
+  uint32_t page(uint32_t index) const { return base + index * page_size; }
+
+  void Watch(uint32_t index, uint32_t count) {
+    handler->AddPhysicalAccessWatch(page(index), count * page_size,
+                                    MMIOHandler::kWatchWrite, RecordFire, this,
+                                    nullptr);
+  }
+
+  // Writes from host code. Watched pages fault and go through the handler.
+  void Write(uint32_t address) {
+    *memory.TranslatePhysical<volatile uint8_t*>(address) = 0xCD;
+  }
+
+  static void RecordFire(void* context_ptr, void* data_ptr, uint32_t address) {
+    reinterpret_cast<WatchTest*>(context_ptr)->fired.push_back(address);
+  }
+
+  Memory memory;
+  MMIOHandler* handler;
+  uint32_t page_size;
+  uint32_t base;
+  std::vector<uint32_t> fired;
+};
+
+}  // namespace
+
+TEST_CASE("access_watch_overlap", "[mmio]") {
+  WatchTest test;
+
+  // Adding a watch fires those it overlaps, on either side.
+  test.Watch(0, 2);
+  test.Watch(3, 2);
+  test.Watch(1, 3);
+  REQUIRE(test.fired == std::vector<uint32_t>({test.page(0), test.page(3)}));
+  REQUIRE(test.handler->IsRangeWatched(test.page(1), 3 * test.page_size));
+  REQUIRE_FALSE(test.handler->IsRangeWatched(test.page(0), test.page_size));
+
+  // Invalidating a range that only touches a watch's ends leaves it alone.
+  test.fired.clear();
+  test.handler->InvalidateRange(test.page(0), test.page_size);
+  test.handler->InvalidateRange(test.page(4), test.page_size);
+  REQUIRE(test.fired.empty());
+  test.handler->InvalidateRange(test.page(4) - 1, 2);
+  REQUIRE(test.fired == std::vector<uint32_t>({test.page(1)}));
+}
+
+TEST_CASE("access_watch_containment", "[mmio]") {
+  WatchTest test;
+
+  // A watch inside another replaces it.
+  test.Watch(0, 4);
+  test.Watch(1, 1);
+  REQUIRE(test.fired == std::vector<uint32_t>({test.page(0)}));
+  REQUIRE(test.handler->IsRangeWatched(test.page(1), test.page_size));
+  REQUIRE_FALSE(test.handler->IsRangeWatched(test.page(0), test.page_size));
+
+  // A watch around others replaces all of them.
+  test.fired.clear();
+  test.Watch(3, 1);
+  test.Watch(0, 5);
+  REQUIRE(test.fired == std::vector<uint32_t>({test.page(1), test.page(3)}));
+
+  // Invalidating a range inside a watch fires it.
+  test.fired.clear();
+  test.handler->InvalidateRange(test.page(2) + 8, 4);
+  REQUIRE(test.fired == std::vector<uint32_t>({test.page(0)}));
+}
+
+TEST_CASE("access_watch_adjacent_runs", "[mmio]") {
+  WatchTest test;
+
+  // Adjacent watches together cover a range, but not across a gap.
+  test.Watch(0, 1);
+  test.Watch(1, 2);
+  test.Watch(3, 1);
+  test.Watch(5, 1);
+  REQUIRE(test.fired.empty());
+  auto watched = [&test](uint32_t address, uint32_t length) {
+    return test.handler->IsRangeWatched(address, length);
+  };
+  REQUIRE(watched(test.page(0), 4 * test.page_size));
+  REQUIRE(watched(test.page(0) + 16, 4 * test.page_size - 16));
+  REQUIRE(watched(test.page(2), 2 * test.page_size));
+  REQUIRE(watched(test.page(3) + test.page_size - 1, 1));
+  REQUIRE_FALSE(watched(test.page(0), 4 * test.page_size + 1));
+  REQUIRE_FALSE(watched(test.page(0), 6 * test.page_size));
+  REQUIRE_FALSE(watched(test.page(4), 1));
+  REQUIRE_FALSE(watched(test.page(4) + test.page_size - 1, 2));
+  REQUIRE(watched(test.page(5), test.page_size));
+}
+
+TEST_CASE("access_watch_fault_boundaries", "[mmio]") {
+  WatchTest test;
+
+  // Faults only fire the watch containing the address, even at the edges of
+  // a run of adjacent watches.
+  test.Watch(0, 1);
+  test.Watch(1, 1);
+  test.Watch(2, 1);
+  test.Write(test.page(1) - 1);
+  REQUIRE(test.fired == std::vector<uint32_t>({test.page(0)}));
+  REQUIRE(test.handler->IsRangeWatched(test.page(1), 2 * test.page_size));
+
+  test.fired.clear();
+  test.Write(test.page(2));
+  REQUIRE(test.fired == std::vector<uint32_t>({test.page(2)}));
+  REQUIRE(test.handler->IsRangeWatched(test.page(1), test.page_size));
+
+  test.fired.clear();
+  test.Write(test.page(2) - 1);
+  REQUIRE(test.fired == std::vector<uint32_t>({test.page(1)}));
+
+  // Fired watches leave their pages writable.
+  test.fired.clear();
+  for (uint32_t i = 0; i < 3; ++i) {
+    test.Write(test.page(i));
+    test.Write(test.page(i + 1) - 1);
+  }
+  REQUIRE(test.fired.empty());
+}
@@ -0,0 +1,160 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2015 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <string>
+#include <vector>
+
+#include "xenia/cpu/backend/x64/x64_backend.h"
+#include "xenia/cpu/module.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/memory.h"
+
+#include "third_party/catch/single_include/catch.hpp"
+
+using namespace xe;
+using namespace xe::cpu;
+
+namespace {
+
+// Contains [low_address, high_address), and reports it as its range only if
+// ranged.
+class SpanModule : public Module {
+ public:
+  SpanModule(Processor* processor, const std::string& name,
+             uint32_t low_address, uint32_t high_address, bool ranged)
+      : Module(processor),
+        name_(name),
+        low_address_(low_address),
+        high_address_(high_address),
+        ranged_(ranged) {}
+
+  const std::string& name() const override { return name_; }
+  bool is_executable() const override { return true; }
+
+  bool ContainsAddress(uint32_t address) override {
+    return address >= low_address_ && address < high_address_;
+  }
+  bool GetAddressRange(uint32_t* out_low_address,
+                       uint32_t* out_high_address) override {
+    if (!ranged_) {
+      return false;
+    }
+    *out_low_address = low_address_;
+    *out_high_address = high_address_;
+    return true;
+  }
+
+ protected:
+  std::unique_ptr<Function> CreateFunction(uint32_t address) override {
+    return std::unique_ptr<Function>(
+        processor_->backend()->CreateGuestFunction(this, address));
+  }
+
+ private:
+  std::string name_;
+  uint32_t low_address_;
+  uint32_t high_address_;
+  bool ranged_;
+};
+
+}  // namespace
+
+TEST_CASE("module_lookup_precedence", "[processor]") {
+  Memory memory;
+  REQUIRE(memory.Initialize());
+  Processor processor(&memory, nullptr);
+  REQUIRE(processor.Setup(std::make_unique<backend::x64::X64Backend>()));
+
+  // Added in this order.
+  struct {
+    const char* name;
+    uint32_t low_address;
+    uint32_t high_address;
+    bool ranged;
+  } spans[] = {
+      {"a", 0x10000, 0x30000, true},   {"b", 0x20000, 0x40000, true},
+      {"c", 0x50000, 0x60000, false},  {"d", 0x50000, 0x70000, true},
+      {"e", 0x80000, 0x90000, false},  {"f", 0x0F000, 0xA0000, true},
+  };
+  std::vector<Module*> modules;
+  for (auto& span : spans) {
+    auto module = std::make_unique<SpanModule>(&processor, span.name,
+                                               span.low_address,
+                                               span.high_address, span.ranged);
+    modules.push_back(module.get());
+    processor.AddModule(std::move(module));
+  }
+
+  // Which module the processor declares the function at the address in. It
+  // is declared up front in every module containing it so that nothing is
+  // scanned.
+  auto lookup = [&](uint32_t address) -> std::string {
+    for (auto module : modules) {
+      if (!module->ContainsAddress(address)) {
+        continue;
+      }
+      Function* function;
+      if (module->DeclareFunction(address, &function) ==
+          Symbol::Status::kNew) {
+        function->set_end_address(address + 4);
+        function->set_status(Symbol::Status::kDeclared);
+      }
+    }
+    auto function = processor.LookupFunction(address);
+    return function ? function->module()->name() : "";
+  };
+
+  // Overlapping ranges go to the module added first, on either side of the
+  // overlap and past either end.
+  REQUIRE(lookup(0x10000) == "a");
+  REQUIRE(lookup(0x28000) == "a");
+  REQUIRE(lookup(0x38000) == "b");
+  REQUIRE(lookup(0x0F000) == "f");
+  REQUIRE(lookup(0x48000) == "f");
+  REQUIRE(lookup(0x9FFFC) == "f");
+  // A known range wins over a module without one, even one added before it.
+  REQUIRE(lookup(0x58000) == "d");
+  REQUIRE(lookup(0x68000) == "d");
+  // e has no range and f, added after it, contains its addresses.
+  REQUIRE(lookup(0x88000) == "f");
+  // Outside of all modules.
+  REQUIRE(lookup(0xA0000) == "");
+  // The per-thread last module is not stale after looking elsewhere.
+  REQUIRE(lookup(0x28000) == "a");
+}
+
+TEST_CASE("module_lookup_unranged", "[processor]") {
+  Memory memory;
+  REQUIRE(memory.Initialize());
+  Processor processor(&memory, nullptr);
+  REQUIRE(processor.Setup(std::make_unique<backend::x64::X64Backend>()));
+
+  // Modules without a range are asked in the order they were added.
+  auto first = std::make_unique<SpanModule>(&processor, "first", 0x10000,
+                                            0x30000, false);
+  auto second = std::make_unique<SpanModule>(&processor, "second", 0x20000,
+                                             0x40000, false);
+  std::vector<Module*> modules = {first.get(), second.get()};
+  processor.AddModule(std::move(first));
+  processor.AddModule(std::move(second));
+  for (uint32_t address : {0x18000u, 0x28000u, 0x38000u}) {
+    for (auto module : modules) {
+      Function* function;
+      if (module->ContainsAddress(address) &&
+          module->DeclareFunction(address, &function) ==
+              Symbol::Status::kNew) {
+        function->set_end_address(address + 4);
+        function->set_status(Symbol::Status::kDeclared);
+      }
+    }
+  }
+  REQUIRE(processor.LookupFunction(0x18000)->module() == modules[0]);
+  REQUIRE(processor.LookupFunction(0x28000)->module() == modules[0]);
+  REQUIRE(processor.LookupFunction(0x38000)->module() == modules[1]);
+}
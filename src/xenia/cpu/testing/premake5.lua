@@ -11,9 +11,39 @@ test_suite("xenia-cpu-tests", project_root, ".", {
     "xenia-core",
     "xenia-cpu",
     "xenia-cpu-backend-x64",
+    "xxhash",
 
     -- TODO(benvanik): cut these dependencies?
     "xenia-kernel",
     "xenia-ui", -- needed by xenia-base
   },
 })
+
+group("tests")
+project("xenia-cpu-sequence-benchmark")
+  uuid("6c1b2f0e-94d5-4f7a-b8a3-2d6e0f3c9a41")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "capstone",
+    "gflags",
+    "xenia-base",
+    "xenia-core",
+    "xenia-cpu",
+    "xenia-cpu-backend-x64",
+    "xxhash",
+
+    -- TODO(benvanik): cut these dependencies?
+    "xenia-kernel",
+  })
+  files({
+    "sequence_benchmark_main.cc",
+    project_root.."/src/xenia/base/main_"..platform_suffix..".cc",
+  })
+  includedirs({
+    project_root.."/third_party/gflags/src",
+  })
+  filter("platforms:Windows")
+    -- xenia-base needs this
+    links({"xenia-ui"})
+  filter({})
@@ -0,0 +1,276 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/testing/util.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+using namespace xe;
+using namespace xe::cpu;
+using namespace xe::cpu::hir;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+namespace {
+
+// Whether two values defined and used within the same block share a register
+// while both are live. A value may take the register of one whose last use is
+// the instruction defining it.
+bool HasBlockLocalInterference(HIRBuilder& b) {
+  struct Interval {
+    RegAssignment reg;
+    size_t start;
+    size_t end;
+  };
+  for (auto block = b.first_block(); block; block = block->next) {
+    std::unordered_map<const Instr*, size_t> positions;
+    size_t position = 0;
+    for (auto i = block->instr_head; i; i = i->next) {
+      positions[i] = position++;
+    }
+    std::vector<Interval> intervals;
+    for (auto i = block->instr_head; i; i = i->next) {
+      if (!i->dest || !i->dest->reg.set) {
+        continue;
+      }
+      Interval interval = {i->dest->reg, positions[i], positions[i]};
+      bool local = true;
+      for (auto use = i->dest->use_head; use; use = use->next) {
+        if (use->instr->block != block) {
+          local = false;
+          break;
+        }
+        interval.end = std::max(interval.end, positions[use->instr]);
+      }
+      if (local) {
+        intervals.push_back(interval);
+      }
+    }
+    for (auto& first : intervals) {
+      for (auto& second : intervals) {
+        if (first.reg.set == second.reg.set &&
+            first.reg.index == second.reg.index &&
+            first.start < second.start && second.start < first.end) {
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+// Values that are all live at once each get a register of their own.
+TEST_CASE("REGISTER_ALLOCATION_INTERFERENCE", "[regalloc]") {
+  bool has_interference = true;
+  TestFunction test(
+      [](HIRBuilder& b) {
+        std::vector<Value*> values;
+        for (uint64_t n = 1; n <= 12; ++n) {
+          values.push_back(b.Add(LoadGPR(b, 4), b.LoadConstantUint64(n)));
+        }
+        auto sum = b.LoadZeroInt64();
+        for (auto value : values) {
+          sum = b.Add(sum, value);
+        }
+        StoreGPR(b, 3, sum);
+        b.Return();
+      },
+      [&](HIRBuilder& b) { has_interference = HasBlockLocalInterference(b); });
+  test.Run([](PPCContext* ctx) { ctx->r[4] = 10; },
+           [](PPCContext* ctx) {
+             auto result = ctx->r[3];
+             REQUIRE(result == 12 * 10 + 78);
+           });
+  REQUIRE_FALSE(has_interference);
+}
+
+// More values than registers, all live into both successors of a branch, so
+// some must be spilled and reloaded in another block.
+TEST_CASE("REGISTER_ALLOCATION_ACROSS_BLOCKS_I64", "[regalloc]") {
+  TestFunction test([](HIRBuilder& b) {
+    std::vector<Value*> values;
+    for (uint64_t n = 0; n < 16; ++n) {
+      values.push_back(b.Add(LoadGPR(b, 4), b.LoadConstantUint64(n)));
+    }
+    auto skip = b.NewLabel();
+    b.BranchTrue(b.CompareEQ(LoadGPR(b, 5), b.LoadZeroInt64()), skip);
+    auto sum = b.LoadConstantUint64(1000);
+    for (auto value : values) {
+      sum = b.Add(sum, value);
+    }
+    StoreGPR(b, 3, sum);
+    b.Return();
+    b.MarkLabel(skip);
+    sum = b.LoadZeroInt64();
+    for (auto value : values) {
+      sum = b.Add(sum, value);
+    }
+    StoreGPR(b, 3, sum);
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[4] = 10;
+        ctx->r[5] = 0;
+      },
+      [](PPCContext* ctx) {
+        auto result = ctx->r[3];
+        REQUIRE(result == 10 * 16 + 120);
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[4] = 10;
+        ctx->r[5] = 1;
+      },
+      [](PPCContext* ctx) {
+        auto result = ctx->r[3];
+        REQUIRE(result == 1000 + 10 * 16 + 120);
+      });
+}
+
+TEST_CASE("REGISTER_ALLOCATION_ACROSS_BLOCKS_V128", "[regalloc]") {
+  TestFunction test([](HIRBuilder& b) {
+    std::vector<Value*> values;
+    for (uint32_t n = 0; n < 16; ++n) {
+      values.push_back(b.VectorAdd(LoadVR(b, 4),
+                                   b.LoadConstantVec128(vec128i(n)),
+                                   INT32_TYPE));
+    }
+    auto skip = b.NewLabel();
+    b.BranchTrue(b.CompareEQ(LoadGPR(b, 5), b.LoadZeroInt64()), skip);
+    auto sum = b.LoadConstantVec128(vec128i(1000));
+    for (auto value : values) {
+      sum = b.VectorAdd(sum, value, INT32_TYPE);
+    }
+    StoreVR(b, 3, sum);
+    b.Return();
+    b.MarkLabel(skip);
+    sum = b.LoadZeroVec128();
+    for (auto value : values) {
+      sum = b.VectorAdd(sum, value, INT32_TYPE);
+    }
+    StoreVR(b, 3, sum);
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->v[4] = vec128i(10);
+        ctx->r[5] = 0;
+      },
+      [](PPCContext* ctx) {
+        auto result = ctx->v[3];
+        REQUIRE(result == vec128i(10 * 16 + 120));
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->v[4] = vec128i(10);
+        ctx->r[5] = 1;
+      },
+      [](PPCContext* ctx) {
+        auto result = ctx->v[3];
+        REQUIRE(result == vec128i(1000 + 10 * 16 + 120));
+      });
+}
+
+// A guest call clobbers every register, so values live across it are stored
+// to locals before it and reloaded after.
+TEST_CASE("REGISTER_ALLOCATION_ACROSS_CALL", "[regalloc]") {
+  // Counted while the HIR is still around.
+  struct {
+    bool found_call;
+    size_t stores_before_call;
+    size_t loads_after_call;
+  } counts = {};
+  TestFunction test(
+      [](HIRBuilder& b) {
+        std::vector<Value*> values;
+        for (uint64_t n = 1; n <= 4; ++n) {
+          values.push_back(b.Add(LoadGPR(b, 4), b.LoadConstantUint64(n)));
+        }
+        // Never taken, but the values still have to survive it.
+        b.CallIndirectTrue(b.CompareNE(LoadGPR(b, 6), b.LoadZeroInt64()),
+                           LoadGPR(b, 7));
+        auto sum = b.LoadZeroInt64();
+        for (auto value : values) {
+          sum = b.Add(sum, value);
+        }
+        StoreGPR(b, 3, sum);
+        b.Return();
+      },
+      [&](HIRBuilder& b) {
+        for (auto block = b.first_block(); block; block = block->next) {
+          for (auto i = block->instr_head; i; i = i->next) {
+            if (i->opcode == &OPCODE_CALL_INDIRECT_TRUE_info) {
+              counts.found_call = true;
+            } else if (i->opcode == &OPCODE_STORE_LOCAL_info &&
+                       !counts.found_call) {
+              ++counts.stores_before_call;
+            } else if (i->opcode == &OPCODE_LOAD_LOCAL_info &&
+                       counts.found_call) {
+              ++counts.loads_after_call;
+            }
+          }
+        }
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[4] = 10;
+        ctx->r[6] = 0;
+        ctx->r[7] = 0;
+      },
+      [](PPCContext* ctx) {
+        auto result = ctx->r[3];
+        REQUIRE(result == 4 * 10 + 1 + 2 + 3 + 4);
+      });
+  REQUIRE(counts.found_call);
+  REQUIRE(counts.stores_before_call >= 4);
+  REQUIRE(counts.loads_after_call >= 4);
+}
+
+// A value defined before a loop and used in it is live around the back-edge,
+// so the temporaries of later iterations must not take its register.
+TEST_CASE("REGISTER_ALLOCATION_ACROSS_LOOP_BACK_EDGE", "[regalloc]") {
+  TestFunction test([](HIRBuilder& b) {
+    auto invariant = b.Add(LoadGPR(b, 4), b.LoadConstantUint64(5));
+    auto loop = b.NewLabel();
+    b.MarkLabel(loop);
+    StoreGPR(b, 3, b.Add(LoadGPR(b, 3), invariant));
+    // Changes each iteration, so none of this is hoisted.
+    std::vector<Value*> values;
+    for (uint64_t n = 0; n < 16; ++n) {
+      values.push_back(b.Add(LoadGPR(b, 5), b.LoadConstantUint64(n)));
+    }
+    auto sum = LoadGPR(b, 7);
+    for (auto value : values) {
+      sum = b.Add(sum, value);
+    }
+    StoreGPR(b, 7, sum);
+    auto counter = b.Sub(LoadGPR(b, 5), b.LoadConstantUint64(1));
+    StoreGPR(b, 5, counter);
+    b.BranchTrue(b.CompareNE(counter, b.LoadZeroInt64()), loop);
+    StoreGPR(b, 8, invariant);
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[3] = 0;
+        ctx->r[4] = 1;
+        ctx->r[5] = 3;
+        ctx->r[7] = 0;
+      },
+      [](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 3 * 6);
+        REQUIRE(ctx->r[7] == 16 * (3 + 2 + 1) + 3 * 120);
+        REQUIRE(ctx->r[8] == 6);
+      });
+}
@@ -0,0 +1,636 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2014 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+#include "xenia/cpu/backend/x64/x64_op.h"
+#include "xenia/cpu/backend/x64/x64_sequences.h"
+#include "xenia/cpu/testing/util.h"
+
+DEFINE_string(sequence_filter, "",
+              "Only benchmark sequences whose name contains this string.");
+DEFINE_int32(sequence_iterations, 1000000,
+             "Loop iterations timed for each sequence.");
+DEFINE_string(sequence_results_path, "",
+              "Writes the results as CSV to the given path.");
+
+namespace xe {
+namespace cpu {
+namespace testing {
+namespace benchmark {
+
+using namespace xe::cpu::hir;
+using xe::cpu::backend::x64::InstrKey;
+using xe::cpu::backend::x64::KEY_TYPE_V_I8;
+
+// Copies of the op under test per loop iteration. Timing the loop with one
+// copy and with kUnrollCount copies cancels out the loop overhead.
+const uint32_t kUnrollCount = 8;
+const uint32_t kWarmupIterations = 1000;
+const uint32_t kScratchSize = 4096;
+
+// PPCContext::v slots holding the sources, results and context scratch.
+const uint32_t kSourceSlot = 0;
+const uint32_t kResultSlot = 16;
+const uint32_t kScratchSlot = kResultSlot + kUnrollCount;
+
+size_t SlotOffset(uint32_t slot) {
+  return offsetof(PPCContext, v) + slot * sizeof(vec128_t);
+}
+
+// Emits copy n of the op. Sources are non-constant values of the types in the
+// sequence key (nullptr for offset/label/symbol operands). Returns the result,
+// or nullptr for ops without one.
+typedef Value* (*EmitFn)(HIRBuilder& b, Value* const* src, TypeName dest_type,
+                         uint32_t n);
+
+struct SequenceBenchmark {
+  const OpcodeInfo* opcode;
+  // Distinguishes entries for the same opcode, e.g. the vector part type.
+  const char* variant;
+  EmitFn emit;
+  // Bitmask of sources (1 << src index) holding a guest address.
+  uint32_t address_sources;
+};
+
+// Indexed by Opcode.
+const OpcodeInfo* kOpcodeInfos[] = {
+#define DEFINE_OPCODE(num, name, sig, flags) &num##_info,
+#include "xenia/cpu/hir/opcodes.inl"
+#undef DEFINE_OPCODE
+};
+
+// Ops the harness can't put in a loop.
+const uint32_t kUnbenchmarkedFlags = OPCODE_FLAG_BRANCH | OPCODE_FLAG_VOLATILE |
+                                     OPCODE_FLAG_IGNORE |
+                                     OPCODE_FLAG_PAIRED_PREV;
+
+#define BINARY(method) \
+  [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) { \
+    return b.method(src[0], src[1]);                          \
+  }
+#define UNARY(method) \
+  [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) { \
+    return b.method(src[0]);                                  \
+  }
+#define CONVERT(method) \
+  [](HIRBuilder& b, Value* const* src, TypeName dest_type, uint32_t) { \
+    return b.method(src[0], dest_type);                                 \
+  }
+#define VECTOR(method, part_type, flags)                             \
+  [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) {         \
+    return b.method(src[0], src[1], part_type, flags);               \
+  }
+#define VECTOR_NO_FLAGS(method, part_type)                   \
+  [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) { \
+    return b.method(src[0], src[1], part_type);              \
+  }
+
+// Ops that branch, call, trap or need a runtime environment (MMIO, locals,
+// atomics) are not listed and run in the loop by other means.
+const SequenceBenchmark kSequenceBenchmarks[] = {
+    // x64_seq_memory.cc
+    {&OPCODE_LOAD_CONTEXT_info, nullptr,
+     [](HIRBuilder& b, Value* const* src, TypeName dest_type, uint32_t n) {
+       return b.LoadContext(SlotOffset(kScratchSlot + n), dest_type);
+     },
+     0},
+    {&OPCODE_STORE_CONTEXT_info, nullptr,
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t n) -> Value* {
+       b.StoreContext(SlotOffset(kScratchSlot + n), src[1]);
+       return nullptr;
+     },
+     0},
+    {&OPCODE_LOAD_info, nullptr,
+     [](HIRBuilder& b, Value* const* src, TypeName dest_type, uint32_t) {
+       return b.Load(src[0], dest_type);
+     },
+     1 << 0},
+    {&OPCODE_STORE_info, nullptr,
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) -> Value* {
+       b.Store(src[0], src[1]);
+       return nullptr;
+     },
+     1 << 0},
+    {&OPCODE_LOAD_OFFSET_info, nullptr,
+     [](HIRBuilder& b, Value* const* src, TypeName dest_type, uint32_t) {
+       return b.LoadOffset(src[0], src[1], dest_type);
+     },
+     1 << 0},
+    {&OPCODE_STORE_OFFSET_info, nullptr,
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) -> Value* {
+       b.StoreOffset(src[0], src[1], src[2]);
+       return nullptr;
+     },
+     1 << 0},
+    {&OPCODE_MEMSET_info, nullptr,
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) -> Value* {
+       // Only zeroing a cache line is supported.
+       b.Memset(src[0], b.LoadZeroInt8(), b.LoadConstantUint64(32));
+       return nullptr;
+     },
+     1 << 0},
+    {&OPCODE_PREFETCH_info, nullptr,
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) -> Value* {
+       b.Prefetch(src[0], 32);
+       return nullptr;
+     },
+     1 << 0},
+
+    // x64_seq_vector.cc
+    {&OPCODE_VECTOR_CONVERT_I2F_info, "signed", UNARY(VectorConvertI2F), 0},
+    {&OPCODE_VECTOR_CONVERT_I2F_info, "unsigned",
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) {
+       return b.VectorConvertI2F(src[0], ARITHMETIC_UNSIGNED);
+     },
+     0},
+    {&OPCODE_VECTOR_CONVERT_F2I_info, "signed", UNARY(VectorConvertF2I), 0},
+    {&OPCODE_VECTOR_CONVERT_F2I_info, "unsigned",
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) {
+       return b.VectorConvertF2I(src[0], ARITHMETIC_UNSIGNED);
+     },
+     0},
+    {&OPCODE_LOAD_VECTOR_SHL_info, nullptr, UNARY(LoadVectorShl), 0},
+    {&OPCODE_LOAD_VECTOR_SHR_info, nullptr, UNARY(LoadVectorShr), 0},
+    {&OPCODE_VECTOR_MAX_info, "i8", VECTOR(VectorMax, INT8_TYPE, 0), 0},
+    {&OPCODE_VECTOR_MAX_info, "i16", VECTOR(VectorMax, INT16_TYPE, 0), 0},
+    {&OPCODE_VECTOR_MAX_info, "i32", VECTOR(VectorMax, INT32_TYPE, 0), 0},
+    {&OPCODE_VECTOR_MIN_info, "i8", VECTOR(VectorMin, INT8_TYPE, 0), 0},
+    {&OPCODE_VECTOR_MIN_info, "i16", VECTOR(VectorMin, INT16_TYPE, 0), 0},
+    {&OPCODE_VECTOR_MIN_info, "i32", VECTOR(VectorMin, INT32_TYPE, 0), 0},
+    {&OPCODE_VECTOR_COMPARE_EQ_info, "i8",
+     VECTOR_NO_FLAGS(VectorCompareEQ, INT8_TYPE), 0},
+    {&OPCODE_VECTOR_COMPARE_EQ_info, "i32",
+     VECTOR_NO_FLAGS(VectorCompareEQ, INT32_TYPE), 0},
+    {&OPCODE_VECTOR_COMPARE_EQ_info, "f32",
+     VECTOR_NO_FLAGS(VectorCompareEQ, FLOAT32_TYPE), 0},
+    {&OPCODE_VECTOR_COMPARE_SGT_info, "i16",
+     VECTOR_NO_FLAGS(VectorCompareSGT, INT16_TYPE), 0},
+    {&OPCODE_VECTOR_COMPARE_SGT_info, "f32",
+     VECTOR_NO_FLAGS(VectorCompareSGT, FLOAT32_TYPE), 0},
+    {&OPCODE_VECTOR_COMPARE_SGE_info, "i16",
+     VECTOR_NO_FLAGS(VectorCompareSGE, INT16_TYPE), 0},
+    {&OPCODE_VECTOR_COMPARE_SGE_info, "f32",
+     VECTOR_NO_FLAGS(VectorCompareSGE, FLOAT32_TYPE), 0},
+    {&OPCODE_VECTOR_COMPARE_UGT_info, "i16",
+     VECTOR_NO_FLAGS(VectorCompareUGT, INT16_TYPE), 0},
+    {&OPCODE_VECTOR_COMPARE_UGE_info, "i16",
+     VECTOR_NO_FLAGS(VectorCompareUGE, INT16_TYPE), 0},
+    {&OPCODE_VECTOR_ADD_info, "i8", VECTOR(VectorAdd, INT8_TYPE, 0), 0},
+    {&OPCODE_VECTOR_ADD_info, "i16", VECTOR(VectorAdd, INT16_TYPE, 0), 0},
+    {&OPCODE_VECTOR_ADD_info, "i32", VECTOR(VectorAdd, INT32_TYPE, 0), 0},
+    {&OPCODE_VECTOR_ADD_info, "i32.sat",
+     VECTOR(VectorAdd, INT32_TYPE, ARITHMETIC_SATURATE), 0},
+    {&OPCODE_VECTOR_ADD_info, "f32", VECTOR(VectorAdd, FLOAT32_TYPE, 0), 0},
+    {&OPCODE_VECTOR_SUB_info, "i16", VECTOR(VectorSub, INT16_TYPE, 0), 0},
+    {&OPCODE_VECTOR_SUB_info, "i32.sat",
+     VECTOR(VectorSub, INT32_TYPE, ARITHMETIC_SATURATE), 0},
+    {&OPCODE_VECTOR_SUB_info, "f32", VECTOR(VectorSub, FLOAT32_TYPE, 0), 0},
+    {&OPCODE_VECTOR_SHL_info, "i8", VECTOR_NO_FLAGS(VectorShl, INT8_TYPE), 0},
+    {&OPCODE_VECTOR_SHL_info, "i16", VECTOR_NO_FLAGS(VectorShl, INT16_TYPE),
+     0},
+    {&OPCODE_VECTOR_SHL_info, "i32", VECTOR_NO_FLAGS(VectorShl, INT32_TYPE),
+     0},
+    {&OPCODE_VECTOR_SHR_info, "i8", VECTOR_NO_FLAGS(VectorShr, INT8_TYPE), 0},
+    {&OPCODE_VECTOR_SHR_info, "i16", VECTOR_NO_FLAGS(VectorShr, INT16_TYPE),
+     0},
+    {&OPCODE_VECTOR_SHR_info, "i32", VECTOR_NO_FLAGS(VectorShr, INT32_TYPE),
+     0},
+    {&OPCODE_VECTOR_SHA_info, "i8", VECTOR_NO_FLAGS(VectorSha, INT8_TYPE), 0},
+    {&OPCODE_VECTOR_SHA_info, "i16", VECTOR_NO_FLAGS(VectorSha, INT16_TYPE),
+     0},
+    {&OPCODE_VECTOR_SHA_info, "i32", VECTOR_NO_FLAGS(VectorSha, INT32_TYPE),
+     0},
+    {&OPCODE_VECTOR_ROTATE_LEFT_info, "i8",
+     VECTOR_NO_FLAGS(VectorRotateLeft, INT8_TYPE), 0},
+    {&OPCODE_VECTOR_ROTATE_LEFT_info, "i16",
+     VECTOR_NO_FLAGS(VectorRotateLeft, INT16_TYPE), 0},
+    {&OPCODE_VECTOR_ROTATE_LEFT_info, "i32",
+     VECTOR_NO_FLAGS(VectorRotateLeft, INT32_TYPE), 0},
+    {&OPCODE_VECTOR_AVERAGE_info, "u8",
+     VECTOR(VectorAverage, INT8_TYPE, ARITHMETIC_UNSIGNED), 0},
+    {&OPCODE_VECTOR_AVERAGE_info, "u16",
+     VECTOR(VectorAverage, INT16_TYPE, ARITHMETIC_UNSIGNED), 0},
+    {&OPCODE_VECTOR_AVERAGE_info, "i32",
+     VECTOR(VectorAverage, INT32_TYPE, 0), 0},
+    {&OPCODE_INSERT_info, nullptr,
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) {
+       return b.Insert(src[0], b.LoadConstantInt8(1), src[2]);
+     },
+     0},
+    {&OPCODE_EXTRACT_info, nullptr,
+     [](HIRBuilder& b, Value* const* src, TypeName dest_type, uint32_t) {
+       return b.Extract(src[0], uint8_t(1), dest_type);
+     },
+     0},
+    {&OPCODE_SPLAT_info, nullptr,
+     [](HIRBuilder& b, Value* const* src, TypeName dest_type, uint32_t) {
+       return b.Splat(src[0], dest_type);
+     },
+     0},
+    {&OPCODE_PERMUTE_info, "i8",
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) -> Value* {
+       // Word permutes take a constant control word instead.
+       if (src[0]->type != VEC128_TYPE) {
+         return nullptr;
+       }
+       return b.Permute(src[0], src[1], src[2], INT8_TYPE);
+     },
+     0},
+    {&OPCODE_PERMUTE_info, "i32",
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) {
+       return b.Permute(b.LoadConstantUint32(MakePermuteMask(0, 1, 1, 2, 0, 3,
+                                                             1, 0)),
+                        src[1], src[2], INT32_TYPE);
+     },
+     0},
+    {&OPCODE_SWIZZLE_info, nullptr,
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) {
+       return b.Swizzle(src[0], INT32_TYPE, SWIZZLE_XYZW_TO_YZWX);
+     },
+     0},
+    {&OPCODE_PACK_info, "d3dcolor",
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) {
+       return b.Pack(src[0], PACK_TYPE_D3DCOLOR);
+     },
+     0},
+    {&OPCODE_PACK_info, "float16_4",
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) {
+       return b.Pack(src[0], PACK_TYPE_FLOAT16_4);
+     },
+     0},
+    {&OPCODE_PACK_info, "16_in_32.sat",
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) {
+       return b.Pack(src[0], src[1],
+                     PACK_TYPE_16_IN_32 | PACK_TYPE_IN_SIGNED |
+                         PACK_TYPE_OUT_SIGNED | PACK_TYPE_OUT_SATURATE);
+     },
+     0},
+    {&OPCODE_UNPACK_info, "d3dcolor",
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) {
+       return b.Unpack(src[0], PACK_TYPE_D3DCOLOR);
+     },
+     0},
+    {&OPCODE_UNPACK_info, "float16_4",
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) {
+       return b.Unpack(src[0], PACK_TYPE_FLOAT16_4);
+     },
+     0},
+    {&OPCODE_UNPACK_info, "8_in_16",
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) {
+       return b.Unpack(src[0], PACK_TYPE_8_IN_16 | PACK_TYPE_TO_LO);
+     },
+     0},
+
+    // x64_sequences.cc
+    {&OPCODE_CAST_info, nullptr, CONVERT(Cast), 0},
+    {&OPCODE_ZERO_EXTEND_info, nullptr, CONVERT(ZeroExtend), 0},
+    {&OPCODE_SIGN_EXTEND_info, nullptr, CONVERT(SignExtend), 0},
+    {&OPCODE_TRUNCATE_info, nullptr, CONVERT(Truncate), 0},
+    {&OPCODE_CONVERT_info, "to_zero",
+     [](HIRBuilder& b, Value* const* src, TypeName dest_type, uint32_t) {
+       return b.Convert(src[0], dest_type, ROUND_TO_ZERO);
+     },
+     0},
+    {&OPCODE_CONVERT_info, "dynamic",
+     [](HIRBuilder& b, Value* const* src, TypeName dest_type, uint32_t) {
+       return b.Convert(src[0], dest_type, ROUND_DYNAMIC);
+     },
+     0},
+    {&OPCODE_ROUND_info, nullptr,
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) {
+       return b.Round(src[0], ROUND_TO_NEAREST);
+     },
+     0},
+    {&OPCODE_LOAD_CLOCK_info, nullptr,
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) {
+       return b.LoadClock();
+     },
+     0},
+    {&OPCODE_MAX_info, nullptr, BINARY(Max), 0},
+    {&OPCODE_MIN_info, nullptr, BINARY(Min), 0},
+    {&OPCODE_SELECT_info, nullptr,
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) {
+       return b.Select(src[0], src[1], src[2]);
+     },
+     0},
+    {&OPCODE_IS_TRUE_info, nullptr, UNARY(IsTrue), 0},
+    {&OPCODE_IS_FALSE_info, nullptr, UNARY(IsFalse), 0},
+    {&OPCODE_IS_NAN_info, nullptr, UNARY(IsNan), 0},
+    {&OPCODE_COMPARE_EQ_info, nullptr, BINARY(CompareEQ), 0},
+    {&OPCODE_COMPARE_NE_info, nullptr, BINARY(CompareNE), 0},
+    {&OPCODE_COMPARE_SLT_info, nullptr, BINARY(CompareSLT), 0},
+    {&OPCODE_COMPARE_SLE_info, nullptr, BINARY(CompareSLE), 0},
+    {&OPCODE_COMPARE_SGT_info, nullptr, BINARY(CompareSGT), 0},
+    {&OPCODE_COMPARE_SGE_info, nullptr, BINARY(CompareSGE), 0},
+    {&OPCODE_COMPARE_ULT_info, nullptr, BINARY(CompareULT), 0},
+    {&OPCODE_COMPARE_ULE_info, nullptr, BINARY(CompareULE), 0},
+    {&OPCODE_COMPARE_UGT_info, nullptr, BINARY(CompareUGT), 0},
+    {&OPCODE_COMPARE_UGE_info, nullptr, BINARY(CompareUGE), 0},
+    {&OPCODE_ADD_info, nullptr, BINARY(Add), 0},
+    {&OPCODE_ADD_CARRY_info, nullptr,
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) {
+       return b.AddWithCarry(src[0], src[1], src[2]);
+     },
+     0},
+    {&OPCODE_SUB_info, nullptr, BINARY(Sub), 0},
+    {&OPCODE_MUL_info, nullptr, BINARY(Mul), 0},
+    {&OPCODE_MUL_HI_info, "signed", BINARY(MulHi), 0},
+    {&OPCODE_MUL_HI_info, "unsigned",
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) {
+       return b.MulHi(src[0], src[1], ARITHMETIC_UNSIGNED);
+     },
+     0},
+    {&OPCODE_DIV_info, "signed", BINARY(Div), 0},
+    {&OPCODE_DIV_info, "unsigned",
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) {
+       return b.Div(src[0], src[1], ARITHMETIC_UNSIGNED);
+     },
+     0},
+    {&OPCODE_MUL_ADD_info, nullptr,
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) {
+       return b.MulAdd(src[0], src[1], src[2]);
+     },
+     0},
+    {&OPCODE_MUL_SUB_info, nullptr,
+     [](HIRBuilder& b, Value* const* src, TypeName, uint32_t) {
+       return b.MulSub(src[0], src[1], src[2]);
+     },
+     0},
+    {&OPCODE_NEG_info, nullptr, UNARY(Neg), 0},
+    {&OPCODE_ABS_info, nullptr, UNARY(Abs), 0},
+    {&OPCODE_SQRT_info, nullptr, UNARY(Sqrt), 0},
+    {&OPCODE_RSQRT_info, nullptr, UNARY(RSqrt), 0},
+    {&OPCODE_RECIP_info, nullptr, UNARY(Recip), 0},
+    {&OPCODE_POW2_info, nullptr, UNARY(Pow2), 0},
+    {&OPCODE_LOG2_info, nullptr, UNARY(Log2), 0},
+    {&OPCODE_DOT_PRODUCT_3_info, nullptr, BINARY(DotProduct3), 0},
+    {&OPCODE_DOT_PRODUCT_4_info, nullptr, BINARY(DotProduct4), 0},
+    {&OPCODE_AND_info, nullptr, BINARY(And), 0},
+    {&OPCODE_OR_info, nullptr, BINARY(Or), 0},
+    {&OPCODE_XOR_info, nullptr, BINARY(Xor), 0},
+    {&OPCODE_NOT_info, nullptr, UNARY(Not), 0},
+    {&OPCODE_SHL_info, nullptr, BINARY(Shl), 0},
+    {&OPCODE_SHR_info, nullptr, BINARY(Shr), 0},
+    {&OPCODE_SHA_info, nullptr, BINARY(Sha), 0},
+    {&OPCODE_ROTATE_LEFT_info, nullptr, BINARY(RotateLeft), 0},
+    {&OPCODE_BYTE_SWAP_info, nullptr, UNARY(ByteSwap), 0},
+    {&OPCODE_CNTLZ_info, nullptr, UNARY(CountLeadingZeros), 0},
+};
+
+#undef BINARY
+#undef UNARY
+#undef CONVERT
+#undef VECTOR
+#undef VECTOR_NO_FLAGS
+
+const char* KeyTypeName(uint32_t key_type) {
+  static const char* names[] = {
+      "",    "label", "offset", "symbol", "i8",
+      "i16", "i32",   "i64",    "f32",    "f64", "v128",
+  };
+  return key_type < xe::countof(names) ? names[key_type] : "?";
+}
+
+std::string GetBenchmarkName(const SequenceBenchmark& benchmark,
+                             const InstrKey& key) {
+  std::string name = benchmark.opcode->name;
+  if (benchmark.variant) {
+    name += ".";
+    name += benchmark.variant;
+  }
+  name += "(";
+  uint32_t src_keys[] = {key.src1, key.src2, key.src3};
+  for (size_t n = 0; n < xe::countof(src_keys) && src_keys[n]; ++n) {
+    name += n ? ", " : "";
+    name += KeyTypeName(src_keys[n]);
+  }
+  name += ")";
+  if (key.dest) {
+    name += " -> ";
+    name += KeyTypeName(key.dest);
+  }
+  return name;
+}
+
+// for (r3 = iterations; r3; --r3) { result[n] = op(sources) x unroll_count }
+// Sources are reloaded from the context each iteration after a barrier, so
+// nothing is hoisted out of the loop or constant folded. Returns false if
+// the builder did not produce the exact sequence being measured.
+bool GenerateLoop(HIRBuilder& b, const SequenceBenchmark& benchmark,
+                  const InstrKey& key, uint32_t unroll_count) {
+  bool matched = true;
+  auto loop = b.NewLabel();
+  b.MarkLabel(loop);
+  b.ContextBarrier();
+  Value* src[3] = {nullptr, nullptr, nullptr};
+  uint32_t src_keys[] = {key.src1, key.src2, key.src3};
+  for (uint32_t n = 0; n < xe::countof(src_keys); ++n) {
+    if (src_keys[n] >= KEY_TYPE_V_I8) {
+      src[n] = b.LoadContext(SlotOffset(kSourceSlot + n),
+                             TypeName(src_keys[n] - KEY_TYPE_V_I8));
+    }
+  }
+  auto dest_type =
+      key.dest >= KEY_TYPE_V_I8 ? TypeName(key.dest - KEY_TYPE_V_I8) : INT64_TYPE;
+  for (uint32_t n = 0; n < unroll_count; ++n) {
+    auto result = benchmark.emit(b, src, dest_type, n);
+    auto instr = b.last_instr();
+    if (!instr || InstrKey(instr).value != key.value) {
+      matched = false;
+    }
+    if (result) {
+      b.StoreContext(SlotOffset(kResultSlot + n), result);
+    }
+  }
+  auto count = b.Sub(LoadGPR(b, 3), b.LoadConstantUint64(1));
+  StoreGPR(b, 3, count);
+  b.BranchTrue(b.CompareNE(count, b.LoadZeroInt64()), loop);
+  b.Return();
+  return matched;
+}
+
+void InitializeSources(PPCContext* ctx, const SequenceBenchmark& benchmark,
+                       const InstrKey& key, uint32_t scratch_address) {
+  uint32_t src_keys[] = {key.src1, key.src2, key.src3};
+  for (uint32_t n = 0; n < xe::countof(src_keys); ++n) {
+    auto& slot = ctx->v[kSourceSlot + n];
+    std::memset(&slot, 0, sizeof(slot));
+    if (src_keys[n] < KEY_TYPE_V_I8) {
+      continue;
+    }
+    if (benchmark.address_sources & (1 << n)) {
+      slot.u64[0] = scratch_address;
+      continue;
+    }
+    // Small values keep shifts, divides and offsets in range and floats away
+    // from denormals.
+    switch (TypeName(src_keys[n] - KEY_TYPE_V_I8)) {
+      case INT8_TYPE:
+      case INT16_TYPE:
+      case INT32_TYPE:
+      case INT64_TYPE:
+        slot.u64[0] = 3;
+        break;
+      case FLOAT32_TYPE:
+        slot.f32[0] = 1.5f;
+        break;
+      case FLOAT64_TYPE:
+        slot.f64[0] = 1.5;
+        break;
+      case VEC128_TYPE:
+        slot = vec128f(1.5f, 2.5f, 3.5f, 4.5f);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+struct SequenceResult {
+  // False if the entry doesn't produce this key, e.g. a vector part type the
+  // sequence doesn't take.
+  bool applicable = true;
+  double seconds = 0;
+  size_t code_size = 0;
+};
+
+bool RunLoop(const SequenceBenchmark& benchmark, const InstrKey& key,
+             uint32_t unroll_count, SequenceResult* out_result) {
+  bool matched = false;
+  TestFunction test([&](HIRBuilder& b) {
+    matched = GenerateLoop(b, benchmark, key, unroll_count);
+  });
+  auto processor = test.processors.front().get();
+  auto function = processor->ResolveFunction(0x80000000);
+  if (!matched) {
+    out_result->applicable = false;
+    return false;
+  }
+  if (!function) {
+    return false;
+  }
+  out_result->code_size =
+      static_cast<GuestFunction*>(function)->machine_code_length();
+
+  uint32_t scratch_address = test.memory->SystemHeapAlloc(kScratchSize);
+  auto thread_state = std::make_unique<ThreadState>(processor, 0x100);
+  auto ctx = thread_state->context();
+  InitializeSources(ctx, benchmark, key, scratch_address);
+  ctx->r[3] = kWarmupIterations;
+  processor->Execute(thread_state.get(), 0x80000000);
+
+  InitializeSources(ctx, benchmark, key, scratch_address);
+  ctx->r[3] = uint32_t(FLAGS_sequence_iterations);
+  uint64_t start_ticks = Clock::QueryHostTickCount();
+  processor->Execute(thread_state.get(), 0x80000000);
+  out_result->seconds = double(Clock::QueryHostTickCount() - start_ticks) /
+                        Clock::host_tick_frequency();
+
+  thread_state.reset();
+  test.memory->SystemHeapFree(scratch_address);
+  return true;
+}
+
+int main(const std::vector<std::wstring>& args) {
+  if (FLAGS_sequence_iterations <= 0) {
+    XELOGE("--sequence_iterations must be positive");
+    return 1;
+  }
+
+  // Sorted so runs can be diffed.
+  std::vector<InstrKey> keys;
+  for (auto& it : backend::x64::sequence_table) {
+    keys.push_back(InstrKey(it.first));
+  }
+  std::sort(keys.begin(), keys.end(), [](const InstrKey& a, const InstrKey& b) {
+    return a.value < b.value;
+  });
+
+  FILE* results_file = nullptr;
+  if (!FLAGS_sequence_results_path.empty()) {
+    auto path = xe::to_wstring(FLAGS_sequence_results_path);
+    results_file = xe::filesystem::OpenFile(path, "w");
+    if (!results_file) {
+      XELOGE("Unable to open %s for writing",
+             FLAGS_sequence_results_path.c_str());
+      return 1;
+    }
+    fprintf(results_file, "sequence,ns_per_op,bytes_per_op\n");
+  }
+
+  uint32_t run_count = 0;
+  uint32_t failed_count = 0;
+  std::vector<std::string> unbenchmarked;
+  for (auto& key : keys) {
+    bool found = false;
+    for (auto& benchmark : kSequenceBenchmarks) {
+      if (benchmark.opcode->num != key.opcode) {
+        continue;
+      }
+      found = true;
+      auto name = GetBenchmarkName(benchmark, key);
+      if (name.find(FLAGS_sequence_filter) == std::string::npos) {
+        continue;
+      }
+      SequenceResult single;
+      SequenceResult unrolled;
+      if (!RunLoop(benchmark, key, 1, &single) ||
+          !RunLoop(benchmark, key, kUnrollCount, &unrolled)) {
+        if (single.applicable && unrolled.applicable) {
+          XELOGE("%-48s failed to compile", name.c_str());
+          ++failed_count;
+        }
+        continue;
+      }
+      ++run_count;
+      double op_count = double(FLAGS_sequence_iterations) * (kUnrollCount - 1);
+      double ns_per_op =
+          std::max(0.0, (unrolled.seconds - single.seconds) * 1e9 / op_count);
+      double bytes_per_op =
+          (double(unrolled.code_size) - double(single.code_size)) /
+          (kUnrollCount - 1);
+      XELOGI("%-48s %8.3f ns/op %7.1f bytes", name.c_str(), ns_per_op,
+             bytes_per_op);
+      if (results_file) {
+        fprintf(results_file, "\"%s\",%.3f,%.1f\n", name.c_str(), ns_per_op,
+                bytes_per_op);
+      }
+    }
+    // Only ops the loop can run are worth reporting.
+    auto opcode = kOpcodeInfos[key.opcode];
+    if (!found && !(opcode->flags & kUnbenchmarkedFlags)) {
+      unbenchmarked.push_back(GetBenchmarkName({opcode, nullptr}, key));
+    }
+  }
+  if (results_file) {
+    fclose(results_file);
+  }
+  XELOGI("Ran %u sequences, %u failed", run_count, failed_count);
+  for (auto& name : unbenchmarked) {
+    XELOGI("  No benchmark for %s", name.c_str());
+  }
+  return failed_count ? 1 : 0;
+}
+
+}  // namespace benchmark
+}  // namespace testing
+}  // namespace cpu
+}  // namespace xe
+
+DEFINE_ENTRY_POINT(L"xenia-cpu-sequence-benchmark",
+                   L"xenia-cpu-sequence-benchmark [--flags]",
+                   xe::cpu::testing::benchmark::main);
@@ -0,0 +1,295 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2013 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/source_map.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include "xenia/cpu/function.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+using namespace xe::cpu;
+
+namespace {
+
+// Builds a map shaped like emitter output: guest addresses mostly ascending
+// with some blocks placed out of order, a new HIR block every few
+// instructions, and a variable amount of code per instruction (sometimes
+// none).
+std::vector<SourceMapEntry> GenerateEntries(uint32_t count,
+                                            uint32_t guest_stride = 4) {
+  std::vector<SourceMapEntry> entries;
+  uint32_t guest_address = 0x82000000;
+  uint32_t block = 0;
+  uint32_t instr = 0;
+  uint32_t code_offset = 0x20;
+  for (uint32_t i = 0; i < count; ++i) {
+    entries.push_back({guest_address, (block << 16) | instr, code_offset});
+    guest_address += guest_stride;
+    instr += 1 + (i % 3);
+    code_offset += (i * 7) % 23;
+    if (i % 11 == 10) {
+      ++block;
+      instr = 0;
+      if (block % 5 == 0) {
+        // Jump back as if a later block was emitted first.
+        guest_address -= guest_stride * 20;
+      }
+    }
+  }
+  return entries;
+}
+
+const SourceMapEntry* LinearLookupGuestAddress(
+    const std::vector<SourceMapEntry>& entries, uint32_t guest_address) {
+  for (auto& entry : entries) {
+    if (entry.guest_address == guest_address) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+const SourceMapEntry* LinearLookupHIROffset(
+    const std::vector<SourceMapEntry>& entries, uint32_t offset) {
+  for (auto& entry : entries) {
+    if (entry.hir_offset >= offset) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+const SourceMapEntry* LinearLookupMachineCodeOffset(
+    const std::vector<SourceMapEntry>& entries, uint32_t offset) {
+  for (int64_t i = entries.size() - 1; i >= 0; --i) {
+    if (entries[i].code_offset <= offset) {
+      return &entries[i];
+    }
+  }
+  return entries.empty() ? nullptr : &entries[0];
+}
+
+bool EntriesEqual(const SourceMapEntry& a, const SourceMapEntry& b) {
+  return a.guest_address == b.guest_address && a.hir_offset == b.hir_offset &&
+         a.code_offset == b.code_offset;
+}
+
+void VerifyAgainstLinear(const std::vector<SourceMapEntry>& entries) {
+  SourceMap source_map;
+  source_map.Assign(entries);
+  REQUIRE(source_map.size() == entries.size());
+
+  std::vector<SourceMapEntry> decoded;
+  source_map.Decode(&decoded);
+  REQUIRE(decoded.size() == entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    REQUIRE(EntriesEqual(decoded[i], entries[i]));
+    REQUIRE(EntriesEqual(source_map.Get(i), entries[i]));
+  }
+
+  // Probe a bounded sample so large maps don't take forever to check.
+  SourceMapEntry entry;
+  size_t stride = std::max(size_t(1), entries.size() / 1000);
+  for (size_t i = 0; i < entries.size(); i += stride) {
+    for (int32_t delta = -4; delta <= 4; delta += 2) {
+      uint32_t address = entries[i].guest_address + delta;
+      auto expected = LinearLookupGuestAddress(entries, address);
+      REQUIRE(source_map.LookupGuestAddress(address, &entry) == !!expected);
+      if (expected) {
+        REQUIRE(EntriesEqual(entry, *expected));
+      }
+    }
+  }
+  uint32_t max_hir = entries.empty() ? 0 : entries.back().hir_offset;
+  for (uint32_t offset = 0; offset <= max_hir + 1;
+       offset += std::max(1u, max_hir / 3000)) {
+    auto expected = LinearLookupHIROffset(entries, offset);
+    REQUIRE(source_map.LookupHIROffset(offset, &entry) == !!expected);
+    if (expected) {
+      REQUIRE(EntriesEqual(entry, *expected));
+    }
+  }
+  uint32_t max_code = entries.empty() ? 0 : entries.back().code_offset;
+  for (uint32_t offset = 0; offset <= max_code + 16;
+       offset += std::max(1u, max_code / 3000)) {
+    auto expected = LinearLookupMachineCodeOffset(entries, offset);
+    REQUIRE(source_map.LookupMachineCodeOffset(offset, &entry) == !!expected);
+    if (expected) {
+      REQUIRE(EntriesEqual(entry, *expected));
+    }
+  }
+}
+
+}  // namespace
+
+TEST_CASE("SOURCE_MAP_EMPTY", "[source_map]") {
+  SourceMap source_map;
+  source_map.Assign(std::vector<SourceMapEntry>());
+  SourceMapEntry entry;
+  REQUIRE(source_map.empty());
+  REQUIRE(!source_map.LookupGuestAddress(0x82000000, &entry));
+  REQUIRE(!source_map.LookupHIROffset(0, &entry));
+  REQUIRE(!source_map.LookupMachineCodeOffset(0, &entry));
+}
+
+TEST_CASE("SOURCE_MAP_LOOKUPS", "[source_map]") {
+  VerifyAgainstLinear(GenerateEntries(1));
+  VerifyAgainstLinear(GenerateEntries(SourceMap::kCheckpointInterval));
+  VerifyAgainstLinear(GenerateEntries(SourceMap::kCheckpointInterval + 1));
+  VerifyAgainstLinear(GenerateEntries(1000));
+}
+
+TEST_CASE("SOURCE_MAP_WIDE_GUEST_INDEX", "[source_map]") {
+  // Too spread out for the packed guest index.
+  VerifyAgainstLinear(GenerateEntries(100, 0x1000));
+  // Too many entries for the packed guest index.
+  VerifyAgainstLinear(GenerateEntries(0x10010));
+}
+
+TEST_CASE("SOURCE_MAP_MOVE", "[source_map]") {
+  auto entries = GenerateEntries(100);
+  SourceMap a;
+  a.Assign(entries);
+  SourceMap b(std::move(a));
+  REQUIRE(a.empty());
+  REQUIRE(b.size() == entries.size());
+  SourceMapEntry entry;
+  REQUIRE(b.LookupGuestAddress(entries[50].guest_address, &entry));
+  REQUIRE(EntriesEqual(entry, entries[50]));
+}
+
+namespace {
+
+// Machine code that is never run, only mapped.
+class MappedFunction : public GuestFunction {
+ public:
+  explicit MappedFunction(uint32_t address) : GuestFunction(nullptr, address) {}
+  uint8_t* machine_code() const override {
+    return const_cast<uint8_t*>(code_);
+  }
+  size_t machine_code_length() const override { return sizeof(code_); }
+  uintptr_t host(uint32_t code_offset) const {
+    return reinterpret_cast<uintptr_t>(code_) + code_offset;
+  }
+
+ protected:
+  bool CallImpl(ThreadState* thread_state, uint32_t return_address) override {
+    return false;
+  }
+
+ private:
+  uint8_t code_[0x80] = {};
+};
+
+}  // namespace
+
+TEST_CASE("SOURCE_MAP_INLINED_RANGES", "[source_map]") {
+  MappedFunction function(0x82000000);
+  function.source_map().Assign(std::vector<SourceMapEntry>{
+      {0x82000000, 0x00000, 0x10},
+      {0x82000004, 0x00002, 0x20},
+      {0x82000008, 0x00004, 0x30},
+  });
+  // Two copies of the same callee back to back, then the epilog.
+  function.SetInlinedCode({{0x83000000, 0x40, 0x60}, {0x83000000, 0x60, 0x70}},
+                          {
+                              {0x83000000, 0x10000, 0x40},
+                              {0x83000004, 0x10002, 0x50},
+                              {0x83000000, 0x20000, 0x60},
+                              {0x83000004, 0x20002, 0x68},
+                          });
+
+  // Host addresses in inlined code map to the callee.
+  REQUIRE(function.MapMachineCodeToGuestAddress(function.host(0x24)) ==
+          0x82000004);
+  REQUIRE(function.MapMachineCodeToGuestAddress(function.host(0x44)) ==
+          0x83000000);
+  REQUIRE(function.MapMachineCodeToGuestAddress(function.host(0x5F)) ==
+          0x83000004);
+  REQUIRE(function.MapMachineCodeToGuestAddress(function.host(0x60)) ==
+          0x83000000);
+  REQUIRE(function.MapMachineCodeToGuestAddress(function.host(0x70)) ==
+          0x82000008);
+  REQUIRE(function.MapMachineCodeToInlinedFunction(function.host(0x3F)) == 0);
+  REQUIRE(function.MapMachineCodeToInlinedFunction(function.host(0x40)) ==
+          0x83000000);
+  REQUIRE(function.MapMachineCodeToInlinedFunction(function.host(0x6F)) ==
+          0x83000000);
+  REQUIRE(function.MapMachineCodeToInlinedFunction(function.host(0x70)) == 0);
+
+  // Guest addresses only ever find the function's own code.
+  SourceMapEntry entry;
+  REQUIRE(function.LookupGuestAddress(0x82000004, &entry));
+  REQUIRE(entry.code_offset == 0x20);
+  REQUIRE(!function.LookupGuestAddress(0x83000004, &entry));
+}
+
+TEST_CASE("SOURCE_MAP_MEMORY", "[source_map]") {
+  auto entries = GenerateEntries(10000);
+  SourceMap source_map;
+  source_map.Assign(entries);
+  REQUIRE(source_map.memory_usage() <
+          entries.size() * sizeof(SourceMapEntry) * 3 / 4);
+}
+
+// Lookup throughput on a very large function, compared against the linear
+// scans the map replaced. Run explicitly with [benchmark].
+TEST_CASE("SOURCE_MAP_BENCHMARK", "[source_map][benchmark][.]") {
+  const uint32_t kEntryCount = 50000;
+  const uint32_t kLookupCount = 20000;
+  auto entries = GenerateEntries(kEntryCount);
+  SourceMap source_map;
+  source_map.Assign(entries);
+
+  auto time = [](const char* name, std::function<void()> fn) {
+    auto start = std::chrono::high_resolution_clock::now();
+    fn();
+    auto end = std::chrono::high_resolution_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(end - start).count();
+    WARN(name << ": " << ms << "ms");
+  };
+
+  uint32_t max_code = entries.back().code_offset;
+  volatile uint32_t sink = 0;
+  SourceMapEntry entry;
+  time("linear guest lookup", [&]() {
+    for (uint32_t i = 0; i < kLookupCount; ++i) {
+      auto result = LinearLookupGuestAddress(
+          entries, entries[(i * 7919) % kEntryCount].guest_address);
+      sink += result->code_offset;
+    }
+  });
+  time("indexed guest lookup", [&]() {
+    for (uint32_t i = 0; i < kLookupCount; ++i) {
+      source_map.LookupGuestAddress(
+          entries[(i * 7919) % kEntryCount].guest_address, &entry);
+      sink += entry.code_offset;
+    }
+  });
+  time("linear code lookup", [&]() {
+    for (uint32_t i = 0; i < kLookupCount; ++i) {
+      auto result =
+          LinearLookupMachineCodeOffset(entries, (i * 7919) % max_code);
+      sink += result->guest_address;
+    }
+  });
+  time("indexed code lookup", [&]() {
+    for (uint32_t i = 0; i < kLookupCount; ++i) {
+      source_map.LookupMachineCodeOffset((i * 7919) % max_code, &entry);
+      sink += entry.guest_address;
+    }
+  });
+  WARN("memory: " << entries.size() * sizeof(SourceMapEntry) << "b vector, "
+                  << source_map.memory_usage() << "b encoded");
+}
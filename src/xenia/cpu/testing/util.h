@@ -32,7 +32,9 @@ using xe::cpu::ppc::PPCContext;
 
 class TestFunction {
  public:
-  TestFunction(std::function<void(hir::HIRBuilder& b)> generator) {
+  // inspect, if given, sees the HIR after the compiler passes have run.
+  TestFunction(std::function<void(hir::HIRBuilder& b)> generator,
+               std::function<void(hir::HIRBuilder& b)> inspect = nullptr) {
     memory_size = 16 * 1024 * 1024;
     memory.reset(new Memory());
     memory->Initialize();
@@ -53,7 +55,8 @@ class TestFunction {
           [generator](hir::HIRBuilder& b) {
             generator(b);
             return true;
-          });
+          },
+          inspect);
       processor->AddModule(std::move(module));
       processor->backend()->CommitExecutableRange(0x80000000, 0x80010000);
     }
@@ -35,7 +35,6 @@ ThreadState::ThreadState(Processor* processor, uint32_t thread_id,
     uint32_t system_thread_handle = xe::threading::current_thread_system_id();
     thread_id_ = 0x80000000 | system_thread_handle;
   }
-  backend_data_ = processor->backend()->AllocThreadData();
 
   // Allocate with 64b alignment.
   context_ = memory::AlignedAlloc<ppc::PPCContext>(64);
@@ -53,6 +52,8 @@ ThreadState::ThreadState(Processor* processor, uint32_t thread_id,
   // Set initial registers.
   context_->r[1] = stack_base;
   context_->r[13] = pcr_address;
+
+  backend_data_ = processor->backend()->AllocThreadData(this);
 }
 
 ThreadState::~ThreadState() {
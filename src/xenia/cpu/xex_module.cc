@@ -26,6 +26,7 @@
 #include "third_party/crypto/rijndael-alg-fst.c"
 #include "third_party/crypto/rijndael-alg-fst.h"
 #include "third_party/pe/pe_image.h"
+#include "third_party/xxhash/xxhash.h"
 
 static const uint8_t xe_xex2_retail_key[16] = {
     0x20, 0xB1, 0x85, 0xA5, 0x9D, 0x28, 0xFD, 0xC3,
@@ -1035,6 +1036,24 @@ bool XexModule::LoadContinue() {
     page += desc.page_count;
   }
 
+  // Identify the code so previously generated machine code can be reused.
+  if (high_address_ > low_address_) {
+    image_hash_ = XXH64(memory()->TranslateVirtual(low_address_),
+                        high_address_ - low_address_, 0);
+    processor_->backend()->LoadCachedCode(this);
+  }
+
+  // Queue up everything we can find for ahead-of-time compilation. Functions
+  // only reachable from these are found as they are scanned.
+  std::vector<uint32_t> function_addresses;
+  uint32_t entry_point = 0;
+  GetOptHeader(XEX_HEADER_ENTRY_POINT, &entry_point);
+  if (entry_point) {
+    function_addresses.push_back(entry_point);
+  }
+  FindPDataFunctions(&function_addresses);
+  processor_->PrecompileFunctions(function_addresses);
+
   return true;
 }
 
@@ -1044,6 +1063,14 @@ bool XexModule::Unload() {
   }
   loaded_ = false;
 
+  // Nothing should be running in the module anymore, so drop its functions
+  // and the code generated for them.
+  uint32_t low_address = low_address_;
+  uint32_t high_address = high_address_;
+  low_address_ = 0;
+  high_address_ = 0;
+  processor_->OnModuleUnloaded(this, low_address, high_address);
+
   // If this isn't a patch, just deallocate the memory occupied by the exe
   if (!is_patch()) {
     assert_not_zero(base_address_);
@@ -1059,12 +1086,14 @@ bool XexModule::Unload() {
 bool XexModule::SetupLibraryImports(const char* name,
                                     const xex2_import_library* library) {
   ExportResolver* kernel_resolver = nullptr;
-  if (kernel_state_->IsKernelModule(name)) {
-    kernel_resolver = processor_->export_resolver();
+  kernel::object_ref<kernel::XModule> user_module;
+  if (kernel_state_) {
+    if (kernel_state_->IsKernelModule(name)) {
+      kernel_resolver = processor_->export_resolver();
+    }
+    user_module = kernel_state_->GetModule(name);
   }
 
-  auto user_module = kernel_state_->GetModule(name);
-
   std::string libbasename = name;
   auto dot = libbasename.find_last_of('.');
   if (dot != libbasename.npos) {
@@ -1241,6 +1270,17 @@ bool XexModule::ContainsAddress(uint32_t address) {
   return address >= low_address_ && address < high_address_;
 }
 
+bool XexModule::GetAddressRange(uint32_t* out_low_address,
+                                uint32_t* out_high_address) {
+  if (high_address_ <= low_address_) {
+    // Not yet loaded.
+    return false;
+  }
+  *out_low_address = low_address_;
+  *out_high_address = high_address_;
+  return true;
+}
+
 std::unique_ptr<Function> XexModule::CreateFunction(uint32_t address) {
   return std::unique_ptr<Function>(
       processor_->backend()->CreateGuestFunction(this, address));
@@ -1567,5 +1607,35 @@ bool XexModule::FindSaveRest() {
   return true;
 }
 
+void XexModule::FindPDataFunctions(std::vector<uint32_t>* out_addresses) {
+  // The .pdata section holds the unwind table, with an entry for (nearly)
+  // every function in the image.
+  // http://msdn.microsoft.com/en-us/library/ms253988(v=vs.90).aspx
+  struct IMAGE_CE_RUNTIME_FUNCTION {
+    xe::be<uint32_t> begin_address;
+    // PrologLength : 8, FunctionLength : 22, ThirtyTwoBit : 1,
+    // ExceptionFlag : 1
+    xe::be<uint32_t> data;
+  };
+  static_assert_size(IMAGE_CE_RUNTIME_FUNCTION, 8);
+
+  auto pdata = GetPESection(".pdata");
+  if (!pdata) {
+    return;
+  }
+  auto entries = memory()->TranslateVirtual<IMAGE_CE_RUNTIME_FUNCTION*>(
+      pdata->address);
+  size_t entry_count = pdata->size / sizeof(IMAGE_CE_RUNTIME_FUNCTION);
+  out_addresses->reserve(out_addresses->size() + entry_count);
+  for (size_t i = 0; i < entry_count; ++i) {
+    uint32_t address = entries[i].begin_address;
+    uint32_t function_length = (entries[i].data >> 8) & 0x3FFFFF;
+    if (!address || !function_length || !ContainsAddress(address)) {
+      continue;
+    }
+    out_addresses->push_back(address);
+  }
+}
+
 }  // namespace cpu
 }  // namespace xe
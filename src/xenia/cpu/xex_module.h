@@ -44,6 +44,8 @@ class XexModule : public xe::cpu::Module {
     std::vector<ImportLibraryFn> imports;
   };
 
+  // The kernel state may be null when only the code is of interest (such as
+  // in tools), in which case imports are left unresolved.
   XexModule(Processor* processor, kernel::KernelState* kernel_state);
   virtual ~XexModule();
 
@@ -126,8 +128,11 @@ class XexModule : public xe::cpu::Module {
   bool Unload();
 
   bool ContainsAddress(uint32_t address) override;
+  bool GetAddressRange(uint32_t* out_low_address,
+                       uint32_t* out_high_address) override;
 
   const std::string& name() const override { return name_; }
+  uint64_t image_hash() const override { return image_hash_; }
   bool is_executable() const override {
     return (xex_header()->module_flags & XEX_MODULE_TITLE) != 0;
   }
@@ -165,6 +170,7 @@ class XexModule : public xe::cpu::Module {
   bool SetupLibraryImports(const char* name,
                            const xex2_import_library* library);
   bool FindSaveRest();
+  void FindPDataFunctions(std::vector<uint32_t>* out_addresses);
 
   Processor* processor_ = nullptr;
   kernel::KernelState* kernel_state_ = nullptr;
@@ -186,6 +192,7 @@ class XexModule : public xe::cpu::Module {
   uint32_t base_address_ = 0;
   uint32_t low_address_ = 0;
   uint32_t high_address_ = 0;
+  uint64_t image_hash_ = 0;
 };
 
 }  // namespace cpu
@@ -451,7 +451,8 @@ void DebugWindow::DrawGuestFunctionSource() {
   //     if historical data for memory/etc present, show combo boxes
   auto memory = emulator_->memory();
   auto function = static_cast<cpu::GuestFunction*>(state_.function);
-  auto& source_map = function->source_map();
+  std::vector<cpu::SourceMapEntry> source_map;
+  function->source_map().Decode(&source_map);
   uint32_t source_map_index = 0;
 
   bool draw_hir = false;
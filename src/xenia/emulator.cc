@@ -378,10 +378,15 @@ void Emulator::Resume() {
 bool Emulator::SaveToFile(const std::wstring& path) {
   Pause();
 
+  // Guest memory dominates the state; the rest (threads, kernel objects, GPU
+  // registers) gets a fixed allowance. The file is truncated to what is
+  // actually written.
+  size_t map_size = 256ull * 1024ull * 1024ull + memory_->GetSaveSizeBound();
   filesystem::CreateFile(path);
-  auto map = MappedMemory::Open(path, MappedMemory::Mode::kReadWrite, 0,
-                                1024ull * 1024ull * 1024ull * 2ull);
+  auto map =
+      MappedMemory::Open(path, MappedMemory::Mode::kReadWrite, 0, map_size);
   if (!map) {
+    Resume();
     return false;
   }
 
@@ -396,11 +401,14 @@ bool Emulator::SaveToFile(const std::wstring& path) {
   graphics_system_->Save(&stream);
   audio_system_->Save(&stream);
   kernel_state_->Save(&stream);
-  memory_->Save(&stream);
+  bool result = memory_->Save(&stream);
   map->Close(stream.offset());
 
   Resume();
-  return true;
+  if (!result) {
+    XELOGE("Could not save memory!");
+  }
+  return result;
 }
 
 bool Emulator::RestoreFromFile(const std::wstring& path) {
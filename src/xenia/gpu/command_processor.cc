@@ -359,6 +359,9 @@ void CommandProcessor::MakeCoherent() {
     return;
   }
 
+  // Guest writes made before the request must be visible from here on.
+  memory_->SyncPhysicalAccessWatches();
+
   const char* action = "N/A";
   if ((status_host & 0x03000000) == 0x03000000) {
     action = "VC | TC";
@@ -389,6 +392,9 @@ void CommandProcessor::IssueSwap(uint32_t frontbuffer_ptr,
     return;
   }
 
+  // Frames are the other point where writes from the CPU are picked up.
+  memory_->SyncPhysicalAccessWatches();
+
   // If there was a swap pending we drop it on the floor.
   // This prevents the display from pulling the backbuffer out from under us.
   // If we skip a lot then we may need to buffer more, but as the display
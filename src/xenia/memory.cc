@@ -12,8 +12,12 @@
 #include <gflags/gflags.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cinttypes>
 #include <cstring>
 
+#include "third_party/snappy/snappy.h"
+
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
@@ -37,6 +41,55 @@ uint32_t get_page_count(uint32_t value, uint32_t page_size) {
   return xe::round_up(value, page_size) / page_size;
 }
 
+// Guest memory covered by one save state chunk, at most.
+const uint32_t kSaveChunkSize = 256 * 1024;
+const uint32_t kSaveStateMagic = 'XMEM';
+const uint32_t kSaveStateVersion = 1;
+
+enum SaveChunkFormat : uint32_t {
+  // All zeros, no data stored.
+  kSaveChunkZero = 0,
+  kSaveChunkRaw = 1,
+  kSaveChunkSnappy = 2,
+};
+
+// Runs fn(0) through fn(count - 1) on the calling thread and one worker per
+// additional logical processor.
+static void ParallelFor(size_t count, const std::function<void(size_t)>& fn) {
+  std::atomic<size_t> next_index(0);
+  auto worker_main = [&]() {
+    for (size_t i = next_index++; i < count; i = next_index++) {
+      fn(i);
+    }
+  };
+  std::vector<std::unique_ptr<xe::threading::Thread>> workers;
+  size_t worker_count =
+      std::min(count, size_t(xe::threading::logical_processor_count()));
+  for (size_t i = 1; i < worker_count; ++i) {
+    xe::threading::Thread::CreationParameters params;
+    auto worker = xe::threading::Thread::Create(params, worker_main);
+    if (!worker) {
+      // Whatever is left runs on the threads we have.
+      break;
+    }
+    workers.push_back(std::move(worker));
+  }
+  worker_main();
+  for (auto& worker : workers) {
+    xe::threading::Wait(worker.get(), false);
+  }
+}
+
+static bool IsZeroMemory(const uint8_t* data, size_t length) {
+  auto words = reinterpret_cast<const uint64_t*>(data);
+  for (size_t i = 0; i < length / sizeof(uint64_t); ++i) {
+    if (words[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
 /**
  * Memory map:
  * 0x00000000 - 0x3FFFFFFF (1024mb) - virtual 4k pages
@@ -409,6 +462,10 @@ void Memory::CancelAccessWatch(uintptr_t watch_handle) {
   mmio_handler_->CancelAccessWatch(watch_handle);
 }
 
+void Memory::SyncPhysicalAccessWatches() {
+  mmio_handler_->SyncDirtyWatches();
+}
+
 uint32_t Memory::SystemHeapAlloc(uint32_t size, uint32_t alignment,
                                  uint32_t system_heap_flags) {
   // TODO(benvanik): lightweight pool.
@@ -464,26 +521,45 @@ void Memory::DumpMap() {
 
 bool Memory::Save(ByteStream* stream) {
   XELOGD("Serializing memory...");
-  heaps_.v00000000.Save(stream);
-  heaps_.v40000000.Save(stream);
-  heaps_.v80000000.Save(stream);
-  heaps_.v90000000.Save(stream);
-  heaps_.physical.Save(stream);
-
-  return true;
+  stream->Write(kSaveStateMagic);
+  stream->Write(kSaveStateVersion);
+  // Physical memory may be protected by access watches, which must neither
+  // fault on the save threads nor fire for it.
+  bool result = false;
+  mmio_handler_->ReadWatchedMemory([this, stream, &result]() {
+    result = heaps_.v00000000.Save(stream) && heaps_.v40000000.Save(stream) &&
+             heaps_.v80000000.Save(stream) && heaps_.v90000000.Save(stream) &&
+             heaps_.physical.Save(stream);
+  });
+  return result;
 }
 
 bool Memory::Restore(ByteStream* stream) {
   XELOGD("Restoring memory...");
-  heaps_.v00000000.Restore(stream);
-  heaps_.v40000000.Restore(stream);
-  heaps_.v80000000.Restore(stream);
-  heaps_.v90000000.Restore(stream);
-  heaps_.physical.Restore(stream);
+  if (stream->Read<uint32_t>() != kSaveStateMagic ||
+      stream->Read<uint32_t>() != kSaveStateVersion) {
+    XELOGE("Memory::Restore: unsupported save state format");
+    return false;
+  }
+  if (!heaps_.v00000000.Restore(stream) ||
+      !heaps_.v40000000.Restore(stream) ||
+      !heaps_.v80000000.Restore(stream) ||
+      !heaps_.v90000000.Restore(stream) || !heaps_.physical.Restore(stream)) {
+    return false;
+  }
 
   return true;
 }
 
+size_t Memory::GetSaveSizeBound() {
+  return sizeof(kSaveStateMagic) + sizeof(kSaveStateVersion) +
+         heaps_.v00000000.GetSaveSizeBound() +
+         heaps_.v40000000.GetSaveSizeBound() +
+         heaps_.v80000000.GetSaveSizeBound() +
+         heaps_.v90000000.GetSaveSizeBound() +
+         heaps_.physical.GetSaveSizeBound();
+}
+
 xe::memory::PageAccess ToPageAccess(uint32_t protect) {
   if ((protect & kMemoryProtectRead) && !(protect & kMemoryProtectWrite)) {
     return xe::memory::PageAccess::kReadOnly;
@@ -524,6 +600,7 @@ void BaseHeap::Initialize(uint8_t* membase, uint32_t heap_base,
   heap_size_ = heap_size - 1;
   page_size_ = page_size;
   page_table_.resize(heap_size / page_size);
+  free_pages_.Reset(uint32_t(page_table_.size()));
 }
 
 void BaseHeap::Dispose() {
@@ -591,98 +668,270 @@ uint32_t BaseHeap::GetTotalPageCount() { return uint32_t(page_table_.size()); }
 
 uint32_t BaseHeap::GetUnreservedPageCount() {
   auto global_lock = global_critical_region_.Acquire();
-  uint32_t count = 0;
-  bool is_empty_span = false;
-  uint32_t empty_span_start = 0;
-  uint32_t size = uint32_t(page_table_.size());
-  for (uint32_t i = 0; i < size; ++i) {
-    auto& page = page_table_[i];
-    if (!page.state) {
-      if (!is_empty_span) {
-        is_empty_span = true;
-        empty_span_start = i;
-      }
+  return free_pages_.free_count();
+}
+
+void BaseHeap::GetSaveChunks(std::vector<SaveChunk>* chunks) {
+  uint32_t chunk_page_count = std::max(1u, kSaveChunkSize / page_size_);
+  uint32_t page_count = uint32_t(page_table_.size());
+  uint32_t page_number = 0;
+  while (page_number < page_count) {
+    if (!(page_table_[page_number].state & kMemoryAllocationCommit)) {
+      ++page_number;
       continue;
     }
-    if (is_empty_span) {
-      is_empty_span = false;
-      count += i - empty_span_start;
+    SaveChunk chunk = {};
+    chunk.page_number = page_number;
+    while (page_number < page_count && chunk.page_count < chunk_page_count &&
+           (page_table_[page_number].state & kMemoryAllocationCommit)) {
+      ++chunk.page_count;
+      ++page_number;
     }
-    i += page.region_page_count - 1;
-  }
-  if (is_empty_span) {
-    count += size - empty_span_start;
+    chunks->push_back(chunk);
   }
-  return count;
 }
 
-bool BaseHeap::Save(ByteStream* stream) {
-  XELOGD("Heap %.8X-%.8X", heap_base_, heap_base_ + heap_size_);
-
-  for (size_t i = 0; i < page_table_.size(); i++) {
-    auto& page = page_table_[i];
-    stream->Write(page.qword);
-    if (!page.state) {
-      // Unallocated.
-      continue;
+void BaseHeap::ForEachProtectRun(
+    const SaveChunk& chunk, bool unreadable_only,
+    const std::function<void(uint32_t, uint32_t, uint32_t)>& fn) {
+  uint32_t end_page_number = chunk.page_number + chunk.page_count;
+  uint32_t page_number = chunk.page_number;
+  while (page_number < end_page_number) {
+    uint32_t protect = page_table_[page_number].current_protect;
+    uint32_t run_start = page_number;
+    while (page_number < end_page_number &&
+           page_table_[page_number].current_protect == protect) {
+      ++page_number;
     }
+    if (!unreadable_only || !(protect & kMemoryProtectRead)) {
+      fn(run_start, page_number - run_start, protect);
+    }
+  }
+}
 
-    // TODO(DrChat): write compressed with snappy.
-    if (page.state & kMemoryAllocationCommit) {
-      void* addr = membase_ + heap_base_ + i * page_size_;
+size_t BaseHeap::GetSaveSizeBound() {
+  std::vector<SaveChunk> chunks;
+  GetSaveChunks(&chunks);
+  size_t size = sizeof(uint32_t) * 3 +
+                snappy::MaxCompressedLength(page_table_.size() *
+                                            sizeof(PageEntry)) +
+                chunks.size() * sizeof(SaveChunk);
+  // Chunks that don't compress are stored raw.
+  for (auto& chunk : chunks) {
+    size += size_t(chunk.page_count) * page_size_;
+  }
+  return size;
+}
 
-      memory::PageAccess old_access;
-      memory::Protect(addr, page_size_, memory::PageAccess::kReadWrite,
-                      &old_access);
+bool BaseHeap::Save(ByteStream* stream) {
+  XELOGD("Heap %.8X-%.8X", heap_base_, heap_base_ + heap_size_);
 
-      stream->Write(addr, page_size_);
+  // The page table is mostly zeros for unreserved pages.
+  std::string page_table_data;
+  snappy::Compress(reinterpret_cast<const char*>(page_table_.data()),
+                   page_table_.size() * sizeof(PageEntry), &page_table_data);
+  stream->Write(uint32_t(page_table_.size()));
+  stream->Write(uint32_t(page_table_data.size()));
+  stream->Write(page_table_data.data(), page_table_data.size());
+
+  std::vector<SaveChunk> chunks;
+  GetSaveChunks(&chunks);
+
+  // Pages the guest can't read are opened up while they're copied out. Other
+  // pages are left alone so access watches stay armed.
+  uint8_t* heap_membase = membase_ + heap_base_;
+  for (auto& chunk : chunks) {
+    ForEachProtectRun(chunk, true,
+                      [&](uint32_t page_number, uint32_t page_count,
+                          uint32_t protect) {
+                        xe::memory::Protect(
+                            heap_membase + page_number * page_size_,
+                            page_count * page_size_,
+                            xe::memory::PageAccess::kReadOnly, nullptr);
+                      });
+  }
 
-      memory::Protect(addr, page_size_, old_access, nullptr);
+  std::vector<std::string> chunk_data(chunks.size());
+  ParallelFor(chunks.size(), [&](size_t i) {
+    auto& chunk = chunks[i];
+    const uint8_t* data = heap_membase + chunk.page_number * page_size_;
+    size_t length = size_t(chunk.page_count) * page_size_;
+    if (IsZeroMemory(data, length)) {
+      chunk.format = kSaveChunkZero;
+      chunk.encoded_length = 0;
+      return;
+    }
+    snappy::Compress(reinterpret_cast<const char*>(data), length,
+                     &chunk_data[i]);
+    if (chunk_data[i].size() < length) {
+      chunk.format = kSaveChunkSnappy;
+      chunk.encoded_length = uint32_t(chunk_data[i].size());
+    } else {
+      chunk.format = kSaveChunkRaw;
+      chunk.encoded_length = uint32_t(length);
+      std::string().swap(chunk_data[i]);
+    }
+  });
+
+  uint64_t data_length = 0;
+  uint64_t decoded_length = 0;
+  for (auto& chunk : chunks) {
+    chunk.data_offset = data_length;
+    data_length += chunk.encoded_length;
+    decoded_length += uint64_t(chunk.page_count) * page_size_;
+  }
+  size_t required_length =
+      sizeof(uint32_t) + chunks.size() * sizeof(SaveChunk) + data_length;
+  bool fits = stream->offset() + required_length <= stream->data_length();
+  if (fits) {
+    stream->Write(uint32_t(chunks.size()));
+    stream->Write(chunks.data(), chunks.size() * sizeof(SaveChunk));
+    for (size_t i = 0; i < chunks.size(); ++i) {
+      auto& chunk = chunks[i];
+      if (chunk.format == kSaveChunkSnappy) {
+        stream->Write(chunk_data[i].data(), chunk_data[i].size());
+      } else if (chunk.format == kSaveChunkRaw) {
+        stream->Write(heap_membase + chunk.page_number * page_size_,
+                      chunk.encoded_length);
+      }
     }
+  } else {
+    XELOGE("BaseHeap::Save ran out of space in the stream");
   }
 
-  return true;
+  for (auto& chunk : chunks) {
+    ForEachProtectRun(chunk, true,
+                      [&](uint32_t page_number, uint32_t page_count,
+                          uint32_t protect) {
+                        xe::memory::Protect(
+                            heap_membase + page_number * page_size_,
+                            page_count * page_size_, ToPageAccess(protect),
+                            nullptr);
+                      });
+  }
+
+  XELOGD("  %u chunks, %" PRIu64 " bytes stored as %" PRIu64 " bytes",
+         uint32_t(chunks.size()), decoded_length, data_length);
+  return fits;
 }
 
 bool BaseHeap::Restore(ByteStream* stream) {
   XELOGD("Heap %.8X-%.8X", heap_base_, heap_base_ + heap_size_);
 
-  for (size_t i = 0; i < page_table_.size(); i++) {
-    auto& page = page_table_[i];
-    page.qword = stream->Read<uint64_t>();
-    if (!page.state) {
-      // Unallocated.
+  uint32_t page_count = stream->Read<uint32_t>();
+  uint32_t page_table_length = stream->Read<uint32_t>();
+  auto page_table_data =
+      reinterpret_cast<const char*>(stream->data() + stream->offset());
+  size_t page_table_size = 0;
+  if (page_count != page_table_.size() ||
+      stream->offset() + page_table_length > stream->data_length() ||
+      !snappy::GetUncompressedLength(page_table_data, page_table_length,
+                                     &page_table_size) ||
+      page_table_size != page_table_.size() * sizeof(PageEntry) ||
+      !snappy::RawUncompress(page_table_data, page_table_length,
+                             reinterpret_cast<char*>(page_table_.data()))) {
+    XELOGE("BaseHeap::Restore failed to read the page table");
+    return false;
+  }
+  stream->Advance(page_table_length);
+
+  // The index starts out all free, so runs come from the page table alone.
+  free_pages_.Reset(page_count);
+  for (uint32_t page_number = 0; page_number < page_count;) {
+    if (!page_table_[page_number].state) {
+      ++page_number;
       continue;
     }
-
-    memory::PageAccess page_access = memory::PageAccess::kNoAccess;
-    if ((page.current_protect & kMemoryProtectRead) &&
-        (page.current_protect & kMemoryProtectWrite)) {
-      page_access = memory::PageAccess::kReadWrite;
-    } else if (page.current_protect & kMemoryProtectRead) {
-      page_access = memory::PageAccess::kReadOnly;
+    uint32_t run_start = page_number;
+    while (page_number < page_count && page_table_[page_number].state) {
+      ++page_number;
     }
+    free_pages_.MarkUsed(run_start, page_number - run_start);
+  }
 
-    // Commit the memory if it isn't already. We do not need to reserve any
-    // memory, as the mapping has already taken care of that.
-    if (page.state & kMemoryAllocationCommit) {
-      xe::memory::AllocFixed(membase_ + heap_base_ + i * page_size_, page_size_,
-                             memory::AllocationType::kCommit,
-                             memory::PageAccess::kReadWrite);
+  uint32_t chunk_count = stream->Read<uint32_t>();
+  if (stream->offset() + size_t(chunk_count) * sizeof(SaveChunk) >
+      stream->data_length()) {
+    XELOGE("BaseHeap::Restore chunk index is truncated");
+    return false;
+  }
+  std::vector<SaveChunk> chunks(chunk_count);
+  stream->Read(chunks.data(), chunks.size() * sizeof(SaveChunk));
+
+  // Chunk data is decompressed straight from the stream into guest memory.
+  const uint8_t* chunk_data = stream->data() + stream->offset();
+  uint64_t data_length = 0;
+  for (auto& chunk : chunks) {
+    if (uint64_t(chunk.page_number) + chunk.page_count > page_count ||
+        (chunk.format == kSaveChunkRaw &&
+         chunk.encoded_length != chunk.page_count * page_size_)) {
+      XELOGE("BaseHeap::Restore chunk index is invalid");
+      return false;
     }
+    data_length =
+        std::max(data_length, chunk.data_offset + chunk.encoded_length);
+  }
+  if (stream->offset() + data_length > stream->data_length()) {
+    XELOGE("BaseHeap::Restore chunk data is truncated");
+    return false;
+  }
+  stream->Advance(size_t(data_length));
+
+  // Commit the memory if it isn't already. We do not need to reserve any
+  // memory, as the mapping has already taken care of that.
+  uint8_t* heap_membase = membase_ + heap_base_;
+  for (auto& chunk : chunks) {
+    uint8_t* addr = heap_membase + chunk.page_number * page_size_;
+    size_t length = size_t(chunk.page_count) * page_size_;
+    xe::memory::AllocFixed(addr, length, memory::AllocationType::kCommit,
+                           memory::PageAccess::kReadWrite);
+    xe::memory::Protect(addr, length, memory::PageAccess::kReadWrite,
+                        nullptr);
+  }
 
-    // Now read into memory. We'll set R/W protection first, then set the
-    // protection back to its previous state.
-    // TODO(DrChat): read compressed with snappy.
-    if (page.state & kMemoryAllocationCommit) {
-      void* addr = membase_ + heap_base_ + i * page_size_;
-      xe::memory::Protect(addr, page_size_, memory::PageAccess::kReadWrite,
-                          nullptr);
-
-      stream->Read(addr, page_size_);
-
-      xe::memory::Protect(addr, page_size_, page_access, nullptr);
+  std::atomic<bool> failed(false);
+  ParallelFor(chunks.size(), [&](size_t i) {
+    auto& chunk = chunks[i];
+    uint8_t* addr = heap_membase + chunk.page_number * page_size_;
+    size_t length = size_t(chunk.page_count) * page_size_;
+    auto data = reinterpret_cast<const char*>(chunk_data + chunk.data_offset);
+    size_t decoded_length = 0;
+    switch (chunk.format) {
+      case kSaveChunkZero:
+        std::memset(addr, 0, length);
+        break;
+      case kSaveChunkRaw:
+        std::memcpy(addr, data, length);
+        break;
+      case kSaveChunkSnappy:
+        if (!snappy::GetUncompressedLength(data, chunk.encoded_length,
+                                           &decoded_length) ||
+            decoded_length != length ||
+            !snappy::RawUncompress(data, chunk.encoded_length,
+                                   reinterpret_cast<char*>(addr))) {
+          failed = true;
+        }
+        break;
+      default:
+        failed = true;
+        break;
     }
+  });
+  if (failed) {
+    XELOGE("BaseHeap::Restore failed to decode chunk data");
+    return false;
+  }
+
+  // Put back the guest protection.
+  for (auto& chunk : chunks) {
+    ForEachProtectRun(chunk, false,
+                      [&](uint32_t page_number, uint32_t page_count,
+                          uint32_t protect) {
+                        xe::memory::Protect(
+                            heap_membase + page_number * page_size_,
+                            page_count * page_size_, ToPageAccess(protect),
+                            nullptr);
+                      });
   }
 
   return true;
@@ -691,6 +940,7 @@ bool BaseHeap::Restore(ByteStream* stream) {
 void BaseHeap::Reset() {
   // TODO(DrChat): protect pages.
   std::memset(page_table_.data(), 0, sizeof(PageEntry) * page_table_.size());
+  free_pages_.Reset(uint32_t(page_table_.size()));
 }
 
 bool BaseHeap::Alloc(uint32_t size, uint32_t alignment,
@@ -779,6 +1029,7 @@ bool BaseHeap::AllocFixed(uint32_t base_address, uint32_t size,
     page_entry.current_protect = protect;
     page_entry.state = kMemoryAllocationReserve | allocation_type;
   }
+  free_pages_.MarkUsed(start_page_number, page_count);
 
   return true;
 }
@@ -808,92 +1059,19 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
   auto global_lock = global_critical_region_.Acquire();
 
   // Find a free page range.
-  // The base page must match the requested alignment, so we first scan for
-  // a free aligned page and only then check for continuous free pages.
-  // TODO(benvanik): optimized searching (free list buckets, bitmap, etc).
-  uint32_t start_page_number = UINT_MAX;
-  uint32_t end_page_number = UINT_MAX;
+  // The base page must match the requested alignment and the range must end
+  // before high_page_number.
   uint32_t page_scan_stride = alignment / page_size_;
-  high_page_number = high_page_number - (high_page_number % page_scan_stride);
-  if (top_down) {
-    for (int64_t base_page_number =
-             high_page_number - xe::round_up(page_count, page_scan_stride);
-         base_page_number >= low_page_number;
-         base_page_number -= page_scan_stride) {
-      if (page_table_[base_page_number].state != 0) {
-        // Base page not free, skip to next usable page.
-        continue;
-      }
-      // Check requested range to ensure free.
-      start_page_number = uint32_t(base_page_number);
-      end_page_number = uint32_t(base_page_number) + page_count - 1;
-      assert_true(end_page_number < page_table_.size());
-      bool any_taken = false;
-      for (uint32_t page_number = uint32_t(base_page_number);
-           !any_taken && page_number <= end_page_number; ++page_number) {
-        bool is_free = page_table_[page_number].state == 0;
-        if (!is_free) {
-          // At least one page in the range is used, skip to next.
-          // We know we'll be starting at least before this page.
-          any_taken = true;
-          if (page_count > page_number) {
-            // Not enough space left to fit entire page range. Breaks outer
-            // loop.
-            base_page_number = -1;
-          } else {
-            base_page_number = page_number - page_count;
-            base_page_number -= base_page_number % page_scan_stride;
-            base_page_number += page_scan_stride;  // cancel out loop logic
-          }
-          break;
-        }
-      }
-      if (!any_taken) {
-        // Found our place.
-        break;
-      }
-      // Retry.
-      start_page_number = end_page_number = UINT_MAX;
-    }
-  } else {
-    for (uint32_t base_page_number = low_page_number;
-         base_page_number <= high_page_number - page_count;
-         base_page_number += page_scan_stride) {
-      if (page_table_[base_page_number].state != 0) {
-        // Base page not free, skip to next usable page.
-        continue;
-      }
-      // Check requested range to ensure free.
-      start_page_number = base_page_number;
-      end_page_number = base_page_number + page_count - 1;
-      bool any_taken = false;
-      for (uint32_t page_number = base_page_number;
-           !any_taken && page_number <= end_page_number; ++page_number) {
-        bool is_free = page_table_[page_number].state == 0;
-        if (!is_free) {
-          // At least one page in the range is used, skip to next.
-          // We know we'll be starting at least after this page.
-          any_taken = true;
-          base_page_number = xe::round_up(page_number + 1, page_scan_stride);
-          base_page_number -= page_scan_stride;  // cancel out loop logic
-          break;
-        }
-      }
-      if (!any_taken) {
-        // Found our place.
-        break;
-      }
-      // Retry.
-      start_page_number = end_page_number = UINT_MAX;
-    }
-  }
-  if (start_page_number == UINT_MAX || end_page_number == UINT_MAX) {
+  uint32_t start_page_number =
+      free_pages_.FindRun(low_page_number, high_page_number, page_count,
+                          page_scan_stride, top_down);
+  if (start_page_number == FreeRunIndex::kNotFound) {
     // Out of memory.
     XELOGE("BaseHeap::Alloc failed to find contiguous range");
     assert_always("Heap exhausted!");
     return false;
   }
-
+  uint32_t end_page_number = start_page_number + page_count - 1;
   // Allocate from host.
   if (allocation_type == kMemoryAllocationReserve) {
     // Reserve is not needed, as we are mapped already.
@@ -924,6 +1102,7 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
     page_entry.current_protect = protect;
     page_entry.state = kMemoryAllocationReserve | allocation_type;
   }
+  free_pages_.MarkUsed(start_page_number, page_count);
 
   *out_address = heap_base_ + (start_page_number * page_size_);
   return true;
@@ -1008,13 +1187,9 @@ bool BaseHeap::Release(uint32_t base_address, uint32_t* out_region_size) {
   }
 
   // Perform table change.
-  uint32_t end_page_number =
-      base_page_number + base_page_entry.region_page_count - 1;
-  for (uint32_t page_number = base_page_number; page_number <= end_page_number;
-       ++page_number) {
-    auto& page_entry = page_table_[page_number];
-    page_entry.qword = 0;
-  }
+  std::memset(page_table_.data() + base_page_number, 0,
+              sizeof(PageEntry) * base_page_entry.region_page_count);
+  free_pages_.MarkFree(base_page_number, base_page_entry.region_page_count);
 
   return true;
 }
@@ -1120,16 +1295,9 @@ bool BaseHeap::QueryRegionInfo(uint32_t base_address,
       out_info->region_size += page_size_;
     }
   } else {
-    // Free region.
-    for (uint32_t page_number = start_page_number;
-         page_number < page_table_.size(); ++page_number) {
-      auto page_entry = page_table_[page_number];
-      if (page_entry.state) {
-        // First non-free page; done with region.
-        break;
-      }
-      out_info->region_size += page_size_;
-    }
+    // Free region, up to the first non-free page.
+    out_info->region_size =
+        free_pages_.FreeRunLength(start_page_number) * page_size_;
   }
   return true;
 }
@@ -11,10 +11,12 @@
 #define XENIA_MEMORY_H_
 
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include "xenia/base/free_run_index.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/mutex.h"
 #include "xenia/cpu/mmio_handler.h"
@@ -155,23 +157,48 @@ class BaseHeap {
   // This is only valid if the page is backed by a physical allocation.
   uint32_t GetPhysicalAddress(uint32_t address);
 
+  // Saves the page table and committed pages, split into chunks that are
+  // compressed in parallel. All-zero chunks are stored without data.
   bool Save(ByteStream* stream);
   bool Restore(ByteStream* stream);
+  // Upper bound of the number of bytes Save writes.
+  size_t GetSaveSizeBound();
 
   void Reset();
 
  protected:
+  // Run of committed pages saved and restored as a unit. The chunk index is
+  // written ahead of the chunk data so any chunk can be located directly.
+  struct SaveChunk {
+    uint32_t page_number;
+    uint32_t page_count;
+    // SaveChunkFormat.
+    uint32_t format;
+    uint32_t encoded_length;
+    // From the start of the chunk data.
+    uint64_t data_offset;
+  };
+
   BaseHeap();
 
   void Initialize(uint8_t* membase, uint32_t heap_base, uint32_t heap_size,
                   uint32_t page_size);
 
+  void GetSaveChunks(std::vector<SaveChunk>* chunks);
+  // Calls fn(page_number, page_count, protect) for each run of pages with the
+  // same protection, skipping readable pages if unreadable_only is set.
+  void ForEachProtectRun(
+      const SaveChunk& chunk, bool unreadable_only,
+      const std::function<void(uint32_t, uint32_t, uint32_t)>& fn);
+
   uint8_t* membase_;
   uint32_t heap_base_;
   uint32_t heap_size_;
   uint32_t page_size_;
   xe::global_critical_region global_critical_region_;
   std::vector<PageEntry> page_table_;
+  // Unreserved pages of page_table_, kept in sync with page state changes.
+  FreeRunIndex free_pages_;
 };
 
 // Normal heap allowing allocations from guest virtual address ranges.
@@ -313,6 +340,10 @@ class Memory {
   // Cancels a write watch requested with AddPhysicalAccessWatch.
   void CancelAccessWatch(uintptr_t watch_handle);
 
+  // Fires write watches on pages written since the last sync when they are
+  // tracked with dirty page bits (--dirty_page_write_watches).
+  void SyncPhysicalAccessWatches();
+
   // Allocates virtual memory from the 'system' heap.
   // System memory is kept separate from game memory but is still accessible
   // using normal guest virtual addresses. Kernel structures and other internal
@@ -337,6 +368,8 @@ class Memory {
 
   bool Save(ByteStream* stream);
   bool Restore(ByteStream* stream);
+  // Upper bound of the number of bytes Save writes.
+  size_t GetSaveSizeBound();
 
  private:
   int MapViews(uint8_t* mapping_base);
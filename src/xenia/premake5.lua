@@ -8,6 +8,7 @@ project("xenia-core")
   language("C++")
   links({
     "xenia-base",
+    "snappy",
   })
   defines({
   })